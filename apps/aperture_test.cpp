@@ -0,0 +1,154 @@
+// checks of cached circular apertures (CBgAperture) against the per-pixel distance test (as in GetStatRadiusAll before) :
+// pixels of spans for many radii and statistics of GetStatRadiusAll for centres inside / at the borders of the image
+// (also with NaN values) , returns number of failed checks
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <bg_fits.h>
+#include <bg_aperture.h>
+#include <bg_quantile.h>
+
+using namespace std;
+
+int gFailed=0;
+
+void check( bool ok, const char* name, int iter )
+{
+   if( !ok ){
+      printf("FAILED : %s (iteration %d)\n",name,iter);
+      gFailed++;
+   }
+}
+
+bool close_to( double a, double b )
+{
+   return ( fabs(a-b) <= 1e-9*max( 1.00, fabs(b) ) );
+}
+
+// pixel (dx,dy) relative to the centre selected by the distance test :
+bool in_aperture( int dx, int dy, int radius )
+{
+   if( dx < -radius || dx >= radius || dy < -radius || dy >= radius ){
+      return false;
+   }
+   return ( sqrt( (double)(dx*dx + dy*dy) ) <= radius );
+}
+
+void test_spans()
+{
+   int iter=0;
+   CBgAperture aperture;
+   for(int radius=0;radius<=50;radius++){
+      iter++;
+      aperture.Init( radius );
+
+      // every pixel of the bounding box counted once if inside :
+      vector<int> counts( (2*radius+1)*(2*radius+1), 0 );
+      long cnt=0;
+      for(int s=0;s<aperture.m_Spans.size();s++){
+         const cApertureSpan& span = aperture.m_Spans[s];
+         for(int dx=span.dx_start;dx<span.dx_end;dx++){
+            if( abs(dx) <= radius && abs(span.dy) <= radius ){
+               counts[(span.dy+radius)*(2*radius+1) + (dx+radius)]++;
+            }
+            cnt++;
+         }
+      }
+
+      bool ok = true;
+      for(int dy=-radius;dy<=radius;dy++){
+         for(int dx=-radius;dx<=radius;dx++){
+            int expected = ( in_aperture( dx, dy, radius ) ? 1 : 0 );
+            if( counts[(dy+radius)*(2*radius+1) + (dx+radius)] != expected ){
+               ok = false;
+            }
+         }
+      }
+      check( ok, "CBgAperture spans", iter );
+      check( cnt == aperture.GetMaxCount() && aperture.GetRadius() == radius, "CBgAperture::GetMaxCount", iter );
+   }
+   printf("CBgAperture : %d radii checked\n",iter);
+}
+
+void test_stat_radius()
+{
+   int iter=0;
+   int size_x=37, size_y=29;
+   CBgFits fits( size_x, size_y );
+   for(int y=0;y<size_y;y++){
+      for(int x=0;x<size_x;x++){
+         double value = (rand() % 1000)*0.25;
+         if( (rand() % 20) == 0 ){
+            value = NAN;
+         }
+         fits.setXY( x, y, value );
+      }
+   }
+
+   CBgAperture aperture;
+   int radii[] = { 0, 1, 3, 10, 40 };
+   for(int r=0;r<5;r++){
+      int radius = radii[r];
+      aperture.Init( radius );
+      for(int t=0;t<20;t++){
+         iter++;
+         // centres inside , at the borders and corners :
+         int xc = ( t < 4 ? (t % 2)*(size_x-1) : rand() % size_x );
+         int yc = ( t < 4 ? (t / 2)*(size_y-1) : rand() % size_y );
+
+         vector<double> values;
+         double sum=0.00, sum2=0.00, minval_ref=1e6, maxval_ref=-1e6;
+         for(int y=yc-radius;y<yc+radius;y++){
+            for(int x=xc-radius;x<xc+radius;x++){
+               if( x>=0 && x<size_x && y>=0 && y<size_y && in_aperture( x-xc, y-yc, radius ) ){
+                  double val = fits.valXY( x, y );
+                  if( isnan(val) ){
+                     continue;
+                  }
+                  values.push_back( val );
+                  sum += val;
+                  sum2 += val*val;
+                  minval_ref = min( minval_ref, val );
+                  maxval_ref = max( maxval_ref, val );
+               }
+            }
+         }
+         int cnt_ref = values.size();
+
+         double mean, rms, minval, maxval, median, iqr, rms_iqr;
+         int cnt = 0;
+         fits.GetStatRadiusAll( aperture, mean, rms, minval, maxval, median, iqr, rms_iqr, cnt, true, xc, yc, 0, 0 );
+         check( cnt == cnt_ref, "GetStatRadiusAll count", iter );
+         if( cnt_ref <= 0 ){
+            continue;
+         }
+
+         double mean_ref = sum/cnt_ref;
+         double rms_ref = sqrt( sum2/cnt_ref - mean_ref*mean_ref );
+         check( close_to( mean, mean_ref ) && close_to( rms, rms_ref ), "GetStatRadiusAll mean / rms", iter );
+         check( minval == minval_ref && maxval == maxval_ref, "GetStatRadiusAll min / max", iter );
+
+         double median_ref, q25_ref, q75_ref;
+         bg_median_iqr( values.data(), cnt_ref, median_ref, q25_ref, q75_ref );
+         check( median == median_ref && iqr == (q75_ref-q25_ref), "GetStatRadiusAll median / IQR", iter );
+      }
+   }
+   printf("GetStatRadiusAll : %d apertures checked\n",iter);
+}
+
+int main()
+{
+   srand( 12345 );
+
+   test_spans();
+   test_stat_radius();
+
+   if( gFailed > 0 ){
+      printf("ERROR : %d checks failed\n",gFailed);
+   }else{
+      printf("OK : all checks passed\n");
+   }
+   return gFailed;
+}
@@ -7,6 +7,9 @@
 
 #include <bg_globals.h>
 #include "bg_fits.h"
+#include "bg_fits_prefetch.h"
+#include "bg_image.h"
+#include "bg_quantile.h"
 #include <mystring.h>
 
 #include <vector>
@@ -32,6 +35,8 @@ bool gCalcRMSAroundPixel = false;
 bool gIgnoreMissingFITS = false;
 int gStartFitsIndex = 0;
 int gEndFitsIndex   = 1000000;
+int gIOThreads = 2; // number of threads reading FITS files ahead of the averaging loop
+double gQuantileCompression = -1; // >0 : median / rms_iqr images from per-pixel t-digest sketches instead of mean / rms
 
 void usage()
 {
@@ -44,13 +49,15 @@ void usage()
    printf("\t-C (x,y) : center position to calculate RMS around [default not defined]\n");
    printf("\t-S start_fits_index : default %d\n",gStartFitsIndex);
    printf("\t-E end_fits_index   : default %d\n",gEndFitsIndex);
+   printf("\t-t N_IO_THREADS : number of threads reading FITS files in parallel with averaging [default %d]\n",gIOThreads);
+   printf("\t-q COMPRESSION : median and rms_iqr (instead of mean and rms) images calculated from per-pixel t-digest sketches of given compression (e.g. 50), constant memory per pixel [default disabled]\n");
    printf("\t-B BEAM_IMAGE : for weighting the averaged images and calculating an average as < Image_(x,y) > = Sum_over_images Beam(x,y)^2 Image(x,y) / Sum_over_images Beam(x,y)^2\n");
    
    exit(0);
 }
 
 void parse_cmdline(int argc, char * argv[]) {
-   char optstring[] = "hixr:w:c:C:S:E:B:";
+   char optstring[] = "hixr:w:c:C:S:E:B:t:q:";
    int opt;
         
    while ((opt = getopt(argc, argv, optstring)) != -1) {
@@ -105,6 +112,18 @@ void parse_cmdline(int argc, char * argv[]) {
             }
             break;
 
+         case 't' :
+            if( optarg ){
+               gIOThreads = atol( optarg );
+            }
+            break;
+
+         case 'q' :
+            if( optarg ){
+               gQuantileCompression = atof( optarg );
+            }
+            break;
+
          case 'w':
             if( optarg ){
                if( sscanf( optarg,"(%d,%d)-(%d,%d)",&gBorderStartX,&gBorderStartY,&gBorderEndX,&gBorderEndY )==4 ){
@@ -145,6 +164,8 @@ void print_parameters()
     }
     printf("Ignore missing FITS = %d\n",int(gIgnoreMissingFITS));
     printf("Beam image for weighting = %s\n",beam_fits_file.c_str());
+    printf("I/O threads = %d\n",gIOThreads);
+    printf("Median from t-digest compression = %.2f\n",gQuantileCompression);
     printf("############################################################################################\n");
 }
 
@@ -211,13 +232,24 @@ int main(int argc,char* argv[])
      pMax->SetKeysWithoutStates( first_fits.GetKeys() );
   }
 
-  double* sum_tab = new double[size];
+  // double precision accumulators :
+  CBgImageD sum_image( first_fits.GetXSize(), first_fits.GetYSize() ), sum2_image, sum_beam_image;
+  double* sum_tab = sum_image.get_data();
   double* sum2_tab = NULL;
   if( strlen(out_rms_fits.c_str()) > 0 ){
-      sum2_tab = new double[size];
+      sum2_image.Alloc( first_fits.GetXSize(), first_fits.GetYSize() );
+      sum2_tab = sum2_image.get_data();
       printf("DEBUG : sum2_tab initialised\n");      
   }
 
+  // per-pixel sketches for median / rms_iqr (also used for image statistics) :
+  vector<CBgTDigest> pixel_digests;
+  if( gQuantileCompression > 0 ){
+     CBgTDigest::m_DefaultCompression = gQuantileCompression;
+     gBGApproxQuantiles = 1;
+     pixel_digests.resize( size );
+  }
+
   CBgFits* pBeamImage = NULL;
   double* sum_beam = NULL;
 
@@ -237,16 +269,31 @@ int main(int argc,char* argv[])
   }
   int good_image_count = 1; // first image already included 
   
-  CBgFits fits;
   // 2014-08-20 was from 1 but I've changed to 0 to average all the files 
   int last_fits = fits_list.size();
   if( gEndFitsIndex < last_fits ){
      last_fits = gEndFitsIndex;
   }
-  for(int i=(gStartFitsIndex);i<last_fits;i++){ // 2019-07-11 - start from the 2nd (1st or 0-based) image 
-     if( fits.ReadFits( fits_list[i].c_str() , 0, 1, 1 ) ){
+  
+  // files are read by separate threads while the previous ones are averaged :
+  CBgFitsPrefetcher prefetcher( fits_list, gIOThreads, 2*gIOThreads, gStartFitsIndex, last_fits );
+  prefetcher.SetReadOptions( 0, 1, 1 );
+  prefetcher.Start();
+  while( true ){ // 2019-07-11 - start from the 2nd (1st or 0-based) image 
+     int i = -1, read_status = 0;
+     CBgFits* pFits = prefetcher.Next( i, read_status );
+     if( i < 0 ){
+        break;
+     }
+     if( !pFits ){
+        continue;
+     }
+     CBgFits& fits = (*pFits);
+  
+     if( read_status ){
         if( gIgnoreMissingFITS ){
            printf("WARNING : could not read fits file %s on the list, -i option means that it is ignored -> FITS file skipped\n",fits_list[i].c_str());
+           prefetcher.Release( pFits );
            continue;
         }else{
            printf("ERROR : could not read fits file %s on the list\n",fits_list[i].c_str());
@@ -286,7 +333,8 @@ int main(int argc,char* argv[])
         }
 
         if( !sum_beam ){     
-           sum_beam = new double[size];
+           sum_beam_image.Alloc( first_fits.GetXSize(), first_fits.GetYSize() );
+           sum_beam = sum_beam_image.get_data();
         }
      }
 
@@ -298,7 +346,8 @@ int main(int argc,char* argv[])
      if( gCenterRadius > 0 ){
 //        printf("DEBUG : checking stat in radius %d pixels around center\n",gCenterRadius);
 //        fits.GetStatRadius( mean, rms, minval, maxval, gCenterRadius );
-        fits.GetStatRadiusAll( mean_center, rms_center, minval_center, maxval_center, median_center, iqr_center, rms_iqr_center, gCenterRadius, true, gBorderStartX, gBorderStartY );
+        int cnt_center = 0;
+        fits.GetStatRadiusAll( mean_center, rms_center, minval_center, maxval_center, median_center, iqr_center, rms_iqr_center, cnt_center, gCenterRadius, true, gBorderStartX, gBorderStartY );
         printf("%s : at CENTER mean stat = %.8f, rms = %.8f, min_val = %.8f, max_val = %.8f , median = %.8f, rms_iqr = %.8f\n",fits_list[i].c_str(),mean_center, rms_center, minval_center, maxval_center, median_center, rms_iqr_center );
      }else{
         if( gBorderStartX>0 && gBorderStartY>0 && gBorderEndX>0 && gBorderEndY>0 ){
@@ -339,6 +388,9 @@ int main(int argc,char* argv[])
                    sum2_tab[pos] += (val*val);
                 }
             }
+            if( pixel_digests.size() ){
+               pixel_digests[pos].Add( val, beam*beam );
+            }
          }
 
          printf("DEBUG : included image %s\n",fits_list[i].c_str());         
@@ -357,6 +409,8 @@ int main(int argc,char* argv[])
         }
      }
 //     first_fits += fits;     
+
+     prefetcher.Release( pFits );
   }
 
   printf("STAT_INFO : averaged %d good images of %d all\n",good_image_count,fits_list.size());    
@@ -381,6 +435,16 @@ int main(int argc,char* argv[])
      
 //     printf("%.8f %.20f\n",first_fits.ch2freq(pos),( sum_tab[pos] / fits_list.size() ));
   }           
+  if( pixel_digests.size() ){
+     printf("INFO : median and rms_iqr images from per-pixel t-digest sketches (compression = %.2f)\n",gQuantileCompression);
+     for (int pos=0;pos<size;pos++){
+        double rms_iqr = 0.00;
+        first_fits.get_data()[pos] = pixel_digests[pos].MedianRmsIQR( rms_iqr );
+        if( sum2_tab ){
+           first_fits2.get_data()[pos] = rms_iqr;
+        }
+     }
+  }
 //  first_fits.Normalize(fits_list.size());
 
   double mean,rms,minval,maxval;
@@ -413,17 +477,8 @@ int main(int argc,char* argv[])
      delete pMax;
   }
 
-  delete [] sum_tab;
-  if( sum2_tab ){
-      delete [] sum2_tab;
-  }
-  
   if( pBeamImage ){
      delete pBeamImage;
   }
-  
-  if( sum_beam ){
-     delete [] sum_beam;
-  }
 }
 
@@ -0,0 +1,258 @@
+// program compares writing/reading speed and size of uncompressed and tile-compressed FITS files
+// of a simulated dynamic spectrum (default 4096 channels x 32768 integrations) , with -a also line by line writing
+// with synchronous and asynchronous (background thread) writer, which have to produce identical files
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <math.h>
+#include <sys/time.h>
+
+#include <bg_globals.h>
+#include <bg_fits.h>
+#include <random.h>
+
+#include <vector>
+using namespace std;
+
+int gChannels = 4096;
+int gIntegrations = 32768;
+string gOutDir = "./";
+float gQuantizeLevel = 4.00;
+long gTileRows = 1;
+bool gKeepFiles = false;
+int gAsyncRingLines = 0; // >0 -> line by line writing tested (CBgFits::EnableAsyncWrite)
+
+void usage()
+{
+   printf("bench_fits_compression [options]\n");
+   printf("\t-x N_CHANNELS : number of channels [default %d]\n",gChannels);
+   printf("\t-y N_INTEGRATIONS : number of integrations [default %d]\n",gIntegrations);
+   printf("\t-o OUTDIR : directory for the test files [default %s]\n",gOutDir.c_str());
+   printf("\t-q QUANTIZE_LEVEL : quantization of float values [default %.2f]\n",gQuantizeLevel);
+   printf("\t-t TILE_ROWS : number of rows in a tile [default %ld]\n",gTileRows);
+   printf("\t-k : keep test files [default %d]\n",gKeepFiles);
+   printf("\t-a RING_LINES : also write the spectrum line by line synchronously and with asynchronous writer of RING_LINES lines (also mixed with\n");
+   printf("\t                synchronous writes of two lines), files have to be byte-identical [default %d - not tested]\n",gAsyncRingLines);
+   exit(0);
+}
+
+void parse_cmdline(int argc, char * argv[]) {
+   char optstring[] = "hka:x:y:o:q:t:";
+   int opt;
+
+   while ((opt = getopt(argc, argv, optstring)) != -1) {
+      switch (opt) {
+         case 'h':
+            usage();
+            break;
+
+         case 'k':
+            gKeepFiles = true;
+            break;
+
+         case 'a' :
+            gAsyncRingLines = atol( optarg );
+            break;
+
+         case 'x' :
+            gChannels = atol( optarg );
+            break;
+
+         case 'y' :
+            gIntegrations = atol( optarg );
+            break;
+
+         case 'o' :
+            gOutDir = optarg;
+            break;
+
+         case 'q' :
+            gQuantizeLevel = atof( optarg );
+            break;
+
+         case 't' :
+            gTileRows = atol( optarg );
+            break;
+
+         default:
+            fprintf(stderr,"Unknown option %c\n",opt);
+            usage();
+      }
+   }
+}
+
+double get_time_sec()
+{
+   struct timeval tv;
+   gettimeofday( &tv, NULL );
+   return tv.tv_sec + tv.tv_usec/1000000.00;
+}
+
+// spectrum written line by line by DumpFitsLine (asynchronous writer when ring_lines>0), every mix_every-th call writes
+// two lines at once (longer than the ring slots -> synchronous write between the queued lines) , returns time or <0 on error :
+double write_lines( const char* szFile, float* data, int ring_lines, int mix_every )
+{
+   double t_start = get_time_sec();
+   CBgFits out( gChannels, gIntegrations );
+   if( ring_lines > 0 ){
+      out.EnableAsyncWrite( ring_lines, ( ring_lines >= 8 ? ring_lines/8 : 1 ) );
+   }
+   if( out.Create( szFile ) ){
+      printf("ERROR : could not create file %s\n",szFile);
+      return -1;
+   }
+   for(int y=0;y<gIntegrations;y++){
+      float* line = data + ((long)y)*gChannels;
+      if( mix_every > 0 && (y % mix_every) == 0 && (y+1) < gIntegrations ){
+         out.DumpFitsLine( line, 2*gChannels );
+         y++;
+      }else{
+         out.DumpFitsLine( line, gChannels );
+      }
+   }
+   if( out.Close() ){
+      printf("ERROR : could not close file %s\n",szFile);
+      return -1;
+   }
+
+   return get_time_sec() - t_start;
+}
+
+bool same_files( const char* szFile1, const char* szFile2 )
+{
+   FILE* f1 = fopen( szFile1, "rb" );
+   FILE* f2 = fopen( szFile2, "rb" );
+   bool bSame = ( f1 && f2 );
+   vector<char> buffer1( 65536 ), buffer2( 65536 );
+   while( bSame ){
+      size_t n1 = fread( &(buffer1[0]), 1, buffer1.size(), f1 );
+      size_t n2 = fread( &(buffer2[0]), 1, buffer2.size(), f2 );
+      if( n1 != n2 || memcmp( &(buffer1[0]), &(buffer2[0]), n1 ) != 0 ){
+         bSame = false;
+      }
+      if( n1 < buffer1.size() ){
+         break;
+      }
+   }
+   if( f1 ){
+      fclose( f1 );
+   }
+   if( f2 ){
+      fclose( f2 );
+   }
+
+   return bSame;
+}
+
+int main(int argc,char* argv[])
+{
+  parse_cmdline( argc , argv );
+  gBGPrintfLevel = BG_WARNING_LEVEL;
+
+  // simulated dynamic spectrum : bandpass x (1 + radiometer noise)
+  printf("Simulating dynamic spectrum %d channels x %d integrations ...\n",gChannels,gIntegrations);
+  CBgFits spectrum( gChannels, gIntegrations );
+  CRandom::Initialize();
+  vector<double> bandpass( gChannels );
+  for(int x=0;x<gChannels;x++){
+     double f = double(x)/gChannels;
+     bandpass[x] = 1e6*(1.00 + 0.5*sin( 3.14159265*f ))*exp(-f);
+  }
+  float* data = spectrum.get_data();
+  for(int y=0;y<gIntegrations;y++){
+     for(int x=0;x<gChannels;x++){
+        data[((long)y)*gChannels+x] = bandpass[x]*( 1.00 + CRandom::GetFastGauss( 0.01, 0.00 ) );
+     }
+  }
+  spectrum.SetKeywordFloat("INTTIME",0.1);
+
+  vector<cFitsCompression> tests;
+  tests.push_back( cFitsCompression( 0 ) );
+  tests.push_back( cFitsCompression( RICE_1, 0, gTileRows, gQuantizeLevel ) );
+  tests.push_back( cFitsCompression( GZIP_1, 0, gTileRows, gQuantizeLevel ) );
+  tests.push_back( cFitsCompression( GZIP_2, 0, gTileRows, gQuantizeLevel ) );
+  tests.push_back( cFitsCompression( HCOMPRESS_1, 0, 16, gQuantizeLevel ) );
+
+  double mbytes = (double(gChannels)*double(gIntegrations)*sizeof(float))/(1024.00*1024.00);
+  long uncompressed_size = -1;
+  printf("# TYPE  TILE_ROWS  Q  WRITE[sec] WRITE[MB/s] READ[sec] READ[MB/s] SIZE[bytes] RATIO MAX_REL_ERR\n");
+  for(int t=0;t<tests.size();t++){
+     cFitsCompression& comp = tests[t];
+     char szFile[1024];
+     sprintf(szFile,"%s/bench_%s.fits",gOutDir.c_str(),cFitsCompression::GetTypeName(comp.type));
+
+     spectrum.SetCompression( comp );
+     double t_start = get_time_sec();
+     if( spectrum.WriteFits( szFile ) ){
+        printf("ERROR : could not write file %s\n",szFile);
+        exit(-1);
+     }
+     double t_write = get_time_sec() - t_start;
+     long size = get_file_size( szFile );
+     if( t==0 ){
+        uncompressed_size = size;
+     }
+
+     CBgFits test;
+     t_start = get_time_sec();
+     if( test.ReadFits( szFile, 0, 1, 1 ) ){
+        printf("ERROR : could not read file %s\n",szFile);
+        exit(-1);
+     }
+     double t_read = get_time_sec() - t_start;
+
+     double max_rel_err = 0.00;
+     float* test_data = test.get_data();
+     for(long i=0;i<((long)gChannels)*gIntegrations;i++){
+        double err = fabs( test_data[i] - data[i] ) / fabs( data[i] );
+        if( err > max_rel_err ){
+           max_rel_err = err;
+        }
+     }
+
+     printf("%-9s %ld %.2f %.4f %.2f %.4f %.2f %ld %.3f %e\n",cFitsCompression::GetTypeName(comp.type),(comp.type==HCOMPRESS_1 ? 16 : gTileRows),comp.quantize_level,
+            t_write,mbytes/t_write,t_read,mbytes/t_read,size,double(uncompressed_size)/double(size),max_rel_err);
+
+     if( !gKeepFiles ){
+        unlink( szFile );
+     }
+  }
+
+  if( gAsyncRingLines > 0 ){
+     printf("# LINE BY LINE WRITE[sec] WRITE[MB/s] IDENTICAL\n");
+     const char* names[3] = { "sync", "async", "async_mixed" };
+     int ring_lines[3] = { 0, gAsyncRingLines, gAsyncRingLines };
+     int mix_every[3] = { 0, 0, 7 };
+     char szSyncFile[1024];
+     sprintf(szSyncFile,"%s/bench_lines_sync.fits",gOutDir.c_str());
+     int n_different = 0;
+     for(int t=0;t<3;t++){
+        char szFile[1024];
+        sprintf(szFile,"%s/bench_lines_%s.fits",gOutDir.c_str(),names[t]);
+        // the same lines are written in the same order -> files have to be byte-identical to the synchronous one :
+        double t_write = write_lines( szFile, data, ring_lines[t], mix_every[t] );
+        if( t_write < 0 ){
+           exit(-1);
+        }
+        bool bSame = ( t==0 || same_files( szSyncFile, szFile ) );
+        if( !bSame ){
+           n_different++;
+        }
+        printf("%-11s %.4f %.2f %d\n",names[t],t_write,mbytes/t_write,bSame);
+        if( !gKeepFiles && t>0 ){
+           unlink( szFile );
+        }
+     }
+     if( !gKeepFiles ){
+        unlink( szSyncFile );
+     }
+     if( n_different > 0 ){
+        printf("ERROR : %d files written with asynchronous writer differ from the synchronously written file\n",n_different);
+        return 1;
+     }
+  }
+
+  return 0;
+}
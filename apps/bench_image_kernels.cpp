@@ -0,0 +1,180 @@
+// program compares speed of element-wise CBgFits operations (Add/Subtract/Multiply/Divide, SEFD, Recalc ...)
+// executed with scalar and vectorized (AVX2/AVX-512) kernels on images of 4096 channels x 32768 integrations (default)
+// and checks that the results are identical
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <math.h>
+#include <sys/time.h>
+
+#include <bg_globals.h>
+#include <bg_fits.h>
+#include <bg_simd.h>
+#include <random.h>
+
+#include <vector>
+using namespace std;
+
+int gChannels = 4096;
+int gIntegrations = 32768;
+int gRepeat = 3;
+int gMaxLevel = -1;
+
+void usage()
+{
+   printf("bench_image_kernels [options]\n");
+   printf("\t-x N_CHANNELS : number of channels [default %d]\n",gChannels);
+   printf("\t-y N_INTEGRATIONS : number of integrations [default %d]\n",gIntegrations);
+   printf("\t-r N_REPEAT : number of repetitions of every operation (best time is used) [default %d]\n",gRepeat);
+   printf("\t-l LEVEL : highest SIMD level to test 0-scalar, 1-avx2, 2-avx512 [default supported by the CPU]\n");
+   exit(0);
+}
+
+void parse_cmdline(int argc, char * argv[]) {
+   char optstring[] = "hx:y:r:l:";
+   int opt;
+
+   while ((opt = getopt(argc, argv, optstring)) != -1) {
+      switch (opt) {
+         case 'h':
+            usage();
+            break;
+
+         case 'x' :
+            gChannels = atol( optarg );
+            break;
+
+         case 'y' :
+            gIntegrations = atol( optarg );
+            break;
+
+         case 'r' :
+            gRepeat = atol( optarg );
+            break;
+
+         case 'l' :
+            gMaxLevel = atol( optarg );
+            break;
+
+         default:
+            fprintf(stderr,"Unknown option %c\n",opt);
+            usage();
+      }
+   }
+}
+
+double get_time_sec()
+{
+   struct timeval tv;
+   gettimeofday( &tv, NULL );
+   return tv.tv_sec + tv.tv_usec/1000000.00;
+}
+
+const char* gTests[] = { "Add", "Subtract", "Multiply", "Divide", "AddImages", "ComplexMag", "SEFD_XX_YY", "SEFD2AOT",
+                         "Divide(const)", "Recalc(eABS)", "Recalc(eSqrtFile)", "Recalc(eTimesConst)", "Recalc(eLog10File)", NULL };
+
+void run_test( int test, CBgFits& image, CBgFits& right )
+{
+   switch( test ){
+      case 0 : image += right; break;
+      case 1 : image.Subtract( right ); break;
+      case 2 : image.Multiply( right ); break;
+      case 3 : image.Divide( right ); break;
+      case 4 : image.AddImages( right, 0.5 ); break;
+      case 5 : image.ComplexMag( right ); break;
+      case 6 : image.SEFD_XX_YY( right ); break;
+      case 7 : image.SEFD2AOT(); break;
+      case 8 : image.Divide( 3.7 ); break;
+      case 9 : image.Recalc( eABS, 0 ); break;
+      case 10 : image.Recalc( eSqrtFile, 0 ); break;
+      case 11 : image.Recalc( eTimesConst, 1.0/3.0 ); break;
+      case 12 : image.Recalc( eLog10File, 0 ); break; // scalar in all modes (reference)
+   }
+}
+
+// best time of gRepeat runs, image is restored from the input before every run :
+double time_test( int test, CBgFits& image, CBgFits& input, CBgFits& right )
+{
+   long size = ((long)input.GetXSize())*input.GetYSize();
+   double best = -1;
+   for(int r=0;r<gRepeat;r++){
+      memcpy( image.get_data(), input.get_data(), size*sizeof(float) );
+      double t0 = get_time_sec();
+      run_test( test, image, right );
+      double dt = get_time_sec() - t0;
+      if( best < 0 || dt < best ){
+         best = dt;
+      }
+   }
+
+   return best;
+}
+
+// identical values or both NaN :
+long count_differences( CBgFits& left, CBgFits& right )
+{
+   long size = ((long)left.GetXSize())*left.GetYSize();
+   float* l = left.get_data();
+   float* r = right.get_data();
+   long diff = 0;
+   for(long i=0;i<size;i++){
+      if( !( l[i] == r[i] || ( isnan(l[i]) && isnan(r[i]) ) ) ){
+         diff++;
+      }
+   }
+
+   return diff;
+}
+
+int main(int argc,char* argv[])
+{
+  parse_cmdline( argc , argv );
+  gBGPrintfLevel = BG_WARNING_LEVEL;
+  if( gRepeat < 1 ){
+     gRepeat = 1;
+  }
+  int max_level = bg_simd_max_level();
+  if( gMaxLevel >= 0 && gMaxLevel < max_level ){
+     max_level = gMaxLevel;
+  }
+  printf("Best SIMD level supported by the CPU = %s , tested up to %s\n",bg_simd_level_name(bg_simd_max_level()),bg_simd_level_name(max_level));
+
+  // simulated XX and YY dynamic spectra with NaN (flagged) and zero pixels :
+  printf("Simulating images %d channels x %d integrations ...\n",gChannels,gIntegrations);
+  CBgFits input( gChannels, gIntegrations ), right( gChannels, gIntegrations );
+  CBgFits image( gChannels, gIntegrations ), reference( gChannels, gIntegrations );
+  CRandom::Initialize();
+  float* in_data = input.get_data();
+  float* right_data = right.get_data();
+  long size = ((long)gChannels)*gIntegrations;
+  for(long i=0;i<size;i++){
+     in_data[i] = 1000.00 + CRandom::GetFastGauss( 100.00, 0.00 );
+     right_data[i] = 1000.00 + CRandom::GetFastGauss( 100.00, 0.00 );
+     if( (i % 1009) == 0 ){
+        in_data[i] = (0.00/0.00);
+     }
+     if( (i % 997) == 0 ){
+        right_data[i] = 0.00;
+     }
+  }
+
+  double mbytes = (double(size)*sizeof(float))/(1024.00*1024.00);
+  printf("# OPERATION   SCALAR[sec] SCALAR[MB/s]   LEVEL TIME[sec] MB/s SPEEDUP DIFFERENT_PIXELS\n");
+  for(int t=0;gTests[t];t++){
+     bg_simd_set_level( eSimdScalar );
+     double t_scalar = time_test( t, reference, input, right );
+
+     for(int level=eSimdAVX2;level<=max_level;level++){
+        bg_simd_set_level( level );
+        double t_simd = time_test( t, image, input, right );
+        long diff = count_differences( reference, image );
+
+        printf("%-20s %.4f %.2f   %s %.4f %.2f %.2f %ld\n",gTests[t],t_scalar,mbytes/t_scalar,bg_simd_level_name(level),t_simd,mbytes/t_simd,t_scalar/t_simd,diff);
+     }
+     if( max_level == eSimdScalar ){
+        printf("%-20s %.4f %.2f\n",gTests[t],t_scalar,mbytes/t_scalar);
+     }
+  }
+}
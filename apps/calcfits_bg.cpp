@@ -4,6 +4,8 @@
 
 #include <bg_globals.h>
 #include <bg_fits.h>
+#include <bg_fits_reader.h>
+#include <bg_fits_expr.h>
 #include <bg_array.h>
 #include <bg_bedlam.h>
 
@@ -32,14 +34,23 @@ int gUseMedian=0;
 int gOutChannels=0;
 double constValue=1.00;
 int gRadius=-1000;
+string gCompression; // tile compression of output FITS files (rice, gzip, gzip2, hcompress)
+float gQuantizeLevel=4.00;
+string gInt16Scaling; // 16-bit scaled integer output FITS files (image, row)
+int gBlockRows=0; // >0 -> statistics calculated reading the file in blocks of rows (option s without -m and -R)
 
 double gSubtractConstAfter=0;
 
 void usage()
 {
-   printf("calcfits_bg FITS_LEFT ACTION FITS_RIGHT OUTPUT_FILE[default out.fits] -s START_INT -e END_INT -k INTTYPE -o OUTDIR -d -p PARAM -r RFI_FLAGS_FITS_FILE(in ao-flagger format) -a SUBTRACT_CONST_AFTER -m\n");
+   printf("calcfits_bg FITS_LEFT ACTION FITS_RIGHT OUTPUT_FILE[default out.fits] -s START_INT -e END_INT -k INTTYPE -o OUTDIR -d -p PARAM -r RFI_FLAGS_FITS_FILE(in ao-flagger format) -a SUBTRACT_CONST_AFTER -m -b BLOCK_ROWS -T MAX_THREADS\n");
    printf("-d : increases devug level\n");
    printf("-m : uses median for statistics option (s)\n");
+   printf("-z COMPRESSION : write tile-compressed output files (rice, gzip, gzip2, hcompress), one spectrum per tile\n");
+   printf("-Q QUANTIZE_LEVEL : quantization level for compressed output [default %.2f]\n",gQuantizeLevel);
+   printf("-i INT16_SCALING : write output files as 16-bit integers with BSCALE/BZERO calculated for the whole image (image) or for every spectrum (row)\n");
+   printf("-b BLOCK_ROWS : statistics option (s) reads the file in blocks of BLOCK_ROWS rows instead of the whole image (for files larger than RAM), not used with -m and -R\n");
+   printf("-T MAX_THREADS : maximum number of threads used by statistics and transposition (0 - all CPUs) [default %d]\n",CBgFits::m_MaxThreads);
    printf("-p PARAM : parameter value\n");
    printf("-R RMS_RADIUS around center. For other positions put X and Y coordinates into FITS_RIGHT and OUTPUT_FILE (after action s, for example calcfits_bg test.fits s 1400 1500)\n");
    printf("ACTION :\n");
@@ -47,8 +58,12 @@ void usage()
    printf("Single fits file actions : \n");
    printf("\t\t\t l - subtract 2 integrations, d - divide 2 integrations, log, s - statistics, i invert, a abs, sqrt , x - times constant (provide in -v option), n - normalize by median integration, f - find value (default exact, but f< finds smaller, f> finds larger), h - dump values to output file for histograming etc, v - normalise by external spectrum in TXTFILE, t - subtract spectrum from text file, -p print pixel ( X Y ) , m - magnitude left=REAL, right=IMAG, output=MAG.fits \n");
    printf("\t\t\t z - subtract median, dB (lin -> dB), log10, 0 - find zero integrations, lin (dB->lin) \n");
+   printf("EXPRESSION MODE (one pass over N images, no intermediate files) :\n");
+   printf("\tcalcfits_bg -E EXPRESSION OUTPUT_FILE FITS_A [FITS_B ...] [options]\n");
+   printf("\t\t images are a,b,c... , operators + - * / ^ , functions sqrt, log10 (log), ln, exp, abs, db, lin, min, max, pow\n");
    printf("EXAMPLES :\n");
    printf("\tcalcfits_bg test.fits l 23 373\n");
+   printf("\tcalcfits_bg -E \"db(sqrt(a*b)/c)+3\" out.fits xx.fits yy.fits norm.fits\n");
    exit(-1);
 }
 
@@ -77,11 +92,14 @@ void print_parameters()
    printf("Out channels = %d\n",gOutChannels);
    printf("Constant value = %.4f\n",constValue);
    printf("Radius       = %d\n",gRadius);
+   printf("Block rows   = %d\n",gBlockRows);
+   printf("Max threads  = %d\n",CBgFits::m_MaxThreads);
+   printf("Compression  = %s (quantize level = %.2f)\n",gCompression.c_str(),gQuantizeLevel);
    printf("#####################################\n");   
 }
 
 void parse_cmdline(int argc, char * argv[]) {
-   char optstring[] = "mcdhs:e:k:o:p:r:a:v:R:";
+   char optstring[] = "mcdhs:e:k:o:p:r:a:v:R:b:z:Q:i:T:";
    int opt,opt_param,i;
         
    while ((opt = getopt(argc, argv, optstring)) != -1) {
@@ -145,6 +163,44 @@ void parse_cmdline(int argc, char * argv[]) {
             gUseMedian = 1;
             break;
 
+         case 'z':
+            if( optarg ){
+               gCompression = optarg;
+               if( cFitsCompression::ParseType( optarg ) < 0 ){
+                  printf("ERROR : unknown compression type %s\n",optarg);
+                  usage();
+               }
+            }
+            break;
+
+         case 'Q':
+            if( optarg ){
+               gQuantizeLevel = atof( optarg );
+            }
+            break;
+
+         case 'i':
+            if( optarg ){
+               gInt16Scaling = optarg;
+               if( CBgFits::ParseInt16Mode( optarg ) < 0 ){
+                  printf("ERROR : unknown 16-bit scaling %s\n",optarg);
+                  usage();
+               }
+            }
+            break;
+
+         case 'b':
+            if( optarg ){
+               gBlockRows = atol( optarg );
+            }
+            break;
+
+         case 'T':
+            if( optarg ){
+               CBgFits::m_MaxThreads = atol( optarg );
+            }
+            break;
+
          case 'v':
             constValue = atof(optarg);
             break;
@@ -283,11 +339,73 @@ eCalcFitsAction_T parse_action( const char* szAction, const char* argv3 )
        
                                                                                                                   
 
+// calcfits_bg -E EXPRESSION OUTPUT_FILE FITS_A [FITS_B ...] [options]
+int calc_expression(int argc,char* argv[])
+{
+  if( argc < 5 ){
+     usage();
+  }
+  string szExpression = argv[2];
+  fits_out = argv[3];
+  int first_option = 4;
+  vector<string> fits_inputs;
+  while( first_option < argc && argv[first_option][0] != '-' ){
+     fits_inputs.push_back( argv[first_option] );
+     first_option++;
+  }
+  parse_cmdline( argc-(first_option-1), argv+(first_option-1) );
+  if( gCompression.length() > 0 ){
+     CBgFits::SetDefaultCompression( cFitsCompression( cFitsCompression::ParseType( gCompression.c_str() ), 0, 1, gQuantizeLevel ) );
+  }
+  if( gInt16Scaling.length() > 0 ){
+     CBgFits::SetDefaultInt16Output( CBgFits::ParseInt16Mode( gInt16Scaling.c_str() ) );
+  }
+
+  CBgFitsExpr expr;
+  if( expr.Compile( szExpression.c_str() ) ){
+     exit(-1);
+  }
+  if( fits_inputs.size() < expr.GetImagesCount() || fits_inputs.size() == 0 ){
+     printf("ERROR : expression %s requires %d input FITS files, %d provided\n",szExpression.c_str(),expr.GetImagesCount(),(int)fits_inputs.size());
+     exit(-1);
+  }
+
+  vector<CBgFits*> images;
+  for(int i=0;i<fits_inputs.size();i++){
+     printf("Reading file %s as image %c ...\n",fits_inputs[i].c_str(),'a'+i);
+     CBgFits* pFits = new CBgFits( fits_inputs[i].c_str() );
+     if( pFits->ReadFits( NULL, 0, 1, 1 ) ){
+        printf("ERROR : error reading fits file %s\n",fits_inputs[i].c_str());
+        exit(-1);
+     }
+     images.push_back( pFits );
+  }
+
+  // result overwrites the first image (keeps its header) :
+  printf("Calculating %s ...\n",szExpression.c_str());fflush(stdout);
+  if( expr.Evaluate( images, *(images[0]) ) ){
+     exit(-1);
+  }
+  if( images[0]->WriteFits( fits_out.c_str() ) ){
+     printf("ERROR : could not write output file %s\n",fits_out.c_str());
+     exit(-1);
+  }
+  printf("SUCCESS : written output file to %s\n",fits_out.c_str());
+
+  for(int i=0;i<images.size();i++){
+     delete images[i];
+  }
+  return 0;
+}
+
 int main(int argc,char* argv[])
 {
   if( argc<2 || (argc>=2 && (strcmp(argv[1],"-h")==0 || strcmp(argv[1],"--h")==0)) ){
      usage();
   }
+  if( strcmp(argv[1],"-E") == 0 ){
+     return calc_expression( argc, argv );
+  }
 
   fits_left = argv[1];
   if( argc>=3 ){
@@ -345,12 +463,33 @@ int main(int argc,char* argv[])
   // parse command line :
   parse_cmdline(argc-4,argv+4);
   print_parameters();
+  if( gCompression.length() > 0 ){
+     CBgFits::SetDefaultCompression( cFitsCompression( cFitsCompression::ParseType( gCompression.c_str() ), 0, 1, gQuantizeLevel ) );
+  }
+  if( gInt16Scaling.length() > 0 ){
+     CBgFits::SetDefaultInt16Output( CBgFits::ParseInt16Mode( gInt16Scaling.c_str() ) );
+  }
   
   CBgFits left(fits_left.c_str());
   CBgFits right(fits_right.c_str());  
   
   printf("Reading file %s ...\n",fits_left.c_str());
-  if( left.ReadFits( NULL, 0, 1, 1) ){
+  int read_status = 0;
+  CBgFitsReader* pReader = NULL;
+  if( action == eGetStat && gBlockRows > 0 && gUseMedian <= 0 && gRadius <= 0 ){
+     // statistics calculated in blocks of rows -> only header is read here :
+     read_status = left.ReadFits( NULL, 0, 0, 1 );
+     if( !read_status ){
+        pReader = new CBgFitsReader( fits_left.c_str(), gBlockRows );
+        read_status = pReader->Open();
+     }
+  }else if( action == ePrintPixelValue || action == eSubtractLines || action == eDivideLines ){
+     // only few lines are used -> memory mapped file, only the lines which are accessed are converted :
+     read_status = left.ReadFitsMMap( NULL, 1 );
+  }else{
+     read_status = left.ReadFits( NULL, 0, 1, 1);
+  }
+  if( read_status ){
      printf("ERROR : error reading fits file %s\n",fits_left.c_str());
      exit(-1);
   }
@@ -520,7 +659,11 @@ int main(int argc,char* argv[])
           printf("%s : MEDIAN = %.8f, RMS_IQR = %.8f , MEAN = %.8f , RMS = %.8f , N_PIXELS = %d around pixel (%d,%d)\n",left.GetFileName(), avg_val, rms_val, median, rms_iqr, pixel_count, stat_x, stat_y );
        }else{
           // full image
-          inttime = left.GetStat( avg, rms, gStartInt, gEndInt, gInttypeKeyword.c_str(), &min_spec, &max_spec, -1e20, NULL, pRFI_FlagsFits );
+          if( pReader ){
+             inttime = pReader->GetStat( avg, rms, gStartInt, gEndInt, gInttypeKeyword.c_str(), &min_spec, &max_spec, -1e20, NULL, pRFI_FlagsFits );
+          }else{
+             inttime = left.GetStat( avg, rms, gStartInt, gEndInt, gInttypeKeyword.c_str(), &min_spec, &max_spec, -1e20, NULL, pRFI_FlagsFits );
+          }
        }
        
        if( gUseMedian > 0 ){
@@ -576,7 +719,11 @@ int main(int argc,char* argv[])
        printf("Saved %d points of AVG and RMS spectrum to files %s and %s\n",(int)avg.size(),out_file_name_full.c_str(),out_file_name_rms_full.c_str());
        
        CBgArray mean_lines, rms_lines;
-       left.MeanLines( mean_lines, rms_lines );
+       if( pReader ){
+          pReader->MeanLines( mean_lines, rms_lines );
+       }else{
+          left.MeanLines( mean_lines, rms_lines );
+       }
        mean_lines.SaveToFile( out_mean_column_file.c_str(), NULL, &rms_lines );
     }
     if( action == eDivideConst || action == eLog10File || action == eSqrtFile || action == eAstroRootImage || action==eTimesConst || action==eNormalizeByMedian || action==eSubtractMedian || action==eFindValue ||
@@ -721,5 +868,8 @@ int main(int argc,char* argv[])
        printf("SUCCESS : written output file to %s\n",fits_out.c_str());
      }
   }
-}
 
+  if( pReader ){
+     delete pReader;
+  }
+}
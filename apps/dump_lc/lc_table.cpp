@@ -1,51 +1,54 @@
 #include "lc_table.h"
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
 #include <myfile.h>
 #include <bg_globals.h>
 #include <bg_fits.h>
+#include <bg_quantile.h>
 
-double CLcTable::m_MinModulationIndex = -1000;
-double CLcTable::m_MinChi2 = -1000;
-bool   CLcTable::m_bUseMedian=true;
+double CLcGrid::m_MinModulationIndex = -1000;
+double CLcGrid::m_MinChi2 = -1000;
+bool   CLcGrid::m_bUseMedian=true;
+int    CLcGrid::m_StatThreads=0;
+double CLcStream::m_DefaultCompression=25.00;
 
 static int debug=10;
 
-CLightcurvePoint::CLightcurvePoint( double uxtime, double flux, double stddev_noise  )
-: m_unixtime(uxtime), m_flux(flux), m_stddev_noise(stddev_noise)
+CLightcurve::CLightcurve( const double* unixtime, const float* flux, const float* stddev_noise, int count )
+: m_UnixTime(unixtime), m_Flux(flux), m_StddevNoise(stddev_noise), m_Count(count)
 {
-//   if(debug>=0){
-//      printf("DEBUG_UNIXTIME (%x) : %.4f %.4f\n",this,m_unixtime,m_flux);
-//      debug--;
-//   }
 }
 
-CLightcurve::CLightcurve()
+void CLightcurve::GetStat( double& mean, double& rms, double& median, double& rms_iqr, double& chi2, double& mean_weighted, bool bUseMedian, double approx )
 {
-}
-
-void CLightcurve::GetStat( double& mean, double& rms, double& median, double& rms_iqr, double& chi2, double& mean_weighted, bool bUseMedian )
-{
-   vector<double> values;
+   // scratch buffer reused for all pixels :
+   static thread_local CBgQuantile values;
+   double compression = bg_approx_compression( approx );
+   CBgTDigest digest( compression );
    int cnt = size();
    
    double sum=0.00,sum2=0.00; 
    for(int i=0;i<cnt;i++){
-       double value = (*this)[i].m_flux;
-       values.push_back( value );
+       double value = m_Flux[i];
+       if( compression > 0 ){
+          digest.Add( value );
+       }
        
        sum += value;
        sum2 += (value*value);
    }
    
-   my_sort_float( values );
-
-   int q75= int(cnt*0.75);
-   int q25= int(cnt*0.25);
-
-   median = values[ cnt / 2 ];
-   double iqr = values[q75] - values[q25];
-   rms_iqr = iqr / 1.35;
+   if( compression > 0 ){
+      median = digest.MedianRmsIQR( rms_iqr );
+   }else{
+      values.assign( m_Flux, cnt );
+      median = values.MedianRmsIQR( rms_iqr );
+   }
    
    mean = sum/cnt;
    rms = sqrt( (sum2/cnt) - mean*mean );
@@ -57,8 +60,8 @@ void CLightcurve::GetStat( double& mean, double& rms, double& median, double& rm
    double sum_w = 0.00 , sum_ww = 0.00;   
    chi2 = 0.00;
    for(int i=0;i<cnt;i++){
-      double value = (*this)[i].m_flux;
-      double stddev_noise = (*this)[i].m_stddev_noise;
+      double value = m_Flux[i];
+      double stddev_noise = m_StddevNoise[i];
       double stddev_noise2 = (stddev_noise*stddev_noise);
       
       chi2 += ( (value-mean_robust)*(value-mean_robust) ) / (stddev_noise2);
@@ -71,139 +74,219 @@ void CLightcurve::GetStat( double& mean, double& rms, double& median, double& rm
    mean_weighted = sum_w / sum_ww;
 }
 
-int CLightcurve::SaveLC(int x, int y, const char* outdir, double min_mod_index,  double& rms_out, double& modidx_out, double& chi2, bool bUseMedian )
+// modulation indexes from the other statistics :
+static void bg_lc_modidx( cLcStat& stat, bool bUseMedian )
 {
-    double mean, rms, median, rms_iqr, mean_weighted;
-    GetStat( mean, rms, median, rms_iqr, chi2, mean_weighted, bUseMedian );
-    double modulation_index = fabs( rms_iqr / median );
-    double modulation_index_robust = fabs( rms / mean_weighted );
+    stat.modidx = fabs( stat.rms_iqr / stat.median );
+    stat.modidx_robust = fabs( stat.rms / stat.mean_weighted );
     if( bUseMedian ){
-       modulation_index_robust = fabs( rms_iqr / mean_weighted );
+       stat.modidx_robust = fabs( stat.rms_iqr / stat.mean_weighted );
     }
-    rms_out     = rms_iqr;
-    modidx_out  = modulation_index_robust;
-    
+}
+
+void CLightcurve::GetStat( cLcStat& stat, bool bUseMedian, double approx )
+{
+    GetStat( stat.mean, stat.rms, stat.median, stat.rms_iqr, stat.chi2, stat.mean_weighted, bUseMedian, approx );
+    bg_lc_modidx( stat, bUseMedian );
+}
+
+int CLightcurve::SaveLC(int x, int y, const char* outdir, const cLcStat& stat )
+{
 //    printf("DEBUG UXTIME - saving lightcurve at pixel (%d,%d)\n",x,y);
     
     int n_saved=0;
-//    if( modulation_index > min_mod_index || fabs(rms/mean) > min_mod_index ){
-    if( modulation_index_robust > min_mod_index ){
-       if( chi2 > CLcTable::m_MinChi2 ){
-          char szOutFileName[512];
-          sprintf(szOutFileName,"%s/pixel_%05d_%05d.txt",outdir,x,y);
-
-          MyOFile out_f(szOutFileName,"a+");
-          out_f.Printf("# LIGHTCURVE STATISTICS : MEAN = %.8f , RMS = %.8f , MEDIAN = %.8f , RMS_IQR = %.8f , MEAN_WEIGHTED = %.8f\n",mean,rms,median,rms_iqr,mean_weighted);
-          out_f.Printf("# LIGHTCURVE MOD-INDEX  : MOD_INDEX = RMS_IQR / MEDIAN = %.8f ( RMS/MEAN = %.8f ) , CHI2 = %.8f , MOD_INDEX_EQ3 = %.8f\n",modulation_index,fabs(rms/mean),chi2,modulation_index_robust);
-          out_f.Printf("# Number of points = %d\n",size());
-          out_f.Printf("# UNIXTIME FLUX[Jy] STDDEV_NOISE[Jy]\n");
-//       out_f.Printf("# Number of points = %d (debug ptr = %x)\n",size(),this);
-          
-    
-          for(int i=0;i<size();i++){
-             CLightcurvePoint& point = (*this)[i];
-           
-             out_f.Printf("%.6f %.6f %.6f\n",point.m_unixtime,point.m_flux,point.m_stddev_noise);
+    char szOutFileName[512];
+    sprintf(szOutFileName,"%s/pixel_%05d_%05d.txt",outdir,x,y);
+
+    MyOFile out_f(szOutFileName,"w");
+    out_f.Printf("# LIGHTCURVE STATISTICS : MEAN = %.8f , RMS = %.8f , MEDIAN = %.8f , RMS_IQR = %.8f , MEAN_WEIGHTED = %.8f\n",stat.mean,stat.rms,stat.median,stat.rms_iqr,stat.mean_weighted);
+    out_f.Printf("# LIGHTCURVE MOD-INDEX  : MOD_INDEX = RMS_IQR / MEDIAN = %.8f ( RMS/MEAN = %.8f ) , CHI2 = %.8f , MOD_INDEX_EQ3 = %.8f\n",stat.modidx,fabs(stat.rms/stat.mean),stat.chi2,stat.modidx_robust);
+    out_f.Printf("# Number of points = %d\n",size());
+    out_f.Printf("# UNIXTIME FLUX[Jy] STDDEV_NOISE[Jy]\n");
+
+    for(int i=0;i<size();i++){
+       out_f.Printf("%.6f %.6f %.6f\n",m_UnixTime[i],m_Flux[i],m_StddevNoise[i]);
        
-             n_saved++;
-          }
-       }
+       n_saved++;
     }
     return n_saved;
 }
 
-CLcTable::CLcTable( int sizeX , int sizeY )
-: m_SizeX(sizeX) , m_SizeY(sizeY)
+CLcGrid::CLcGrid()
+: m_SizeX(0), m_SizeY(0), m_StartX(0), m_StartY(0), m_Step(1), m_GridX(0), m_GridY(0), m_bPixelList(false)
+{
+}
+
+CLcGrid::~CLcGrid()
 {
-   int size = m_SizeX*m_SizeY;
-   assign( size, NULL );
 }
 
-/*void CLcTable::Alloc( int sizeX , int sizeY )
+void CLcGrid::SetGrid( int sizeX , int sizeY, int startX, int startY, int endX, int endY, int step )
 {
    m_SizeX = sizeX;
-   m_sizeY = sizeY;
-   
-   int size = m_SizeX*m_SizeY;
-   assign( size, NULL );
-}*/
+   m_SizeY = sizeY;
+   m_StartX = startX;
+   m_StartY = startY;
+   m_Step = step;
+   m_GridX = 0;
+   m_GridY = 0;
+   if( m_Step < 1 ){
+      m_Step = 1;
+   }
+   if( endX > startX ){
+      m_GridX = (endX - startX + m_Step - 1)/m_Step;
+   }
+   if( endY > startY ){
+      m_GridY = (endY - startY + m_Step - 1)/m_Step;
+   }
+
+   m_bPixelList = false;
+   m_PixelX.clear();
+   m_PixelY.clear();
+   m_PixelKeys.clear();
+   m_Stat.clear();
+}
 
-CLcTable::~CLcTable()
+void CLcGrid::SetPixels( int sizeX , int sizeY, const vector<int>& x, const vector<int>& y )
 {
-   for(int i=0;i<size();i++){
-      CLightcurve* ptr = (*this)[i];
+   SetGrid( sizeX, sizeY, 0, 0, 0, 0, 1 );
+   m_bPixelList = true;
 
-      if (ptr ){
-         delete ptr;
+   for(int i=0;i<x.size() && i<y.size();i++){
+      m_PixelKeys.push_back( ((long)y[i])*m_SizeX + x[i] );
+   }
+   std::sort( m_PixelKeys.begin(), m_PixelKeys.end() );
+   m_PixelKeys.erase( std::unique( m_PixelKeys.begin(), m_PixelKeys.end() ), m_PixelKeys.end() );
+
+   m_PixelX.resize( m_PixelKeys.size() );
+   m_PixelY.resize( m_PixelKeys.size() );
+   for(long pos=0;pos<m_PixelKeys.size();pos++){
+      m_PixelX[pos] = m_PixelKeys[pos] % m_SizeX;
+      m_PixelY[pos] = m_PixelKeys[pos] / m_SizeX;
+   }
+}
+
+long CLcGrid::GetPixelIndex( int x, int y )
+{
+   if( m_bPixelList ){
+      long key = ((long)y)*m_SizeX + x;
+      vector<long>::iterator it = std::lower_bound( m_PixelKeys.begin(), m_PixelKeys.end(), key );
+      if( x < 0 || x >= m_SizeX || it == m_PixelKeys.end() || (*it) != key ){
+         return -1;
       }
+      return ( it - m_PixelKeys.begin() );
+   }
+
+   int dx = x - m_StartX;
+   int dy = y - m_StartY;
+   if( dx < 0 || dy < 0 || (dx % m_Step) != 0 || (dy % m_Step) != 0 ){
+      return -1;
    }
+   dx = dx / m_Step;
+   dy = dy / m_Step;
+   if( dx >= m_GridX || dy >= m_GridY ){
+      return -1;
+   }
+
+   return ((long)dy)*m_GridX + dx;
 }
-   
-CLightcurve* CLcTable::getXY(int x, int y)
+
+void CLcGrid::GetPixelXY( long pos, int& x, int& y )
 {
-   int pos = y*m_SizeX + x;
-   if ( pos < (m_SizeX*m_SizeY) ){   
-      CLightcurve* ptr = (*this)[pos];
-      
-      return ptr;
-   }else{
-      printf("ERROR in code : requested element at (x,y) = (%d,%d) - index = %d from the array size (%d,%d) size = %d\n",x,y,pos,m_SizeX,m_SizeY,(m_SizeX*m_SizeY));   
+   if( m_bPixelList ){
+      x = m_PixelX[pos];
+      y = m_PixelY[pos];
+      return;
    }
-   
-   return NULL;
+
+   x = m_StartX + (pos % m_GridX)*m_Step;
+   y = m_StartY + (pos / m_GridX)*m_Step;
 }
 
-void  CLcTable::setXY(int x, int y, CLightcurve* ptr )
+bool CLcGrid::GetBoundingBox( int& start_x, int& start_y, int& end_x, int& end_y )
 {
-   int pos = y*m_SizeX + x;
-   if ( pos < (m_SizeX*m_SizeY) ){   
-      (*this)[pos] = ptr;
+   long n_pixels = GetPixelsCount();
+   if( n_pixels <= 0 ){
+      return false;
+   }
+
+   if( m_bPixelList ){
+      start_x = end_x = m_PixelX[0];
+      for(long pos=1;pos<n_pixels;pos++){
+         start_x = min( start_x, m_PixelX[pos] );
+         end_x = max( end_x, m_PixelX[pos] );
+      }
+      // list is sorted by y :
+      start_y = m_PixelY[0];
+      end_y = m_PixelY[n_pixels-1];
    }else{
-      printf("ERROR in code : requested to set element at (x,y) = (%d,%d) - index = %d in the array size (%d,%d) size = %d\n",x,y,pos,m_SizeX,m_SizeY,(m_SizeX*m_SizeY));   
+      start_x = m_StartX;
+      start_y = m_StartY;
+      end_x = m_StartX + (m_GridX-1)*m_Step;
+      end_y = m_StartY + (m_GridY-1)*m_Step;
    }
+   end_x++;
+   end_y++;
+
+   return true;
+}
+
+bool CLcGrid::IsVariable( const cLcStat& stat )
+{
+//   if( stat.modidx > m_MinModulationIndex || fabs(stat.rms/stat.mean) > m_MinModulationIndex ){
+   return ( stat.modidx_robust > m_MinModulationIndex && stat.chi2 > m_MinChi2 );
 }
 
-CLightcurve* CLcTable::setXY( int x, int y, double uxtime, double flux, double stddev_noise )
+long CLcGrid::GetVariablePixels( vector<int>& x, vector<int>& y )
 {
-   CLightcurve* lc = getXY(x,y);
-   if( !lc ){
-      lc = new CLightcurve();
-      setXY(x,y,lc);      
+   x.clear();
+   y.clear();
+   for(long pos=0;pos<m_Stat.size();pos++){
+      if( IsVariable( m_Stat[pos] ) ){
+         int pixel_x, pixel_y;
+         GetPixelXY( pos, pixel_x, pixel_y );
+         x.push_back( pixel_x );
+         y.push_back( pixel_y );
+      }
    }
-   
-   lc->push_back( CLightcurvePoint(uxtime,flux,stddev_noise) );   
-   
-   return lc;
+
+   return x.size();
 }
 
-int CLcTable::SaveLC(const char* outdir, int BorderStartX, int BorderStartY, int BorderEndX, int BorderEndY )
+int CLcGrid::SaveMaps( const char* outdir )
 {
-   MyFile::CreateDir( outdir );
-   
    CBgFits rms_map( m_SizeX, m_SizeY ), modidx_map( m_SizeX, m_SizeY ), chi2_map( m_SizeX, m_SizeY );
-   double rms,modidx,chi2;
-   
-   for(int y=BorderStartY;y<BorderEndY;y++){
-      if( (y%10) == 0 ){
-         printf("Y = %d\n",y);         
-      }
-      for(int x=BorderStartX;x<BorderEndX;x++){
-        CLightcurve* lc = getXY( x, y );
-
-        if( lc ){
-           lc->SaveLC(x,y,outdir,CLcTable::m_MinModulationIndex,rms, modidx, chi2, CLcTable::m_bUseMedian );
-           
-           chi2_map.setXY(x,y,chi2);
-           rms_map.setXY(x,y,rms);
-           modidx_map.setXY(x,y,modidx);
-        }
-      }
+   FillMaps( rms_map, modidx_map, chi2_map );
+
+   return WriteMaps( outdir, rms_map, modidx_map, chi2_map );
+}
+
+void CLcGrid::FillMaps( CBgFits& rms_map, CBgFits& modidx_map, CBgFits& chi2_map )
+{
+   if( (long)m_Stat.size() != GetPixelsCount() ){
+      CalcStat();
    }
-   
+
+   for(long pos=0;pos<GetPixelsCount();pos++){
+      int x, y;
+      GetPixelXY( pos, x, y );
+
+      chi2_map.setXY(x,y,m_Stat[pos].chi2);
+      rms_map.setXY(x,y,m_Stat[pos].rms_iqr);
+      modidx_map.setXY(x,y,m_Stat[pos].modidx_robust);
+   }
+}
+
+int CLcGrid::WriteMaps( const char* outdir, CBgFits& rms_map, CBgFits& modidx_map, CBgFits& chi2_map )
+{
+   MyFile::CreateDir( outdir );
+
+   int ret = 0;
    char szOutFits[1024];
    sprintf(szOutFits,"%s/rmsmap.fits",outdir);
    if( rms_map.WriteFits(szOutFits) ){
       printf("ERROR : could not save FITS file %s\n",szOutFits);
+      ret = -1;
    }else{
       printf("INFO : saved FITS %s\n",szOutFits);
    }
@@ -211,6 +294,7 @@ int CLcTable::SaveLC(const char* outdir, int BorderStartX, int BorderStartY, int
    sprintf(szOutFits,"%s/modidx.fits",outdir);
    if( modidx_map.WriteFits(szOutFits) ){
       printf("ERROR : could not save FITS file %s\n",szOutFits);
+      ret = -1;
    }else{
      printf("INFO : saved FITS %s\n",szOutFits);
    }
@@ -218,12 +302,536 @@ int CLcTable::SaveLC(const char* outdir, int BorderStartX, int BorderStartY, int
    sprintf(szOutFits,"%s/chi2.fits",outdir);
    if( chi2_map.WriteFits(szOutFits) ){
       printf("ERROR : could not save FITS file %s\n",szOutFits);
+      ret = -1;
    }else{
      printf("INFO : saved FITS %s\n",szOutFits);
    }
+
+   return ret;
+}
+
+CLcTable::CLcTable( int sizeX , int sizeY, int startX, int startY, int endX, int endY, int step, int max_epochs )
+: m_MaxEpochs(0), m_Approx(BG_APPROX_DEFAULT)
+{
+   if( max_epochs > 0 ){
+      Alloc( sizeX, sizeY, startX, startY, endX, endY, step, max_epochs );
+   }
+}
+
+void CLcTable::Alloc( int sizeX , int sizeY, int startX, int startY, int endX, int endY, int step, int max_epochs )
+{
+   SetGrid( sizeX, sizeY, startX, startY, endX, endY, step );
+   m_MaxEpochs = max_epochs;
+   AllocColumns();
+}
+
+void CLcTable::AllocPixels( int sizeX , int sizeY, const vector<int>& x, const vector<int>& y, int max_epochs )
+{
+   SetPixels( sizeX, sizeY, x, y );
+   m_MaxEpochs = max_epochs;
+   AllocColumns();
+}
+
+void CLcTable::AllocColumns()
+{
+   if( m_MaxEpochs < 0 ){
+      m_MaxEpochs = 0;
+   }
+
+   long size = GetPixelsCount()*m_MaxEpochs;
+   printf("INFO : allocating lightcurves of %ld pixels x %d epochs ( %.2f MB )\n",GetPixelsCount(),m_MaxEpochs,(2.00*size*sizeof(float))/(1024.00*1024.00));
+   m_UnixTime.clear();
+   m_UnixTime.reserve( m_MaxEpochs );
+   m_Flux.assign( size, (0.00/0.00) );
+   m_StddevNoise.assign( size, (0.00/0.00) );
+}
+
+int CLcTable::AddEpoch( double uxtime )
+{
+   if( (int)m_UnixTime.size() >= m_MaxEpochs ){
+      printf("ERROR in code : lightcurve table is full ( %d epochs )\n",m_MaxEpochs);
+      return -1;
+   }
+   m_UnixTime.push_back( uxtime );
+
+   return (m_UnixTime.size()-1);
+}
+
+int CLcTable::AddImage( CBgFits& fits, CBgFits* pRmsFits, double uxtime )
+{
+   int epoch = AddEpoch( uxtime );
+   if( epoch < 0 ){
+      return -1;
+   }
+
+   // getXY uses coordinates of the full image also when only the window was read :
+   long n_pixels = GetPixelsCount();
+   for(long pos=0;pos<n_pixels;pos++){
+      int x, y;
+      GetPixelXY( pos, x, y );
+
+      long offset = pos*m_MaxEpochs + epoch;
+      m_Flux[offset] = fits.getXY(x,y);
+      m_StddevNoise[offset] = ( pRmsFits ? pRmsFits->getXY(x,y) : 1.00 );
+   }
+
+   return epoch;
+}
+
+void CLcTable::GetLightcurve( long pos, CLightcurve& lc )
+{
+   long offset = pos*m_MaxEpochs;
+   lc = CLightcurve( m_UnixTime.data(), m_Flux.data() + offset, m_StddevNoise.data() + offset, m_UnixTime.size() );
+}
+
+bool CLcTable::getXY(int x, int y, CLightcurve& lc )
+{
+   long pos = GetPixelIndex( x, y );
+   if( pos < 0 || m_UnixTime.size() <= 0 ){
+      return false;
+   }
+
+   GetLightcurve( pos, lc );
+   return true;
+}
+
+void CLcTable::setXY( int x, int y, int epoch, double flux, double stddev_noise )
+{
+   long pos = GetPixelIndex( x, y );
+   if ( pos >= 0 && epoch >= 0 && epoch < m_MaxEpochs ){
+      long offset = pos*m_MaxEpochs + epoch;
+      m_Flux[offset] = flux;
+      m_StddevNoise[offset] = stddev_noise;
+   }else{
+      printf("ERROR in code : requested to set element at (x,y) = (%d,%d) , epoch = %d outside the table of %ld pixels and %d epochs\n",x,y,epoch,GetPixelsCount(),m_MaxEpochs);
+   }
+}
+
+// pixels are taken in chunks from the shared counter, so threads with cheaper lightcurves (e.g. NaN) take more of them :
+struct cLcStatJob
+{
+   CLcGrid*         table;
+   pthread_mutex_t* mutex;
+   long*            next_pixel;
+   long             n_pixels;
+   long             chunk;
+};
+
+static void bg_lc_stat_pixels( cLcStatJob* job )
+{
+   while( true ){
+      pthread_mutex_lock( job->mutex );
+      long pos_start = (*job->next_pixel);
+      (*job->next_pixel) += job->chunk;
+      pthread_mutex_unlock( job->mutex );
+
+      if( pos_start >= job->n_pixels ){
+         break;
+      }
+      long pos_end = ( pos_start + job->chunk < job->n_pixels ? pos_start + job->chunk : job->n_pixels );
+      job->table->CalcStat( pos_start, pos_end );
+   }
+}
+
+static void* bg_lc_stat_thread( void* ptr )
+{
+   bg_lc_stat_pixels( (cLcStatJob*)ptr );
+   return NULL;
+}
+
+void CLcGrid::CalcStat()
+{
+   long n_pixels = GetPixelsCount();
+   m_Stat.assign( n_pixels, cLcStat() );
+
+   int n_threads = m_StatThreads;
+   if( n_threads <= 0 ){
+      n_threads = sysconf( _SC_NPROCESSORS_ONLN );
+   }
+   long chunk = 256;
+   if( n_threads > (n_pixels + chunk - 1)/chunk ){
+      n_threads = (n_pixels + chunk - 1)/chunk;
+   }
+   if( n_threads <= 1 ){
+      CalcStat( 0, n_pixels );
+      return;
+   }
+
+   pthread_mutex_t mutex;
+   pthread_mutex_init( &mutex, NULL );
+   long next_pixel = 0;
+   cLcStatJob job;
+   job.table = this;
+   job.mutex = &mutex;
+   job.next_pixel = &next_pixel;
+   job.n_pixels = n_pixels;
+   job.chunk = chunk;
+
+   vector<pthread_t> threads;
+   for(int t=1;t<n_threads;t++){
+      pthread_t thread;
+      if( pthread_create( &thread, NULL, bg_lc_stat_thread, &job ) ){
+         printf("WARNING : could not start statistics thread %d -> using %d threads\n",t,(int)threads.size()+1);
+         break;
+      }
+      threads.push_back( thread );
+   }
+   bg_lc_stat_pixels( &job );
+   for(int t=0;t<threads.size();t++){
+      pthread_join( threads[t], NULL );
+   }
+   pthread_mutex_destroy( &mutex );
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("INFO : statistics of %ld lightcurves calculated by %d threads\n",n_pixels,(int)threads.size()+1);
+   }
+}
+
+void CLcTable::CalcStat( long pos_start, long pos_end )
+{
+   if( GetEpochsCount() <= 0 ){
+      return;
+   }
+
+   for(long pos=pos_start;pos<pos_end;pos++){
+      CLightcurve lc;
+      GetLightcurve( pos, lc );
+      lc.GetStat( m_Stat[pos], CLcTable::m_bUseMedian, m_Approx );
+   }
+}
+
+// flux / noise columns written as NAXIS1=epochs x pixels image (rows of the table are m_MaxEpochs long) :
+static int bg_lc_write_columns( fitsfile* fp, vector<float>& columns, long n_pixels, int n_epochs, int max_epochs )
+{
+   int status = 0;
+   if( n_epochs == max_epochs ){
+      fits_write_img( fp, TFLOAT, 1, ((LONGLONG)n_pixels)*n_epochs, columns.data(), &status );
+   }else{
+      for(long pos=0;pos<n_pixels && !status;pos++){
+         fits_write_img( fp, TFLOAT, ((LONGLONG)pos)*n_epochs+1, n_epochs, columns.data() + pos*max_epochs, &status );
+      }
+   }
+
+   return status;
+}
+
+// statistics columns of LCSTAT extension (after X, Y and VARIABLE) :
+static double cLcStat::* lc_stat_columns[] = { &cLcStat::mean, &cLcStat::rms, &cLcStat::median, &cLcStat::rms_iqr, &cLcStat::mean_weighted, &cLcStat::chi2, &cLcStat::modidx, &cLcStat::modidx_robust };
+static const int lc_stat_columns_count = sizeof(lc_stat_columns)/sizeof(lc_stat_columns[0]);
+
+int CLcTable::WriteCube( const char* fits_file )
+{
+   int n_epochs = GetEpochsCount();
+   long n_pixels = GetPixelsCount();
+   if( n_epochs <= 0 || n_pixels <= 0 ){
+      printf("ERROR : no lightcurves to save in FITS file %s\n",fits_file);
+      return -1;
+   }
+   if( (long)m_Stat.size() != n_pixels ){
+      CalcStat();
+   }
+
+   string szFitsFileToOverwrite = "!";
+   szFitsFileToOverwrite += fits_file;
+   fitsfile* fp = NULL;
+   int status = 0;
+   if( fits_create_file( &fp, szFitsFileToOverwrite.c_str(), &status ) ){
+      printf("ERROR : could not create FITS file %s , due to error %d\n",fits_file,status);
+      return status;
+   }
+
+   // flux (pixels of the list are in LCSTAT) :
+   long naxes[3] = { n_epochs, m_GridX, m_GridY };
+   int step = m_Step;
+   if( m_bPixelList ){
+      naxes[1] = n_pixels;
+      naxes[2] = 1;
+      step = 0;
+   }
+   fits_create_img( fp, FLOAT_IMG, 3, naxes, &status );
+   fits_write_key( fp, TINT, "LCSIZEX", &m_SizeX, "X size of the images", &status );
+   fits_write_key( fp, TINT, "LCSIZEY", &m_SizeY, "Y size of the images", &status );
+   fits_write_key( fp, TINT, "LCSTARTX", &m_StartX, "image x of the first pixel", &status );
+   fits_write_key( fp, TINT, "LCSTARTY", &m_StartY, "image y of the first pixel", &status );
+   fits_write_key( fp, TINT, "LCSTEP", &step, "pixel step in both axes (0 - list of pixels in LCSTAT)", &status );
+   if( !status ){
+      status = bg_lc_write_columns( fp, m_Flux, n_pixels, n_epochs, m_MaxEpochs );
+   }
+
+   // noise :
+   fits_create_img( fp, FLOAT_IMG, 3, naxes, &status );
+   fits_write_key( fp, TSTRING, "EXTNAME", (void*)"NOISE", NULL, &status );
+   if( !status ){
+      status = bg_lc_write_columns( fp, m_StddevNoise, n_pixels, n_epochs, m_MaxEpochs );
+   }
+
+   // time axis :
+   char* time_ttype[] = { (char*)"UNIXTIME" };
+   char* time_tform[] = { (char*)"1D" };
+   fits_create_tbl( fp, BINARY_TBL, n_epochs, 1, time_ttype, time_tform, NULL, "TIME", &status );
+   fits_write_col( fp, TDOUBLE, 1, 1, 1, n_epochs, m_UnixTime.data(), &status );
+
+   // statistics of pixels :
+   char* stat_ttype[] = { (char*)"X", (char*)"Y", (char*)"VARIABLE", (char*)"MEAN", (char*)"RMS", (char*)"MEDIAN", (char*)"RMS_IQR", (char*)"MEAN_WEIGHTED", (char*)"CHI2", (char*)"MODIDX", (char*)"MODIDX_EQ3" };
+   char* stat_tform[] = { (char*)"1J", (char*)"1J", (char*)"1L", (char*)"1D", (char*)"1D", (char*)"1D", (char*)"1D", (char*)"1D", (char*)"1D", (char*)"1D", (char*)"1D" };
+   fits_create_tbl( fp, BINARY_TBL, n_pixels, 3+lc_stat_columns_count, stat_ttype, stat_tform, NULL, "LCSTAT", &status );
+   if( !status ){
+      vector<int> x_column( n_pixels ), y_column( n_pixels );
+      vector<char> variable_column( n_pixels );
+      for(long pos=0;pos<n_pixels;pos++){
+         GetPixelXY( pos, x_column[pos], y_column[pos] );
+         variable_column[pos] = IsVariable( m_Stat[pos] );
+      }
+      fits_write_col( fp, TINT, 1, 1, 1, n_pixels, x_column.data(), &status );
+      fits_write_col( fp, TINT, 2, 1, 1, n_pixels, y_column.data(), &status );
+      fits_write_col( fp, TLOGICAL, 3, 1, 1, n_pixels, variable_column.data(), &status );
+
+      vector<double> column( n_pixels );
+      for(int c=0;c<lc_stat_columns_count;c++){
+         for(long pos=0;pos<n_pixels;pos++){
+            column[pos] = m_Stat[pos].*lc_stat_columns[c];
+         }
+         fits_write_col( fp, TDOUBLE, 4+c, 1, 1, n_pixels, column.data(), &status );
+      }
+   }
+
+   int close_status = 0;
+   fits_close_file( fp, &close_status );
+   if( status || close_status ){
+      printf("ERROR : could not write lightcurves to FITS file %s , due to error %d\n",fits_file,(status ? status : close_status));
+      return ( status ? status : close_status );
+   }
+   printf("INFO : saved lightcurves of %ld pixels x %d epochs to FITS file %s\n",n_pixels,n_epochs,fits_file);
+
+   return 0;
+}
+
+int CLcTable::ReadCube( const char* fits_file, bool bStatOnly )
+{
+   fitsfile* fp = NULL;
+   int status = 0;
+   if( fits_open_file( &fp, fits_file, READONLY, &status ) ){
+      printf("ERROR : could not open FITS file %s , due to error %d\n",fits_file,status);
+      return status;
+   }
+
+   int bitpix = 0, naxis = 0;
+   long naxes[3] = { 0, 0, 0 };
+   fits_get_img_param( fp, 3, &bitpix, &naxis, naxes, &status );
+   int sizeX = 0, sizeY = 0, startX = 0, startY = 0, step = 1;
+   fits_read_key( fp, TINT, "LCSIZEX", &sizeX, NULL, &status );
+   fits_read_key( fp, TINT, "LCSIZEY", &sizeY, NULL, &status );
+   fits_read_key( fp, TINT, "LCSTARTX", &startX, NULL, &status );
+   fits_read_key( fp, TINT, "LCSTARTY", &startY, NULL, &status );
+   fits_read_key( fp, TINT, "LCSTEP", &step, NULL, &status );
+   if( status || naxis != 3 ){
+      printf("ERROR : FITS file %s is not a lightcurve cube (NAXIS = %d , error %d)\n",fits_file,naxis,status);
+      int close_status = 0;
+      fits_close_file( fp, &close_status );
+      return ( status ? status : -1 );
+   }
+   int n_epochs = naxes[0];
+   long n_pixels = naxes[1]*naxes[2];
+   // only time axis and statistics are read with bStatOnly (lightcurves are not allocated) :
+   int max_epochs = ( bStatOnly ? 0 : n_epochs );
+   if( step > 0 ){
+      Alloc( sizeX, sizeY, startX, startY, startX + naxes[1]*step, startY + naxes[2]*step, step, max_epochs );
+   }else{
+      // list of pixels :
+      vector<int> x_column( n_pixels ), y_column( n_pixels );
+      fits_movnam_hdu( fp, BINARY_TBL, (char*)"LCSTAT", 0, &status );
+      fits_read_col( fp, TINT, 1, 1, 1, n_pixels, NULL, x_column.data(), NULL, &status );
+      fits_read_col( fp, TINT, 2, 1, 1, n_pixels, NULL, y_column.data(), NULL, &status );
+      fits_movabs_hdu( fp, 1, NULL, &status );
+      if( status ){
+         printf("ERROR : could not read list of pixels from LCSTAT extension in FITS file %s , due to error %d\n",fits_file,status);
+         int close_status = 0;
+         fits_close_file( fp, &close_status );
+         return status;
+      }
+      AllocPixels( sizeX, sizeY, x_column, y_column, max_epochs );
+   }
+   float nulval = (0.00/0.00);
+
+   if( !bStatOnly ){
+      LONGLONG n_values = ((LONGLONG)n_epochs)*n_pixels;
+      fits_read_img( fp, TFLOAT, 1, n_values, &nulval, m_Flux.data(), NULL, &status );
+      fits_movnam_hdu( fp, IMAGE_HDU, (char*)"NOISE", 0, &status );
+      fits_read_img( fp, TFLOAT, 1, n_values, &nulval, m_StddevNoise.data(), NULL, &status );
+   }
+   fits_movnam_hdu( fp, BINARY_TBL, (char*)"TIME", 0, &status );
+   m_UnixTime.resize( n_epochs );
+   fits_read_col( fp, TDOUBLE, 1, 1, 1, n_epochs, NULL, m_UnixTime.data(), NULL, &status );
+
+   // statistics saved with the lightcurves (not calculated again) :
+   fits_movnam_hdu( fp, BINARY_TBL, (char*)"LCSTAT", 0, &status );
+   if( !status ){
+      m_Stat.resize( n_pixels );
+      vector<double> column( n_pixels );
+      for(int c=0;c<lc_stat_columns_count && !status;c++){
+         fits_read_col( fp, TDOUBLE, 4+c, 1, 1, n_pixels, NULL, column.data(), NULL, &status );
+         for(long pos=0;pos<n_pixels;pos++){
+            m_Stat[pos].*lc_stat_columns[c] = column[pos];
+         }
+      }
+   }
+
+   int close_status = 0;
+   fits_close_file( fp, &close_status );
+   if( status ){
+      printf("ERROR : could not read lightcurves from FITS file %s , due to error %d\n",fits_file,status);
+      m_UnixTime.clear();
+      m_Stat.clear();
+      return status;
+   }
+   printf("INFO : read %s of %ld pixels x %d epochs from FITS file %s\n",(bStatOnly ? "statistics" : "lightcurves"),GetPixelsCount(),n_epochs,fits_file);
+
+   return 0;
+}
+
+int CLcTable::SaveTextLC( const char* outdir, bool bVariableOnly )
+{
+   MyFile::CreateDir( outdir );
+   if( (long)m_Stat.size() != GetPixelsCount() ){
+      CalcStat();
+   }
+
+   int n_saved = 0;
+   for(long pos=0;pos<GetPixelsCount();pos++){
+      int x, y;
+      GetPixelXY( pos, x, y );
+      if( !m_bPixelList && (pos % m_GridX) == 0 && (y%10) == 0 ){
+         printf("Y = %d\n",y);
+      }
+
+      if( GetEpochsCount() > 0 && ( !bVariableOnly || IsVariable( m_Stat[pos] ) ) ){
+         CLightcurve lc;
+         GetLightcurve( pos, lc );
+         lc.SaveLC( x, y, outdir, m_Stat[pos] );
+         n_saved++;
+      }
+   }
+   printf("INFO : saved %d lightcurves as text files in %s\n",n_saved,outdir);
+
+   return n_saved;
+}
+
+int CLcTable::SaveLC( const char* outdir, bool bSaveCube, bool bSaveText )
+{
+   CalcStat();
+   SaveMaps( outdir );
+
+   char szOutFits[1024];
+   if( bSaveCube ){
+      sprintf(szOutFits,"%s/lc_cube.fits",outdir);
+      WriteCube( szOutFits );
+   }
+   if( bSaveText ){
+      SaveTextLC( outdir );
+   }
    
    printf("DEBUG : end of CLcTable::SaveLC\n");fflush(stdout);
    
    return 1;
 }
 
+CLcStream::CLcStream( int sizeX , int sizeY, int startX, int startY, int endX, int endY, int step, double compression )
+: m_Epochs(0), m_StartUnixTime(0), m_EndUnixTime(0)
+{
+   SetGrid( sizeX, sizeY, startX, startY, endX, endY, step );
+   if( compression <= 0 ){
+      compression = m_DefaultCompression;
+   }
+
+   long n_pixels = GetPixelsCount();
+   cLcAccum zero;
+   memset( &zero, 0, sizeof(zero) );
+   m_Accum.assign( n_pixels, zero );
+   m_Digests.assign( n_pixels, CBgTDigest( compression ) );
+   printf("INFO : streaming statistics of %ld pixels (t-digest compression = %.2f , at most %.2f MB)\n",n_pixels,compression,(double(n_pixels)*GetMaxBytesPerPixel(compression))/(1024.00*1024.00));
+}
+
+long CLcStream::GetMaxBytesPerPixel( double compression )
+{
+   if( compression <= 0 ){
+      compression = m_DefaultCompression;
+   }
+
+   return sizeof(cLcAccum) + sizeof(CBgTDigest) + CBgTDigest::GetMaxMemory( compression ) + sizeof(cLcStat);
+}
+
+bool CLcStream::GetTimeRange( double& start_uxtime, double& end_uxtime ) const
+{
+   start_uxtime = m_StartUnixTime;
+   end_uxtime = m_EndUnixTime;
+
+   return ( m_Epochs > 0 );
+}
+
+void CLcStream::Add( long pos, double flux, double stddev_noise )
+{
+   cLcAccum& accum = m_Accum[pos];
+   if( accum.count <= 0 ){
+      accum.ref = flux;
+   }
+   accum.count++;
+
+   double delta = flux - accum.mean;
+   accum.mean += delta/accum.count;
+   accum.m2 += delta*(flux - accum.mean);
+
+   double weight = 1.00/(stddev_noise*stddev_noise);
+   double diff = flux - accum.ref;
+   accum.sum_ww += weight;
+   accum.sum_w  += diff*weight;
+   accum.sum_w2 += diff*diff*weight;
+
+   m_Digests[pos].Add( flux );
+}
+
+int CLcStream::AddImage( CBgFits& fits, CBgFits* pRmsFits, double uxtime )
+{
+   long n_pixels = GetPixelsCount();
+   for(long pos=0;pos<n_pixels;pos++){
+      int x, y;
+      GetPixelXY( pos, x, y );
+
+      Add( pos, fits.getXY(x,y), ( pRmsFits ? pRmsFits->getXY(x,y) : 1.00 ) );
+   }
+   if( m_Epochs <= 0 || uxtime < m_StartUnixTime ){
+      m_StartUnixTime = uxtime;
+   }
+   if( m_Epochs <= 0 || uxtime > m_EndUnixTime ){
+      m_EndUnixTime = uxtime;
+   }
+   m_Epochs++;
+
+   return (m_Epochs-1);
+}
+
+void CLcStream::CalcStat( long pos_start, long pos_end )
+{
+   for(long pos=pos_start;pos<pos_end;pos++){
+      cLcAccum& accum = m_Accum[pos];
+      cLcStat& stat = m_Stat[pos];
+      int cnt = accum.count;
+      if( cnt <= 0 ){
+         continue;
+      }
+
+      stat.mean = accum.mean;
+      stat.rms = sqrt( accum.m2/cnt );
+      stat.median = m_Digests[pos].MedianRmsIQR( stat.rms_iqr );
+
+      // sum of (flux-mean_robust)^2/noise^2 from the sums relative to the reference value :
+      double mean_robust = stat.mean;
+      if( m_bUseMedian ){
+         mean_robust = stat.median;
+      }
+      double diff = mean_robust - accum.ref;
+      stat.chi2 = ( accum.sum_w2 - 2.00*diff*accum.sum_w + diff*diff*accum.sum_ww ) / (cnt-1);
+      stat.mean_weighted = accum.ref + accum.sum_w / accum.sum_ww;
+
+      bg_lc_modidx( stat, m_bUseMedian );
+   }
+}
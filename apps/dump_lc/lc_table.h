@@ -1,49 +1,199 @@
 #ifndef _LC_TABLE_H__
 #define _LC_TABLE_H__
 
+#include <stdlib.h>
 #include <vector>
+#include <bg_quantile.h>
 using namespace std;
 
-// Assign : https://www.cplusplus.com/reference/vector/vector/assign/
+class CBgFits;
 
-class CLightcurvePoint
+// variability statistics of a lightcurve :
+struct cLcStat
 {
-public :
-   double m_unixtime;
-   double m_flux;
-   double m_stddev_noise; // local noise 
-
-   CLightcurvePoint( double uxtime, double flux, double stddev_noise );
+   double mean;
+   double rms;
+   double median;
+   double rms_iqr;
+   double mean_weighted;
+   double chi2;
+   double modidx;        // rms_iqr / median
+   double modidx_robust; // Bell et al. (2016) eq. 3 : rms_iqr / mean_weighted (or rms / mean_weighted)
 };
 
-class CLightcurve : public vector<CLightcurvePoint>
+// Lightcurve of a single pixel : view of the contiguous columns of CLcTable (no data owned) :
+class CLightcurve
 {
 public :
-  CLightcurve();
-  
-  int SaveLC(int x, int y, const char* outdir, double min_mod_index, double& rms_out, double& modidx_out, double& chi2, bool bUseMedian=true );
-  void GetStat( double& mean, double& rms, double& median, double& rms_iqr, double& chi2, double& mean_weighted, bool bUseMedian=true );
+  CLightcurve( const double* unixtime=NULL, const float* flux=NULL, const float* stddev_noise=NULL, int count=0 );
+
+  inline int size() const { return m_Count; }
+
+  // approx : exact median/rms_iqr (0) or t-digest of given compression (see bg_approx_compression) :
+  void GetStat( double& mean, double& rms, double& median, double& rms_iqr, double& chi2, double& mean_weighted, bool bUseMedian=true, double approx=BG_APPROX_DEFAULT );
+  void GetStat( cLcStat& stat, bool bUseMedian=true, double approx=BG_APPROX_DEFAULT );
+
+  // text file pixel_XXXXX_YYYYY.txt (overwritten) , returns number of points saved :
+  int SaveLC(int x, int y, const char* outdir, const cLcStat& stat );
+
+  const double* m_UnixTime;    // shared time axis
+  const float*  m_Flux;
+  const float*  m_StddevNoise; // local noise
+  int           m_Count;
 };
 
-class CLcTable : public vector<CLightcurve*>
+// Pixels of a window (every step-th pixel in both axes) or an explicit list of pixels (e.g. selected variable pixels) with
+// variability statistics per pixel. Coordinates (x,y) are in the full image, pixels are indexed pos=0,...,GetPixelsCount()-1
+// (row by row for the window). Images are added by AddImage (values of all the pixels), derived classes keep lightcurves or
+// accumulators.
+class CLcGrid
 {
-public: 
-   CLcTable( int sizeX , int sizeY );
-   ~CLcTable();
-   
+public :
+   CLcGrid();
+   virtual ~CLcGrid();
+
+   void SetGrid( int sizeX , int sizeY, int startX, int startY, int endX, int endY, int step );
+   void SetPixels( int sizeX , int sizeY, const vector<int>& x, const vector<int>& y ); // sorted by y and x
+
    int m_SizeX;
    int m_SizeY;
-   
+
    static double m_MinModulationIndex;
    static double m_MinChi2;
-   static bool   m_bUseMedian; // to calculate robust Chi2 and modulation index as in Martin Bell et al. (2016), eq. 1,2,3 
-   
-//   void Alloc( int sizeX , int sizeY );   
-   CLightcurve* getXY(int x, int y);
-   void  setXY(int x, int y, CLightcurve* ptr );
-   CLightcurve* setXY( int x, int y, double uxtime, double flux, double stddev_noise );
-   
-   int SaveLC(const char* outdir, int BorderStartX, int BorderStartY, int BorderEndX, int BorderEndY );
+   static bool   m_bUseMedian; // to calculate robust Chi2 and modulation index as in Martin Bell et al. (2016), eq. 1,2,3
+   static int    m_StatThreads; // threads used by CalcStat (0 -> number of CPUs)
+
+   inline long GetPixelsCount() const { return ( m_bPixelList ? (long)m_PixelX.size() : ((long)m_GridX)*m_GridY ); }
+   inline bool IsPixelList() const { return m_bPixelList; }
+
+   // pixel index or -1 when (x,y) is not on the grid / list :
+   long GetPixelIndex( int x, int y );
+   void GetPixelXY( long pos, int& x, int& y );
+   bool GetBoundingBox( int& start_x, int& start_y, int& end_x, int& end_y ); // end not included , false if no pixels
+   inline int GetStartX() const { return m_StartX; }
+   inline int GetStartY() const { return m_StartY; }
+   inline int GetStep() const { return m_Step; }
+   inline int GetGridX() const { return m_GridX; }
+   inline int GetGridY() const { return m_GridY; }
+
+   // values of all the pixels from image (and noise from RMS image, 1 when NULL), returns index of the new epoch or -1 on error :
+   virtual int AddImage( CBgFits& fits, CBgFits* pRmsFits, double uxtime ) = 0;
+
+   // statistics of all pixels (m_Stat), chunks of pixels are taken by m_StatThreads threads from a shared counter :
+   void CalcStat();
+   virtual void CalcStat( long pos_start, long pos_end ) = 0; // pixels [pos_start,pos_end) , m_Stat has to be allocated
+   inline const cLcStat& GetStat( long pos ) const { return m_Stat[pos]; }
+   static bool IsVariable( const cLcStat& stat ); // passes m_MinModulationIndex and m_MinChi2
+   long GetVariablePixels( vector<int>& x, vector<int>& y ); // returns number of pixels
+
+   // rmsmap.fits (rms_iqr), modidx.fits (modulation index eq. 3) and chi2.fits in outdir :
+   int SaveMaps( const char* outdir );
+   void FillMaps( CBgFits& rms_map, CBgFits& modidx_map, CBgFits& chi2_map ); // pixels of the grid set in maps of the image size
+   static int WriteMaps( const char* outdir, CBgFits& rms_map, CBgFits& modidx_map, CBgFits& chi2_map );
+
+protected :
+   int m_StartX;
+   int m_StartY;
+   int m_Step;
+   int m_GridX; // number of pixels in the window grid
+   int m_GridY;
+
+   bool         m_bPixelList;
+   vector<int>  m_PixelX;
+   vector<int>  m_PixelY;
+   vector<long> m_PixelKeys; // y*m_SizeX + x of the list (sorted)
+
+   vector<cLcStat> m_Stat; // [pixel] , see CalcStat
+};
+
+// Lightcurves stored in columns : one time axis shared by all pixels and preallocated pixel-major blocks of flux and noise
+// (lightcurve of a pixel is contiguous), sized for the maximum number of epochs (number of FITS files) up front.
+// Images are added by AddImage or AddEpoch + setXY of every pixel (not set values are NaN).
+class CLcTable : public CLcGrid
+{
+public:
+   CLcTable( int sizeX=0 , int sizeY=0, int startX=0, int startY=0, int endX=0, int endY=0, int step=1, int max_epochs=0 );
+   void Alloc( int sizeX , int sizeY, int startX, int startY, int endX, int endY, int step, int max_epochs );
+   void AllocPixels( int sizeX , int sizeY, const vector<int>& x, const vector<int>& y, int max_epochs );
+
+   // returns index of the new epoch or -1 when the table is full :
+   int AddEpoch( double uxtime );
+   inline int GetEpochsCount() const { return m_UnixTime.size(); }
+
+   virtual int AddImage( CBgFits& fits, CBgFits* pRmsFits, double uxtime );
+
+   // returns false if the lightcurve of (x,y) is not stored :
+   bool getXY(int x, int y, CLightcurve& lc );
+   void setXY( int x, int y, int epoch, double flux, double stddev_noise );
+   void GetLightcurve( long pos, CLightcurve& lc );
+
+   using CLcGrid::CalcStat;
+   virtual void CalcStat( long pos_start, long pos_end );
+   // median / rms_iqr of lightcurves calculated by CalcStat (approx parameter of CLightcurve::GetStat) :
+   void SetApproxQuantiles( double approx ){ m_Approx = approx; }
+
+   // lightcurve cube in a single FITS file : primary HDU = flux (NAXIS1 = epochs, NAXIS2 x NAXIS3 = pixels of the window grid,
+   // or NAXIS2 = pixels of the list and LCSTEP=0), extensions NOISE (the same as flux), TIME (UNIXTIME column) and
+   // LCSTAT (index of pixels with statistics from m_Stat). ReadCube with bStatOnly reads only the time axis and statistics
+   // (lightcurves are not allocated) :
+   int WriteCube( const char* fits_file );
+   int ReadCube( const char* fits_file, bool bStatOnly=false );
+
+   // statistics maps (rmsmap.fits, modidx.fits, chi2.fits), lc_cube.fits and optionally text files of variable pixels :
+   int SaveLC( const char* outdir, bool bSaveCube=true, bool bSaveText=false );
+   int SaveTextLC( const char* outdir, bool bVariableOnly=true ); // returns number of lightcurves saved
+
+protected :
+   void AllocColumns();
+
+   int m_MaxEpochs;
+   double m_Approx;
+
+   vector<double> m_UnixTime;    // [epoch]
+   vector<float>  m_Flux;        // [pixel*m_MaxEpochs + epoch]
+   vector<float>  m_StddevNoise; // [pixel*m_MaxEpochs + epoch]
+};
+
+// online accumulators of a pixel (see CLcStream) , weighted sums use the first value as reference (flux-ref) to avoid cancellation :
+struct cLcAccum
+{
+   int    count;
+   double mean;   // Welford mean and sum of squared differences
+   double m2;
+   double ref;    // first value
+   double sum_ww; // sum of 1/noise^2
+   double sum_w;  // sum of (flux-ref)/noise^2
+   double sum_w2; // sum of (flux-ref)^2/noise^2
+};
+
+// One pass variability statistics : images update per-pixel accumulators (mean/rms, weighted mean and chi2 terms) and
+// t-digest sketch of the flux (approximate median / rms_iqr), memory does not depend on the number of images.
+// Chi2 around the median is calculated from the weighted sums when the median is known (CalcStat).
+class CLcStream : public CLcGrid
+{
+public :
+   CLcStream( int sizeX , int sizeY, int startX, int startY, int endX, int endY, int step, double compression=0 );
+
+   static double m_DefaultCompression; // compression of the per-pixel digests when <=0 is given
+
+   // upper limit of memory per pixel (accumulators, digest and statistics) in bytes :
+   static long GetMaxBytesPerPixel( double compression=0 );
+
+   virtual int AddImage( CBgFits& fits, CBgFits* pRmsFits, double uxtime );
+   void Add( long pos, double flux, double stddev_noise );
+   inline int GetEpochsCount() const { return m_Epochs; }
+   // unix time of the first and the last image , false if no images were added :
+   bool GetTimeRange( double& start_uxtime, double& end_uxtime ) const;
+
+   using CLcGrid::CalcStat;
+   virtual void CalcStat( long pos_start, long pos_end );
+
+protected :
+   int                m_Epochs;
+   double             m_StartUnixTime;
+   double             m_EndUnixTime;
+   vector<cLcAccum>   m_Accum;   // [pixel]
+   vector<CBgTDigest> m_Digests; // [pixel]
 };
 
-#endif
\ No newline at end of file
+#endif
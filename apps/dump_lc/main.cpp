@@ -4,9 +4,12 @@
 #include <stdlib.h>
 #include <string>
 #include <math.h>
+#include <getopt.h>
 
 #include <bg_globals.h>
 #include "bg_fits.h"
+#include "bg_fits_prefetch.h"
+#include "bg_quantile.h"
 #include <mystring.h>
 #include <myfile.h>
 
@@ -22,6 +25,7 @@ string gOutDir="lc/";
 double gMaxRMSOnSingle  = 4.00; // maximum allowed RMS on 
 
 bool gIgnoreMissingFITS = false;
+int gIOThreads = 2; // number of threads reading FITS files ahead of the processing loop
 
 // WINDOW :
 bool gUseBorder = false;
@@ -31,9 +35,18 @@ int gBorderEndX=-1;
 int gBorderEndY=-1;
 int gCenterRadius = -1;
 bool gCalcRMSAroundPixel = false;
+int gDecimation = 1;        // lightcurves of every gDecimation-th pixel in both axes
+bool gReadWindowOnly = true; // only the window (and the aperture for image statistics) is read from FITS files
 
 // 
 bool gFast=true; // use in-memory version
+bool gStreaming=false; // one pass statistics (memory does not depend on number of images), lightcurves of selected pixels in the second pass
+bool gLcCuts=false;    // -i or -x specified
+double gMemBudgetMB=0; // >0 -> window processed in tiles so that lightcurves of a tile fit in this memory (in MB)
+
+// OUTPUT :
+bool gSaveTextLC = false; // text files of variable pixels in addition to the lightcurve cube (lc_cube.fits)
+string gExportCube;       // only export text lightcurves from this cube (FITS list is not processed)
 
 void usage()
 {
@@ -44,21 +57,36 @@ void usage()
    printf("\t-w (x_start,y_start)-(x_end,y_end) - do dump dynamic spectra of all pixels in this window\n");
    printf("\t-r MAX_RMS on image [default %.4f]\n",gMaxRMSOnSingle);
    printf("\t-s : slow (old legacy) version for comparisons\n");
+   printf("\t-S : streaming mode - statistics maps from one pass over the images (per-pixel accumulators and t-digest median, memory does not depend on number of images),\n");
+   printf("\t     lightcurves of pixels passing -i / -x cuts are read in the second pass and saved to OUTDIR/lc_cube.fits (and text files with -T)\n");
+   printf("\t-B / --mem-budget MB : process the window in tiles with lightcurves (or streaming accumulators with -S) of at most MB megabytes in memory, each tile is read from FITS files\n");
+   printf("\t     and saved to OUTDIR/tile_XXXXX_YYYYY/ (lc_cube.fits, not with -S), finished tiles are skipped when restarted with the same parameters [default %.1f - no tiles]\n",gMemBudgetMB);
    printf("\t-o OUTDIR : name of output directory [default %s]\n",gOutDir.c_str());
    printf("\t-i MIN_MODULATION_INDEX : minimu modulation index to save lightcurve [default %.4f]\n",CLcTable::m_MinModulationIndex);
    printf("\t-x MIN_CHI2 : minimum value of Chi2 [default %.4f]\n",CLcTable::m_MinChi2);
    printf("\t-m : use median and rms_iqr to calculate Chi2 and modulation index as in Martin Bell et al. (2016) eq. 1,2,3 (this is default)\n");
    printf("\t-M : use mean and normal rms (not median/rms_iqr) to calculate Chi2 and modulation index as in Martin Bell et al. (2016) eq. 1,2,3\n");
    printf("\t-I : ignore missing FITS files [default %d]\n",gIgnoreMissingFITS);
+   printf("\t-t N_IO_THREADS : number of threads reading FITS files in parallel with processing [default %d]\n",gIOThreads);
+   printf("\t-p N_THREADS : number of threads calculating statistics of lightcurves (0 - number of CPUs) [default %d]\n",CLcTable::m_StatThreads);
+   printf("\t-d STEP : save lightcurves of every STEP-th pixel in the window (decimation in both axes, other pixels are read only for image checks -r) [default %d]\n",gDecimation);
+   printf("\t-q COMPRESSION : median and rms_iqr of lightcurves and images from t-digest sketches of given compression (approximate, single pass) [default exact]\n");
+   printf("\t-T : save lightcurves of variable pixels also as text files pixel_XXXXX_YYYYY.txt (all lightcurves are saved to OUTDIR/lc_cube.fits)\n");
+   printf("\t-E LC_CUBE_FITS : export text lightcurves of variable pixels from previously saved lightcurve cube (FITS list is not read)\n");
+   printf("\t-F : read full FITS images even when the window is specified (by default only pixels in the window are read)\n");
    
    exit(0);
 }
 
 void parse_cmdline(int argc, char * argv[]) {
-   char optstring[] = "hr:w:so:i:x:mMI";
+   char optstring[] = "hr:w:so:i:x:mMIt:d:Fq:TE:p:SB:";
+   static struct option long_options[] = {
+      { "mem-budget", required_argument, NULL, 'B' },
+      { NULL, 0, NULL, 0 }
+   };
    int opt;
         
-   while ((opt = getopt(argc, argv, optstring)) != -1) {
+   while ((opt = getopt_long(argc, argv, optstring, long_options, NULL)) != -1) {
 //      printf("opt = %c (%s)\n",opt,optarg);   
       switch (opt) {
          case 'h':
@@ -66,20 +94,71 @@ void parse_cmdline(int argc, char * argv[]) {
             break;
 
          case 'I' :
+            gIgnoreMissingFITS = true;
+            break;
+
+         case 't' :
+            if( optarg ){
+               gIOThreads = atol( optarg );
+            }
+            break;
+
+         case 'p' :
+            if( optarg ){
+               CLcTable::m_StatThreads = atol( optarg );
+            }
+            break;
+
+         case 'd' :
+            if( optarg ){
+               gDecimation = atol( optarg );
+               if( gDecimation < 1 ){
+                  gDecimation = 1;
+               }
+            }
+            break;
+
+         case 'F' :
+            gReadWindowOnly = false;
+            break;
+
+         case 'T' :
+            gSaveTextLC = true;
+            break;
+
+         case 'E' :
+            if( optarg ){
+               gExportCube = optarg;
+            }
+            break;
+
+         case 'q' :
             if( optarg ){
-               gIgnoreMissingFITS = true;
+               CBgTDigest::m_DefaultCompression = atof( optarg );
+               gBGApproxQuantiles = 1;
             }
             break;
             
          case 'i' :
             if( optarg ){
                CLcTable::m_MinModulationIndex = atof( optarg );
+               gLcCuts = true;
             }
             break;
 
          case 's' :
             gFast = false;
             break;
+
+         case 'S' :
+            gStreaming = true;
+            break;
+
+         case 'B' :
+            if( optarg ){
+               gMemBudgetMB = atof( optarg );
+            }
+            break;
             
          case 'r' :
             gMaxRMSOnSingle = atof( optarg );
@@ -105,6 +184,7 @@ void parse_cmdline(int argc, char * argv[]) {
          case 'x' :
             if( optarg ){
                CLcTable::m_MinChi2 = atof( optarg );
+               gLcCuts = true;
             }
             break; 
 
@@ -127,56 +207,156 @@ void parse_cmdline(int argc, char * argv[]) {
    }
 }
 
-bool generate_lc_in_memory( vector<string>& fits_list )
+// image size from the header of the first FITS file , window is the whole image when not specified :
+bool init_lc_window( vector<string>& fits_list, int& sizeX, int& sizeY )
 {
    if( fits_list.size() <= 0 ){
       printf("ERROR : no FITS files provided for the lightcurve generation\n");
       return false;
    }
 
+   // header is enough to get the image size :
    CBgFits first_fits;
-   if( first_fits.ReadFits( fits_list[0].c_str() ) ){
+   if( first_fits.ReadFits( fits_list[0].c_str(), 0, 0 ) ){
       printf("ERROR : could not read the first FITS file %s\n",fits_list[0].c_str());
       return false;
    }
+   sizeX = first_fits.GetXSize();
+   sizeY = first_fits.GetYSize();
    
-   CLcTable lc_table( first_fits.GetXSize(), first_fits.GetYSize() );
-   // lc_table.Alloc( first_fits.GetXSize(), first_fits.GetYSize() );
+   if( gBorderEndX <= 0 ){
+      gBorderEndX = sizeX;
+   }
+   if( gBorderEndY <= 0 ){
+      gBorderEndY = sizeY;
+   }
+
+   return true;
+}
 
-  CBgFits fits, rms_fits;   
+// image statistics (around the center or in the window) , returns false if the image should be skipped :
+bool check_lc_image( CBgFits& fits, const char* fits_file )
+{
+   // check image :
+   double mean, rms, minval, maxval;
+   double mean_center, rms_center, minval_center, maxval_center, median_center, iqr_center, rms_iqr_center;
+   
+   if( gCenterRadius > 0 ){
+//        printf("DEBUG : checking stat in radius %d pixels around center\n",gCenterRadius);
+//        fits.GetStatRadius( mean, rms, minval, maxval, gCenterRadius );
+      // window coordinates -> pixels in the image read (the same when full image is read) :
+      int cnt_center = 0;
+      fits.GetStatRadiusAll( mean_center, rms_center, minval_center, maxval_center, median_center, iqr_center, rms_iqr_center, cnt_center, gCenterRadius/fits.GetRoiStep(), true, fits.RoiX(gBorderStartX), fits.RoiY(gBorderStartY) );
+      printf("%s : at CENTER mean stat = %.8f, rms = %.8f, min_val = %.8f, max_val = %.8f , median = %.8f, rms_iqr = %.8f\n",fits_file,mean_center, rms_center, minval_center, maxval_center, median_center, rms_iqr_center );
+   }else{
+      if( gBorderStartX>0 && gBorderStartY>0 && gBorderEndX>0 && gBorderEndY>0 && gUseBorder ){
+         printf("DEBUG : Checking stat in the window (%d,%d) - (%d,%d)\n",gBorderStartX,gBorderStartY,gBorderEndX,gBorderEndY );
+         fits.GetStat( mean, rms, minval, maxval, fits.RoiX(gBorderStartX), fits.RoiY(gBorderStartY), fits.RoiX(gBorderEndX), fits.RoiY(gBorderEndY) );
+
+         // setting the other variables to just use the center ones, 
+         // in the future I may want to impose a criteria on both            
+      }else{
+         fits.GetStatBorder( mean, rms, minval, maxval, 5 );
+      }
+      
+      mean_center = mean;
+      rms_center  = rms;
+      minval_center = minval;
+      maxval_center = maxval;
+      median_center = mean;
+      rms_iqr_center = rms;
+      iqr_center    = rms*1.35;
+   }
+   
+   if( rms_iqr_center > gMaxRMSOnSingle ){
+      printf("WARNING : image %s skipped due to RMS_IQR = %.4f > limit = %.4f\n",fits_file,rms_iqr_center,gMaxRMSOnSingle);
+      return false;
+   }
+
+   return true;
+}
+
+// FITS files (and rms_ files when they exist) are read from the list, images passing the checks are added to lc_grid 
+// (names of these files are added to accepted_list when given). Files already accepted are read without the checks 
+// (bCheckImages=false) : 
+bool process_lc_images( vector<string>& fits_list, CLcGrid& lc_grid, vector<string>* accepted_list=NULL, bool bCheckImages=true )
+{
+  // names of RMS files (empty when not expected or not existing) :
+  vector<string> rms_list( fits_list.size() );
   for(int i=0;i<fits_list.size();i++){
-     // CBgFits fits; // if not here field dtime_fs needs to be set to -1 as otherwise it will be the same for all the FITS files 
-     // WARNING : if this is here I think there seem to be some memory leak !!!
-     fits.dtime_fs = -1000;
-     
-     char rms_fits_file[1024];     
-     bool bRMSFileFound=false;
      if( strncmp( fits_list[i].c_str(), "mean_", 5 ) == 0 ){
+        char rms_fits_file[1024];     
         sprintf(rms_fits_file, "rms_%s", fits_list[i].c_str()+5 );
         printf("INFO : trying to read RMS FITS file %s\n",rms_fits_file);
         
         if( MyFile::DoesFileExist( rms_fits_file ) ){
-           printf("INFO : reading RMS FITS file %s\n",rms_fits_file);
-           if( rms_fits.ReadFits( rms_fits_file , 0, 1, 1 ) ){
-              if( gIgnoreMissingFITS ){
-                 printf("WARNING : could not read RMS FITS file %s on the list, -i option means that it is ignored -> FITS file skipped\n",rms_fits_file);
-                 continue;
-              }else{
-                 printf("ERROR : could not read RMS FITS file %s on the list\n",rms_fits_file);
-                 exit(-1); 
-              }
-           }else{
-              bRMSFileFound=true;
-              printf("INFO : rms file %s read OK\n",rms_fits_file);
-           }
+           rms_list[i] = rms_fits_file;
         }
      }else{
         printf("WARNING : FITS file name not in expected format mean_*.fits -> do not know what is the name of RMS file\n");
      }
+  }
+
+  // images and RMS maps are read by separate threads while the previous ones are processed :
+  CBgFitsPrefetcher prefetcher( fits_list, gIOThreads, 2*gIOThreads );
+  CBgFitsPrefetcher rms_prefetcher( rms_list, gIOThreads, 2*gIOThreads );
+  
+  // only the window is read when image statistics do not need the rest of the image (see below) , without image checks
+  // only pixels of lc_grid are needed :
+  int grid_start_x, grid_start_y, grid_end_x, grid_end_y;
+  if( gReadWindowOnly && !bCheckImages && lc_grid.GetBoundingBox( grid_start_x, grid_start_y, grid_end_x, grid_end_y ) ){
+     printf("INFO : reading only pixels (%d,%d) - (%d,%d) with step %d from FITS files\n",grid_start_x,grid_start_y,grid_end_x,grid_end_y,gDecimation);
+     prefetcher.SetROI( grid_start_x, grid_start_y, grid_end_x, grid_end_y, gDecimation );
+     rms_prefetcher.SetROI( grid_start_x, grid_start_y, grid_end_x, grid_end_y, gDecimation );
+  }else if( gReadWindowOnly && gUseBorder && ( gCenterRadius > 0 || (gBorderStartX>0 && gBorderStartY>0 && gBorderEndX>0 && gBorderEndY>0) ) ){
+     // all pixels of the window (and of the aperture) are needed for image statistics , only the lightcurve grid is decimated :
+     int roi_start_x = gBorderStartX, roi_start_y = gBorderStartY, roi_end_x = gBorderEndX, roi_end_y = gBorderEndY;
+     if( gCenterRadius > 0 ){
+        // aperture around (gBorderStartX,gBorderStartY) :
+        roi_start_x = max( 0, min( roi_start_x, gBorderStartX - gCenterRadius ) );
+        roi_start_y = max( 0, min( roi_start_y, gBorderStartY - gCenterRadius ) );
+        roi_end_x = max( roi_end_x, gBorderStartX + gCenterRadius );
+        roi_end_y = max( roi_end_y, gBorderStartY + gCenterRadius );
+     }
+     printf("INFO : reading only window (%d,%d) - (%d,%d) from FITS files\n",roi_start_x,roi_start_y,roi_end_x,roi_end_y);
+     prefetcher.SetROI( roi_start_x, roi_start_y, roi_end_x, roi_end_y, 1 );
+     rms_prefetcher.SetROI( roi_start_x, roi_start_y, roi_end_x, roi_end_y, 1 );
+  }
+  prefetcher.Start();
+  rms_prefetcher.Start();
+  while( true ){
+     int i = -1, read_status = 0;
+     int rms_i = -1, rms_read_status = 0;
+     CBgFits* pFits = prefetcher.Next( i, read_status );
+     CBgFits* pRmsFits = rms_prefetcher.Next( rms_i, rms_read_status );
+     if( i < 0 ){
+        break;
+     }
      
-     if( fits.ReadFits( fits_list[i].c_str() , 0, 1, 1 ) ){
+     bool bRMSFileFound=false;
+     if( pRmsFits ){
+        printf("INFO : reading RMS FITS file %s\n",rms_list[i].c_str());
+        if( rms_read_status ){
+           if( gIgnoreMissingFITS ){
+              printf("WARNING : could not read RMS FITS file %s on the list, -i option means that it is ignored -> FITS file skipped\n",rms_list[i].c_str());
+              prefetcher.Release( pFits );
+              rms_prefetcher.Release( pRmsFits );
+              continue;
+           }else{
+              printf("ERROR : could not read RMS FITS file %s on the list\n",rms_list[i].c_str());
+              exit(-1); 
+           }
+        }else{
+           bRMSFileFound=true;
+           printf("INFO : rms file %s read OK\n",rms_list[i].c_str());
+        }
+     }
+     
+     if( !pFits || read_status ){
         if( gIgnoreMissingFITS ){
            printf("WARNING : could not read fits file %s on the list, -i option means that it is ignored -> FITS file skipped\n",fits_list[i].c_str());
+           prefetcher.Release( pFits );
+           rms_prefetcher.Release( pRmsFits );
            continue;
         }else{
            printf("ERROR : could not read fits file %s on the list\n",fits_list[i].c_str());
@@ -185,6 +365,7 @@ bool generate_lc_in_memory( vector<string>& fits_list )
      }else{
         printf("OK : fits file %s read ok\n",fits_list[i].c_str());
      }
+     CBgFits& fits = (*pFits);
      if( gBorderEndX <= 0 ){
         gBorderEndX = fits.GetXSize();
      }
@@ -194,63 +375,315 @@ bool generate_lc_in_memory( vector<string>& fits_list )
      double uxtime = fits.GetUnixTime();
      printf("DEBUG_UXTIME : %s -> %.4f\n",fits_list[i].c_str() , uxtime );
      
-     // check image :
-     double mean, rms, minval, maxval;
-     double mean_center, rms_center, minval_center, maxval_center, median_center, iqr_center, rms_iqr_center;
-     
-     if( gCenterRadius > 0 ){
-//        printf("DEBUG : checking stat in radius %d pixels around center\n",gCenterRadius);
-//        fits.GetStatRadius( mean, rms, minval, maxval, gCenterRadius );
-        fits.GetStatRadiusAll( mean_center, rms_center, minval_center, maxval_center, median_center, iqr_center, rms_iqr_center, gCenterRadius, true, gBorderStartX, gBorderStartY );
-        printf("%s : at CENTER mean stat = %.8f, rms = %.8f, min_val = %.8f, max_val = %.8f , median = %.8f, rms_iqr = %.8f\n",fits_list[i].c_str(),mean_center, rms_center, minval_center, maxval_center, median_center, rms_iqr_center );
-     }else{
-        if( gBorderStartX>0 && gBorderStartY>0 && gBorderEndX>0 && gBorderEndY>0 && gUseBorder ){
-           printf("DEBUG : Checking stat in the window (%d,%d) - (%d,%d)\n",gBorderStartX,gBorderStartY,gBorderEndX,gBorderEndY );
-           fits.GetStat( mean, rms, minval, maxval, gBorderStartX, gBorderStartY, gBorderEndX, gBorderEndY );
-
-           // setting the other variables to just use the center ones, 
-           // in the future I may want to impose a criteria on both            
-        }else{
-           fits.GetStatBorder( mean, rms, minval, maxval, 5 );
-        }
-        
-        mean_center = mean;
-        rms_center  = rms;
-        minval_center = minval;
-        maxval_center = maxval;
-        median_center = mean;
-        rms_iqr_center = rms;
-        iqr_center    = rms*1.35;
-     }
-     
-     if( rms_iqr_center > gMaxRMSOnSingle ){
-        printf("WARNING : image %s skipped due to RMS_IQR = %.4f > limit = %.4f\n",fits_list[i].c_str(),rms_iqr_center,gMaxRMSOnSingle);
+     if( bCheckImages && !check_lc_image( fits, fits_list[i].c_str() ) ){
+        prefetcher.Release( pFits );
+        rms_prefetcher.Release( pRmsFits );
         continue;
      }
 
-     // only dump pixels in a specified Window :
-     for(int y=gBorderStartY;y<gBorderEndY;y++){
-        for(int x=gBorderStartX;x<gBorderEndX;x++){
-           double value = fits.getXY(x,y);
-           double stddev_noise = 1.00;
-           if( bRMSFileFound ){
-              stddev_noise = rms_fits.getXY(x,y);
-              // printf("DEBUG : stddev_noise = %.8f",stddev_noise);
-           }
-           
-           lc_table.setXY(x,y,uxtime,value,stddev_noise);                              
-        }
+     // only pixels in a specified Window (getXY uses coordinates of the full image also when only the window was read) :
+     lc_grid.AddImage( fits, ( bRMSFileFound ? pRmsFits : NULL ), uxtime );
+     if( accepted_list ){
+        accepted_list->push_back( fits_list[i] );
      }
+     
+     prefetcher.Release( pFits );
+     rms_prefetcher.Release( pRmsFits );
    }
 
+   return true;
+}
+
+bool generate_lc_in_memory( vector<string>& fits_list )
+{
+   int sizeX = 0, sizeY = 0;
+   if( !init_lc_window( fits_list, sizeX, sizeY ) ){
+      return false;
+   }
+
+   // lightcurves of the window pixels for all the FITS files on the list allocated at once :
+   CLcTable lc_table( sizeX, sizeY, gBorderStartX, gBorderStartY, gBorderEndX, gBorderEndY, gDecimation, fits_list.size() );
+   process_lc_images( fits_list, lc_table );
+
    // save lightcurves :
    printf("DEBUG : saving lightcurves in window (%d,%d) - (%d,%d)\n",gBorderStartX, gBorderStartY, gBorderEndX, gBorderEndY );
-   lc_table.SaveLC( gOutDir.c_str(), gBorderStartX, gBorderStartY, gBorderEndX, gBorderEndY );   
+   lc_table.SaveLC( gOutDir.c_str(), true, gSaveTextLC );   
    printf("DEBUG : end of generate_lc_in_memory\n");fflush(stdout);
    
    return true;
 }
 
+// hash of the file names on a list (FNV-1a) , identifies the list of FITS files a result was produced from :
+string lc_list_hash( const vector<string>& fits_list )
+{
+   unsigned long long hash = 14695981039346656037ULL;
+   for(int i=0;i<fits_list.size();i++){
+      const char* name = fits_list[i].c_str();
+      for(int k=0;k<=(int)fits_list[i].length();k++){ // terminating 0 separates the names
+         hash ^= (unsigned char)name[k];
+         hash *= 1099511628211ULL;
+      }
+   }
+
+   char szHash[64];
+   sprintf(szHash,"%d:%016llx",(int)fits_list.size(),hash);
+   return szHash;
+}
+
+// parameters the tiles depend on (saved in gOutDir/tiles_params.txt and tile.done files) , results of a previous run are
+// only re-used when they are the same :
+string lc_tiles_params( const vector<string>& fits_list )
+{
+   char szParams[2048];
+   sprintf(szParams,"window=(%d,%d)-(%d,%d) step=%d mem_budget=%.3f max_rms=%.8f radius=%d read_window=%d median=%d approx=%d compression=%.3f list=%s files=%s",
+           gBorderStartX,gBorderStartY,gBorderEndX,gBorderEndY,gDecimation,gMemBudgetMB,gMaxRMSOnSingle,gCenterRadius,gReadWindowOnly,
+           CLcTable::m_bUseMedian,gBGApproxQuantiles,CBgTDigest::m_DefaultCompression,list.c_str(),lc_list_hash( fits_list ).c_str());
+
+   return szParams;
+}
+
+// lines of a text file start with the given lines (params and optionally more) :
+bool lc_check_params_file( const char* file, const string& params, const string& params2="" )
+{
+   if( !MyFile::DoesFileExist( file ) ){
+      return false;
+   }
+   vector<string> lines;
+   bg_read_list( file, lines );
+
+   if( lines.size() < 1 || lines[0] != params ){
+      return false;
+   }
+   if( params2.length() && ( lines.size() < 2 || lines[1] != params2 ) ){
+      return false;
+   }
+
+   return true;
+}
+
+// tiles of the window grid (tile_cols x tile_rows pixels) so that bytes_per_pixel of all pixels of a tile fit in gMemBudgetMB,
+// returns false when the whole window fits (single tile) :
+bool lc_tiles( double bytes_per_pixel, long& tile_cols, long& tile_rows, int& n_tiles_x, int& n_tiles_y )
+{
+   long grid_x = (gBorderEndX - gBorderStartX + gDecimation - 1)/gDecimation;
+   long grid_y = (gBorderEndY - gBorderStartY + gDecimation - 1)/gDecimation;
+   tile_cols = grid_x;
+   tile_rows = grid_y;
+   n_tiles_x = 1;
+   n_tiles_y = 1;
+   long tile_pixels = (long)( (gMemBudgetMB*1024.00*1024.00) / bytes_per_pixel );
+   if( tile_pixels >= grid_x*grid_y ){
+      printf("INFO : the whole window fits in memory budget %.1f MB -> no tiles\n",gMemBudgetMB);
+      return false;
+   }
+   if( tile_pixels < 1 ){
+      tile_pixels = 1;
+   }
+   tile_cols = min( grid_x, tile_pixels );
+   tile_rows = max( 1L, min( grid_y, tile_pixels/tile_cols ) );
+   n_tiles_x = (grid_x + tile_cols - 1)/tile_cols;
+   n_tiles_y = (grid_y + tile_rows - 1)/tile_rows;
+   printf("INFO : window (%d,%d) - (%d,%d) processed in %d x %d tiles of %ld x %ld pixels (memory budget %.1f MB)\n",gBorderStartX,gBorderStartY,gBorderEndX,gBorderEndY,n_tiles_x,n_tiles_y,tile_cols,tile_rows,gMemBudgetMB);
+
+   return true;
+}
+
+// window split into tiles of pixels whose lightcurves fit in gMemBudgetMB , every tile is read from the FITS files (only its pixels)
+// and saved to gOutDir/tile_XXXXX_YYYYY/ , tile.done marks finished tiles which are not processed again after restart with the same
+// parameters (only their statistics are read).
+// Images are checked (check_lc_image) only for the first tile and the list of accepted files is saved to gOutDir/accepted_fits_list.txt :
+bool generate_lc_tiled( vector<string>& fits_list )
+{
+   int sizeX = 0, sizeY = 0;
+   if( !init_lc_window( fits_list, sizeX, sizeY ) ){
+      return false;
+   }
+
+   double bytes_per_pixel = 2.00*sizeof(float)*fits_list.size() + sizeof(cLcStat);
+   long tile_cols, tile_rows;
+   int n_tiles_x, n_tiles_y;
+   if( !lc_tiles( bytes_per_pixel, tile_cols, tile_rows, n_tiles_x, n_tiles_y ) ){
+      return generate_lc_in_memory( fits_list );
+   }
+
+   // results of a previous run are used only if it was started with the same parameters :
+   MyFile::CreateDir( gOutDir.c_str() );
+   string params = lc_tiles_params( fits_list );
+   string params_file = gOutDir + "/tiles_params.txt";
+   string accepted_file = gOutDir + "/accepted_fits_list.txt";
+   bool bRestart = lc_check_params_file( params_file.c_str(), params );
+   if( !bRestart ){
+      if( MyFile::DoesFileExist( params_file.c_str() ) ){
+         printf("WARNING : results in %s were produced with different parameters -> all tiles are processed again\n",gOutDir.c_str());
+      }
+      MyFile::Delete( accepted_file.c_str() );
+      MyOFile params_f( params_file.c_str(), "w" );
+      params_f.Printf("%s\n",params.c_str());
+      params_f.Close();
+   }
+
+   // files accepted when the first tile was processed (also in a previous run) , tile.done files keep hash of this list :
+   vector<string> accepted_list;
+   string accepted_hash;
+   bool bAccepted = false;
+   if( bRestart && MyFile::DoesFileExist( accepted_file.c_str() ) ){
+      bg_read_list( accepted_file.c_str(), accepted_list );
+      accepted_hash = "accepted=" + lc_list_hash( accepted_list );
+      bAccepted = true;
+      printf("INFO : %d accepted FITS files read from %s (restart)\n",(int)accepted_list.size(),accepted_file.c_str());
+   }
+
+   CBgFits rms_map( sizeX, sizeY ), modidx_map( sizeX, sizeY ), chi2_map( sizeX, sizeY );
+   for(int ty=0;ty<n_tiles_y;ty++){
+      for(int tx=0;tx<n_tiles_x;tx++){
+         int start_x = gBorderStartX + tx*tile_cols*gDecimation;
+         int start_y = gBorderStartY + ty*tile_rows*gDecimation;
+         int end_x = min( (long)gBorderEndX, start_x + tile_cols*gDecimation );
+         int end_y = min( (long)gBorderEndY, start_y + tile_rows*gDecimation );
+
+         char szTileDir[1024],szTileFile[1024],szDoneFile[1024];
+         sprintf(szTileDir,"%s/tile_%05d_%05d",gOutDir.c_str(),start_x,start_y);
+         sprintf(szTileFile,"%s/lc_cube.fits",szTileDir);
+         sprintf(szDoneFile,"%s/tile.done",szTileDir);
+         printf("INFO : tile (%d,%d) - (%d,%d) -> %s\n",start_x,start_y,end_x,end_y,szTileDir);
+
+         // statistics of a tile finished with the same parameters (cube has to cover the tile and all accepted images) :
+         CLcTable lc_table;
+         if( bAccepted && lc_check_params_file( szDoneFile, params, accepted_hash ) && lc_table.ReadCube( szTileFile, true ) == 0 ){
+            int tile_grid_x = (end_x - start_x + gDecimation - 1)/gDecimation;
+            int tile_grid_y = (end_y - start_y + gDecimation - 1)/gDecimation;
+            if( !lc_table.IsPixelList() && lc_table.GetStartX() == start_x && lc_table.GetStartY() == start_y && lc_table.GetStep() == gDecimation 
+                && lc_table.GetGridX() == tile_grid_x && lc_table.GetGridY() == tile_grid_y && lc_table.GetEpochsCount() == (int)accepted_list.size() ){
+               printf("INFO : tile %s already processed -> skipped\n",szTileDir);
+               lc_table.FillMaps( rms_map, modidx_map, chi2_map );
+               continue;
+            }
+            printf("WARNING : lightcurve cube %s does not match the tile (%d,%d) - (%d,%d) or %d accepted images -> tile processed again\n",szTileFile,start_x,start_y,end_x,end_y,(int)accepted_list.size());
+         }
+
+         if( bAccepted ){
+            lc_table.Alloc( sizeX, sizeY, start_x, start_y, end_x, end_y, gDecimation, accepted_list.size() );
+            process_lc_images( accepted_list, lc_table, NULL, false );
+         }else{
+            lc_table.Alloc( sizeX, sizeY, start_x, start_y, end_x, end_y, gDecimation, fits_list.size() );
+            process_lc_images( fits_list, lc_table, &accepted_list, true );
+
+            MyOFile out_f( accepted_file.c_str(), "w" );
+            for(int i=0;i<accepted_list.size();i++){
+               out_f.Printf("%s\n",accepted_list[i].c_str());
+            }
+            out_f.Close();
+            accepted_hash = "accepted=" + lc_list_hash( accepted_list );
+            bAccepted = true;
+         }
+
+         lc_table.CalcStat();
+         MyFile::CreateDir( szTileDir );
+         if( gSaveTextLC ){
+            lc_table.SaveTextLC( szTileDir );
+         }
+         MyFile::Delete( szDoneFile );
+         if( lc_table.WriteCube( szTileFile ) == 0 ){
+            MyOFile done_f( szDoneFile, "w" );
+            done_f.Printf("%s\n",params.c_str());
+            done_f.Printf("%s\n",accepted_hash.c_str());
+            done_f.Printf("%d epochs\n",lc_table.GetEpochsCount());
+         }
+         lc_table.FillMaps( rms_map, modidx_map, chi2_map );
+      }
+   }
+
+   CLcGrid::WriteMaps( gOutDir.c_str(), rms_map, modidx_map, chi2_map );
+
+   return true;
+}
+
+// one pass over the FITS files with per-pixel accumulators, full lightcurves of pixels passing -i / -x cuts are read
+// in the second pass (only from the files accepted in the first pass). When accumulators of the window do not fit in 
+// gMemBudgetMB the window is processed in tiles (images are checked in the first tile, the others use the accepted files) :
+bool generate_lc_streaming( vector<string>& fits_list )
+{
+   int sizeX = 0, sizeY = 0;
+   if( !init_lc_window( fits_list, sizeX, sizeY ) ){
+      return false;
+   }
+
+   double compression = bg_approx_compression( BG_APPROX_DEFAULT );
+   long tile_cols = 0, tile_rows = 0;
+   int n_tiles_x = 1, n_tiles_y = 1;
+   if( gMemBudgetMB > 0 ){
+      lc_tiles( CLcStream::GetMaxBytesPerPixel( compression ), tile_cols, tile_rows, n_tiles_x, n_tiles_y );
+   }
+
+   CBgFits rms_map( sizeX, sizeY ), modidx_map( sizeX, sizeY ), chi2_map( sizeX, sizeY );
+   vector<string> accepted_list;
+   vector<int> variable_x, variable_y;
+   long n_pixels = 0;
+   int n_epochs = 0;
+   for(int ty=0;ty<n_tiles_y;ty++){
+      for(int tx=0;tx<n_tiles_x;tx++){
+         int start_x = gBorderStartX, start_y = gBorderStartY, end_x = gBorderEndX, end_y = gBorderEndY;
+         if( n_tiles_x > 1 || n_tiles_y > 1 ){
+            start_x = gBorderStartX + tx*tile_cols*gDecimation;
+            start_y = gBorderStartY + ty*tile_rows*gDecimation;
+            end_x = min( (long)gBorderEndX, start_x + tile_cols*gDecimation );
+            end_y = min( (long)gBorderEndY, start_y + tile_rows*gDecimation );
+            printf("INFO : streaming statistics of tile (%d,%d) - (%d,%d)\n",start_x,start_y,end_x,end_y);
+         }
+
+         CLcStream lc_stream( sizeX, sizeY, start_x, start_y, end_x, end_y, gDecimation, compression );
+         if( tx == 0 && ty == 0 ){
+            process_lc_images( fits_list, lc_stream, &accepted_list );
+         }else{
+            process_lc_images( accepted_list, lc_stream, NULL, false );
+         }
+         lc_stream.CalcStat();
+         lc_stream.FillMaps( rms_map, modidx_map, chi2_map );
+
+         vector<int> tile_x, tile_y;
+         lc_stream.GetVariablePixels( tile_x, tile_y );
+         variable_x.insert( variable_x.end(), tile_x.begin(), tile_x.end() );
+         variable_y.insert( variable_y.end(), tile_y.begin(), tile_y.end() );
+         n_pixels += lc_stream.GetPixelsCount();
+         n_epochs = lc_stream.GetEpochsCount();
+
+         double start_uxtime, end_uxtime;
+         if( tx == 0 && ty == 0 && lc_stream.GetTimeRange( start_uxtime, end_uxtime ) ){
+            printf("INFO : %d images accepted in time range %.4f - %.4f ( %.1f sec )\n",n_epochs,start_uxtime,end_uxtime,(end_uxtime-start_uxtime));
+         }
+      }
+   }
+   CLcGrid::WriteMaps( gOutDir.c_str(), rms_map, modidx_map, chi2_map );
+
+   long n_variable = variable_x.size();
+   printf("INFO : %ld pixels out of %ld passed the cuts (modulation index > %.4f , chi2 > %.4f) in %d images\n",n_variable,n_pixels,CLcTable::m_MinModulationIndex,CLcTable::m_MinChi2,n_epochs);
+   if( !gLcCuts ){
+      printf("INFO : no cuts on modulation index or chi2 specified (-i / -x) -> lightcurves are not extracted\n");
+      return true;
+   }
+   if( n_variable <= 0 || accepted_list.size() <= 0 ){
+      return true;
+   }
+
+   // second pass for the selected pixels :
+   CLcTable lc_table;
+   lc_table.AllocPixels( sizeX, sizeY, variable_x, variable_y, accepted_list.size() );
+   process_lc_images( accepted_list, lc_table, NULL, false );
+   lc_table.CalcStat();
+
+   char szOutFits[1024];
+   sprintf(szOutFits,"%s/lc_cube.fits",gOutDir.c_str());
+   lc_table.WriteCube( szOutFits );
+   if( gSaveTextLC ){
+      lc_table.SaveTextLC( gOutDir.c_str(), false );
+   }
+   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+      printf("DEBUG : end of generate_lc_streaming\n");fflush(stdout);
+   }
+
+   return true;
+}
+
 void generate_lc_slow( vector<string>& fits_list )
 {
   for(int i=0;i<fits_list.size();i++){
@@ -283,7 +716,8 @@ void generate_lc_slow( vector<string>& fits_list )
      if( gCenterRadius > 0 ){
 //        printf("DEBUG : checking stat in radius %d pixels around center\n",gCenterRadius);
 //        fits.GetStatRadius( mean, rms, minval, maxval, gCenterRadius );
-        fits.GetStatRadiusAll( mean_center, rms_center, minval_center, maxval_center, median_center, iqr_center, rms_iqr_center, gCenterRadius, true, gBorderStartX, gBorderStartY );
+        int cnt_center = 0;
+        fits.GetStatRadiusAll( mean_center, rms_center, minval_center, maxval_center, median_center, iqr_center, rms_iqr_center, cnt_center, gCenterRadius, true, gBorderStartX, gBorderStartY );
         printf("%s : at CENTER mean stat = %.8f, rms = %.8f, min_val = %.8f, max_val = %.8f , median = %.8f, rms_iqr = %.8f\n",fits_list[i].c_str(),mean_center, rms_center, minval_center, maxval_center, median_center, rms_iqr_center );
      }else{
         if( gBorderStartX>0 && gBorderStartY>0 && gBorderEndX>0 && gBorderEndY>0 && gUseBorder ){
@@ -333,19 +767,40 @@ void print_parameters()
     printf("Min. mod. index  = %.8f\n",CLcTable::m_MinModulationIndex);
     printf("Minimum CHI2     = %.8f\n",CLcTable::m_MinChi2);
     printf("Fast code = %d\n",gFast);
+    printf("Streaming = %d\n",gStreaming);
+    printf("Memory budget = %.1f MB\n",gMemBudgetMB);
     printf("Use median in Eq. 1 and rms_iqr in Eq. 3 in Bell et al. (2016) = %d\n",CLcTable::m_bUseMedian);
+    printf("Ignore missing FITS = %d\n",gIgnoreMissingFITS);
+    printf("I/O threads = %d\n",gIOThreads);
+    printf("Decimation  = %d\n",gDecimation);
+    printf("Statistics threads = %d\n",CLcTable::m_StatThreads);
+    printf("Read window only = %d\n",gReadWindowOnly);
+    printf("Save text lightcurves = %d\n",gSaveTextLC);
+    if( gExportCube.length() ){
+       printf("Export from cube = %s\n",gExportCube.c_str());
+    }
+    printf("Approximate quantiles = %d (t-digest compression = %.2f)\n",gBGApproxQuantiles,CBgTDigest::m_DefaultCompression);
     printf("############################################################################################\n");
 }
 
 int main(int argc,char* argv[])
 {
-  string list="fits_list";
   if( argc >= 2 ){
      list = argv[1];
   }
 
   parse_cmdline( argc , argv );
   print_parameters();
+
+  if( gExportCube.length() ){
+     CLcTable lc_table;
+     if( lc_table.ReadCube( gExportCube.c_str() ) ){
+        printf("ERROR : could not read lightcurve cube %s\n",gExportCube.c_str());
+        exit(-1);
+     }
+     lc_table.SaveTextLC( gOutDir.c_str() );
+     exit(0);
+  }
  
   
   vector<string> fits_list;
@@ -359,7 +814,11 @@ int main(int argc,char* argv[])
   }
   
 
-  if( gFast ){
+  if( gStreaming ){
+     generate_lc_streaming( fits_list );
+  }else if( gFast && gMemBudgetMB > 0 ){
+     generate_lc_tiled( fits_list );
+  }else if( gFast ){
      generate_lc_in_memory( fits_list );
   }else{
      generate_lc_slow( fits_list );
@@ -0,0 +1,141 @@
+// program dumps values of a pixel through all planes of a FITS cube (spectrum or lightcurve along axis 3)
+// or saves a single plane as 2D FITS image, without reading the whole cube into memory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include <bg_globals.h>
+#include <bg_fits.h>
+#include <bg_fits_cube.h>
+#include <myfile.h>
+
+#include <vector>
+using namespace std;
+
+string gCubeFile;
+int gX = -1;
+int gY = -1;
+int gStartPlane = 0;
+int gEndPlane = -1;
+string gOutFile;
+int gPlane = -1;
+string gOutPlaneFits;
+
+void usage()
+{
+   printf("dump_spaxel CUBE.fits X Y [options]\n");
+   printf("\t-s START_PLANE : first plane [default %d]\n",gStartPlane);
+   printf("\t-e END_PLANE : last plane (exclusive) [default all]\n");
+   printf("\t-o OUTFILE : text file for values of the pixel (PLANE VALUE) [default stdout]\n");
+   printf("\t-p PLANE : save plane PLANE to FITS file specified by -P option\n");
+   printf("\t-P OUT_FITS : output FITS file for option -p [default plane_PLANE.fits]\n");
+   exit(0);
+}
+
+void parse_cmdline(int argc, char * argv[]) {
+   char optstring[] = "hs:e:o:p:P:";
+   int opt;
+
+   while ((opt = getopt(argc, argv, optstring)) != -1) {
+      switch (opt) {
+         case 'h':
+            usage();
+            break;
+
+         case 's' :
+            if( optarg ){
+               gStartPlane = atol( optarg );
+            }
+            break;
+
+         case 'e' :
+            if( optarg ){
+               gEndPlane = atol( optarg );
+            }
+            break;
+
+         case 'o' :
+            if( optarg ){
+               gOutFile = optarg;
+            }
+            break;
+
+         case 'p' :
+            if( optarg ){
+               gPlane = atol( optarg );
+            }
+            break;
+
+         case 'P' :
+            if( optarg ){
+               gOutPlaneFits = optarg;
+            }
+            break;
+
+         default:
+            fprintf(stderr,"Unknown option %c\n",opt);
+            usage();
+      }
+   }
+}
+
+int main(int argc,char* argv[])
+{
+  if( argc < 4 || strcmp(argv[1],"-h")==0 ){
+     usage();
+  }
+  gCubeFile = argv[1];
+  gX = atol( argv[2] );
+  gY = atol( argv[3] );
+
+  parse_cmdline( argc-3 , argv+3 );
+  if( gStartPlane < 0 ){
+     gStartPlane = 0;
+  }
+
+  CBgFitsCube cube( gCubeFile.c_str(), 1 );
+  if( cube.Open() ){
+     printf("ERROR : could not open FITS cube %s\n",gCubeFile.c_str());
+     exit(-1);
+  }
+  printf("Cube %s : %d x %d x %d\n",gCubeFile.c_str(),cube.GetXSize(),cube.GetYSize(),cube.GetZSize());
+
+  if( gPlane >= 0 ){
+     CBgFits* pPlane = cube.GetPlane( gPlane );
+     if( !pPlane ){
+        exit(-1);
+     }
+     if( gOutPlaneFits.length() == 0 ){
+        char szOutFits[64];
+        sprintf(szOutFits,"plane_%d.fits",gPlane);
+        gOutPlaneFits = szOutFits;
+     }
+     pPlane->SetKeys( cube.GetHeader().GetKeys() );
+     if( pPlane->WriteFits( gOutPlaneFits.c_str() ) ){
+        printf("ERROR : could not write plane %d to FITS file %s\n",gPlane,gOutPlaneFits.c_str());
+        exit(-1);
+     }
+     printf("Plane %d saved to FITS file %s\n",gPlane,gOutPlaneFits.c_str());
+  }
+
+  if( gX >= 0 && gY >= 0 ){
+     vector<float> values;
+     if( cube.GetSpaxel( gX, gY, values, gStartPlane, gEndPlane ) < 0 ){
+        exit(-1);
+     }
+
+     if( gOutFile.length() > 0 ){
+        MyOFile out_f( gOutFile.c_str(), "w" );
+        for(int z=0;z<values.size();z++){
+           out_f.Printf("%d %.8f\n",gStartPlane+z,values[z]);
+        }
+        printf("Values of pixel (%d,%d) in %d planes saved to %s\n",gX,gY,(int)values.size(),gOutFile.c_str());
+     }else{
+        for(int z=0;z<values.size();z++){
+           printf("%d %.8f\n",gStartPlane+z,values[z]);
+        }
+     }
+  }
+}
@@ -0,0 +1,165 @@
+// program creates/updates binary catalog of header keys (time, integration time, sizes, frequencies) of FITS files on a list
+// and selects files in a time range from the catalog without opening the FITS files again
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include <bg_globals.h>
+#include <bg_fits_catalog.h>
+#include <mystring.h>
+#include <myfile.h>
+
+#include <vector>
+using namespace std;
+
+string gListFile="fits_list";
+string gCatalogFile;
+string gOutList;
+int gThreads = 4;
+double gStartUxTime = 0;
+double gEndUxTime = -1;
+bool gNoScan = false;
+bool gPrintEntries = false;
+
+void usage()
+{
+   printf("fits_catalog FITS_LIST [options]\n");
+   printf("\t-c CATALOG_FILE : name of the catalog file [default FITS_LIST.cat]\n");
+   printf("\t-t N_THREADS : number of threads reading FITS headers [default %d]\n",gThreads);
+   printf("\t-s UXTIME_START : select files with start time >= UXTIME_START\n");
+   printf("\t-e UXTIME_END : select files with start time <= UXTIME_END\n");
+   printf("\t-o OUT_LIST : save list of selected files (sorted by time) to OUT_LIST [default stdout]\n");
+   printf("\t-n : do not scan FITS files on the list (only select from the existing catalog)\n");
+   printf("\t-p : print catalog entries\n");
+   exit(0);
+}
+
+void parse_cmdline(int argc, char * argv[]) {
+   char optstring[] = "hc:t:s:e:o:np";
+   int opt;
+
+   while ((opt = getopt(argc, argv, optstring)) != -1) {
+      switch (opt) {
+         case 'h':
+            usage();
+            break;
+
+         case 'c' :
+            if( optarg ){
+               gCatalogFile = optarg;
+            }
+            break;
+
+         case 't' :
+            if( optarg ){
+               gThreads = atol( optarg );
+            }
+            break;
+
+         case 's' :
+            if( optarg ){
+               gStartUxTime = atof( optarg );
+            }
+            break;
+
+         case 'e' :
+            if( optarg ){
+               gEndUxTime = atof( optarg );
+            }
+            break;
+
+         case 'o' :
+            if( optarg ){
+               gOutList = optarg;
+            }
+            break;
+
+         case 'n' :
+            gNoScan = true;
+            break;
+
+         case 'p' :
+            gPrintEntries = true;
+            break;
+
+         default:
+            fprintf(stderr,"Unknown option %c\n",opt);
+            usage();
+      }
+   }
+}
+
+void print_parameters()
+{
+    printf("############################################################################################\n");
+    printf("PARAMETERS :\n");
+    printf("############################################################################################\n");
+    printf("List file    = %s\n",gListFile.c_str());
+    printf("Catalog file = %s\n",gCatalogFile.c_str());
+    printf("Threads      = %d\n",gThreads);
+    printf("Time range   = %.4f - %.4f\n",gStartUxTime,gEndUxTime);
+    printf("Output list  = %s\n",gOutList.c_str());
+    printf("Scan files   = %d\n",!gNoScan);
+    printf("############################################################################################\n");
+}
+
+int main(int argc,char* argv[])
+{
+  if( argc < 2 || strcmp(argv[1],"-h")==0 ){
+     usage();
+  }
+  gListFile = argv[1];
+
+  // parse command line :
+  parse_cmdline( argc-1 , argv+1 );
+  if( gCatalogFile.length() == 0 ){
+     gCatalogFile = gListFile + ".cat";
+  }
+  print_parameters();
+
+  CBgFitsCatalog catalog( gCatalogFile.c_str() );
+  if( catalog.Read() < 0 ){
+     printf("WARNING : catalog %s could not be read -> will be re-created\n",gCatalogFile.c_str());
+  }
+
+  if( !gNoScan ){
+     vector<string> fits_list;
+     if( bg_read_list( gListFile.c_str(), fits_list ) <= 0 ){
+        printf("ERROR : could not read list file %s\n",gListFile.c_str());
+        exit(-1);
+     }
+
+     int n_read = catalog.Scan( fits_list, gThreads );
+     printf("Read %d headers of %d files on the list\n",n_read,(int)fits_list.size());
+     if( catalog.IsModified() ){
+        if( catalog.Write() ){
+           exit(-1);
+        }
+     }
+  }
+
+  if( gPrintEntries ){
+     printf("# FILE UXTIME INTTIME SIZE_X SIZE_Y START_FREQ STOP_FREQ DELTA_FREQ STATUS\n");
+     for(int i=0;i<catalog.GetEntriesCount();i++){
+        cFitsCatalogEntry& entry = catalog.GetEntry(i);
+        printf("%s %.6f %.6f %d %d %.6f %.6f %.6f %d\n",entry.path.c_str(),entry.GetUnixTime(),entry.inttime,entry.size_x,entry.size_y,entry.start_freq,entry.stop_freq,entry.delta_freq,entry.status);
+     }
+  }
+
+  vector<string> selected;
+  vector<double> times;
+  catalog.Select( gStartUxTime, gEndUxTime, selected, &times );
+  if( gOutList.length() > 0 ){
+     MyOFile out_f( gOutList.c_str(), "w" );
+     for(int i=0;i<selected.size();i++){
+        out_f.Printf("%s\n",selected[i].c_str());
+     }
+     printf("Saved %d files in time range %.4f - %.4f to %s\n",(int)selected.size(),gStartUxTime,gEndUxTime,gOutList.c_str());
+  }else{
+     for(int i=0;i<selected.size();i++){
+        printf("%s %.6f\n",selected[i].c_str(),times[i]);
+     }
+  }
+}
@@ -0,0 +1,88 @@
+// checks of selection based median / IQR (bg_select, bg_median_iqr, bg_median_rms_iqr, CBgQuantile) against sorted tables
+// for random tables with many or few distinct values (duplicates) , returns number of failed checks
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <bg_quantile.h>
+
+using namespace std;
+
+int gFailed=0;
+
+void check( bool ok, const char* name, int iter )
+{
+   if( !ok ){
+      printf("FAILED : %s (iteration %d)\n",name,iter);
+      gFailed++;
+   }
+}
+
+int main()
+{
+   srand( 12345 );
+
+   int iter=0;
+   CBgQuantile quantile; // re-used for all tables (as for channels / pixels)
+   for(int cnt=1;cnt<=2000;cnt=(cnt*3)/2+1){
+      for(int n_distinct=2;n_distinct<=20000;n_distinct*=100){
+         iter++;
+         vector<double> values( cnt );
+         vector<float> values_float( cnt );
+         for(int i=0;i<cnt;i++){
+            values[i] = (rand() % n_distinct) - n_distinct/2;
+            values_float[i] = values[i];
+         }
+         vector<double> sorted( values );
+         sort( sorted.begin(), sorted.end() );
+         double median_ref = sorted[cnt/2];
+         double q25_ref = sorted[(int)(cnt*0.25)];
+         double q75_ref = sorted[(int)(cnt*0.75)];
+
+         vector<double> tab( values );
+         double median, q25, q75;
+         bool ok = bg_median_iqr( tab.data(), cnt, median, q25, q75 );
+         check( ok && median == median_ref && q25 == q25_ref && q75 == q75_ref, "bg_median_iqr", iter );
+
+         tab = values;
+         double rms_iqr;
+         median = bg_median_rms_iqr( tab.data(), cnt, rms_iqr );
+         check( median == median_ref && fabs( rms_iqr - (q75_ref-q25_ref)/1.35 ) < 1e-9, "bg_median_rms_iqr", iter );
+
+         tab = values;
+         check( bg_median( tab.data(), cnt ) == median_ref, "bg_median", iter );
+
+         for(int t=0;t<5;t++){
+            tab = values;
+            long k = rand() % cnt;
+            check( bg_select( tab.data(), cnt, k ) == sorted[k], "bg_select", iter );
+         }
+
+         // input data are not modified by CBgQuantile :
+         vector<float> values_float_copy( values_float );
+         quantile.assign( values_float.data(), cnt );
+         ok = quantile.MedianIQR( median, q25, q75 );
+         check( ok && median == median_ref && q25 == q25_ref && q75 == q75_ref, "CBgQuantile::MedianIQR (float)", iter );
+         quantile.clear();
+         for(int i=0;i<cnt;i++){
+            quantile.push_back( values[i] );
+         }
+         check( quantile.size() == cnt && quantile.Median() == median_ref, "CBgQuantile::Median (push_back)", iter );
+         check( values_float == values_float_copy, "CBgQuantile input not modified", iter );
+      }
+   }
+
+   double dummy;
+   check( !bg_median_iqr( NULL, 0, dummy, dummy, dummy ), "bg_median_iqr of empty table", iter );
+   quantile.clear();
+   check( !quantile.MedianIQR( dummy, dummy, dummy ), "CBgQuantile::MedianIQR of empty table", iter );
+   printf("median / IQR : %d tables checked\n",iter);
+
+   if( gFailed > 0 ){
+      printf("ERROR : %d checks failed\n",gFailed);
+   }else{
+      printf("OK : all checks passed\n");
+   }
+   return gFailed;
+}
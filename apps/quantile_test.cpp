@@ -0,0 +1,222 @@
+// checks of sliding window quantiles (CBgSlidingQuantile) : Select / MedianIQR after random Insert / Erase (duplicates and NaN)
+// against sorted tables and the sliding window of running_median (-D -1/0/+1) against the window collected for every point ,
+// returns number of failed checks
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <bg_quantile.h>
+
+using namespace std;
+
+int gFailed=0;
+
+void check( bool ok, const char* name, int iter )
+{
+   if( !ok ){
+      printf("FAILED : %s (iteration %d)\n",name,iter);
+      gFailed++;
+   }
+}
+
+bool same( double a, double b )
+{
+   return ( a == b || (isnan(a) && isnan(b)) );
+}
+
+// NaN after all other values (as in CBgSlidingQuantile) :
+bool nan_last( double a, double b )
+{
+   if( isnan(a) ){
+      return false;
+   }
+   return ( a < b || isnan(b) );
+}
+
+double random_value( int n_distinct, bool bNaN )
+{
+   if( bNaN && (rand() % 10) == 0 ){
+      return NAN;
+   }
+   // few distinct values -> many duplicates :
+   return (rand() % n_distinct) - n_distinct/2;
+}
+
+void test_sliding_quantile()
+{
+   int iter=0;
+   for(int n_distinct=3;n_distinct<=1000;n_distinct*=10){
+      CBgSlidingQuantile window( 64 );
+      vector<double> values;
+
+      for(int i=0;i<5000;i++){
+         iter++;
+         if( values.size() == 0 || (rand() % 3) != 0 ){
+            double value = random_value( n_distinct, true );
+            window.Insert( value );
+            values.push_back( value );
+         }else{
+            int k = rand() % values.size();
+            check( window.Erase( values[k] ), "CBgSlidingQuantile::Erase of existing value", iter );
+            values[k] = values.back();
+            values.pop_back();
+         }
+
+         vector<double> sorted( values );
+         sort( sorted.begin(), sorted.end(), nan_last );
+         long cnt = sorted.size();
+         check( window.size() == cnt, "CBgSlidingQuantile::size", iter );
+         if( cnt <= 0 ){
+            double median, q25, q75;
+            check( !window.MedianIQR( median, q25, q75 ), "CBgSlidingQuantile::MedianIQR of empty window", iter );
+            continue;
+         }
+
+         for(int t=0;t<5;t++){
+            long k = rand() % cnt;
+            check( same( window.Select(k), sorted[k] ), "CBgSlidingQuantile::Select", iter );
+         }
+         check( same( window.Select(0), sorted[0] ) && same( window.Select(cnt-1), sorted[cnt-1] ), "CBgSlidingQuantile::Select of min/max", iter );
+
+         double median, q25, q75;
+         bool ok = window.MedianIQR( median, q25, q75 );
+         check( ok && same( median, sorted[cnt/2] ) && same( q25, sorted[(int)(cnt*0.25)] ) && same( q75, sorted[(int)(cnt*0.75)] ), "CBgSlidingQuantile::MedianIQR", iter );
+      }
+      // values are integers or NaN :
+      check( !window.Erase( 0.5 ), "CBgSlidingQuantile::Erase of missing value", iter );
+   }
+   printf("CBgSlidingQuantile : %d iterations checked\n",iter);
+}
+
+// window of running_median : median / rms_iqr of the values collected for every point (as before CBgSlidingQuantile) and
+// from the sliding window with insert / erase (as in running_median.cpp) :
+void running_median_brute( const vector<double>& y, int half, int direction, bool bIncludeCentral, vector<double>& median, vector<double>& rms_iqr )
+{
+   int n = y.size();
+   median.assign( n, -1000 );
+   rms_iqr.assign( n, 0 );
+   for(int i=0;i<n;i++){
+      vector<double> values;
+      int start = i-half, end = i+half;
+      bool bCentral = bIncludeCentral;
+      if( direction < 0 ){
+         start = i-2*half-1;
+         end = i;
+         bCentral = ( bIncludeCentral || i==0 );
+      }
+      if( direction > 0 ){
+         start = i;
+         end = i+2*half+1;
+         bCentral = ( bIncludeCentral || i==(n-1) );
+      }
+      for(int k=start;k<=end;k++){
+         if( k>=0 && k<n ){
+            if( k != i || bCentral ){
+               values.push_back( y[k] );
+            }
+         }
+      }
+      if( values.size() > 0 ){
+         median[i] = bg_median_rms_iqr( values.data(), values.size(), rms_iqr[i] );
+      }
+   }
+}
+
+void running_median_sliding( const vector<double>& y, int half, int direction, bool bIncludeCentral, vector<double>& median, vector<double>& rms_iqr )
+{
+   int n = y.size();
+   median.assign( n, -1000 );
+   rms_iqr.assign( n, 0 );
+
+   CBgSlidingQuantile window( 2*half+2 );
+   int win_start=0, win_end=-1;
+   for(int i=0;i<n;i++){
+      int start = i-half, end = i+half;
+      bool bExcludeCentral = !bIncludeCentral;
+      if( direction < 0 ){
+         start = i-2*half-1;
+         end = i;
+         bExcludeCentral = ( !bIncludeCentral && i>0 );
+      }
+      if( direction > 0 ){
+         start = i;
+         end = i+2*half+1;
+         bExcludeCentral = ( !bIncludeCentral && i<(n-1) );
+      }
+      if( start < 0 ){
+         start = 0;
+      }
+      if( end >= n ){
+         end = n-1;
+      }
+
+      while( win_end < end ){
+         win_end++;
+         window.Insert( y[win_end] );
+      }
+      while( win_start < start ){
+         window.Erase( y[win_start] );
+         win_start++;
+      }
+      if( bExcludeCentral ){
+         window.Erase( y[i] );
+      }
+      if( window.size() > 0 ){
+         median[i] = window.MedianRmsIQR( rms_iqr[i] );
+      }
+      if( bExcludeCentral ){
+         window.Insert( y[i] );
+      }
+   }
+}
+
+void test_running_median()
+{
+   int iter=0;
+   int sizes[] = { 1, 2, 5, 50, 1000 };
+   for(int s=0;s<5;s++){
+      int n = sizes[s];
+      vector<double> y( n );
+      for(int i=0;i<n;i++){
+         y[i] = random_value( 20, false ) + ( (i % 2) ? 0.25 : 0 );
+      }
+
+      for(int half=0;half<=20;half+=(half<3 ? 1 : 8)){
+         for(int direction=-1;direction<=1;direction++){
+            for(int central=0;central<=1;central++){
+               iter++;
+               vector<double> median1, rms_iqr1, median2, rms_iqr2;
+               running_median_brute( y, half, direction, central, median1, rms_iqr1 );
+               running_median_sliding( y, half, direction, central, median2, rms_iqr2 );
+
+               bool ok = true;
+               for(int i=0;i<n;i++){
+                  if( median1[i] != median2[i] || fabs(rms_iqr1[i]-rms_iqr2[i]) > 1e-12 ){
+                     printf("\tn = %d , half = %d , -D %d , central = %d : point %d median %.4f != %.4f or rms_iqr %.4f != %.4f\n",n,half,direction,central,i,median1[i],median2[i],rms_iqr1[i],rms_iqr2[i]);
+                     ok = false;
+                     break;
+                  }
+               }
+               check( ok, "running median window", iter );
+            }
+         }
+      }
+   }
+   printf("running median : %d cases checked\n",iter);
+}
+
+int main()
+{
+   srand( 12345 );
+
+   test_sliding_quantile();
+   test_running_median();
+
+   if( gFailed > 0 ){
+      printf("ERROR : %d checks failed\n",gFailed);
+   }else{
+      printf("OK : all checks passed\n");
+   }
+   return gFailed;
+}
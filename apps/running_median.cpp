@@ -5,6 +5,7 @@
 #include <bg_globals.h>
 #include <bg_fits.h>
 #include <bg_array.h>
+#include <bg_quantile.h>
 #include <libnova_interface.h>
 
 #include <vector>
@@ -45,7 +46,7 @@ void usage()
    printf("-n N_HALF_MEDIAN_POINTS : half of number of median points +/- N_HALF_MEDIAN_POINTS around the value [default %d]\n",gHalfMedianPoints);
    printf("-Y Y_COLUMN : y column [default %d]\n",gYCol);
    printf("-R COUNT_IN_RUNNING_RMS : number of values in running RMS [default %d]\n",gRunningRMSCount);
-   printf("-D Median direction : 0 - both before and after, -1 only before, +1 only after\n");
+   printf("-D Median direction : 0 - both before and after, -1 only before, +1 only after (2*N_HALF_MEDIAN_POINTS+1 points)\n");
    exit(-1);
 }
 
@@ -134,11 +135,11 @@ void parse_cmdline(int argc, char * argv[]) {
 
 double calc_running_rms( vector<double>& running_rms )
 {
-   my_sort_float( running_rms, running_rms.size() );
+   // median of a copy, running_rms is a cyclic buffer (current_index) and must keep its order :
+   static CBgQuantile scratch;
+   scratch.assign( running_rms.data(), running_rms.size() );
 
-   double running_rms_value = running_rms[running_rms.size()/2];
-   
-   return running_rms_value;      
+   return scratch.Median();      
 }
 
 double add_running_rms( vector<double>& running_rms, double rms, int& current_index )
@@ -187,39 +188,45 @@ int main(int argc,char* argv[])
   CValueVector txtfile;
   int n = txtfile.read_file( text_file.c_str() , 0, 0, gYCol );
   
+  // window [start,end] around the current point is updated incrementally (values entering / leaving the window),
+  // the central point is removed from the window for the median calculation if not included :
+  CBgSlidingQuantile window( 2*gHalfMedianPoints+2 );
+  int win_start=0, win_end=-1;
   for(int i=0;i<n;i++){
-     vector<double> values;
-
-     if( gMedianDirection == 0 ){     
-        for(int k=(i-gHalfMedianPoints);k<(i+gHalfMedianPoints+1);k++){
-           if( k>=0 && k<n ){
-              if( k != i || gIncludeCentral ){
-                 values.push_back( txtfile[k].y );
-              }
-           }
-        }
-     }else{
-        if( gMedianDirection < 0 ){
-           for(int k=(i-2*gHalfMedianPoints-1);k<=i;k++){
-              if( k>=0 && k<n ){
-                 if( k != i || gIncludeCentral || i==0 ){
-                    values.push_back( txtfile[k].y );
-                 }
-              }
-           }
-        }
+     int start = i-gHalfMedianPoints, end = i+gHalfMedianPoints;
+     bool bExcludeCentral = !gIncludeCentral;
+     if( gMedianDirection < 0 ){
+        start = i-2*gHalfMedianPoints-1;
+        end = i;
+        bExcludeCentral = ( !gIncludeCentral && i>0 );
      }
-     
-     if( values.size() > 0 ){
-        my_sort_float( values, values.size() );
-        int half = values.size()/2;
-     
-        txtfile[i].z = values[half];
-        
-        int q75 = int(values.size()*0.75);
-        int q25 = int(values.size()*0.25);
-        double iqr = values[q75] - values[q25];
-        double rms_iqr = iqr/1.35;
+     if( gMedianDirection > 0 ){
+        start = i;
+        end = i+2*gHalfMedianPoints+1;
+        bExcludeCentral = ( !gIncludeCentral && i<(n-1) );
+     }
+     if( start < 0 ){
+        start = 0;
+     }
+     if( end >= n ){
+        end = n-1;
+     }
+
+     while( win_end < end ){
+        win_end++;
+        window.Insert( txtfile[win_end].y );
+     }
+     while( win_start < start ){
+        window.Erase( txtfile[win_start].y );
+        win_start++;
+     }
+     if( bExcludeCentral ){
+        window.Erase( txtfile[i].y );
+     }
+
+     if( window.size() > 0 ){
+        double rms_iqr;
+        txtfile[i].z = window.MedianRmsIQR( rms_iqr );
         txtfile[i].err = rms_iqr;
         
         // running rms here :
@@ -236,6 +243,10 @@ int main(int argc,char* argv[])
         printf("ERROR : bug in code ???? no values in sorted table ???\n");
         txtfile[i].z = -1000;
      }
+
+     if( bExcludeCentral ){
+        window.Insert( txtfile[i].y );
+     }
   }
 
   MyOFile outf(out_file.c_str(),"w");
@@ -322,8 +333,7 @@ int main(int argc,char* argv[])
      double rms    = sqrt( sum2/txtfiles.size() - median*median );
 
      if( gAvgType == eMedian ){
-        my_sort_float( tmp_buffer, txtfiles.size() );
-        median = tmp_buffer[txtfiles.size()/2];
+        median = bg_median( tmp_buffer, txtfiles.size() );
      }
      
      cValue median_value;
@@ -0,0 +1,101 @@
+// checks of approximate quantiles (CBgTDigest) against sorted tables : exact quantiles of small samples, rank error of large
+// samples (also of digests merged from parts) and fallback of the approx parameter (bg_approx_compression) ,
+// returns number of failed checks
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <bg_quantile.h>
+
+using namespace std;
+
+int gFailed=0;
+
+void check( bool ok, const char* name, int iter )
+{
+   if( !ok ){
+      printf("FAILED : %s (iteration %d)\n",name,iter);
+      gFailed++;
+   }
+}
+
+// rank of value in sorted table as fraction [0,1] :
+double rank_of( const vector<double>& sorted, double value )
+{
+   long lower = lower_bound( sorted.begin(), sorted.end(), value ) - sorted.begin();
+   long upper = upper_bound( sorted.begin(), sorted.end(), value ) - sorted.begin();
+   return ( (lower+upper)*0.5 )/sorted.size();
+}
+
+int main()
+{
+   srand( 12345 );
+   double compression = 100;
+
+   // exact for small samples (count <= compression) :
+   int iter=0;
+   for(int cnt=1;cnt<=compression;cnt++){
+      iter++;
+      CBgTDigest digest( compression );
+      vector<double> values;
+      for(int i=0;i<cnt;i++){
+         double value = ((rand() % 100000) - 50000)*0.5; // exact in float
+         digest.Add( value );
+         values.push_back( value );
+      }
+      digest.Add( NAN ); // ignored
+      sort( values.begin(), values.end() );
+
+      double median, q25, q75;
+      bool ok = digest.MedianIQR( median, q25, q75 );
+      check( ok && digest.Count() == cnt, "CBgTDigest::Count (NaN ignored)", iter );
+      check( ok && median == values[cnt/2] && q25 == values[(int)(cnt*0.25)] && q75 == values[(int)(cnt*0.75)], "CBgTDigest::MedianIQR of small sample", iter );
+   }
+   CBgTDigest empty( compression );
+   double dummy;
+   check( !empty.MedianIQR( dummy, dummy, dummy ), "CBgTDigest::MedianIQR of empty digest", iter );
+
+   // bounded rank error for large samples (also merged from parts) :
+   for(int cnt=1000;cnt<=100000;cnt*=10){
+      iter++;
+      CBgTDigest digest( compression ), part1( compression ), part2( compression );
+      vector<double> values;
+      for(int i=0;i<cnt;i++){
+         double value = ( (i % 2) ? (rand() % 1000) : (rand() % 1000000)*0.001 );
+         digest.Add( value );
+         ( (i % 3) ? part1 : part2 ).Add( value );
+         values.push_back( value );
+      }
+      part1.Merge( part2 );
+      sort( values.begin(), values.end() );
+
+      double max_err=0.00;
+      for(int q=1;q<100;q++){
+         double err1 = fabs( rank_of( values, digest.Quantile( q*0.01 ) ) - q*0.01 );
+         double err2 = fabs( rank_of( values, part1.Quantile( q*0.01 ) ) - q*0.01 );
+         max_err = max( max_err, max( err1, err2 ) );
+      }
+      check( max_err < 0.02, "CBgTDigest::Quantile rank error of large sample", iter );
+      check( digest.GetCentroidsCount() <= 2*compression, "CBgTDigest number of centroids", iter );
+      check( part1.Count() == cnt, "CBgTDigest::Merge count", iter );
+      printf("CBgTDigest : %d values , max rank error = %.6f , centroids = %d\n",cnt,max_err,digest.GetCentroidsCount());
+   }
+
+   // approx parameter : default follows gBGApproxQuantiles , 0 exact , >0 compression :
+   iter++;
+   gBGApproxQuantiles = 0;
+   check( bg_approx_compression( BG_APPROX_DEFAULT ) == 0, "bg_approx_compression default (gBGApproxQuantiles=0)", iter );
+   check( bg_approx_compression( 0 ) == 0 && bg_approx_compression( 50 ) == 50, "bg_approx_compression explicit", iter );
+   gBGApproxQuantiles = 1;
+   check( bg_approx_compression( BG_APPROX_DEFAULT ) == CBgTDigest::m_DefaultCompression && CBgTDigest::m_DefaultCompression > 0, "bg_approx_compression default (gBGApproxQuantiles=1)", iter );
+   check( bg_approx_compression( 0 ) == 0 && bg_approx_compression( 50 ) == 50, "bg_approx_compression explicit (gBGApproxQuantiles=1)", iter );
+   gBGApproxQuantiles = 0;
+
+   if( gFailed > 0 ){
+      printf("ERROR : %d checks failed\n",gFailed);
+   }else{
+      printf("OK : all checks passed\n");
+   }
+   return gFailed;
+}
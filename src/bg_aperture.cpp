@@ -0,0 +1,41 @@
+#include "bg_aperture.h"
+
+CBgAperture::CBgAperture( int radius )
+: m_Radius(-1), m_MaxCount(0)
+{
+   Init( radius );
+}
+
+void CBgAperture::Init( int radius )
+{
+   if( radius == m_Radius ){
+      return;
+   }
+   m_Radius = radius;
+   m_Spans.clear();
+   m_MaxCount = 0;
+   if( radius < 0 ){
+      return;
+   }
+
+   long r2 = ((long)radius)*radius;
+   for(int dy=-radius;dy<radius;dy++){
+      // half width of the row , dx^2 <= r^2 - dy^2 :
+      long dy2 = ((long)dy)*dy;
+      int dx = 0;
+      while( dx < radius && ((long)(dx+1))*(dx+1) + dy2 <= r2 ){
+         dx++;
+      }
+
+      cApertureSpan span;
+      span.dy = dy;
+      span.dx_start = -dx;
+      span.dx_end = ( dx < radius ? dx+1 : radius ); // dx=+radius is outside (end of the bounding box)
+      if( span.dx_end > span.dx_start ){
+         m_Spans.push_back( span );
+         m_MaxCount += (span.dx_end - span.dx_start);
+      }
+   }
+
+   m_Values.reserve( m_MaxCount );
+}
@@ -0,0 +1,37 @@
+#ifndef _BG_APERTURE_H__
+#define _BG_APERTURE_H__
+
+#include <vector>
+using namespace std;
+
+// pixels [dx_start,dx_end) in row dy (relative to the centre of the aperture) :
+struct cApertureSpan
+{
+   int dy;
+   int dx_start;
+   int dx_end;
+};
+
+// Circular aperture of given radius as list of row spans : pixels with dx^2+dy^2 <= radius^2 and -radius <= dx,dy < radius
+// (the same pixels as used by GetStatRadius/GetStatRadiusAll before). Spans are calculated once per radius, so that one
+// object can be used for many calls and images (see CBgFits::GetStatRadiusAll), the scratch buffer for median/IQR is reused too.
+class CBgAperture
+{
+public :
+   CBgAperture( int radius=-1 );
+
+   // spans re-calculated only when radius changes :
+   void Init( int radius );
+
+   inline int GetRadius() const { return m_Radius; }
+   inline long GetMaxCount() const { return m_MaxCount; } // number of pixels in the aperture (not clipped by image borders)
+
+   vector<cApertureSpan> m_Spans;
+   vector<double> m_Values; // scratch buffer
+
+protected :
+   int  m_Radius;
+   long m_MaxCount;
+};
+
+#endif
@@ -3,18 +3,95 @@
 #include <string.h>
 #include <math.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <myfile.h>
 #include <myfits.h>
 #include "bg_globals.h"
 #include "bg_array.h"
 #include "bg_bedlam.h"
 #include "bg_units.h"
+#include "bg_fits_reader.h"
+#include "bg_fits_async_writer.h"
+#include "bg_fits_prefetch.h"
+#include "bg_fits_cube.h"
+#include "bg_simd.h"
+#include "bg_quantile.h"
+#include "bg_aperture.h"
 
 int CBgFits::gFitsUnixTimeError=0;
+cFitsCompression CBgFits::m_DefaultCompression;
+int CBgFits::m_DefaultInt16Mode=eInt16None;
+int CBgFits::m_TransposeTile=64;
+int CBgFits::m_StatThreads=0;
+int CBgFits::m_MaxThreads=0;
 const int CBgFits::m_TypicalBighornsChannels=4096;
 const int CBgFits::m_TypicalBighornsYSize=200;
 string CBgFits::gInAOFlaggerDir;
 
+// value of m_Int16Blank when there is no BLANK keyword (does not match any short value) :
+#define BG_INT16_NO_BLANK 0x10000
+
+int cFitsCompression::ParseType( const char* szType )
+{
+   if( !szType || !szType[0] || strcasecmp(szType,"none")==0 ){
+      return 0;
+   }
+   if( strcasecmp(szType,"rice")==0 ){
+      return RICE_1;
+   }
+   if( strcasecmp(szType,"gzip")==0 ){
+      return GZIP_1;
+   }
+   if( strcasecmp(szType,"gzip2")==0 ){
+      return GZIP_2;
+   }
+   if( strcasecmp(szType,"hcompress")==0 ){
+      return HCOMPRESS_1;
+   }
+   if( strcasecmp(szType,"plio")==0 ){
+      return PLIO_1;
+   }
+   
+   return -1;
+}
+
+const char* cFitsCompression::GetTypeName( int type )
+{
+   switch( type ){
+      case RICE_1 :
+         return "rice";
+      case GZIP_1 :
+         return "gzip";
+      case GZIP_2 :
+         return "gzip2";
+      case HCOMPRESS_1 :
+         return "hcompress";
+      case PLIO_1 :
+         return "plio";
+   }
+   
+   return "none";
+}
+
+int CBgFits::ParseInt16Mode( const char* szMode )
+{
+   if( !szMode || !szMode[0] || strcasecmp(szMode,"none")==0 ){
+      return eInt16None;
+   }
+   if( strcasecmp(szMode,"image")==0 ){
+      return eInt16PerImage;
+   }
+   if( strcasecmp(szMode,"row")==0 ){
+      return eInt16PerRow;
+   }
+   
+   return -1;
+}
+
 const char* cIntRange::GetIntTypeDesc(eIntType inttype)
 {
    if( inttype == eIntTypeANT ){
@@ -68,7 +145,12 @@ int CBgFits::freq2ch(double freq)
 
 CBgFits::CBgFits( const char* fits_file, int xSize, int ySize )
  : data(NULL),m_SizeX(xSize),m_SizeY(ySize),bitpix(-32),inttime(0), start_freq(0), stop_freq(480), m_fptr(NULL), total_counter(0),m_lines_counter(0),delta_freq(480.00/4096.00), m_pRFIMask(NULL), 
-   image_type(TFLOAT), dtime_fs(0), dtime_fu(0), m_bExternalData(false)
+   image_type(TFLOAT), dtime_fs(0), dtime_fu(0), m_bExternalData(false),
+   m_pMMapBase(NULL), m_MMapSize(0),
+   m_pAsyncWriter(NULL), m_AsyncRingLines(0), m_AsyncBatchLines(0), m_bHeaderIndexValid(false),
+   m_Compression(m_DefaultCompression),
+   m_Int16Mode(m_DefaultInt16Mode), m_bKeepInt16(false), m_Int16Blank(BG_INT16_NO_BLANK),
+   m_bROI(false), m_RoiStartX(0), m_RoiStartY(0), m_RoiStep(1), m_FullSizeX(0), m_FullSizeY(0)
 {
   if( fits_file && strlen(fits_file) ){   
      m_FileName = fits_file;
@@ -79,7 +161,12 @@ CBgFits::CBgFits( const char* fits_file, int xSize, int ySize )
 }
 
 CBgFits::CBgFits( int xSize, int ySize )
-: data(NULL),m_SizeX(xSize),m_SizeY(ySize),bitpix(-32),inttime(0), start_freq(0), stop_freq(480), m_fptr(NULL), total_counter(0),m_lines_counter(0),delta_freq(480.00/4096.00), m_pRFIMask(NULL), image_type(TFLOAT), dtime_fs(0), dtime_fu(0), m_bExternalData(false)
+: data(NULL),m_SizeX(xSize),m_SizeY(ySize),bitpix(-32),inttime(0), start_freq(0), stop_freq(480), m_fptr(NULL), total_counter(0),m_lines_counter(0),delta_freq(480.00/4096.00), m_pRFIMask(NULL), image_type(TFLOAT), dtime_fs(0), dtime_fu(0), m_bExternalData(false),
+  m_pMMapBase(NULL), m_MMapSize(0),
+  m_pAsyncWriter(NULL), m_AsyncRingLines(0), m_AsyncBatchLines(0), m_bHeaderIndexValid(false),
+  m_Compression(m_DefaultCompression),
+  m_Int16Mode(m_DefaultInt16Mode), m_bKeepInt16(false), m_Int16Blank(BG_INT16_NO_BLANK),
+  m_bROI(false), m_RoiStartX(0), m_RoiStartY(0), m_RoiStep(1), m_FullSizeX(0), m_FullSizeY(0)
 {
    int size = m_SizeX*m_SizeY;
    Realloc( xSize, ySize, FALSE );   
@@ -90,8 +177,12 @@ CBgFits& CBgFits::operator=(const CBgFits& right)
    if( GetXSize() != right.GetXSize() || GetYSize() != right.GetYSize() ){
       printf("WARNING : size of the left is (%d,%d) != right (%d,%d) -> realloc called\n",GetXSize(),GetYSize(),right.GetXSize(),right.GetYSize());
       Realloc( right.GetXSize(), right.GetYSize() );
+   }else if( image_type == TSHORT ){
+      // kept 16-bit image has a half size buffer -> new float buffer of the same size (old values are overwritten anyway) :
+      Realloc( right.GetXSize(), right.GetYSize(), FALSE );
    }
    
+   ((CBgFits&)right).PrepareData();
    int size=right.GetXSize()*right.GetYSize();
    memcpy( data, right.data, size*sizeof(BG_FITS_DATA_TYPE));
    
@@ -101,42 +192,77 @@ CBgFits& CBgFits::operator=(const CBgFits& right)
 void CBgFits::Realloc( int sizeX, int sizeY, int bKeepOldData )
 {   
    if( sizeX>0 && sizeY>0 ){
-      float* new_data = NULL;
+      CBgImageF new_image;
       long int size = ((long int)(sizeX))*((long int)(sizeY));
       if( gBGPrintfLevel >= BG_INFO_LEVEL ){
          printf("CBgFits::Realloc : allocated array of size = %ld floats = %ld bytes = %.2f GB\n",(long int)size,size*sizeof(float),(float(size)*sizeof(float))/(1024*1024*1024));
       }
       try{ 
-         new_data = new float[size];
+         new_image.Alloc( sizeX, sizeY );
       }catch(...){
          printf("ERROR : exception caught when trying to allocate array of size = %ld floats = %ld bytes = %.2f GB\n",(long int)size,size*sizeof(float),(float(size)*sizeof(float))/(1024*1024*1024));
          exit(-1);
       }
-      if( data ){
-         if( bKeepOldData ){            
-            memcpy(new_data,data,m_SizeX*m_SizeY*sizeof(float));
+      if( bKeepOldData ){
+         PrepareData();
+         if( data ){
+            long int old_size = ((long int)m_SizeX)*((long int)m_SizeY);
+            memcpy( new_image.get_data(), data, ( old_size < size ? old_size : size )*sizeof(float) );
          }
-         delete [] data;
       }
-      data = new_data;   
+      FreeData();
+      m_Image.Swap( new_image );
+      data = m_Image.get_data();
+      m_bExternalData = false;
       m_SizeX = sizeX;
       m_SizeY = sizeY;         
    }
 }
 
+void CBgFits::AllocData( int sizeX, int sizeY )
+{
+   if( data && !m_pMMapBase ){
+      if( m_bExternalData ? ( sizeX == m_SizeX && sizeY == m_SizeY ) : ( sizeX == m_Image.GetXSize() && sizeY == m_Image.GetYSize() ) ){
+         return;
+      }
+   }
+   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+      printf("Allocating %d x %d image\n",sizeX,sizeY);fflush(stdout);
+   }
+   FreeData();
+   m_Image.Alloc( sizeX, sizeY );
+   data = m_Image.get_data();
+   m_bExternalData = false;
+}
+
 
 void CBgFits::Clean()
 {
   if( !m_bExternalData ){
-     if( data ){
-        delete [] data;
-        data = NULL;
-     }   
+     FreeData();
   }
 }
 
+void CBgFits::FreeData()
+{
+   if( m_pMMapBase ){
+      munmap( m_pMMapBase, m_MMapSize );
+      m_pMMapBase = NULL;
+      m_MMapSize  = 0;
+   }
+   m_Image.Free();
+   m_Int16.Free();
+   if( image_type == TSHORT ){
+      image_type = TFLOAT;
+   }
+   data = NULL;
+}
+
 CBgFits::~CBgFits()
 {
+  if( m_pAsyncWriter ){
+     delete m_pAsyncWriter; // drains the queue
+  }
   Clean();
   
   if( m_pRFIMask ){
@@ -144,6 +270,72 @@ CBgFits::~CBgFits()
   }
 }
 
+int CBgFits::ApplyCompression( fitsfile* fptr, int image_bitpix )
+{
+   int status = 0;
+   if( m_Compression.type <= 0 ){
+      return 0;
+   }
+   
+   long tile[2];
+   tile[0] = m_Compression.tile[0];
+   tile[1] = m_Compression.tile[1];
+   if( tile[0] <= 0 ){
+      tile[0] = m_SizeX;
+   }
+   if( tile[1] <= 0 ){
+      tile[1] = 1;
+   }
+   if( m_Compression.type == HCOMPRESS_1 && tile[1] < 4 ){
+      // HCOMPRESS requires 2D tiles of at least 4 pixels in each dimension :
+      tile[1] = 16;
+      if( gBGPrintfLevel >= BG_WARNING_LEVEL ){
+         printf("WARNING : HCOMPRESS requires tiles of at least 4 rows -> using tile size %ld x %ld\n",tile[0],tile[1]);
+      }
+   }
+   
+   fits_set_compression_type( fptr, m_Compression.type, &status );
+   fits_set_tile_dim( fptr, 2, tile, &status );
+   if( image_bitpix < 0 ){
+      // only floating point images are quantized :
+      fits_set_quantize_level( fptr, m_Compression.quantize_level, &status );
+   }
+   if( status ){
+      fits_report_error(stderr, status);
+   }else{
+      if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+         printf("DEBUG : writing %s compressed image with tiles %ld x %ld , quantize level = %.2f\n",cFitsCompression::GetTypeName(m_Compression.type),tile[0],tile[1],m_Compression.quantize_level);
+      }
+   }
+   
+   return status;
+}
+
+bool CBgFits::IsStructuralKeyword( const char* key )
+{
+   // NAXISn of all axes (e.g. header of a cube copied to a single plane) :
+   if( strcmp(key,"SIMPLE")==0 || strcmp(key,"BITPIX")==0 || strncmp(key,"NAXIS",5)==0 || strcmp(key,"EXTEND")==0 ){
+      return true;
+   }
+   
+   // extensions and tile-compressed images (stored as binary tables) :
+   if( strcmp(key,"XTENSION")==0 || strcmp(key,"PCOUNT")==0 || strcmp(key,"GCOUNT")==0 || strcmp(key,"TFIELDS")==0 ||
+       strncmp(key,"TTYPE",5)==0 || strncmp(key,"TFORM",5)==0 || strcmp(key,"ZIMAGE")==0 || strcmp(key,"ZSIMPLE")==0 ||
+       strcmp(key,"ZBITPIX")==0 || strncmp(key,"ZNAXIS",6)==0 || strncmp(key,"ZTILE",5)==0 || strcmp(key,"ZCMPTYPE")==0 ||
+       strncmp(key,"ZNAME",5)==0 || strncmp(key,"ZVAL",4)==0 || strcmp(key,"ZQUANTIZ")==0 || strcmp(key,"ZDITHER0")==0 ||
+       strcmp(key,"ZTENSION")==0 || strcmp(key,"ZPCOUNT")==0 || strcmp(key,"ZGCOUNT")==0 || strcmp(key,"ZEXTEND")==0 ||
+       strcmp(key,"ZHECKSUM")==0 || strcmp(key,"ZDATASUM")==0 || strcmp(key,"ZBLANK")==0 || strcmp(key,"ZSCALE")==0 || strcmp(key,"ZZERO")==0 ){
+      return true;
+   }
+   
+   // scaling of integer images (written by WriteInt16Image when required) :
+   if( strcmp(key,"BSCALE")==0 || strcmp(key,"BZERO")==0 || strcmp(key,"BLANK")==0 || strcmp(key,"ROWSCALE")==0 ){
+      return true;
+   }
+   
+   return false;
+}
+
 int CBgFits::Create( const char* fits_file )
 {
    int status = 0;
@@ -168,6 +360,19 @@ int CBgFits::Create( const char* fits_file )
          return( status );
       }
                 
+      if( m_Compression.type > 0 ){
+         if( m_Compression.tile[1] != 1 ){
+            printf("WARNING : lines are written one by one, tiles of %ld rows require that lines are written in multiples of tile rows\n",m_Compression.tile[1]);
+         }
+         if( ( status = ApplyCompression( m_fptr, bitpix ) ) ){
+            // empty file is not left on disk :
+            int delete_status = 0;
+            fits_delete_file( m_fptr, &delete_status );
+            m_fptr = NULL;
+            return status;
+         }
+      }
+
       /* Write the required keywords for the primary array image */
       if ( fits_create_img(m_fptr,  bitpix, naxis, naxes, &status) ){
          if (status) fits_report_error(stderr, status);
@@ -176,20 +381,52 @@ int CBgFits::Create( const char* fits_file )
       
       total_counter = 0;         
       m_lines_counter = 0;
+
+      if( m_AsyncRingLines > 0 ){
+         if( m_pAsyncWriter ){
+            delete m_pAsyncWriter;
+         }
+         m_pAsyncWriter = new CBgFitsAsyncWriter( m_SizeX, m_AsyncRingLines, m_AsyncBatchLines );
+         status = m_pAsyncWriter->Start( m_fptr, 1 );
+      }
       return status;    
    }
    
    return -1;
 }
 
+void CBgFits::EnableAsyncWrite( int ring_lines, int batch_lines )
+{
+   m_AsyncRingLines = ring_lines;
+   m_AsyncBatchLines = batch_lines;
+}
+
+int CBgFits::FlushAsyncWrite()
+{
+   if( m_pAsyncWriter ){
+      return m_pAsyncWriter->Flush();
+   }
+   
+   return 0;
+}
+
 int CBgFits::DumpFitsLine( float* buffer, int size )
 {
    int status=0;
 
    if( m_fptr ){
-      int ret = fits_write_img(m_fptr, TFLOAT, total_counter+1, size, buffer, &status );
-      if( ret ){
-         if (status) fits_report_error(stderr, status);
+      if( m_pAsyncWriter && m_pAsyncWriter->IsRunning() && size <= m_pAsyncWriter->GetLineSize() ){
+         status = m_pAsyncWriter->Push( buffer, size );
+      }else{
+         // lines longer than the ring slots are written directly after the queued ones , writer continues after them :
+         FlushAsyncWrite();
+         int ret = fits_write_img(m_fptr, TFLOAT, total_counter+1, size, buffer, &status );
+         if( ret ){
+            if (status) fits_report_error(stderr, status);
+         }
+         if( m_pAsyncWriter && m_pAsyncWriter->IsRunning() ){
+            m_pAsyncWriter->SetWritePixel( ((long long)total_counter) + size + 1 );
+         }
       }
       
       total_counter += size;
@@ -218,6 +455,7 @@ void CBgFits::set_ysize( int lines_counter )
 
 int CBgFits::add_line( CBgArray& line )
 {
+   PrepareData();
    if( data && line.size()==m_SizeX ){
       if( m_lines_counter == m_SizeY ){
          Realloc( m_SizeX, 2*m_SizeY );
@@ -241,6 +479,7 @@ int CBgFits::add_line( CBgArray& line )
 
 int CBgFits::add_line( float* buffer, int size )
 {
+   PrepareData();
    if( buffer && data && size==m_SizeX ){
       if( m_lines_counter == m_SizeY ){
          Realloc( m_SizeX, 2*m_SizeY );
@@ -264,6 +503,13 @@ int CBgFits::Close()
 {
    int status=0;
    
+   if( m_pAsyncWriter ){
+      // all queued lines have to be written before the file is closed :
+      if( m_pAsyncWriter->Stop() ){
+         printf("ERROR : asynchronous writing of lines to FITS file %s failed\n",m_FileName.c_str());
+      }
+   }
+
    if( m_fptr ){
       fits_close_file(m_fptr, &status);
 //      m_fptr = NULL; // NEW 2016-09-28 - will it be a problem for other things, it was a problem when using single object CBgFits to save many FITS files 
@@ -281,6 +527,7 @@ int CBgFits::WriteKeys()
 {
    int status=0;
 
+   FlushAsyncWrite(); // cfitsio file cannot be used by two threads at the same time
    SetKeyValues(); // set values like inttime etc to strings keyword values 
    for(int k=0;k<_fitsHeaderRecords.size();k++){
          HeaderRecord& rec = _fitsHeaderRecords[k];
@@ -289,7 +536,7 @@ int CBgFits::WriteKeys()
          const char* value = rec.Value.c_str();
          const char* comment = rec.Comment.c_str();
          
-         if( strcmp(key,"SIMPLE")==0 || strcmp(key,"BITPIX")==0 ||  strcmp(key,"NAXIS")==0 ||  strcmp(key,"NAXIS1")==0 || strcmp(key,"NAXIS2")==0 || strcmp(key,"EXTEND")==0 ){
+         if( IsStructuralKeyword(key) ){
             continue;
          }
 
@@ -319,6 +566,10 @@ int CBgFits::WriteKeys( fitsfile* fptr )
 {
    int status=0;
 
+   if( fptr == m_fptr ){
+      FlushAsyncWrite();
+   }
+
    SetKeyValues(); // set values like inttime etc to strings keyword values 
    for(int k=0;k<_fitsHeaderRecords.size();k++){
          HeaderRecord& rec = _fitsHeaderRecords[k];
@@ -327,7 +578,7 @@ int CBgFits::WriteKeys( fitsfile* fptr )
          const char* value = rec.Value.c_str();
          const char* comment = rec.Comment.c_str();
          
-         if( strcmp(key,"SIMPLE")==0 || strcmp(key,"BITPIX")==0 ||  strcmp(key,"NAXIS")==0 ||  strcmp(key,"NAXIS1")==0 || strcmp(key,"NAXIS2")==0 || strcmp(key,"EXTEND")==0 ){
+         if( IsStructuralKeyword(key) ){
             continue;
          }
 
@@ -357,6 +608,7 @@ int CBgFits::WriteKeys( fitsfile* fptr )
 
 int CBgFits::WriteFits( const char* fits_file, int bUpdateSizeY, int bWriteKeys )
 {
+   PrepareData();
    int status = 0;
 
    if( !fits_file || strlen(fits_file) == 0 ){
@@ -372,7 +624,9 @@ int CBgFits::WriteFits( const char* fits_file, int bUpdateSizeY, int bWriteKeys
          }
       }
    
+      FlushAsyncWrite();
       fitsfile *fptr=m_fptr;
+      bool bCreated = false; // file created here (not by CreateFits)
       long naxes[2] = { m_SizeX, m_SizeY };   /* image is 300 pixels wide by 200 rows */
       long naxis    = 2;
       long fpixel   = 1; /* first pixel to write      */
@@ -395,27 +649,53 @@ int CBgFits::WriteFits( const char* fits_file, int bUpdateSizeY, int bWriteKeys
             return( status );
          }
          fptr = m_fptr;
+         bCreated = true;
       }
 //      }
                 
+      int out_bitpix = ( m_Int16Mode > 0 ? SHORT_IMG : bitpix );
+      if( ( status = ApplyCompression( fptr, out_bitpix ) ) ){
+         if( bCreated ){
+            // empty file is not left on disk :
+            int delete_status = 0;
+            fits_delete_file( fptr, &delete_status );
+            m_fptr = NULL;
+         }
+         return status;
+      }
+
       /* Write the required keywords for the primary array image */      
-      if ( fits_create_img(fptr,  bitpix, naxis, naxes, &status) ){
+      if ( fits_create_img(fptr,  out_bitpix, naxis, naxes, &status) ){
          if (status) fits_report_error(stderr, status);
          return( status );
       }
                                                                                               
       long int nelements = naxes[0] * naxes[1];          /* number of pixels to write */
+      vector<double> row_scale, row_zero;
                                                                      
-      /* Write the array of long integers (after converting them to short) */
-      if ( fits_write_img(fptr, TFLOAT, fpixel, nelements, data, &status) ){
-         printf("ERROR : could not write output FITS files of size %ld elements\n",nelements);
-         return( status );
+      if( m_Int16Mode > 0 ){
+         if( ( status = WriteInt16Image( fptr, row_scale, row_zero ) ) ){
+            return status;
+         }
+      }else{
+         /* Write the array of long integers (after converting them to short) */
+         if ( fits_write_img(fptr, TFLOAT, fpixel, nelements, data, &status) ){
+            printf("ERROR : could not write output FITS files of size %ld elements\n",nelements);
+            return( status );
+         }
       }
          
       if( bWriteKeys > 0 ) {   
           SetKeyValues(); // set values like inttime etc to strings keyword values 
           WriteKeys(); // write fits keys 
       }
+      
+      if( m_Int16Mode == eInt16PerRow ){
+         // has to be after the image keywords as it creates a new HDU :
+         if( ( status = WriteRowScaling( fptr, row_scale, row_zero ) ) ){
+            return status;
+         }
+      }
 
 /*      for(int k=0;k<_fitsHeaderRecords.size();k++){
          HeaderRecord& rec = _fitsHeaderRecords[k];
@@ -424,7 +704,8 @@ int CBgFits::WriteFits( const char* fits_file, int bUpdateSizeY, int bWriteKeys
          const char* value = rec.Value.c_str();
          const char* comment = rec.Comment.c_str();
          
-         if( strcmp(key,"SIMPLE")==0 || strcmp(key,"BITPIX")==0 ||  strcmp(key,"NAXIS")==0 ||  strcmp(key,"NAXIS1")==0 || strcmp(key,"NAXIS2")==0 || strcmp(key,"EXTEND")==0 ){
+         // NAXISn of all axes (e.g. header of a cube copied to a single plane) :
+   if( strcmp(key,"SIMPLE")==0 || strcmp(key,"BITPIX")==0 || strncmp(key,"NAXIS",5)==0 || strcmp(key,"EXTEND")==0 ){
             continue;
          }
 
@@ -459,8 +740,212 @@ int CBgFits::WriteFits( const char* fits_file, int bUpdateSizeY, int bWriteKeys
 }
 
 
+// BSCALE/BZERO mapping range of finite values to [-32767,32767] , -32768 is BLANK (NaN) :
+static void bg_int16_scaling( const float* values, long n, double& bscale, double& bzero )
+{
+   double minval=0.00, maxval=0.00;
+   bool bFound = false;
+   for(long i=0;i<n;i++){
+      if( isfinite(values[i]) ){
+         if( !bFound || values[i] < minval ){
+            minval = values[i];
+         }
+         if( !bFound || values[i] > maxval ){
+            maxval = values[i];
+         }
+         bFound = true;
+      }
+   }
+   
+   bscale = 1.00;
+   if( bFound && maxval > minval ){
+      bscale = (maxval - minval)/65534.00;
+   }
+   bzero = minval + 32767.00*bscale;
+}
+
+static void bg_int16_encode( const float* values, long n, double bscale, double bzero, short* out )
+{
+   for(long i=0;i<n;i++){
+      if( !isfinite(values[i]) ){
+         out[i] = BG_INT16_BLANK;
+      }else{
+         double raw = floor( (values[i] - bzero)/bscale + 0.5 );
+         if( raw > 32767 ){
+            raw = 32767;
+         }
+         if( raw < -32767 ){
+            raw = -32767;
+         }
+         out[i] = (short)raw;
+      }
+   }
+}
+
+int CBgFits::WriteInt16Image( fitsfile* fptr, vector<double>& row_scale, vector<double>& row_zero )
+{
+   int status = 0;
+   long int nelements = ((long int)m_SizeX)*((long int)m_SizeY);
+   
+   row_scale.assign( m_SizeY, 1.00 );
+   row_zero.assign( m_SizeY, 0.00 );
+   if( m_Int16Mode == eInt16PerRow ){
+      for(int y=0;y<m_SizeY;y++){
+         bg_int16_scaling( data+((long int)y)*m_SizeX, m_SizeX, row_scale[y], row_zero[y] );
+      }
+   }else{
+      double bscale=1.00, bzero=0.00;
+      bg_int16_scaling( data, nelements, bscale, bzero );
+      row_scale.assign( m_SizeY, bscale );
+      row_zero.assign( m_SizeY, bzero );
+      
+      fits_write_key( fptr, TDOUBLE, "BSCALE", &bscale, "data range scaled to 16-bit integers", &status );
+      fits_write_key( fptr, TDOUBLE, "BZERO", &bzero, NULL, &status );
+   }
+   int blank = BG_INT16_BLANK;
+   fits_write_key( fptr, TINT, "BLANK", &blank, "NaN values", &status );
+   if( m_Int16Mode == eInt16PerRow ){
+      int bRowScale = 1;
+      fits_write_key( fptr, TLOGICAL, "ROWSCALE", &bRowScale, "BSCALE/BZERO of every row in ROWSCALE extension", &status );
+   }
+   
+   // values are scaled here, cfitsio has to write them as they are (header is parsed first, otherwise the first write 
+   // would set scaling from BSCALE/BZERO keywords again) :
+   fits_set_hdustruc( fptr, &status );
+   fits_set_bscale( fptr, 1.00, 0.00, &status );
+   if( status ){
+      fits_report_error(stderr, status);
+      return status;
+   }
+   
+   vector<short> line( m_SizeX );
+   for(int y=0;y<m_SizeY;y++){
+      bg_int16_encode( data+((long int)y)*m_SizeX, m_SizeX, row_scale[y], row_zero[y], &(line[0]) );
+      if ( fits_write_img(fptr, TSHORT, ((LONGLONG)y)*m_SizeX+1, m_SizeX, &(line[0]), &status) ){
+         printf("ERROR : could not write row %d of 16-bit output FITS file\n",y);
+         fits_report_error(stderr, status);
+         return status;
+      }
+   }
+   
+   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+      printf("DEBUG : written %ld pixels as scaled 16-bit integers (%s scaling)\n",nelements,(m_Int16Mode == eInt16PerRow ? "per-row" : "per-image"));
+   }
+   
+   return status;
+}
+
+int CBgFits::WriteRowScaling( fitsfile* fptr, vector<double>& row_scale, vector<double>& row_zero )
+{
+   int status = 0;
+   char* ttype[] = { (char*)"BSCALE", (char*)"BZERO" };
+   char* tform[] = { (char*)"1D", (char*)"1D" };
+   
+   if( fits_create_tbl( fptr, BINARY_TBL, m_SizeY, 2, ttype, tform, NULL, "ROWSCALE", &status ) ){
+      printf("ERROR : could not create ROWSCALE extension\n");
+      fits_report_error(stderr, status);
+      return status;
+   }
+   fits_write_col( fptr, TDOUBLE, 1, 1, 1, m_SizeY, &(row_scale[0]), &status );
+   fits_write_col( fptr, TDOUBLE, 2, 1, 1, m_SizeY, &(row_zero[0]), &status );
+   if( status ){
+      printf("ERROR : could not write BSCALE/BZERO of %d rows to ROWSCALE extension\n",m_SizeY);
+      fits_report_error(stderr, status);
+   }
+   
+   return status;
+}
+
+int CBgFits::ReadRowScaling( fitsfile* fp, vector<double>& row_scale, vector<double>& row_zero, int n_image_rows )
+{
+   if( n_image_rows < 0 ){
+      n_image_rows = m_SizeY;
+   }
+   int status = 0;
+   int hdu_num = 1;
+   fits_get_hdu_num( fp, &hdu_num );
+   
+   if( fits_movnam_hdu( fp, BINARY_TBL, (char*)"ROWSCALE", 0, &status ) ){
+      printf("ERROR : ROWSCALE=T , but ROWSCALE extension not found in FITS file %s\n",m_FileName.c_str());
+      return status;
+   }
+   
+   long n_rows = 0;
+   fits_get_num_rows( fp, &n_rows, &status );
+   if( status || n_rows != n_image_rows ){
+      printf("ERROR : ROWSCALE extension in FITS file %s has %ld rows != image size %d\n",m_FileName.c_str(),n_rows,n_image_rows);
+      return ( status ? status : -1 );
+   }
+   row_scale.assign( n_image_rows, 1.00 );
+   row_zero.assign( n_image_rows, 0.00 );
+   fits_read_col( fp, TDOUBLE, 1, 1, 1, n_image_rows, NULL, &(row_scale[0]), NULL, &status );
+   fits_read_col( fp, TDOUBLE, 2, 1, 1, n_image_rows, NULL, &(row_zero[0]), NULL, &status );
+   if( status ){
+      printf("ERROR : could not read BSCALE/BZERO columns from ROWSCALE extension in FITS file %s\n",m_FileName.c_str());
+      return status;
+   }
+   
+   // back to the image :
+   fits_movabs_hdu( fp, hdu_num, NULL, &status );
+   
+   return status;
+}
+
+int CBgFits::ReadInt16Scaling( fitsfile* fp, int file_bitpix, int n_image_rows, double& scale, double& zero, vector<double>& row_scale, vector<double>& row_zero )
+{
+   scale = 1.00;
+   zero  = 0.00;
+   row_scale.clear();
+   row_zero.clear();
+   if( file_bitpix != SHORT_IMG ){
+      return 0;
+   }
+
+   int key_status=0;
+   fits_read_key(fp, TDOUBLE, "BSCALE", &scale, NULL, &key_status);
+   key_status=0;
+   fits_read_key(fp, TDOUBLE, "BZERO", &zero, NULL, &key_status);
+   key_status=0;
+   int bRowScale = 0;
+   fits_read_key(fp, TLOGICAL, "ROWSCALE", &bRowScale, NULL, &key_status);
+   if( key_status ){
+      bRowScale = 0;
+   }
+   fits_clear_errmsg();
+
+   if( bRowScale ){
+      return ReadRowScaling( fp, row_scale, row_zero, n_image_rows );
+   }
+
+   return 0;
+}
+
+void CBgFits::ConvertInt16ToFloat()
+{
+   if( image_type != TSHORT ){
+      return;
+   }
+   
+   m_Image.Alloc( m_Int16.GetXSize(), m_Int16.GetYSize() );
+   for(int y=0;y<m_Int16.GetYSize();y++){
+      const short* raw = m_Int16.get_line(y);
+      float* line = m_Image.get_line(y);
+      for(int x=0;x<m_Int16.GetXSize();x++){
+         line[x] = Int16ToFloat( raw[x], y );
+      }
+   }
+   m_Int16.Free();
+   data = m_Image.get_data();
+   image_type = TFLOAT;
+   
+   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+      printf("DEBUG : 16-bit image %s converted to float\n",m_FileName.c_str());
+   }
+}
+
 int CBgFits::UpdateImage(  const char* fits_file, const char* out_file )
 {
+   PrepareData();
    int status = 0;
 
    if( !fits_file || strlen(fits_file) == 0 ){
@@ -722,6 +1207,324 @@ int CBgFits::ParseSkyIntegrations()
    return ret; 
 }
 
+// state of header parsing in ReadFits, keywords can be read all or only selected ones (see SetHeaderFilter) :
+struct cHeaderParseState
+{
+   bool transposed;
+   string szFreqKeyword, szFreqDelta, szTimeDelta;
+   int bStopFreqFound;
+   int bDeltaFreqFound;
+   mystring szDATE_UT,szCDELT2;
+
+   cHeaderParseState( bool _transposed )
+   : transposed(false), szFreqKeyword("CRVAL1"), szFreqDelta("CDELT1"), szTimeDelta("CDELT2"), bStopFreqFound(0), bDeltaFreqFound(0)
+   {
+      if( _transposed ){
+         SetTransposed();
+      }
+   }
+   
+   void SetTransposed()
+   {
+      transposed = true;
+      szFreqKeyword = "CRVAL2";
+      szFreqDelta = "CDELT2";
+      szTimeDelta = "CDELT1";
+   }
+};
+
+// value of keyword keyname (with CHANNELS-style long string) -> record with keytype and apostrophes removed from string values 
+static int bg_fill_header_record( fitsfile* fp, const char* keyname, char* keyvalue, const char* comment, HeaderRecord& rec )
+{
+   int status = 0;
+
+   if( strcmp(keyname,"CHANNELS") == 0 ){        
+       char long_keyvalue1[1024],long_comment[1024],long_keyvalue2[1024],long_keyvalue3[1024];
+       char* longstr[3];
+       longstr[0] = long_keyvalue1;
+       longstr[1] = long_keyvalue2;
+       longstr[2] = long_keyvalue3;
+
+       // fits_read_string_key( fp, keyname, 0, 1023, long_keyvalue, &keylen, long_comment, &status);
+       // http://www.mssl.ucl.ac.uk/swift/om/sw/help/fitsio/node78.html
+       fits_read_key_longstr( fp, keyname, longstr, long_comment, &status);
+       // printf("CHANNELS = %s -> strlen = %d vs. %d \n",longstr[0],strlen(longstr[0]),(FLEN_VALUE+1));           
+       strcpy( keyvalue, longstr[0] );           
+   }
+   if (status) return status;
+       
+   int keylen = strlen(keyvalue);
+   if( keylen ){
+      fits_get_keytype( keyvalue, &rec.keytype, &status);
+      
+      if( rec.keytype == 'C' ){
+         // removing aphostrophs from start and end (to be tested if not spoils anything !)
+         const char* ptr = keyvalue;
+         while( (*ptr) == '\'' ){
+            ptr++;
+         }
+         int len=strlen(ptr);
+         while(len>0 && ptr[len-1]=='\'' ){
+            len--;
+         }
+         
+         char tmpvalue[FLEN_VALUE+1];
+         strncpy(tmpvalue,ptr,len);
+         tmpvalue[len] = '\0';
+         strcpy(keyvalue,tmpvalue);
+      }
+   }
+                           
+   rec.Keyword = keyname;
+   rec.Value = keyvalue;
+   rec.Comment = comment; 
+
+   return status;
+}
+
+// ikey-th keyword (1-based) :
+static int bg_read_header_record( fitsfile* fp, int ikey, HeaderRecord& rec )
+{
+   char keyname[1024]; // was FLEN_KEYWORD+1
+   char keyvalue[1024];  // was FLEN_VALUE+1 
+   char comment[1024]; // was FLEN_COMMENT+1
+   int status = 0;
+
+   fits_read_keyn(fp, ikey, keyname, keyvalue, comment, &status);
+   if( status ) return status;
+   
+   return bg_fill_header_record( fp, keyname, keyvalue, comment, rec );
+}
+
+// keyword by name, returns KEY_NO_EXIST if not in the header :
+static int bg_read_header_record( fitsfile* fp, const char* keyname, HeaderRecord& rec )
+{
+   char keyvalue[1024];  // was FLEN_VALUE+1 
+   char comment[1024]; // was FLEN_COMMENT+1
+   int status = 0;
+
+   fits_read_keyword(fp, keyname, keyvalue, comment, &status);
+   if( status ) return status;
+   
+   return bg_fill_header_record( fp, keyname, keyvalue, comment, rec );
+}
+
+void CBgFits::ParseHeaderRecord( HeaderRecord& rec, cHeaderParseState& state )
+{
+   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+      printf("DEBUG0 : %s = %s\n",rec.Keyword.c_str(),rec.Value.c_str());
+   }
+   
+   if( ( strcmp(rec.Keyword.c_str(),"CTYPE2") == 0  && strcmp(rec.Value.c_str(),"Frequency")==0 ) || ( strcmp(rec.Keyword.c_str(),"CTYPE1") ==0 && strcmp(rec.Value.c_str(),"Time")==0 ) ){
+      if( !state.transposed ){
+         state.SetTransposed();
+         if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+            printf("DEBUG : auto-detected that the dynamic spectrum has time on horizontal axis and frequency on vertical (frequency vs. time)\n");
+         }
+      }
+   }
+
+   if( strstr(rec.Keyword.c_str(),"AVERF" ) ){
+      m_AverList.push_back( rec.Value );
+   }
+   if( strstr(rec.Keyword.c_str(),"INTTIME" ) ){
+      inttime = atof(rec.Value.c_str());
+   }
+   if( strstr(rec.Keyword.c_str(),"DTIME-FS" ) ){
+      dtime_fs = atol(rec.Value.c_str());
+
+      // fix Unixtime for data 20121004 - 20121105 :          
+      if( gFitsUnixTimeError>0 && dtime_fs>1349049600 && dtime_fs<1352160000 ){
+         // only for 201210 data 
+         double time_drift=21.5;
+         double dt=711+((dtime_fs-1351753823)/86400)*time_drift;
+         dtime_fs = dtime_fs - dt;
+
+         char szUxTime[64];
+         sprintf(szUxTime,"%d",(int)dtime_fs);
+         rec.Value = szUxTime;
+      }
+   }
+   if( strstr(rec.Keyword.c_str(),"DATE" ) ){
+      if( strcmp(rec.Keyword.c_str(),"DATE-OBS" )==0 ){
+          // DATE-OBS has priority over others 
+          if( strlen( state.szDATE_UT.c_str() ) > 0 ){
+             printf("WARNING : overwritting value in szDATE_UT = %s with DATE-OBS = %s\n",state.szDATE_UT.c_str(),rec.Value.c_str());
+          }
+          state.szDATE_UT = rec.Value.c_str();
+      }else{
+          // only overwrite if still empty to avoid overwritting DATE-OBS value !
+          if( strlen(state.szDATE_UT.c_str()) == 0 ){                 
+             state.szDATE_UT = rec.Value.c_str();
+          }else{
+             printf("WARNING : szDATE_UT already has a value = %s , therefore date non-priority keyword %s = %s ignored (priority keyword is DATE-OBS)\n",state.szDATE_UT.c_str(),rec.Keyword.c_str(),rec.Value.c_str());
+          }
+      }
+   }
+   if( strstr(rec.Keyword.c_str(),"DTIME-FU" ) ){
+      dtime_fu = atol(rec.Value.c_str());
+   }
+   if( strstr(rec.Keyword.c_str(),"NACCUM" ) ){    
+      naccum = atol(rec.Value.c_str());            
+   }
+   
+   if( strstr(rec.Keyword.c_str(),"STARTFRQ" ) || strstr(rec.Keyword.c_str(), state.szFreqKeyword.c_str() ) ){
+//       double unit = 1000000.00; // MHz in Hz 
+      double unit = 1.00; // MHz 
+      start_freq = atof(rec.Value.c_str())/unit; // in header in Hz
+      if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+         printf("DEBUG : start freq = %.2f MHz\n",start_freq);
+      }
+   }
+   if( strstr(rec.Keyword.c_str(),"STOPFRQ" ) ){
+      double unit = 1.00; // MHz
+      stop_freq = atof(rec.Value.c_str())/unit; // in header in Hz
+      if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+         printf("DEBUG : stop freq = %.2f MHz\n",stop_freq);
+      }
+      state.bStopFreqFound = 1;
+   }                          
+   
+   if( strstr(rec.Keyword.c_str(), state.szFreqDelta.c_str() ) ){
+      state.bDeltaFreqFound = 1; 
+      delta_freq = atof(rec.Value.c_str());
+   }                         
+   if( strstr(rec.Keyword.c_str(), state.szTimeDelta.c_str() ) ){
+      state.szCDELT2 = rec.Value.c_str();
+   }                         
+}
+
+int CBgFits::ReadFitsHeader( fitsfile* fp, int bIgnoreHeaderErrors, bool transposed )
+{
+   int status = 0;
+   cHeaderParseState parse_state( transposed );
+
+   // reading keywords :
+   int nkeys=0;
+   fits_get_hdrspace(fp, &nkeys, NULL, &status);
+   if(status)nkeys=0;
+   
+   // tile-compressed image is stored in a binary table, its keywords (ZCMPTYPE, TFORM1 etc.) are not image header :
+   int bCompressed = fits_is_compressed_image( fp, &status );
+
+   _fitsHeaderRecords.clear();         
+   _headerKeywordMap.clear();
+   m_FlaggedIntegrations.clear();
+   m_bHeaderIndexValid = true;
+   if( m_HeaderKeywordsFilter.size() > 0 ){
+      // only requested keywords :
+      for(int k=0;k<m_HeaderKeywordsFilter.size();k++){
+         HeaderRecord rec;
+         int key_status = bg_read_header_record( fp, m_HeaderKeywordsFilter[k].c_str(), rec );
+         if( key_status == KEY_NO_EXIST ){
+            fits_clear_errmsg();
+            continue;
+         }
+         if( key_status ){
+            status = key_status;
+            break;
+         }
+         ParseHeaderRecord( rec, parse_state );
+         AddHeaderRecord( rec );
+      }
+   }else{
+      for(int ikey=0; ikey<nkeys; ikey++){
+        HeaderRecord rec;
+        status = bg_read_header_record( fp, ikey+1, rec );
+        if( status ){
+           break;
+        }
+        if( bCompressed && IsStructuralKeyword( rec.Keyword.c_str() ) ){
+           continue;
+        }
+        ParseHeaderRecord( rec, parse_state );
+        AddHeaderRecord( rec );
+      }  
+   }
+   int bStopFreqFound = parse_state.bStopFreqFound;
+   int bDeltaFreqFound = parse_state.bDeltaFreqFound;
+   mystring& szDATE_UT = parse_state.szDATE_UT;
+   mystring& szCDELT2 = parse_state.szCDELT2;
+   
+   if( !bStopFreqFound && bDeltaFreqFound ){
+      // m_Size -> (m_SizeX-1) - 2013-06-10 due to S11 csv files -> fits (see comment in CBgFits::ch2freq)
+      stop_freq = start_freq + delta_freq*(m_SizeX-1);
+   }
+
+   if( inttime <= 0 ){
+      // CDELT2
+      if( strlen(szCDELT2.c_str())>0 ){
+         inttime = atof(szCDELT2.c_str());
+      }else{
+         if( bIgnoreHeaderErrors <= 0 ){
+             printf("WARNING : could not read INTTIME nor CDELT2 to get time resolutions information for file %s\n",m_FileName.c_str());
+         }
+      }
+   }
+   if( dtime_fs <= 0 ){
+      if( strlen(szDATE_UT.c_str()) > 0 ){
+         // meaning that DTIME-FS was not found - try to use format 2016-04-15T00:12:23
+         struct tm _tm;
+         memset( &_tm,'\0',sizeof(struct tm));       
+         strptime(szDATE_UT.c_str(), "%Y-%m-%dT%H:%M:%S", &_tm);
+         double unixtime = (double)timegm( &_tm );
+
+        // add fractional if : %Y-%m-%dT%H:%M:%S.5           
+         const char* p_dot = strstr(szDATE_UT.c_str(),".");
+         if( p_dot ){
+            double extra = atof( p_dot );
+            unixtime += extra;                            
+         }
+         
+         dtime_fs = (int)unixtime;
+         dtime_fu = (unixtime-(int)unixtime)*1e6;                 
+         
+//           printf("%s -> %.2f -> %d / %d\n",szDATE_UT.c_str(), unixtime,dtime_fs,dtime_fu);
+         
+/*           int match = sscanf(szDateTime.c_str(),"%d-%d-%dT%d:%d:%d",&_tm->tm_year,&_tm->tm_mon,&_tm->tm_mday,&_tm->tm_hour,&_tm->tm_min,&_tm->tm_sec);
+         if( match == 6 ){
+            _tm->tm_year = (_tm->tm_year - 1900);            
+             // and months from 1 :
+             _tm->tm_mon--;                              
+         
+            double unixtime = (double)timegm( &_tm );
+            dtime_fs = (int)unixtime;
+            dtime_us = (unixtime-(int)unixtime)*1e6;
+         }else{
+            printf("ERROR : could not parse UT date/time from string %s\n",szDateTime.c_str());
+         }*/
+      }else{
+         if( bIgnoreHeaderErrors <= 0 ){
+             printf("WARNING : cannot get start UT time of the image %s !\n",m_FileName.c_str());
+         }
+      }
+   }
+   
+   int sky_int_count = 0;
+   HeaderRecord* szStates = GetKeyword("STATES");
+   if( szStates ){
+      sky_int_count = ParseStates(szStates->Value.c_str());
+   }else{
+      sky_int_count = ParseSkyIntegrations();
+   }
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("---------------------------------------\n");                                                                                                                 
+      printf("CBgFits::ReadFits %s : read %d header keys\n",m_FileName.c_str(),nkeys);
+      printf("---------------------------------------\n");
+      for(int i=0;i<_fitsHeaderRecords.size();i++){
+         printf("%s = %s\n",_fitsHeaderRecords[i].Keyword.c_str(),_fitsHeaderRecords[i].Value.c_str());
+      }
+   }
+
+
+   if( m_AverList.size() == 0 ){
+      m_AverList.push_back( m_FileName.c_str() );
+   }
+   
+   return status;
+}
+
 int CBgFits::ReadFits( const char* fits_file, int bAutoDetect /*=0*/, int bReadImage /* =1 */ , int bIgnoreHeaderErrors /* =0 */ , bool transposed /* =false */ )
 {
   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
@@ -730,12 +1533,6 @@ int CBgFits::ReadFits( const char* fits_file, int bAutoDetect /*=0*/, int bReadI
 
   fitsfile *fp=0;
   int status = 0;
-  string szFreqKeyword = "CRVAL1", szFreqDelta = "CDELT1", szTimeDelta = "CDELT2";
-  if( transposed ){
-     szFreqKeyword = "CRVAL2";
-     szFreqDelta = "CDELT2";
-     szTimeDelta = "CDELT1";
-  }
 
   if( !fits_file || strlen(fits_file) == 0 ){
      fits_file = m_FileName.c_str();
@@ -762,17 +1559,29 @@ int CBgFits::ReadFits( const char* fits_file, int bAutoDetect /*=0*/, int bReadI
          printf("ERROR : could not read parameters from FITS file %s, due to error %d\n",m_FileName.c_str(),status);
          return status;
      }
+     m_bROI = false;
      if( bAutoDetect > 0 ){
-        if( bitpix == 8 ){
-           printf("INFO : image type set to TBYTE=%d (was %d) , number of bits=%d\n",TBYTE,image_type,bitpix);
-           image_type = TBYTE;
+        if( bitpix == BYTE_IMG ){
+           // pixels are always float here, CBgImageU8 (bg_image.h) keeps them as bytes :
+           printf("INFO : 8-bit image (number of bits=%d) converted to float\n",bitpix);
         }
      } 
      
-     // check sizes and allocate/re-allocate :
-     if( data && (axsizes[0] != m_SizeX || axsizes[1] != m_SizeY) ){        
-        delete [] data;
-        data = NULL;
+     // BLANK of scaled 16-bit images (see SetInt16Output) :
+     if( bitpix == SHORT_IMG ){
+        int key_status=0;
+        m_Int16Blank = BG_INT16_NO_BLANK;
+        fits_read_key(fp, TINT, "BLANK", &m_Int16Blank, NULL, &key_status);
+        if( key_status ){
+           m_Int16Blank = BG_INT16_NO_BLANK;
+        }
+        fits_clear_errmsg();
+     }
+     bool bKeepInt16 = ( m_bKeepInt16 && bitpix == SHORT_IMG && bReadImage > 0 );
+     
+     // check sizes and allocate/re-allocate (int16 image is kept in m_Int16) :
+     if( (data || image_type == TSHORT) && (axsizes[0] != m_SizeX || axsizes[1] != m_SizeY || m_pMMapBase || (image_type == TSHORT) != bKeepInt16) ){        
+        FreeData();
      }     
      m_SizeX = axsizes[0];
      if( naxis > 1 ){
@@ -780,14 +1589,28 @@ int CBgFits::ReadFits( const char* fits_file, int bAutoDetect /*=0*/, int bReadI
      }else{
         m_SizeY = 1;
      }
+
+     // scaling of 16-bit images (see SetInt16Output) :
+     double int16_scale=1.00, int16_zero=0.00;
+     vector<double> row_scale, row_zero;
+     if( ( status = ReadInt16Scaling( fp, bitpix, m_SizeY, int16_scale, int16_zero, row_scale, row_zero ) ) ){
+        fits_close_file(fp, &status);
+        return status;
+     }
+     bool bRowScale = ( row_scale.size() > 0 );
      
      if( bReadImage > 0 ){
          long int sizeXY = ((long int)m_SizeX)*((long int)m_SizeY);
-         if( !data ){
-            if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
-               printf("Allocating %d x %d = %ld image for naxis = %d \n",m_SizeX,m_SizeY,sizeXY,naxis);fflush(stdout);
+         void* buffer = NULL;
+         if( bKeepInt16 ){
+            if( image_type != TSHORT ){
+               m_Int16.Alloc( m_SizeX, m_SizeY );
+               image_type = TSHORT;
             }
-            data = new float[sizeXY];
+            buffer = m_Int16.get_data();
+         }else{
+            AllocData( m_SizeX, m_SizeY );
+            buffer = data;
          }
      
 //         long firstpixel[2] = {1, 1};
@@ -798,259 +1621,435 @@ int CBgFits::ReadFits( const char* fits_file, int bAutoDetect /*=0*/, int bReadI
          }
          
 //         int sizeXY = m_SizeX*m_SizeY;
-         fits_read_pix(fp, image_type, firstpixel, sizeXY, NULL, data, NULL, &status);
+         float nan_value = (0.00/0.00);
+         void* nulval = NULL;
+         if( image_type == TSHORT ){
+            // raw values , scaled when accessed :
+            fits_set_bscale( fp, 1.00, 0.00, &status );
+            m_Int16Scale.assign( 1, int16_scale );
+            m_Int16Zero.assign( 1, int16_zero );
+         }else if( bitpix == SHORT_IMG && image_type == TFLOAT ){
+            // BLANK -> NaN :
+            nulval = &nan_value;
+         }
+         fits_read_pix(fp, image_type, firstpixel, sizeXY, nulval, buffer, NULL, &status);
+         delete [] firstpixel;
          if( status ){ 
              printf("ERROR : could not read data from FITS file %s, due to error %d\n",m_FileName.c_str(),status);
+             int close_status = 0;
+             fits_close_file(fp, &close_status);
              return status;
          }
          
-         delete [] firstpixel;
+         if( bRowScale ){
+            if( image_type == TSHORT ){
+               m_Int16Scale = row_scale;
+               m_Int16Zero = row_zero;
+            }else{
+               for(int y=0;y<m_SizeY;y++){
+                  float* line = data + ((long int)y)*m_SizeX;
+                  for(int x=0;x<m_SizeX;x++){
+                     line[x] = line[x]*row_scale[y] + row_zero[y];
+                  }
+               }
+            }
+         }
+     }
+     if( bitpix == SHORT_IMG && ( int16_scale != 1.00 || int16_zero != 0.00 || bRowScale ) ){
+        // scaled values are not integers -> written as float unless 16-bit output is required (SetInt16Output) :
+        bitpix = FLOAT_IMG;
      }
 
-     // reading keywords :
-     int nkeys=0;
-     fits_get_hdrspace(fp, &nkeys, NULL, &status);
-   
-     char keyname[1024]; // was FLEN_KEYWORD+1
-     char keyvalue[1024];  // was FLEN_VALUE+1 
-     char comment[1024]; // was FLEN_COMMENT+1
-            
-     if(status)nkeys=0;
-
-     int bStopFreqFound=0;
-     int bDeltaFreqFound=0;
-     _fitsHeaderRecords.clear();         
-     mystring szDATE_UT,szCDELT2;     
-     for(int ikey=0; ikey<nkeys; ikey++){
-       HeaderRecord rec;
-                           
-       fits_read_keyn(fp, ikey+1, keyname, keyvalue, comment, &status);
-       
-       if( strcmp(keyname,"CHANNELS") == 0 ){        
-           char long_keyvalue1[1024],long_comment[1024],long_keyvalue2[1024],long_keyvalue3[1024];
-           char* longstr[3];
-           longstr[0] = long_keyvalue1;
-           longstr[1] = long_keyvalue2;
-           longstr[2] = long_keyvalue3;
-
-           // fits_read_string_key( fp, keyname, 0, 1023, long_keyvalue, &keylen, long_comment, &status);
-           // http://www.mssl.ucl.ac.uk/swift/om/sw/help/fitsio/node78.html
-           fits_read_key_longstr( fp, keyname, longstr, long_comment, &status);
-           // printf("CHANNELS = %s -> strlen = %d vs. %d \n",longstr[0],strlen(longstr[0]),(FLEN_VALUE+1));           
-           strcpy( keyvalue, longstr[0] );           
-       }
-       
-       
-       
-       if (status) break;
-       
-       int keylen = strlen(keyvalue);
-       if( keylen ){
-          fits_get_keytype( keyvalue, &rec.keytype, &status);
-          
-          if( rec.keytype == 'C' ){
-             // removing aphostrophs from start and end (to be tested if not spoils anything !)
-             const char* ptr = keyvalue;
-             while( (*ptr) == '\'' ){
-                ptr++;
-             }
-             int len=strlen(ptr);
-             while(len>0 && ptr[len-1]=='\'' ){
-                len--;
-             }
-             
-             char tmpvalue[FLEN_VALUE+1];
-             strncpy(tmpvalue,ptr,len);
-             tmpvalue[len] = '\0';
-             strcpy(keyvalue,tmpvalue);
-          }
-       }
-                               
-       rec.Keyword = keyname;
-       rec.Value = keyvalue;
-       rec.Comment = comment; 
-       
-       if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
-          printf("DEBUG0 : %s = %s\n",rec.Keyword.c_str(),rec.Value.c_str());
-       }
-       
-       if( ( strcmp(rec.Keyword.c_str(),"CTYPE2") == 0  && strcmp(rec.Value.c_str(),"Frequency")==0 ) || ( strcmp(rec.Keyword.c_str(),"CTYPE1") ==0 && strcmp(rec.Value.c_str(),"Time")==0 ) ){
-          if( !transposed ){
-             transposed = true;
-             szFreqKeyword = "CRVAL2";
-             szFreqDelta = "CDELT2";
-             szTimeDelta = "CDELT1";             
-             if( gBGPrintfLevel >= BG_INFO_LEVEL ){
-                printf("DEBUG : auto-detected that the dynamic spectrum has time on horizontal axis and frequency on vertical (frequency vs. time)\n");
-             }
-          }
-       }
+     status = ReadFitsHeader( fp, bIgnoreHeaderErrors, transposed );
 
-       if( strstr(rec.Keyword.c_str(),"AVERF" ) ){
-          m_AverList.push_back( rec.Value );
-       }
-       if( strstr(rec.Keyword.c_str(),"INTTIME" ) ){
-          inttime = atof(rec.Value.c_str());
-       }
-       if( strstr(rec.Keyword.c_str(),"DTIME-FS" ) ){
-          dtime_fs = atol(rec.Value.c_str());
-
-          // fix Unixtime for data 20121004 - 20121105 :          
-          if( gFitsUnixTimeError>0 && dtime_fs>1349049600 && dtime_fs<1352160000 ){
-             // only for 201210 data 
-             double time_drift=21.5;
-             double dt=711+((dtime_fs-1351753823)/86400)*time_drift;
-             dtime_fs = dtime_fs - dt;
-
-             char szUxTime[64];
-             sprintf(szUxTime,"%d",(int)dtime_fs);
-             rec.Value = szUxTime;
-          }
-       }
-       if( strstr(rec.Keyword.c_str(),"DATE" ) ){
-          if( strcmp(rec.Keyword.c_str(),"DATE-OBS" )==0 ){
-              // DATE-OBS has priority over others 
-              if( strlen( szDATE_UT.c_str() ) > 0 ){
-                 printf("WARNING : overwritting value in szDATE_UT = %s with DATE-OBS = %s\n",szDATE_UT.c_str(),rec.Value.c_str());
-              }
-              szDATE_UT = rec.Value.c_str();
-          }else{
-              // only overwrite if still empty to avoid overwritting DATE-OBS value !
-              if( strlen(szDATE_UT.c_str()) == 0 ){                 
-                 szDATE_UT = rec.Value.c_str();
-              }else{
-                 printf("WARNING : szDATE_UT already has a value = %s , therefore date non-priority keyword %s = %s ignored (priority keyword is DATE-OBS)\n",szDATE_UT.c_str(),rec.Keyword.c_str(),rec.Value.c_str());
-              }
-          }
-       }
-//       if( strstr(rec.Keyword.c_str(),"DATE-OBS" ) ){
-          // overwrites DATE 
-//          szDATE_UT = rec.Value.c_str();
-//       }
-       if( strstr(rec.Keyword.c_str(),"DTIME-FU" ) ){
-          dtime_fu = atol(rec.Value.c_str());
-       }
-       if( strstr(rec.Keyword.c_str(),"NACCUM" ) ){    
-          naccum = atol(rec.Value.c_str());            
-       }
-       
-       if( strstr(rec.Keyword.c_str(),"STARTFRQ" ) || strstr(rec.Keyword.c_str(), szFreqKeyword.c_str() ) ){
-//       if( strstr(rec.Keyword.c_str(),"CRVAL1" ) ){       
-//          double unit = 1000000.00; // MHz in Hz 
-          double unit = 1.00; // MHz 
-          start_freq = atof(rec.Value.c_str())/unit; // in header in Hz
-          if( gBGPrintfLevel >= BG_INFO_LEVEL ){
-             printf("DEBUG : start freq = %.2f MHz\n",start_freq);
-          }
-       }
-       if( strstr(rec.Keyword.c_str(),"STOPFRQ" ) ){
-          double unit = 1.00; // MHz
-          stop_freq = atof(rec.Value.c_str())/unit; // in header in Hz
-          if( gBGPrintfLevel >= BG_INFO_LEVEL ){
-             printf("DEBUG : stop freq = %.2f MHz\n",stop_freq);
-          }
-          bStopFreqFound = 1;
-       }                          
-       
-       if( strstr(rec.Keyword.c_str(), szFreqDelta.c_str() ) ){
-          bDeltaFreqFound = 1; 
-          delta_freq = atof(rec.Value.c_str());
-       }                         
-       if( strstr(rec.Keyword.c_str(), szTimeDelta.c_str() ) ){
-          szCDELT2 = rec.Value.c_str();
-       }                         
-                                                                 
-       _fitsHeaderRecords.push_back(rec);                                                                     
-       // _headerKeywordMap.insert( pair<string,int>(rec.Keyword,ikey) );
-     }  
-     
-     if( !bStopFreqFound && bDeltaFreqFound ){
-        // m_Size -> (m_SizeX-1) - 2013-06-10 due to S11 csv files -> fits (see comment in CBgFits::ch2freq)
-        stop_freq = start_freq + delta_freq*(m_SizeX-1);
+     fits_close_file(fp, &status);                     
+     if( status ){ 
+         printf("ERROR : could not close FITS file %s, due to error %d\n",m_FileName.c_str(),status);
+         return status;
+     }     
+  }else{
+     printf("ERROR : empty fits_file name parameter passed to CBgFits::ReadFits !\n");
+     return -1;
+  }
+  
+  return status;
+}
+
+int CBgFits::ReadFitsROI( const char* fits_file, int x_start, int y_start, int x_end, int y_end, int step, int bIgnoreHeaderErrors )
+{
+  if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+     printf("DEBUG : ReadFitsROI( %s , (%d,%d)-(%d,%d) , step = %d )\n",fits_file,x_start,y_start,x_end,y_end,step);
+  }
+
+  if( !fits_file || strlen(fits_file) == 0 ){
+     fits_file = m_FileName.c_str();
+  }else{
+     m_FileName = fits_file;
+  }
+  if( m_FileName.length() == 0 ){
+     printf("ERROR : empty fits_file name parameter passed to CBgFits::ReadFitsROI !\n");
+     return -1;
+  }
+
+  fitsfile *fp=0;
+  int status = 0;
+  fits_open_image(&fp, m_FileName.c_str(), READONLY, &status);
+  if( status ){
+     printf("ERROR : could not open FITS file %s , due to error %d\n",m_FileName.c_str(),status);
+     return status;
+  }
+
+  int naxis=0;
+  long axsizes[2] = { 0, 1 };
+  fits_get_img_param(fp, 2, &bitpix, &naxis, axsizes, &status);
+  if( status || naxis < 1 ){
+     printf("ERROR : could not read parameters from FITS file %s, due to error %d\n",m_FileName.c_str(),status);
+     fits_close_file(fp, &status);
+     return ( status ? status : -1 );
+  }
+  int full_x = axsizes[0];
+  int full_y = ( naxis > 1 ? axsizes[1] : 1 );
+
+  // window inside the image, start is moved by whole steps to keep the decimation grid :
+  if( step < 1 ){
+     step = 1;
+  }
+  while( x_start < 0 ){
+     x_start += step;
+  }
+  while( y_start < 0 ){
+     y_start += step;
+  }
+  if( x_end < 0 || x_end > full_x ){
+     x_end = full_x;
+  }
+  if( y_end < 0 || y_end > full_y ){
+     y_end = full_y;
+  }
+  if( x_start >= x_end || y_start >= y_end ){
+     printf("ERROR : window (%d,%d)-(%d,%d) is outside image %s of size %d x %d\n",x_start,y_start,x_end,y_end,m_FileName.c_str(),full_x,full_y);
+     fits_close_file(fp, &status);
+     return -1;
+  }
+  int roi_x = (x_end - x_start + step - 1)/step;
+  int roi_y = (y_end - y_start + step - 1)/step;
+
+  // buffer of the window size (re-used for the next window of the same size) :
+  AllocData( roi_x, roi_y );
+
+  // keywords and row scaling refer to the full image :
+  m_SizeX = full_x;
+  m_SizeY = full_y;
+  m_bROI = false;
+
+  double int16_scale=1.00, int16_zero=0.00;
+  vector<double> row_scale, row_zero;
+  if( ( status = ReadInt16Scaling( fp, bitpix, full_y, int16_scale, int16_zero, row_scale, row_zero ) ) ){
+     fits_close_file(fp, &status);
+     return status;
+  }
+  bool bRowScale = ( row_scale.size() > 0 );
+
+  // only the window is read from disk :
+  vector<long> fpixel( naxis, 1 ), lpixel( naxis, 1 ), inc( naxis, 1 );
+  fpixel[0] = x_start + 1;
+  lpixel[0] = x_end;
+  inc[0]    = step;
+  if( naxis > 1 ){
+     fpixel[1] = y_start + 1;
+     lpixel[1] = y_end;
+     inc[1]    = step;
+  }
+  float nan_value = (0.00/0.00);
+  fits_read_subset(fp, TFLOAT, &(fpixel[0]), &(lpixel[0]), &(inc[0]), ( bitpix == SHORT_IMG ? &nan_value : NULL ), data, NULL, &status);
+  if( status ){
+     printf("ERROR : could not read window (%d,%d)-(%d,%d) from FITS file %s, due to error %d\n",x_start,y_start,x_end,y_end,m_FileName.c_str(),status);
+     fits_close_file(fp, &status);
+     return status;
+  }
+  if( bRowScale ){
+     for(int y=0;y<roi_y;y++){
+        int file_y = y_start + y*step;
+        float* line = data + ((long int)y)*roi_x;
+        for(int x=0;x<roi_x;x++){
+           line[x] = line[x]*row_scale[file_y] + row_zero[file_y];
+        }
      }
+  }
+  if( bitpix == SHORT_IMG && ( int16_scale != 1.00 || int16_zero != 0.00 || bRowScale ) ){
+     bitpix = FLOAT_IMG;
+  }
+
+  status = ReadFitsHeader( fp, bIgnoreHeaderErrors, false );
+
+  m_bROI      = true;
+  m_RoiStartX = x_start;
+  m_RoiStartY = y_start;
+  m_RoiStep   = step;
+  m_FullSizeX = full_x;
+  m_FullSizeY = full_y;
+  m_SizeX     = roi_x;
+  m_SizeY     = roi_y;
+  if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+     printf("INFO : read window (%d,%d)-(%d,%d) step %d = %d x %d pixels of %d x %d image %s\n",x_start,y_start,x_end,y_end,step,roi_x,roi_y,full_x,full_y,m_FileName.c_str());
+  }
+
+  fits_close_file(fp, &status);
+  if( status ){
+     printf("ERROR : could not close FITS file %s, due to error %d\n",m_FileName.c_str(),status);
+     return status;
+  }
+
+  return status;
+}
+
+int CBgFits::ReadFitsTransposed( const char* fits_file, int bIgnoreHeaderErrors )
+{
+  if( !fits_file || strlen(fits_file) == 0 ){
+     fits_file = m_FileName.c_str();
+  }else{
+     m_FileName = fits_file;
+  }
+  if( m_FileName.length() == 0 ){
+     printf("ERROR : empty fits_file name parameter passed to CBgFits::ReadFitsTransposed !\n");
+     return -1;
+  }
 
-     if( inttime <= 0 ){
-        // CDELT2
-        if( strlen(szCDELT2.c_str())>0 ){
-           inttime = atof(szCDELT2.c_str());
-        }else{
-           if( bIgnoreHeaderErrors <= 0 ){
-               printf("WARNING : could not read INTTIME nor CDELT2 to get time resolutions information for file %s\n",fits_file);
-           }
-        }
+  fitsfile *fp=0;
+  int status = 0;
+  fits_open_image(&fp, m_FileName.c_str(), READONLY, &status);
+  if( status ){
+     printf("ERROR : could not open FITS file %s , due to error %d\n",m_FileName.c_str(),status);
+     return status;
+  }
+
+  int naxis=0;
+  long axsizes[2] = { 0, 1 };
+  fits_get_img_param(fp, 2, &bitpix, &naxis, axsizes, &status);
+  if( status || naxis < 1 ){
+     printf("ERROR : could not read parameters from FITS file %s, due to error %d\n",m_FileName.c_str(),status);
+     fits_close_file(fp, &status);
+     return ( status ? status : -1 );
+  }
+  int file_x = axsizes[0];
+  int file_y = ( naxis > 1 ? axsizes[1] : 1 );
+
+  AllocData( file_y, file_x );
+  m_bROI = false;
+  m_SizeX = file_y;
+  m_SizeY = file_x;
+
+  double int16_scale=1.00, int16_zero=0.00;
+  vector<double> row_scale, row_zero;
+  if( ( status = ReadInt16Scaling( fp, bitpix, file_y, int16_scale, int16_zero, row_scale, row_zero ) ) ){
+     fits_close_file(fp, &status);
+     return status;
+  }
+  bool bRowScale = ( row_scale.size() > 0 );
+
+  // block of tile rows is read and its tiles are written as columns of the output image :
+  int tile = ( m_TransposeTile >= 8 ? m_TransposeTile : 8 );
+  vector<float> block( ((long int)tile)*file_x );
+  vector<long> firstpixel( naxis, 1 );
+  float nan_value = (0.00/0.00);
+  for(int y=0;y<file_y && !status;y+=tile){
+     int rows = ( (file_y - y) < tile ? (file_y - y) : tile );
+     if( naxis > 1 ){
+        firstpixel[1] = y + 1;
      }
-     if( dtime_fs <= 0 ){
-        if( strlen(szDATE_UT.c_str()) > 0 ){
-           // meaning that DTIME-FS was not found - try to use format 2016-04-15T00:12:23
-           struct tm _tm;
-           memset( &_tm,'\0',sizeof(struct tm));       
-           strptime(szDATE_UT.c_str(), "%Y-%m-%dT%H:%M:%S", &_tm);
-           double unixtime = (double)timegm( &_tm );
-
-          // add fractional if : %Y-%m-%dT%H:%M:%S.5           
-           const char* p_dot = strstr(szDATE_UT.c_str(),".");
-           if( p_dot ){
-              double extra = atof( p_dot );
-              unixtime += extra;                            
-           }
-           
-           dtime_fs = (int)unixtime;
-           dtime_fu = (unixtime-(int)unixtime)*1e6;                 
-           
-//           printf("%s -> %.2f -> %d / %d\n",szDATE_UT.c_str(), unixtime,dtime_fs,dtime_fu);
-           
-/*           int match = sscanf(szDateTime.c_str(),"%d-%d-%dT%d:%d:%d",&_tm->tm_year,&_tm->tm_mon,&_tm->tm_mday,&_tm->tm_hour,&_tm->tm_min,&_tm->tm_sec);
-           if( match == 6 ){
-              _tm->tm_year = (_tm->tm_year - 1900);            
-               // and months from 1 :
-               _tm->tm_mon--;                              
-           
-              double unixtime = (double)timegm( &_tm );
-              dtime_fs = (int)unixtime;
-              dtime_us = (unixtime-(int)unixtime)*1e6;
-           }else{
-              printf("ERROR : could not parse UT date/time from string %s\n",szDateTime.c_str());
-           }*/
-        }else{
-           if( bIgnoreHeaderErrors <= 0 ){
-               printf("WARNING : cannot get start UT time of the image %s !\n",fits_file);
+     fits_read_pix(fp, TFLOAT, &(firstpixel[0]), ((LONGLONG)rows)*file_x, ( bitpix == SHORT_IMG ? &nan_value : NULL ), &(block[0]), NULL, &status);
+     if( status ){
+        printf("ERROR : could not read rows %d - %d from FITS file %s, due to error %d\n",y,y+rows-1,m_FileName.c_str(),status);
+        break;
+     }
+     if( bRowScale ){
+        for(int r=0;r<rows;r++){
+           float* line = &(block[((long int)r)*file_x]);
+           for(int x=0;x<file_x;x++){
+              line[x] = line[x]*row_scale[y+r] + row_zero[y+r];
            }
         }
      }
-     
-     int sky_int_count = 0;
-     HeaderRecord* szStates = GetKeyword("STATES");
-     if( szStates ){
-        sky_int_count = ParseStates(szStates->Value.c_str());
-     }else{
-        sky_int_count = ParseSkyIntegrations();
+
+     for(int x=0;x<file_x;x+=tile){
+        int cols = ( (file_x - x) < tile ? (file_x - x) : tile );
+        bg_simd_transpose( &(block[x]), file_x, data + ((long int)x)*m_SizeX + y, m_SizeX, rows, cols );
      }
+  }
+  if( status ){
+     int close_status = 0;
+     fits_close_file(fp, &close_status);
+     return status;
+  }
+  if( bitpix == SHORT_IMG && ( int16_scale != 1.00 || int16_zero != 0.00 || bRowScale ) ){
+     bitpix = FLOAT_IMG;
+  }
 
-     if( gBGPrintfLevel >= BG_INFO_LEVEL ){
-        printf("---------------------------------------\n");                                                                                                                 
-        printf("CBgFits::ReadFits %s : read %d header keys\n",fits_file,nkeys);
-        printf("---------------------------------------\n");
-        for(int i=0;i<_fitsHeaderRecords.size();i++){
-           printf("%s = %s\n",_fitsHeaderRecords[i].Keyword.c_str(),_fitsHeaderRecords[i].Value.c_str());
+  // keywords describe the axes of the file (time on axis 1 even without CTYPE keywords) , swapped to the axes of the image in memory :
+  status = ReadFitsHeader( fp, bIgnoreHeaderErrors, true );
+  SwapAxisKeywords();
+  if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+     printf("INFO : read %d x %d image %s transposed to %d x %d\n",file_x,file_y,m_FileName.c_str(),m_SizeX,m_SizeY);
+  }
+
+  fits_close_file(fp, &status);
+  if( status ){
+     printf("ERROR : could not close FITS file %s, due to error %d\n",m_FileName.c_str(),status);
+     return status;
+  }
+
+  return status;
+}
+
+int CBgFits::ReadFitsCube( const char* fits_file, int bAutoDetect, int bReadImage, int bIgnoreHeaderErrors )
+{
+  // header (sizes of the first plane) :
+  int status = ReadFits( fits_file, bAutoDetect, 0, bIgnoreHeaderErrors );
+  if( status ){
+     return status;
+  }
+  
+  CBgFitsCube cube( m_FileName.c_str(), 1 );
+  if( ( status = cube.Open( NULL, 1 ) ) ){
+     return status;
+  }
+  
+  if( bReadImage > 0 ){
+     // planes are stacked along Y axis , plane z is rows [z*NAXIS2,(z+1)*NAXIS2) :
+     int plane_size_y = cube.GetYSize();
+     Realloc( cube.GetXSize(), plane_size_y*cube.GetZSize(), FALSE );
+     image_type = TFLOAT;
+     for(int z=0;z<cube.GetZSize();z++){
+        if( ( status = cube.ReadPlane( z, data + ((long int)z)*m_SizeX*plane_size_y ) ) ){
+           return status;
         }
      }
+  }
+  
+  if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+     printf("INFO : read cube %s of %d x %d x %d pixels\n",m_FileName.c_str(),cube.GetXSize(),cube.GetYSize(),cube.GetZSize());
+  }
+  
+  return status;
+}
 
+static bool bg_is_little_endian()
+{
+   const unsigned int one = 1;
+   return ( *((const unsigned char*)&one) == 1 );
+}
 
-     if( m_AverList.size() == 0 ){
-        m_AverList.push_back( m_FileName.c_str() );
+int CBgFits::ReadFitsMMap( const char* fits_file, int bIgnoreHeaderErrors )
+{
+  if( !fits_file || strlen(fits_file) == 0 ){
+     fits_file = m_FileName.c_str();
+  }
+  string szFileName = fits_file; // fits_file may point to m_FileName which is overwritten by ReadFits
+  
+  if( szFileName.length() == 0 ){
+     printf("ERROR : empty fits_file name parameter passed to CBgFits::ReadFitsMMap !\n");
+     return -1;
+  }
+  
+  // release previous data (the header-only ReadFits below does not free or allocate the image buffer) :
+  if( !m_bExternalData ){
+     FreeData();
+  }
+  data = NULL;
+  m_bExternalData = false;
+  image_type = TFLOAT;
+  
+  // only plain files on disk can be mapped (no extended file name syntax, no compression) :
+  bool bCanMap = ( strchr(szFileName.c_str(),'[') == NULL && strstr(szFileName.c_str(),".gz") == NULL && strstr(szFileName.c_str(),"://") == NULL );
+  
+  LONGLONG headstart=0, datastart=0, dataend=0;
+  if( bCanMap ){
+     fitsfile *fp=0;
+     int status = 0;
+     fits_open_image(&fp, szFileName.c_str(), READONLY, &status);
+     if( status ){
+        printf("ERROR : could not open FITS file %s , due to error %d\n",szFileName.c_str(),status);
+        return status;
      }
      
-     fits_close_file(fp, &status);                     
-     if( status ){ 
-         printf("ERROR : could not close FITS file %s, due to error %d\n",m_FileName.c_str(),status);
-         return status;
-     }     
-  }else{
-     printf("ERROR : empty fits_file name parameter passed to CBgFits::ReadFits !\n");
+     int naxis=0, img_bitpix=0, is_compressed=0;
+     long axsizes[2] = { 0, 1 };
+     fits_get_img_param(fp, 2, &img_bitpix, &naxis, axsizes, &status);
+     is_compressed = fits_is_compressed_image(fp, &status);
+     fits_get_hduaddrll(fp, &headstart, &datastart, &dataend, &status);
+     
+     // BSCALE/BZERO would require conversion of every pixel :
+     double bscale=1.00, bzero=0.00;
+     int key_status=0;
+     fits_read_key(fp, TDOUBLE, "BSCALE", &bscale, NULL, &key_status);
+     key_status=0;
+     fits_read_key(fp, TDOUBLE, "BZERO", &bzero, NULL, &key_status);
+     
+     int close_status=0;
+     fits_close_file(fp, &close_status);
+     
+     if( status || img_bitpix != FLOAT_IMG || naxis<1 || naxis>2 || is_compressed || bscale != 1.00 || bzero != 0.00 ){
+        bCanMap = false;
+     }
+  }
+  
+  if( !bCanMap ){
+     if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+        printf("INFO : FITS file %s cannot be memory mapped -> reading with CBgFits::ReadFits\n",szFileName.c_str());
+     }
+     return ReadFits( szFileName.c_str(), 0, 1, bIgnoreHeaderErrors );
+  }
+
+  // header, image size etc. (image itself not read) :
+  int status = ReadFits( szFileName.c_str(), 0, 0, bIgnoreHeaderErrors );
+  if( status ){
+     return status;
+  }
+  
+  long int sizeXY = ((long int)m_SizeX)*((long int)m_SizeY);
+  size_t data_bytes = sizeXY*sizeof(float);
+  
+  int fd = open( szFileName.c_str(), O_RDONLY );
+  if( fd < 0 ){
+     printf("ERROR : could not open file %s for memory mapping, due to error %s\n",szFileName.c_str(),strerror(errno));
+     return -1;
+  }
+  struct stat file_stat;
+  if( fstat( fd, &file_stat ) || (size_t)file_stat.st_size < (size_t)(datastart + data_bytes) ){
+     printf("ERROR : file %s is too short (%ld bytes) to contain %ld pixels starting at %ld\n",szFileName.c_str(),(long int)file_stat.st_size,sizeXY,(long int)datastart);
+     close( fd );
      return -1;
   }
   
-  return status;
+  // private writable mapping : pages are copied on write (byte-swap) and the file itself is never modified :
+  size_t map_size = datastart + data_bytes;
+  void* ptr = mmap( NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if( ptr == MAP_FAILED ){
+     printf("ERROR : could not memory map file %s (%ld bytes), due to error %s\n",szFileName.c_str(),(long int)map_size,strerror(errno));
+     return -1;
+  }
+  // pages are swapped sequentially :
+  madvise( ptr, map_size, MADV_SEQUENTIAL );
+  
+  m_pMMapBase = ptr;
+  m_MMapSize  = map_size;
+  data = (BG_FITS_DATA_TYPE*)( ((char*)ptr) + datastart ); // data unit starts at a multiple of 2880 bytes -> aligned for float
+  
+  // FITS data are big-endian -> nothing to be done on big-endian machines. All pixels are swapped here, so that every access
+  // to data (also direct) sees native values :
+  if( bg_is_little_endian() ){
+     unsigned int* words = (unsigned int*)data;
+     for(long int i=0;i<sizeXY;i++){
+        words[i] = __builtin_bswap32( words[i] );
+     }
+  }
+  
+  if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+     printf("INFO : FITS file %s memory mapped (%d x %d image at offset %ld)\n",szFileName.c_str(),m_SizeX,m_SizeY,(long int)datastart);
+  }
+  
+  return 0;
 }
 
 void CBgFits::SetKeyValues()
@@ -1063,13 +2062,63 @@ void CBgFits::SetKeyValues()
    }
 }
 
-HeaderRecord* CBgFits::GetKeyword(const char *keyword)
+void CBgFits::RebuildHeaderIndex()
 {
+   _headerKeywordMap.clear();
+   m_FlaggedIntegrations.clear();
    for(int i=0;i<_fitsHeaderRecords.size();i++){
-      if( strcmp(_fitsHeaderRecords[i].Keyword.c_str(), keyword ) == 0 ){
-         return &(_fitsHeaderRecords[i]);
+      HeaderRecord& rec = _fitsHeaderRecords[i];
+      _headerKeywordMap.insert( pair<string,int>(rec.Keyword,i) ); // first record with given keyword is kept
+      
+      if( strcasecmp(rec.Keyword.c_str(),"flag")==0 ){
+         m_FlaggedIntegrations.insert( atol(rec.Value.c_str()) );
+      }
+   }
+   m_bHeaderIndexValid = true;
+}
+
+void CBgFits::AddHeaderRecord( const HeaderRecord& rec )
+{
+   _fitsHeaderRecords.push_back(rec);
+   if( m_bHeaderIndexValid ){
+      _headerKeywordMap.insert( pair<string,int>(rec.Keyword,_fitsHeaderRecords.size()-1) );
+      
+      if( strcasecmp(rec.Keyword.c_str(),"flag")==0 ){
+         m_FlaggedIntegrations.insert( atol(rec.Value.c_str()) );
       }
    }
+}
+
+int CBgFits::FindKeywordIndex( const char* keyword )
+{
+   if( !m_bHeaderIndexValid ){
+      RebuildHeaderIndex();
+   }
+   
+   unordered_map<string,int>::iterator it = _headerKeywordMap.find( keyword );
+   if( it == _headerKeywordMap.end() ){
+      return -1;
+   }
+   
+   return it->second;
+}
+
+void CBgFits::SetHeaderFilter( const char* szKeywords )
+{
+   m_HeaderKeywordsFilter.clear();
+   if( szKeywords && strlen(szKeywords) ){
+      char* szTmpList = strdup( szKeywords );
+      ParseCommaList( szTmpList , m_HeaderKeywordsFilter );
+      free( szTmpList );
+   }
+}
+
+HeaderRecord* CBgFits::GetKeyword(const char *keyword)
+{
+   int idx = FindKeywordIndex( keyword );
+   if( idx >= 0 ){
+      return &(_fitsHeaderRecords[idx]);
+   }
    
    return NULL;
 }
@@ -1113,11 +2162,13 @@ void CBgFits::SetKeyword(const char *keyword, int new_value ){
 void CBgFits::SetKeyword(const char *keyword, const char* new_value, char keytype, const char* comment )
 {
    if( keyword && strlen(keyword) && new_value && strlen(new_value) ){
-      for(int i=0;i<_fitsHeaderRecords.size();i++){
-        if( strcmp(_fitsHeaderRecords[i].Keyword.c_str(), keyword ) == 0 ){
-           _fitsHeaderRecords[i].Value = new_value;
-           return;
-        }
+      int idx = FindKeywordIndex( keyword );
+      if( idx >= 0 ){
+         _fitsHeaderRecords[idx].Value = new_value;
+         if( strcasecmp(keyword,"flag")==0 ){
+            InvalidateHeaderIndex();
+         }
+         return;
       }
       
       HeaderRecord new_rec;
@@ -1127,31 +2178,26 @@ void CBgFits::SetKeyword(const char *keyword, const char* new_value, char keytyp
       if( comment && strlen(comment) ){
          new_rec.Comment = comment;
       }
-      _fitsHeaderRecords.push_back(new_rec);
+      AddHeaderRecord(new_rec);
    }
 }
 
 CBgFits& CBgFits::add_squared(const CBgFits& right)
 {
+   PrepareData();
+   ((CBgFits&)right).PrepareData();
     if( data && right.data && m_SizeX==right.m_SizeX && m_SizeY==right.m_SizeY ){
-        int sizeXY=m_SizeX*m_SizeY;
-      
-      for(int i=0;i<sizeXY;i++){
-         data[i] = data[i] + (right.data[i] * right.data[i]);
-      }
-
+      bg_simd_binary( eSimdAddSquared, data, right.data, ((long)m_SizeX)*m_SizeY );
     }    
     return (*this);
 }
 
 CBgFits& CBgFits::operator+=(const CBgFits& right)
 {
+   PrepareData();
+   ((CBgFits&)right).PrepareData();
    if( data && right.data && m_SizeX==right.m_SizeX && m_SizeY==right.m_SizeY ){
-      int sizeXY=m_SizeX*m_SizeY;
-      
-      for(int i=0;i<sizeXY;i++){
-         data[i] = data[i] + right.data[i];
-      }
+      bg_simd_binary( eSimdAdd, data, right.data, ((long)m_SizeX)*m_SizeY );
    } 
    
    inttime += right.inttime;
@@ -1167,7 +2213,7 @@ void CBgFits::NormalizeY()
    
    for(int y=0;y<GetYSize();y++){
       for(int x=0;x<GetXSize();x++){
-         col_avg[y] += getXY(x,y);
+         col_avg[y] += valXY_auto(x,y);
       }
       
       col_avg[y] = col_avg[y] / GetXSize();
@@ -1181,8 +2227,8 @@ void CBgFits::NormalizeY()
       double norm_val = col_avg[y];
    
       for(int x=0;x<GetXSize();x++){
-         double val = getXY(x,y);
-         setXY( x, y, val/norm_val );
+         double val = valXY_auto(x,y);
+         setXY_auto( x, y, val/norm_val );
       }
    }   
    
@@ -1203,7 +2249,7 @@ void CBgFits::NormalizeX()
    
    for(int ch=0;ch<n_ch;ch++){
       for(int t=0;t<n_times;t++){
-         line_avg[ch] += getXY(ch,t);
+         line_avg[ch] += valXY_auto(ch,t);
       }
       
       line_avg[ch] = line_avg[ch] / n_times;
@@ -1216,8 +2262,8 @@ void CBgFits::NormalizeX()
       double norm_val = line_avg[ch];
    
       for(int t=0;t<n_times;t++){
-         double val = getXY(ch,t);
-         setXY( ch, t, val/norm_val );
+         double val = valXY_auto(ch,t);
+         setXY_auto( ch, t, val/norm_val );
       }
    }   
 
@@ -1233,12 +2279,9 @@ void CBgFits::NormalizeX()
 
 void CBgFits::Normalize(double norm_factor)
 {
+   PrepareData();
    if( data ){
-      int sizeXY=m_SizeX*m_SizeY;
-      
-      for(int i=0;i<sizeXY;i++){
-         data[i] = data[i] / norm_factor;
-      }
+      bg_simd_unary( eSimdDivideConst, data, ((long)m_SizeX)*m_SizeY, norm_factor );
    }
 }
 
@@ -1250,36 +2293,49 @@ float CBgFits::valXY( int x, int y )
    }   
    return -1;*/
    
+   if( m_bROI ){
+      // coordinates of the full image -> pixel in the window read by ReadFitsROI :
+      x -= m_RoiStartX;
+      y -= m_RoiStartY;
+      if( x<0 || y<0 || (x % m_RoiStep) || (y % m_RoiStep) ){
+         return (0.00/0.00);
+      }
+      x /= m_RoiStep;
+      y /= m_RoiStep;
+   }
+   
    return valXY_auto(x,y);
 }
 
 char CBgFits::valXY_char( int x, int y )
 {
-   int pos = y*m_SizeX + x;
-   char* data_char = (char*)data;
-   // WRONG : if( pos>=0 && pos < (m_SizeX*m_SizeY) ){
-   if( x>=0 && y>=0 && x<m_SizeX && y<m_SizeY ){
-      return data_char[pos];      
+   // 8-bit images are converted to float when read (natively stored by CBgImageU8) :
+   return (char)valXY_auto(x,y);
+}
+
+float CBgFits::setXY( int x, int y, float value )
+{
+   if( m_bROI ){
+      // coordinates of the full image -> pixel in the window read by ReadFitsROI (pixels outside are not stored) :
+      x -= m_RoiStartX;
+      y -= m_RoiStartY;
+      if( x<0 || y<0 || (x % m_RoiStep) || (y % m_RoiStep) ){
+         return (0.00/0.00);
+      }
+      x /= m_RoiStep;
+      y /= m_RoiStep;
    }
-   
-   // was -1 , but it does not make sense as it is perfectly valid value NaN is better    
-   return (0.00/0.00); // NaN is more robust way of returning None/NULL like value, checked with isnan or fpclassify(val) == FP_NAN , test code /home/msok/bighorns/software/analysis/test/nan.cpp
+
+   return setXY_auto(x,y,value);
 }
 
 float CBgFits::valXY_auto( int x, int y )
 {
+   PrepareRow(y);
    int pos = y*m_SizeX + x;
    
-   if( image_type == TBYTE ){
-      char* data_char = (char*)data;
-      // WRONG : if( pos>=0 && pos < (m_SizeX*m_SizeY) ){ - it can allow x>m_SizeX !!!
-      if( x>=0 && y>=0 && x<m_SizeX && y<m_SizeY ){
-         return (float)(data_char[pos]);
-      }
-   }else{
-      if( pos>=0 && pos < (m_SizeX*m_SizeY) ){
-         return data[pos];      
-      }
+   if( pos>=0 && pos < (m_SizeX*m_SizeY) ){
+      return data[pos];      
    }
       
    // was -1 , but it does not make sense as it is perfectly valid value NaN is better    
@@ -1290,7 +2346,7 @@ int CBgFits::setY( int y, float value )
 {
    int ret=0;
    for(int x=0;x<m_SizeX;x++){
-      setXY(x,y,value);
+      setXY_auto(x,y,value);
       ret++;
    }
    
@@ -1299,6 +2355,7 @@ int CBgFits::setY( int y, float value )
 
 float CBgFits::addXY( int x, int y, float value )
 {
+   PrepareRow(y);
    int pos = y*m_SizeX + x;
    // WRONG : if( pos>=0 && pos < (m_SizeX*m_SizeY) ){ - it can allow x>m_SizeX !!!
    if( x>=0 && y>=0 && x<m_SizeX && y<m_SizeY ){
@@ -1310,8 +2367,9 @@ float CBgFits::addXY( int x, int y, float value )
    return (0.00/0.00); // NaN is more robust way of returning None/NULL like value, checked with isnan or fpclassify(val) == FP_NAN , test code /home/msok/bighorns/software/analysis/test/nan.cpp
 }
 
-float CBgFits::setXY( int x, int y, float value )
+float CBgFits::setXY_auto( int x, int y, float value )
 {
+   PrepareRow(y);
    int pos = y*m_SizeX + x;
    // WRONG : if( pos>=0 && pos < (m_SizeX*m_SizeY) ){  - it can allow x>m_SizeX !!!
    if( x>=0 && y>=0 && x<m_SizeX && y<m_SizeY ){
@@ -1325,6 +2383,7 @@ float CBgFits::setXY( int x, int y, float value )
 
 float* CBgFits::set_line( int y, float* buffer )
 {
+   PrepareRow(y);
    int pos = y*m_SizeX;
    if( buffer ){
       if( y < m_SizeY ){
@@ -1340,6 +2399,7 @@ float* CBgFits::set_line( int y, float* buffer )
 
 float* CBgFits::set_line( int y, CBgArray& line )
 {
+   PrepareRow(y);
    int pos = y*m_SizeX;
    
    if( m_SizeX != line.size() ){
@@ -1356,6 +2416,7 @@ float* CBgFits::set_line( int y, CBgArray& line )
 
 float* CBgFits::set_line( int y, vector<cValue>& line )
 {
+   PrepareRow(y);
    int pos = y*m_SizeX;
    
    if( m_SizeX != line.size() ){
@@ -1372,6 +2433,7 @@ float* CBgFits::set_line( int y, vector<cValue>& line )
 
 float* CBgFits::set_line( int y, vector<double>& line )
 {
+   PrepareRow(y);
    int pos = y*m_SizeX;
    
    if( m_SizeX != line.size() ){
@@ -1389,6 +2451,7 @@ float* CBgFits::set_line( int y, vector<double>& line )
 
 float* CBgFits::set_reim_line( int y, vector<double>& line_re, vector<double>& line_im )
 {
+   PrepareRow(y);
    int pos = y*m_SizeX;
    
    if( m_SizeX != (line_re.size()*2) ){
@@ -1413,6 +2476,7 @@ float* CBgFits::set_reim_line( int y, vector<double>& line_re, vector<double>& l
 
 float CBgFits::value( int y, int x )
 {
+   PrepareRow(y);
    int pos = y*m_SizeX + x;
    // WRONG : if( pos>=0 && pos < (m_SizeX*m_SizeY) ){
    if( x>=0 && y>=0 && x<m_SizeX && y<m_SizeY ){
@@ -1430,6 +2494,7 @@ float* CBgFits::get_line( int y )
       return NULL;
    }
 
+   PrepareRow(y);
    int pos = y*m_SizeX;         
    return &(data[pos]);
 }
@@ -1438,7 +2503,7 @@ float* CBgFits::get_line( int y, CBgArray& buffer )
 {
    buffer.alloc( GetXSize() , 0 );
    for(int x=0;x<GetXSize();x++){
-      buffer[x] = getXY(x,y);
+      buffer[x] = valXY_auto(x,y);
    }
    
    return get_line(y);
@@ -1449,16 +2514,11 @@ float* CBgFits::get_line( int y, float* buffer ){
       printf("ERROR : requested line %d >= size = %d\n",y,m_SizeY);
       return NULL;
    }
+   PrepareRow(y);
 
    int pos = y*m_SizeX;
    if( buffer ){
-      if( image_type == TBYTE ){
-         for(int x=0;x<GetXSize();x++){
-            buffer[x] = getXY(x,y);
-         }
-      }else{
-         memcpy(buffer,&(data[pos]),m_SizeX*sizeof(float));
-      }
+      memcpy(buffer,&(data[pos]),m_SizeX*sizeof(float));
    }
    
    return buffer;
@@ -1488,15 +2548,14 @@ double CBgFits::GetUnixTime(int y)
 
 void CBgFits::Multiply( CBgFits& right )
 {
-   int size = m_SizeX*m_SizeY;
-   
-   for(int i=0;i<size;i++){
-      data[i] = (data[i] * right.data[i]);
-   }
+   PrepareData();
+   right.PrepareData();
+   bg_simd_binary( eSimdMultiply, data, right.data, ((long)m_SizeX)*m_SizeY );
 }
 
 double CBgFits::Sum()
 {
+   PrepareData();
    double sum = 0.00;
    int size = m_SizeX*m_SizeY;
    
@@ -1509,62 +2568,46 @@ double CBgFits::Sum()
 
 void CBgFits::AddImages( CBgFits& right, double mult_const )
 {
-   int size = m_SizeX*m_SizeY;
+   PrepareData();
+   right.PrepareData();
+   double val = valXY_auto(82,101);
    
-   double val = getXY(82,101);
-   
-   for(int i=0;i<size;i++){
-      data[i] = (data[i] + right.data[i]) * mult_const;
-   }
+   bg_simd_binary( eSimdAddMult, data, right.data, ((long)m_SizeX)*m_SizeY, mult_const );
    
    if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
-      printf("DEBUG : (%.4f + %.4f)/2 = %.4f\n",val,right.getXY(82,101),getXY(82,101));
+      printf("DEBUG : (%.4f + %.4f)/2 = %.4f\n",val,right.getXY(82,101),valXY_auto(82,101));
    }   
 }
 
 void CBgFits::SEFD_XX_YY( CBgFits& right )
 {
-   int size = m_SizeX*m_SizeY;
-   
-   for(int i=0;i<size;i++){
-      double xx_val = data[i];
-      double yy_val = right.data[i];
-      
-      double out_val = 0.5*sqrt( xx_val*xx_val + yy_val*yy_val );
-      data[i] = out_val;       
-   }
+   PrepareData();
+   right.PrepareData();
+   // 0.5*sqrt( xx*xx + yy*yy ) :
+   bg_simd_binary( eSimdSEFD, data, right.data, ((long)m_SizeX)*m_SizeY );
 }
 
 void CBgFits::SEFD2AOT()
 {
-   int size = m_SizeX*m_SizeY;
-   
-   for(int i=0;i<size;i++){
-      double sefd = data[i];
-      
-      double aot = (2.00*1380.00)/sefd;
-      data[i] = aot;       
-   }
+   PrepareData();
+   // aot = (2.00*1380.00)/sefd :
+   bg_simd_unary( eSimdConstOver, data, ((long)m_SizeX)*m_SizeY, 2.00*1380.00 );
 }
 
 
 
 void CBgFits::Subtract( CBgFits& right )
 {
-   int size = m_SizeX*m_SizeY;
-   
-   for(int i=0;i<size;i++){
-      data[i] = (data[i] - right.data[i]);
-   }
+   PrepareData();
+   right.PrepareData();
+   bg_simd_binary( eSimdSubtract, data, right.data, ((long)m_SizeX)*m_SizeY );
 }
 
 void CBgFits::ComplexMag( CBgFits& right )
 {
-   int size = m_SizeX*m_SizeY;
-   
-   for(int i=0;i<size;i++){
-      data[i] = (data[i]*data[i] + right.data[i]*right.data[i]);
-   }
+   PrepareData();
+   right.PrepareData();
+   bg_simd_binary( eSimdComplexMag, data, right.data, ((long)m_SizeX)*m_SizeY );
 }
 
 int CBgFits::SubtractColumn( CBgArray& column )
@@ -1575,12 +2618,9 @@ int CBgFits::SubtractColumn( CBgArray& column )
    }
    
    for(int y=0;y<m_SizeY;y++){
-      double y_value = column[y];
-      
-      for(int x=0;x<m_SizeX;x++){
-         double new_val = getXY(x,y) - y_value;
-         setXY(x,y,new_val);
-      }
+      PrepareRow(y);
+      // value - y_value is the same as value + (-y_value) :
+      bg_simd_unary( eSimdAddConst, data + ((long)y)*m_SizeX, m_SizeX, -column[y] );
    }
    
    return m_SizeY;
@@ -1595,8 +2635,8 @@ int CBgFits::SubtractSpectrum( CBgArray& spectrum )
    
    for(int y=0;y<m_SizeY;y++){
       for(int x=0;x<m_SizeX;x++){
-         double new_val = getXY(x,y) - spectrum[x];
-         setXY(x,y,new_val);
+         double new_val = valXY_auto(x,y) - spectrum[x];
+         setXY_auto(x,y,new_val);
       }
    }
    
@@ -1613,7 +2653,7 @@ int CBgFits::DivideBySpectrum( vector<cValue>& spectrum )
 
    for(int y=0;y<m_SizeY;y++){
       for(int x=0;x<m_SizeX;x++){
-         double fits_val = getXY(x,y);
+         double fits_val = valXY_auto(x,y);
          double spec_val=0;
          if( bInterpol > 0 ){
             double freq = ch2freq(x);
@@ -1623,7 +2663,7 @@ int CBgFits::DivideBySpectrum( vector<cValue>& spectrum )
          }
          
          double new_val = fits_val / spec_val;
-         setXY(x,y,new_val);
+         setXY_auto(x,y,new_val);
       }
    }   
    
@@ -1634,6 +2674,8 @@ int CBgFits::DivideBySpectrum( vector<cValue>& spectrum )
 
 void CBgFits::RMS( int n_count, CBgFits& right )
 {
+   PrepareData();
+   right.PrepareData();
    int size = m_SizeX*m_SizeY;
    
    for(int i=0;i<size;i++){
@@ -1652,30 +2694,24 @@ void CBgFits::HorFlip()
       
       for(int x=0;x<buffer.size();x++){
          int x_new = GetXSize()-1-x;
-         setXY(x_new,y,buffer[x]);
+         setXY_auto(x_new,y,buffer[x]);
       }
    }
 }
 
 void CBgFits::Divide( CBgFits& right )
 {
-   int size = m_SizeX*m_SizeY;
-   
-   for(int i=0;i<size;i++){
-      if ( right.data[i] != 0.00 ){
-         data[i] = (data[i] / right.data[i]);
-      }
-   }
+   PrepareData();
+   right.PrepareData();
+   // pixels where right image is 0 are not changed :
+   bg_simd_binary( eSimdDivide, data, right.data, ((long)m_SizeX)*m_SizeY );
 }
 
 
 void CBgFits::Divide( double value )
 {
-   int size = m_SizeX*m_SizeY;
-   
-   for(int i=0;i<size;i++){
-      data[i] = (data[i] / value);
-   }
+   PrepareData();
+   bg_simd_unary( eSimdDivideConst, data, ((long)m_SizeX)*m_SizeY, value );
 }
 
 void CBgFits::AvgChannels(int n_channels, CBgFits& outfits )
@@ -1696,7 +2732,7 @@ void CBgFits::AvgChannels(int n_channels, CBgFits& outfits )
          int added_channels=0;
          double sum=0;
          while( added_channels < n_channels && xx<m_SizeX ){
-            sum += valXY(xx,y);
+            sum += valXY_auto(xx,y);
             added_channels++;
             xx++; 
          }
@@ -1718,7 +2754,7 @@ bool CBgFits::Offset( double dx, double dy, CBgFits& out_fits, double multiplier
    
    for(int y=0;y<m_SizeY;y++){
       for(int x=0;x<m_SizeY;x++){
-         double val = getXY( x , y );
+         double val = valXY_auto( x , y );
          int dx_int = int( double( dx ) );
          int dy_int = int( double( dy ) );
          
@@ -1732,6 +2768,8 @@ bool CBgFits::Offset( double dx, double dy, CBgFits& out_fits, double multiplier
 
 int CBgFits::Compare( CBgFits& right, float min_diff, int verb )
 {
+   PrepareData();
+   right.PrepareData();
    if( m_SizeX!=right.m_SizeX || m_SizeY!=right.m_SizeY ){
       printf("RESULT : image sizes differ %dx%d != %dx%d\n",m_SizeX,m_SizeY,right.m_SizeX,right.m_SizeY);
       return 1;
@@ -1775,8 +2813,8 @@ void CBgFits::SubtractLines( int y1, int y0, const char* outfile)
       outf = fopen(outfile,"w");
    }
    for(int x=0;x<m_SizeX;x++){
-      double val1 = valXY(x,y1);
-      double val0 = valXY(x,y0);
+      double val1 = valXY_auto(x,y1);
+      double val0 = valXY_auto(x,y0);
       double diff = val1 - val0;
       double freq = x*(480.000/4096.00);
       if(outf){
@@ -1797,8 +2835,8 @@ void CBgFits::DivideLines( int y1, int y0, const char* outfile )
       outf = fopen(outfile,"w");
    }
    for(int x=0;x<m_SizeX;x++){
-      double val1 = valXY(x,y1);
-      double val0 = valXY(x,y0);
+      double val1 = valXY_auto(x,y1);
+      double val0 = valXY_auto(x,y0);
       double ratio = val1 / val0;
       double freq = x*(480.000/4096.00);
       if(outf){
@@ -1817,7 +2855,7 @@ double CBgFits::MeanColumn( int x , double* out_rms )
     int count=0;
     
     for(int y=0;y<GetYSize();y++){
-        double val = getXY(x,y);
+        double val = valXY_auto(x,y);
         mean_column += val;
         sum2 += val*val;
         
@@ -1859,7 +2897,7 @@ double CBgFits::GetStat( double& mean, double& rms, double& minval, double& maxv
    int non_zero_count=0;
    for(int y=y_start;y<y_end;y++){
        for(int x=x_start;x<x_end;x++){
-           double val = valXY(x,y);
+           double val = valXY_auto(x,y);
            total_count++;
                       
            if ( isnan(val) || isinf(val) ){
@@ -1900,12 +2938,19 @@ double CBgFits::GetStat( double& mean, double& rms, double& minval, double& maxv
 double CBgFits::GetStatRadiusAll( double& mean, double& rms, double& minval, double& maxval, 
                                   double& median, double& iqr, double& rms_iqr, int& cnt, int radius, 
                                   bool do_iqr /* = true */,
-                                  int xc /*= -1*/, int yc /* = -1 */, int gDebugLevel /* = 0 */  )
+                                  int xc /*= -1*/, int yc /* = -1 */, int gDebugLevel /* = 0 */, double approx /* = BG_APPROX_DEFAULT */ )
+{
+   // spans of the last radius used are kept for the next calls (one aperture per thread) :
+   static thread_local CBgAperture aperture;
+   aperture.Init( radius );
+
+   return GetStatRadiusAll( aperture, mean, rms, minval, maxval, median, iqr, rms_iqr, cnt, do_iqr, xc, yc, gDebugLevel, approx );
+}
+
+double CBgFits::GetStatRadiusAll( CBgAperture& aperture, double& mean, double& rms, double& minval, double& maxval,
+                                  double& median, double& iqr, double& rms_iqr, int& cnt,
+                                  bool do_iqr, int xc, int yc, int gDebugLevel, double approx )
 {
-   double sum = 0.00;
-   double sum2 = 0.00;
-   cnt  = 0;
-   
    minval = 1e6;
    maxval = -1e6;
    iqr = 0.00;
@@ -1922,78 +2967,80 @@ double CBgFits::GetStatRadiusAll( double& mean, double& rms, double& minval, dou
        center_y = yc;
    }
 
-   int x_start = (center_x - radius);
-   int y_start = (center_y - radius);
-   
-   int x_end   = (center_x + radius);
-   int y_end   = (center_y + radius);
-   
-   int max_count = (y_end - y_start + 1)*(x_end - x_start + 1);
-   double* values = NULL;
-   if ( do_iqr ){
-//      printf("DEBUG : allocating max_count = %d ( %d x %d , from %d pixels around (%d,%d) )\n",max_count,(y_end - y_start + 1),(x_end - y_start + 1),radius,center_x,center_y);
-      values = new double[max_count];
+   CBgTDigest* digest = NULL;
+   vector<double>* values = NULL;
+   double compression = bg_approx_compression( approx );
+   if( do_iqr && compression > 0 ){
+      digest = new CBgTDigest( compression );
+   }else if ( do_iqr ){
+      values = &(aperture.m_Values);
+      values->clear();
+   }
+   
+   // statistics of contiguous parts of rows inside the image :
+   PrepareData();
+   cBgSimdStat stat;
+   bg_simd_stat_init( stat );
+   for(int s=0;s<aperture.m_Spans.size();s++){
+      const cApertureSpan& span = aperture.m_Spans[s];
+      int y = center_y + span.dy;
+      if( y < 0 || y >= m_SizeY ){
+         continue;
+      }
+      int x_start = max( center_x + span.dx_start, 0 );
+      int x_end = min( center_x + span.dx_end, m_SizeX );
+      if( x_end <= x_start ){
+         continue;
+      }
+
+      const float* row = data + ((long)y)*m_SizeX;
+      bg_simd_stat( row + x_start, x_end - x_start, stat );
+
+      if( values || digest ){
+         for(int x=x_start;x<x_end;x++){
+            double val = row[x];
+            if ( isnan(val) || isinf(val) ){
+               continue;
+            }
+            if( values ){
+               values->push_back( val );
+            }else{
+               digest->Add( val );
+            }
+         }
+      }
    }
-   
-   int nan_count = 0, total_count = 0;   
-   for(int y=y_start;y<y_end;y++){
-       for(int x=x_start;x<x_end;x++){
-           if ( x>=0 && x<m_SizeX && y>=0 && y<m_SizeY ){
-              double distance = sqrt( (x-center_x)*(x-center_x) + (y-center_y)*(y-center_y) );
-              
-              if( distance <= radius ){           
-                 double val = valXY(x,y);
-                 total_count++;
-                      
-                 if ( isnan(val) || isinf(val) ){
-                    nan_count++;
-                    continue;
-                 }
-                 
-                 if( values ){
-                    if ( cnt < max_count ){
-                       values[cnt] = val;
-                    }else{
-                       printf("ERROR : cnt = %d >= max_count allocated = %d -> skipped !!!\n",cnt,max_count);
-                       continue;
-                    }
-                 }
-
-                 sum  += val;
-                 sum2 += val*val;
-                 cnt  += 1;                    
-           
-                 if( val > maxval ){
-                     maxval = val;
-                 }
-                 if( val < minval ){
-                     minval = val;
-                 }
-              }
-           }
-       }
+
+   double sum2 = 0.00;
+   double sum = bg_simd_stat_sum( stat, sum2 );
+   cnt = stat.count;
+   if( stat.count > 0 ){
+      minval = min( minval, stat.minval );
+      maxval = max( maxval, stat.maxval );
    }
    
    mean = sum / cnt;
    rms  = sqrt( sum2/cnt - mean*mean );
 
-   if( nan_count > 0 ){
+   if( stat.nan_count > 0 ){
       if ( gDebugLevel > 0 ){
-         printf("WARNING : %d / %d are NaN values found and ignored\n",nan_count,total_count);
+         printf("WARNING : %ld / %ld are NaN values found and ignored\n",stat.nan_count,(stat.nan_count+stat.count));
       }
    }
    
    if( values ){
-      int q75= int(cnt*0.75);
-      int q25= int(cnt*0.25);
-
-   
-      my_sort_float( values, cnt );
-      median = values[ cnt / 2 ];
-      iqr = values[q75] - values[q25];
+      double q25, q75;
+      bg_median_iqr( &((*values)[0]), values->size(), median, q25, q75 );
+      iqr = q75 - q25;
       rms_iqr = iqr / 1.35;
-   
-      delete [] values;
+   }
+   if( digest ){
+      double q25, q75;
+      digest->MedianIQR( median, q25, q75 );
+      iqr = q75 - q25;
+      rms_iqr = iqr / 1.35;
+
+      delete digest;
    }
    
    return 0.00;
@@ -2002,63 +3049,110 @@ double CBgFits::GetStatRadiusAll( double& mean, double& rms, double& minval, dou
 
 double CBgFits::GetStatRadius( double& mean, double& rms, double& minval, double& maxval, int radius  )
 {
-   double sum = 0.00;
-   double sum2 = 0.00;
-   int    cnt  = 0;
-   
-   minval = 1e6;
-   maxval = -1e6;
+   double median, iqr, rms_iqr;
+   int cnt = 0;
+
+   static thread_local CBgAperture aperture;
+   aperture.Init( radius );
+   GetStatRadiusAll( aperture, mean, rms, minval, maxval, median, iqr, rms_iqr, cnt, false, -1, -1, 1 );
+
+   return 0.00;
+}
+
+
+
+// threads used for images of size pixels , n_threads <= 0 -> number of CPUs (at most CBgFits::m_MaxThreads when set) :
+static int bg_threads_count( int n_threads, long size )
+{
+   if( n_threads <= 0 ){
+      n_threads = sysconf( _SC_NPROCESSORS_ONLN );
+      if( CBgFits::m_MaxThreads > 0 && n_threads > CBgFits::m_MaxThreads ){
+         n_threads = CBgFits::m_MaxThreads;
+      }
+   }
+   // threads are not worth starting for small images :
+   if( size < 1000000 ){
+      n_threads = 1;
+   }
+   if( n_threads < 1 ){
+      n_threads = 1;
+   }
+
+   return n_threads;
+}
+
+// rows [y_start,y_end) of the image, selected rows (mask) added to per-channel statistics :
+struct cStatJob
+{
+   const float* data;
+   const float* flags;
+   const unsigned char* mask;
+   int sizeX;
+   int y_start;
+   int y_end;
+   double min_acceptable_value;
+   CBgSpectrumStat stat;
+};
+
+static void bg_stat_rows( cStatJob* job )
+{
+   job->stat.Init( job->sizeX );
+   for(int y=job->y_start;y<job->y_end;y++){
+      long offset = ((long)y)*job->sizeX;
+      const float* row = job->data + offset;
+      job->stat.AddToTotal( row );
+
+      if( job->mask[y] ){
+         job->stat.AddRow( row, y, ( job->flags ? job->flags + offset : NULL ), job->min_acceptable_value );
+      }
+   }
+}
 
-   int center_x = m_SizeX/2;
-   int center_y = m_SizeY/2;
+static void* bg_stat_thread( void* ptr )
+{
+   bg_stat_rows( (cStatJob*)ptr );
+   return NULL;
+}
 
-   int x_start = (center_x - radius);
-   int y_start = (center_y - radius);
-   
-   int x_end   = (center_x + radius);
-   int y_end   = (center_y + radius);
-   
-   int nan_count = 0, total_count = 0;   
-   for(int y=y_start;y<y_end;y++){
-       for(int x=x_start;x<x_end;x++){
-           if ( x>=0 && x<m_SizeX && y>=0 && y<m_SizeY ){
-              double distance = sqrt( (x-center_x)*(x-center_x) + (y-center_y)*(y-center_y) );
-              
-              if( distance <= radius ){           
-                 double val = valXY(x,y);
-                 total_count++;
-                      
-                 if ( isnan(val) || isinf(val) ){
-                    nan_count++;
-                    continue;
-                 }
-
-                 sum  += val;
-                 sum2 += val*val;
-                 cnt  += 1;                    
-           
-                 if( val > maxval ){
-                     maxval = val;
-                 }
-                 if( val < minval ){
-                     minval = val;
-                 }
-              }
-           }
-       }
+int CBgFits::GetStateMask( vector<unsigned char>& mask, int start_int, int end_int, const char* szState )
+{
+   if( end_int < 0 || end_int > m_SizeY ){
+      end_int = m_SizeY;
    }
-   
-   mean = sum / cnt;
-   rms  = sqrt( sum2/cnt - mean*mean );
+   if( start_int < 0 ){
+      start_int = 0;
+   }
+   bool bAll = ( !szState || !szState[0] );
+   mask.assign( m_SizeY + 1, ( bAll ? 1 : 0 ) );
 
-   if( nan_count > 0 ){
-      printf("WARNING : %d / %d are NaN values found and ignored\n",nan_count,total_count);
+   if( !bAll ){
+      // ranges in reverse order, so that the first range containing an integration decides (as in GetRange) :
+      for(int i=((int)m_IntegrationRanges.size())-1;i>=0;i--){
+         cIntRange& range = m_IntegrationRanges[i];
+         unsigned char value = ( strcmp( range.m_szName.c_str(), szState ) == 0 ? 1 : 0 );
+         int y_start = ( range.start_int > 0 ? range.start_int : 0 );
+         int y_end = ( range.end_int < m_SizeY ? range.end_int : (m_SizeY-1) );
+         for(int y=y_start;y<=y_end;y++){
+            mask[y] = value;
+         }
+      }
    }
-   
-   return 0.00;
-}
 
+   int count = 0;
+   for(int y=0;y<m_SizeY;y++){
+      if( y < start_int || y >= end_int ){
+         mask[y] = 0;
+      }
+      if( mask[y] ){
+         count++;
+         if( !bAll && gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+            printf("Integration %d used\n",y);
+         }
+      }
+   }
 
+   return count;
+}
 
 double CBgFits::GetStat( CBgArray& avg_spectrum, CBgArray& rms_spectrum, 
                          int start_int, int end_int, const char* szState,
@@ -2077,204 +3171,56 @@ double CBgFits::GetStat( CBgArray& avg_spectrum, CBgArray& rms_spectrum,
       end_int = m_SizeY;
    }
 
-   long double sum=0.00,sum2=0.00,minval=10000000.00,maxval=-100000000.00;
-   int size = m_SizeX*m_SizeY;
-    
-   int count=0,minpos=-1,maxpos=-1;
-   int n_int=0;
-
-   for(int y=start_int;y<end_int;y++){
-      if( szState && szState[0] ){
-         int range_idx;
-         cIntRange* pRange = GetRange(y, range_idx);
-         if( pRange ){
-             int strcmp_ret =  strcmp(pRange->m_szName.c_str(),szState);
-             if( strcmp_ret ){
-                continue; // skip wrong integration type 
-             }
-         }else{
-            continue;
-         }
-         
-         if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
-            printf("Integration %d used\n",y);
-         }
-      }
-   
-      for(int x=0;x<m_SizeX;x++){
-         int i = y*m_SizeX+x;
-         double val = getXY(x,y);
-         
-         if( rfi_flag_fits_file ){
-            double flag = rfi_flag_fits_file->getXY(x,y);
-//            double flag=0;
-            if( flag > 0 ){
-               continue;
-            }
-         }
-         
-         sum  += val;
-         sum2 += (val*val);
-      
-         if( val > maxval ){
-            maxval = val;
-            maxpos = i;
-         }
-         if( val < minval ){
-            minval = val;
-            minpos = i;
-         }      
-         count++;
-      }
-      
-      n_int++;
-   }
+   vector<unsigned char> mask;
+   GetStateMask( mask, start_int, end_int, szState );
 
-   long double mean = (sum/count);
-   long double mean2 = (sum2/count);
-   long double avg2 = mean*mean;
-   long double rms=0.00;
-   if( mean2 >= avg2 ){
-      rms = sqrt( mean2 - avg2 );   
-   }else{
-      printf("ERROR in CBgFits::GetStat mean2=%.4f < avg2=%.4f\n",(double)mean2,(double)avg2);
-   }                                 
+   // the same accumulator is used by CBgFitsReader::GetStat for files which do not fit in memory.
+   // Every thread gets a contiguous range of rows, partial statistics are merged in row order :
+   cStatJob job;
+   job.data = get_data();
+   job.flags = ( rfi_flag_fits_file ? rfi_flag_fits_file->get_data() : NULL );
+   job.mask = &(mask[0]);
+   job.sizeX = m_SizeX;
+   job.min_acceptable_value = min_acceptable_value;
 
-   CBgArray sum2_tab( GetXSize() , 0 ), count_tab( GetXSize(), 0 );
-   avg_spectrum.alloc( GetXSize() , 0 );
-   rms_spectrum.alloc( GetXSize() , 0 );
-   if( min_spectrum ){
-      min_spectrum->alloc( GetXSize() , 1000e9 );
+   int n_threads = bg_threads_count( m_StatThreads, ((long)m_SizeX)*m_SizeY );
+   if( n_threads > m_SizeY ){
+      n_threads = m_SizeY;
    }
-   if( max_spectrum ){
-      max_spectrum->alloc( GetXSize() , -1000e9 );
+   if( n_threads < 1 ){
+      n_threads = 1;
    }
-   int y_lines_counter=0;
-   for(int y=start_int;y<end_int;y++){
-/*      if( abs(y-1291) <= 2 ){
-         continue;
-      }      */      
-      
-      if( szState && szState[0] ){
-         int range_idx;
-         cIntRange* pRange = GetRange(y, range_idx);
-         if( pRange ){
-             int strcmp_ret =  strcmp(pRange->m_szName.c_str(),szState);
-             if( strcmp_ret ){
-                continue; // skip wrong integration type 
-             }
-         }else{
-            continue;
-         }
-      }
-
-      for(int x=0;x<m_SizeX;x++){
-         double val = getXY(x,y);
-
-         if( rfi_flag_fits_file ){
-            double flag = rfi_flag_fits_file->getXY(x,y);
-//            double flag=0;
-            if( flag > 0 ){
-               continue;
-            }
-         }                                                                     
-      
-         avg_spectrum[x] += val;
-         sum2_tab[x] += val*val;
-         count_tab[x] += 1;
-      }
-      y_lines_counter++;
+   vector<cStatJob> jobs( n_threads, job );
+   int rows_per_thread = (m_SizeY + n_threads - 1)/n_threads;
+   for(int t=0;t<n_threads;t++){
+      jobs[t].y_start = ( t*rows_per_thread < m_SizeY ? t*rows_per_thread : m_SizeY );
+      jobs[t].y_end = ( (t+1)*rows_per_thread < m_SizeY ? (t+1)*rows_per_thread : m_SizeY );
    }
-   
-   
-   for(int x=0;x<GetXSize();x++){
-      int y_lines_count = count_tab[x];
-      double mean = avg_spectrum[x] / y_lines_count;      
-      
-//      printf("%.2f MHz : %.4f = %.4f / %d\n",ch2freq(x),mean,avg_spectrum[x],y_lines_count);
-      double mean2 = (sum2_tab[x] / y_lines_count );      
-      
-      if( y_lines_count <= 0 ){
-         mean = 0;
-         mean2 = 0;
-      }
 
-      rms_spectrum[x] = sqrt( mean2 - mean*mean );
-      avg_spectrum[x] = mean;
-      
-      if( min_spectrum && max_spectrum ){
-//         for(int y=0;y<GetYSize();y++){
-         for(int y=start_int;y<end_int;y++){
-            if( szState && szState[0] ){
-               int range_idx;
-               cIntRange* pRange = GetRange(y, range_idx);
-               if( pRange ){
-                   int strcmp_ret =  strcmp(pRange->m_szName.c_str(),szState);
-                   if( strcmp_ret ){
-                      continue; // skip wrong integration type 
-                   }
-               }else{
-                  continue;
-               }
-            }
-         
-            double val = getXY(x,y);
-            
-            if( val < (*min_spectrum)[x] && val>=min_acceptable_value ){
-               (*min_spectrum)[x] = val;
-            }
-            if( val > (*max_spectrum)[x] ){
-               (*max_spectrum)[x] = val;
-            }
-         }         
+   vector<pthread_t> threads;
+   for(int t=1;t<n_threads;t++){
+      pthread_t thread;
+      if( pthread_create( &thread, NULL, bg_stat_thread, &(jobs[t]) ) ){
+         printf("WARNING : could not start statistics thread %d -> rows processed in the calling thread\n",t);
+         bg_stat_rows( &(jobs[t]) );
+         continue;
       }
-      
+      threads.push_back( thread );
    }
-
-   double inttime = GetIntTime();
-   double total_inttime = inttime * n_int;
-
-   double total_sum_test=0;
-   int non_zero_count=0;
-   for(int yy=0;yy<GetYSize();yy++){
-      for(int xx=0;xx<GetXSize();xx++){
-         double val =  getXY(xx,yy);
-         total_sum_test += val;
-         
-         if( fabs(val) > 0.0000000001 ){
-            non_zero_count++;
-         }
-      }
-   }      
-
-   // calculate total power of average integration in bedlam units and dBm
-   double total_power = 0.00, total_power_mW = 0;
-   for(int i=0;i<avg_spectrum.size();i++){
-      double freq = ch2freq(i);
-      total_power += avg_spectrum[i];
-      total_power_mW += CBedlamSpectrometer::power2mW( freq,avg_spectrum[i]);
+   bg_stat_rows( &(jobs[0]) );
+   for(int t=0;t<threads.size();t++){
+      pthread_join( threads[t], NULL );
    }
-   double total_power_dbm = mW2dbm( total_power_mW );
 
-   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
-      printf("##################################### STATISTICS %d - %d #####################################\n",start_int,end_int);
-      printf("Mean    = %e\n",(double)mean);
-      printf("RMS     = %e\n",(double)rms);
-      printf("SUM     = %.8f\n",total_sum_test);
-      printf("Int count = %d\n",y_lines_counter);
-      printf("MAX val = %.8f at (%d,%d)\n",(double)maxval,(maxpos%m_SizeX),(maxpos/m_SizeX));
-      printf("MIN val = %.8f at (%d,%d)\n",(double)minval,(minpos%m_SizeX),(minpos/m_SizeX));
-      printf("INTTIME = %d x %.8f [sec] = %.8f [sec]\n",n_int,inttime,total_inttime);
-      printf("TOTAL POWER ( uxtime = %.8f ) = %.20f [?] = %.2f [dBm]\n",GetUnixTime(),total_power,total_power_dbm);
-      printf("Non-zero values = %d\n",non_zero_count);
-      printf("######################################################################################\n");
+   CBgSpectrumStat& stat = jobs[0].stat;
+   for(int t=1;t<n_threads;t++){
+      stat.Merge( jobs[t].stat );
    }
-   
-   if( out_number_of_used_integrations ){
-     (*out_number_of_used_integrations) = y_lines_counter;
+   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+      printf("DEBUG : statistics of %d x %d image calculated using %d threads\n",m_SizeX,m_SizeY,n_threads);
    }
-   
-   return total_inttime;
+
+   return stat.Finish( *this, start_int, end_int, avg_spectrum, rms_spectrum, min_spectrum, max_spectrum, out_number_of_used_integrations );
 }
 
 
@@ -2288,7 +3234,7 @@ double CBgFits::GetMaxPower( int integration, double& max_freq, int start_channe
    }
    
    for(int x=start_channel;x<end_channel;x++){
-      double power = valXY(x,integration);
+      double power = valXY_auto(x,integration);
       if( power >= max_power ){
          max_power = power;
          max_freq = ch2freq(x);
@@ -2309,7 +3255,7 @@ double CBgFits::GetTotalPower( int integration, int start_channel, int end_chann
    
    for(int x=0;x<m_SizeX;x++){
       if( x>=start_channel && x<=end_channel ){      
-         sum += valXY(x,integration);
+         sum += valXY_auto(x,integration);
       }
    }
    
@@ -2327,67 +3273,71 @@ double CBgFits::GetTotalPowerFreq( int integration, double start_freq, double en
 
 int CBgFits::Recalc( eCalcFitsAction_T action, double value )
 {
-   int size = m_SizeX*m_SizeY;
+   PrepareData();
+   long size = ((long)m_SizeX)*m_SizeY;
    
-   for(int i=0;i<size;i++){
-      switch( action ){
+   // element-wise operations go through vectorized kernels, logarithms and exponent are scalar :
+   switch( action ){
 
-         case eInvert :            
-            data[i] = 1.00 /  data[i];
-            break;
+      case eInvert :            
+         bg_simd_unary( eSimdInvert, data, size );
+         break;
 
-         case eABS :            
-            data[i] = fabs( data[i] );
-            break;
+      case eABS :            
+         bg_simd_unary( eSimdAbs, data, size );
+         break;
 
-         case eLog10File :
+      case eLog10File :
+         for(long i=0;i<size;i++){
             data[i] = log10( data[i] );
-            break;
+         }
+         break;
 
-         case eDBFile :
+      case eDBFile :
+         for(long i=0;i<size;i++){
             data[i] = 10.00*log10( data[i] );
-            break;
+         }
+         break;
 
-         case eLin2DB :
+      case eLin2DB :
+         for(long i=0;i<size;i++){
             data[i] = exp( (data[i] / 10) * log(10.0) );
-            break;
-
-         case eAstroRootImage :
-//            data[i] = sqrt( data[i] );
-//            if( data[i] > value ){
-//               data[i] = value;
-//            }
-            if( data[i] > value ){
-               data[i] = value;
-            }
-            break;
-
-         case eSqrtFile :
-            data[i] = sqrt( data[i] );
-            break;
+         }
+         break;
+
+      case eAstroRootImage :
+//         data[i] = sqrt( data[i] );
+//         if( data[i] > value ){
+//            data[i] = value;
+//         }
+         bg_simd_unary( eSimdClipMax, data, size, value );
+         break;
+
+      case eSqrtFile :
+         bg_simd_unary( eSimdSqrt, data, size );
+         break;
             
-         case eDivideConst :
-            data[i] = (data[i] / value);
-            break;
+      case eDivideConst :
+         bg_simd_unary( eSimdDivideConst, data, size, value );
+         break;
 
-         case eTimesConst :
-            data[i] = (data[i] * value);
-            break;
+      case eTimesConst :
+         bg_simd_unary( eSimdTimesConst, data, size, value );
+         break;
 
-         case eAddConst :
-            data[i] = (data[i] + value);
-            break;
+      case eAddConst :
+         bg_simd_unary( eSimdAddConst, data, size, value );
+         break;
             
-         default :
-            printf("ERROR : unknown image action = %d, ignored !\n",action);
-            return -1;
-      }
+      default :
+         printf("ERROR : unknown image action = %d, ignored !\n",action);
+         return -1;
    }                  
    
    return 1;
 }
 
-int CBgFits::GetMedianInt( CBgArray& median_int, CBgArray& rms_iqr_int )
+int CBgFits::GetMedianInt( CBgArray& median_int, CBgArray& rms_iqr_int, double approx )
 {
    cIntRange range;
    vector<cIntRange> ranges;
@@ -2395,14 +3345,12 @@ int CBgFits::GetMedianInt( CBgArray& median_int, CBgArray& rms_iqr_int )
    range.end_int   = GetYSize()-1;
    ranges.push_back( range );  
    
-   return GetMedianInt( ranges, median_int, rms_iqr_int );               
+   return GetMedianInt( ranges, median_int, rms_iqr_int, approx );               
 }
 
 
-int CBgFits::GetMedianInt( vector<cIntRange>& int_ranges, CBgArray& median_int, CBgArray& rms_iqr_int )
+int CBgFits::GetMedianInt( vector<cIntRange>& int_ranges, CBgArray& median_int, CBgArray& rms_iqr_int, double approx )
 {	
-   double* median_tab = new double[GetYSize()];       
-
    if( median_int.size() != GetXSize() ){
       median_int.alloc(GetXSize());
    }
@@ -2410,6 +3358,35 @@ int CBgFits::GetMedianInt( vector<cIntRange>& int_ranges, CBgArray& median_int,
       rms_iqr_int.alloc(GetXSize());
    }
 
+   double compression = bg_approx_compression( approx );
+   if( compression > 0 ){
+      // sketch of every channel, rows are read only once :
+      vector<CBgTDigest> digests( GetXSize(), CBgTDigest( compression ) );
+      vector<float> line( GetXSize() );
+      int count=0;
+      for(int i=0;i<int_ranges.size();i++){
+         cIntRange& range = int_ranges[i];
+
+         for(int y=range.start_int;y<=range.end_int && y<GetYSize();y++){
+            float* row = get_line( y, &(line[0]) );
+            for(int x=0;x<GetXSize();x++){
+               digests[x].Add( row[x] );
+            }
+            count++;
+         }
+      }
+
+      for(int x=0;x<GetXSize();x++){
+         double rms_iqr = 0.00;
+         median_int[x] = digests[x].MedianRmsIQR( rms_iqr );
+         rms_iqr_int[x] = rms_iqr;
+      }
+
+      return count;
+   }
+
+   double* median_tab = new double[GetYSize()];       
+
    int max_count=-1;
    for(int x=0;x<GetXSize();x++){
    
@@ -2418,22 +3395,20 @@ int CBgFits::GetMedianInt( vector<cIntRange>& int_ranges, CBgArray& median_int,
          cIntRange& range = int_ranges[i];
       
          for(int y=range.start_int;y<=range.end_int;y++){
-            median_tab[count] = valXY(x,y);
+            median_tab[count] = valXY_auto(x,y);
             count++;
          }            
       }         
       
-      my_sort_float( median_tab, count );
-      median_int[x] = median_tab[count/2];      
+      double median, q25, q75;
+      bg_median_iqr( median_tab, count, median, q25, q75 );
+      median_int[x] = median;
 
-      int q75= (int)(count*0.75);
-      int q25= (int)(count*0.25);
-         
       if( count > max_count ){
          max_count = count;
       }   
          
-      rms_iqr_int[x] = ( median_tab[q75] - median_tab[q25] ) / 1.35; // 2020-07-13 - division by 1.35 added !
+      rms_iqr_int[x] = ( q75 - q25 ) / 1.35; // 2020-07-13 - division by 1.35 added !
    }
    
    delete [] median_tab;
@@ -2454,6 +3429,21 @@ cIntRange* CBgFits::GetRange(int y,int& out_range_idx)
    return NULL;
 }
 
+bool CBgFits::IsIntegrationInState(int y, const char* szState)
+{
+   if( !szState || !szState[0] ){
+      return true;
+   }
+
+   int range_idx;
+   cIntRange* pRange = GetRange(y, range_idx);
+   if( pRange ){
+      return ( strcmp(pRange->m_szName.c_str(),szState) == 0 );
+   }
+
+   return false;
+}
+
 
 eIntType CBgFits::GetIntType(int y)
 {
@@ -2546,6 +3536,7 @@ CBgFits* CBgFits::AllocOutFits( const char* fname, int _y_size, int bAddStates )
 void CBgFits::ClearKeys()
 {
    _fitsHeaderRecords.clear();
+   RebuildHeaderIndex();
 }
 
 int CBgFits::SetKeysWithoutStates( std::vector<HeaderRecord>& keys )
@@ -2582,7 +3573,7 @@ int CBgFits::SetKeysWithoutStates( std::vector<HeaderRecord>& keys )
         }
                 
         if( !bIsStateKey ){
-           _fitsHeaderRecords.push_back(rec);
+           AddHeaderRecord(rec);
         }
      }
      
@@ -2591,63 +3582,24 @@ int CBgFits::SetKeysWithoutStates( std::vector<HeaderRecord>& keys )
 
 void CBgFits::dump_max_hold( int start_int, int end_int, const char* szOutFile, int bShowFreq )
 {
-   float* out_line = new float[m_SizeX];
-   
-   for(int x=0;x<m_SizeX;x++){
-      out_line[x] = -10e9;
-   }
+   vector<float> out_line( m_SizeX, -10e9 ), line( m_SizeX );
    
    for(int y=0;y<m_SizeY;y++){
-      for(int x=0;x<m_SizeX;x++){
-         if( valXY(x,y) > out_line[x] ){
-           out_line[x] = valXY(x,y);
-         }
-      }
+      bg_max_hold( get_line( y, &(line[0]) ), &(out_line[0]), m_SizeX );
    }
 
-   FILE* outfile = fopen(szOutFile,"w");
-   for(int x=0;x<m_SizeX;x++){
-       double x_val = x;
-       if( bShowFreq ){
-          x_val = ch2freq(x);
-       }
-          
-      fprintf(outfile,"%.2f %e\n",x_val,out_line[x]);
-   }
-   fclose(outfile);
-   
-   delete [] out_line;        
+   bg_save_hold( szOutFile, &(out_line[0]), *this, bShowFreq );
 }
 
 void CBgFits::dump_min_hold( int start_int, int end_int, const char* szOutFile, int bShowFreq )
 {
-   float* out_line = new float[m_SizeX];
-   
-   for(int x=0;x<m_SizeX;x++){
-      out_line[x] = 10e20;
-   }
+   vector<float> out_line( m_SizeX, 10e20 ), line( m_SizeX );
    
    for(int y=0;y<m_SizeY;y++){
-      for(int x=0;x<m_SizeX;x++){
-         if( valXY(x,y) < out_line[x] ){
-           out_line[x] = valXY(x,y);
-         }
-      }
-   }
-
-   FILE* outfile = fopen(szOutFile,"w");
-   for(int x=0;x<m_SizeX;x++){
-       double x_val = x;
-       if( bShowFreq ){
-          x_val = ch2freq(x);
-       }
-          
-      fprintf(outfile,"%.2f %e\n",x_val,out_line[x]);
+      bg_min_hold( get_line( y, &(line[0]) ), &(out_line[0]), m_SizeX );
    }
-   fclose(outfile);
-   
-   delete [] out_line;        
 
+   bg_save_hold( szOutFile, &(out_line[0]), *this, bShowFreq );
 }
 
 void CBgFits::SetIntTimeKeyword( double _inttime )
@@ -2781,7 +3733,7 @@ void CBgFits::SetNaN()
    for(int y=0;y<GetYSize();y++){
       for(int x=0;x<GetXSize();x++){
 //         setXY(x,y,FP_NAN);
-         setXY(x,y,0.00/0.00); // NaN see https://en.cppreference.com/w/cpp/numeric/math/FP_categories
+         setXY_auto(x,y,0.00/0.00); // NaN see https://en.cppreference.com/w/cpp/numeric/math/FP_categories
       }
    }
 }
@@ -2790,69 +3742,167 @@ void CBgFits::SetValue(double value)
 {
    for(int y=0;y<GetYSize();y++){
       for(int x=0;x<GetXSize();x++){
-         setXY(x,y,value);
+         setXY_auto(x,y,value);
       }
    }
 }
 
-int CBgFits::CalcMedian( vector<string>& fits_list, CBgFits& out_rms, int bDoAverage )
-{   
-   int ySize=-1;
-   int xSize=-1;
-   vector<CBgFits*> fits_tab;
-   for(int i=0;i<fits_list.size();i++){
-      CBgFits* fits = new CBgFits( fits_list[i].c_str() );
-      if( fits->ReadFits( fits_list[i].c_str() ) ){
-         printf("ERROR : could not read first fits file %s\n",fits_list[i].c_str());
-         exit(-1);
-      }
-      
-      if( ySize < 0 ){
-          ySize = fits->GetYSize();
-          xSize = fits->GetXSize();
-      }else{
-         if( ySize != fits->GetYSize() ){
-            printf("ERROR : not all fits files have equal ySize - %d != %d (file %s)\n",ySize,fits->GetYSize(),fits_list[i].c_str());
-            return -1;
+// pixels [p_start,p_end) of a strip of rows, values of pixel p from all files are in values[p*n_files,(p+1)*n_files) :
+struct cMedianJob
+{
+   const float* values;
+   int    n_files;
+   long   p_start;
+   long   p_end;
+   int    bDoAverage;
+   float* out;
+   float* out_rms;
+};
+
+static void bg_median_pixels( cMedianJob* job )
+{
+   CBgQuantile scratch( job->n_files );
+   for(long p=job->p_start;p<job->p_end;p++){
+      const float* values = job->values + p*job->n_files;
+
+      if( job->bDoAverage > 0 ){
+         // mean and rms (as in GetStat) :
+         double mean = 0.00, m2 = 0.00;
+         for(int f=0;f<job->n_files;f++){
+            double delta = values[f] - mean;
+            mean += delta/(f+1);
+            m2 += delta*(values[f] - mean);
          }
+         job->out[p] = mean;
+         job->out_rms[p] = sqrt( m2/job->n_files );
+      }else{
+         double rms_iqr = 0.00;
+         scratch.assign( values, job->n_files );
+         job->out[p] = scratch.MedianRmsIQR( rms_iqr );
+         job->out_rms[p] = rms_iqr;
       }
-      fits_tab.push_back( fits );
-      
-/*      if( i==0 ){
-         Realloc(fits.GetXSize(),fits_list.size()*fits.GetYSize());
-         reset_lines_counter();
-      }*/
-            
-//      for(int y=0;y<fits.GetYSize();y++){
-//         add_line( fits.get_line(y), fits.GetXSize() );
-//      }                                
    }
+}
+
+static void* bg_median_thread( void* ptr )
+{
+   bg_median_pixels( (cMedianJob*)ptr );
+   return NULL;
+}
+
+int CBgFits::CalcMedian( vector<string>& fits_list, CBgFits& out_rms, int bDoAverage, int n_io_threads, double mem_budget_mb, int n_threads )
+{   
+   int n_files = fits_list.size();
+   if( n_files <= 0 ){
+      printf("ERROR : empty list of FITS files passed to CBgFits::CalcMedian\n");
+      return -1;
+   }
+
+   // sizes from the header of the first file :
+   CBgFits first;
+   if( first.ReadFits( fits_list[0].c_str(), 0, 0, 1 ) ){
+      printf("ERROR : could not read first fits file %s\n",fits_list[0].c_str());
+      exit(-1);
+   }
+   int xSize = first.GetXSize();
+   int ySize = first.GetYSize();
+   if( xSize <= 0 || ySize <= 0 ){
+      printf("ERROR : wrong size (%d,%d) of fits file %s\n",xSize,ySize,fits_list[0].c_str());
+      return -1;
+   }
+
+   // the same band of rows is read from all files, the band has to fit into the memory budget
+   // together with the images waiting in the prefetch queue :
+   if( n_io_threads < 1 ){
+      n_io_threads = 1;
+   }
+   int queue_size = 2*n_io_threads;
+   double row_bytes = ((double)xSize)*sizeof(float)*(n_files + queue_size);
+   int strip_rows = (int)( (mem_budget_mb*1024.00*1024.00) / row_bytes );
+   if( strip_rows < 1 ){
+      printf("WARNING : memory budget %.2f MB is too small for %d files of %d pixels per row -> one row per strip used\n",mem_budget_mb,n_files,xSize);
+      strip_rows = 1;
+   }
+   if( strip_rows > ySize ){
+      strip_rows = ySize;
+   }
+   n_threads = bg_threads_count( n_threads, ((long)xSize)*strip_rows*n_files );
    
    if( gBGPrintfLevel >= BG_INFO_LEVEL ){
       printf("INFO : Re-sizing current image to (%d,%d)\n",xSize,ySize);
+      printf("INFO : median of %d files calculated in strips of %d rows (memory budget = %.2f MB), %d threads\n",n_files,strip_rows,mem_budget_mb,n_threads);
    }
    Realloc(xSize,ySize);
    out_rms.Realloc(xSize,ySize);
-   
-   CBgFits tmp_fits( xSize, fits_list.size() );
-   for(int y=0;y<ySize;y++){
-      for(int i=0;i<fits_list.size();i++){
-         tmp_fits.set_line(i,(fits_tab[i])->get_line(y));
+   float* out_data = get_data();
+   float* out_rms_data = out_rms.get_data();
+
+   vector<float> strip( ((long)xSize)*strip_rows*n_files );
+   for(int y_start=0;y_start<ySize;y_start+=strip_rows){
+      int y_end = ( y_start + strip_rows < ySize ? y_start + strip_rows : ySize );
+      long n_pixels = ((long)xSize)*(y_end - y_start);
+
+      // files are read in parallel by n_io_threads threads (only rows of the strip) :
+      CBgFitsPrefetcher prefetcher( fits_list, n_io_threads, queue_size );
+      prefetcher.SetReadOptions( 0, 1, 1 );
+      prefetcher.SetROI( 0, y_start, xSize, y_end );
+      prefetcher.Start();
+      for(int i=0;i<n_files;i++){
+         int index=-1, read_status=0;
+         CBgFits* fits = prefetcher.Next( index, read_status );
+         if( !fits || read_status ){
+            printf("ERROR : could not read fits file %s\n",fits_list[i].c_str());
+            exit(-1);
+         }
+         if( fits->GetFullYSize() != ySize || fits->GetFullXSize() != xSize ){
+            printf("ERROR : not all fits files have equal size - (%d,%d) != (%d,%d) (file %s)\n",xSize,ySize,fits->GetFullXSize(),fits->GetFullYSize(),fits_list[i].c_str());
+            prefetcher.Release( fits );
+            return -1;
+         }
+
+         // pixel-major order , values of one pixel from all files next to each other :
+         const float* fits_data = fits->get_data();
+         float* dst = &(strip[0]) + i;
+         for(long p=0;p<n_pixels;p++){
+            dst[p*n_files] = fits_data[p];
+         }
+         prefetcher.Release( fits );
       }
-      
-      CBgArray median_int, rms_iqr_int;
-      if( bDoAverage > 0 ){
-         tmp_fits.GetStat( median_int, rms_iqr_int );
-      }else{
-         tmp_fits.GetMedianInt( median_int, rms_iqr_int );
+      prefetcher.Stop();
+
+      // columns (pixels) of the strip split between threads :
+      long offset = ((long)y_start)*xSize;
+      int strip_threads = ( n_threads < n_pixels ? n_threads : 1 );
+      vector<cMedianJob> jobs( strip_threads );
+      long pixels_per_thread = (n_pixels + strip_threads - 1)/strip_threads;
+      for(int t=0;t<strip_threads;t++){
+         jobs[t].values = &(strip[0]);
+         jobs[t].n_files = n_files;
+         jobs[t].p_start = ( t*pixels_per_thread < n_pixels ? t*pixels_per_thread : n_pixels );
+         jobs[t].p_end = ( (t+1)*pixels_per_thread < n_pixels ? (t+1)*pixels_per_thread : n_pixels );
+         jobs[t].bDoAverage = bDoAverage;
+         jobs[t].out = out_data + offset;
+         jobs[t].out_rms = out_rms_data + offset;
+      }
+
+      vector<pthread_t> threads;
+      for(int t=1;t<strip_threads;t++){
+         pthread_t thread;
+         if( pthread_create( &thread, NULL, bg_median_thread, &(jobs[t]) ) ){
+            printf("WARNING : could not start median thread %d -> pixels processed in the calling thread\n",t);
+            bg_median_pixels( &(jobs[t]) );
+            continue;
+         }
+         threads.push_back( thread );
+      }
+      bg_median_pixels( &(jobs[0]) );
+      for(int t=0;t<threads.size();t++){
+         pthread_join( threads[t], NULL );
       }
-      set_line(y,median_int);
-      out_rms.set_line(y,rms_iqr_int);
-   }
 
-   // clean memory 
-   for(int i=0;i<fits_list.size();i++){
-      delete (fits_tab[i]);
+      if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+         printf("DEBUG : rows %d - %d of median image calculated\n",y_start,y_end);
+      }
    }
    
    return 1;
@@ -2860,17 +3910,13 @@ int CBgFits::CalcMedian( vector<string>& fits_list, CBgFits& out_rms, int bDoAve
 
 int CBgFits::IsFlagged( int integration )
 {
-   std::vector<HeaderRecord>& keys = GetKeys();
-      
-   for(int k=0;k<keys.size();k++){
-      HeaderRecord& key = keys[k];
-               
-      if( strcasecmp(key.Keyword.c_str(),"flag")==0 ){
-         int keyval = atol(key.Value.c_str());
-         if( keyval == (integration+1) ){
-            return 1;
-         }
-      }  
+   if( !m_bHeaderIndexValid ){
+      RebuildHeaderIndex();
+   }
+   
+   // FLAG keywords contain integration numbers counted from 1 :
+   if( m_FlaggedIntegrations.find( integration+1 ) != m_FlaggedIntegrations.end() ){
+      return 1;
    }
                                                                         
    return 0;
@@ -3023,6 +4069,7 @@ CBgFits* CBgFits::GetRFIMask()
 
 int CBgFits::SaveAsByte( const char* outfile )
 {
+   PrepareData();
    if( outfile && outfile[0] ){
       MyFile::CreateDir(outfile);
       
@@ -3041,6 +4088,13 @@ int CBgFits::SaveAsByte( const char* outfile )
          return( status );
       }
                 
+      if( ( status = ApplyCompression( fptr, bitpix_char ) ) ){
+         // empty file is not left on disk :
+         int delete_status = 0;
+         fits_delete_file( fptr, &delete_status );
+         return status;
+      }
+
       /* Write the required keywords for the primary array image */
       if ( fits_create_img(fptr,  bitpix_char, naxis, naxes, &status) ){
          if (status) fits_report_error(stderr, status);
@@ -3092,7 +4146,7 @@ double CBgFits::FitPoly( int y, double fit_min_freq, double fit_max_freq, double
                     
       if( fit_min_freq<=freq && freq<=fit_max_freq ){
          fit_spec_freq[cnt] = freq;
-         fit_spec_pwr[cnt]  = valXY(x,y);
+         fit_spec_pwr[cnt]  = valXY_auto(x,y);
          cnt++;
       }
    }
@@ -3112,8 +4166,8 @@ double CBgFits::FitPoly( int y, double fit_min_freq, double fit_max_freq, double
       if( fit_min_freq<=freq && freq<=fit_max_freq ){
          double fit_val = A*freq + B;
                        
-         double diff = (fit_val - valXY(x,y));
-         double err  = valXY(x,y)/sqrt(tau*bandwidth);
+         double diff = (fit_val - valXY_auto(x,y));
+         double err  = valXY_auto(x,y)/sqrt(tau*bandwidth);
          fit_chi2 += (diff/err)*(diff/err);
       }
    }
@@ -3132,9 +4186,9 @@ int CBgFits::ZeroWrongValues( double limit )
    
    for(int y=0;y<m_SizeY;y++){
       for(int x=0;x<m_SizeX;x++){
-          double val = valXY(x,y);
+          double val = valXY_auto(x,y);
           if( fabs(val) > limit ){
-             setXY(x,y,0);
+             setXY_auto(x,y,0);
              count_bad++;
           }
       }
@@ -3148,13 +4202,13 @@ int CBgFits::FixBadValues( double minValueOK, double maxValueOK )
    int count_bad=0;
    for(int y=0;y<m_SizeY;y++){
       for(int x=0;x<m_SizeX;x++){
-         double val = valXY(x,y);
+         double val = valXY_auto(x,y);
          
          if( val > maxValueOK ){
-            setXY(x,y,maxValueOK );
+            setXY_auto(x,y,maxValueOK );
          }
          if( val < minValueOK ){
-            setXY(x,y,minValueOK );
+            setXY_auto(x,y,minValueOK );
          }
       }
    }
@@ -3164,36 +4218,123 @@ int CBgFits::FixBadValues( double minValueOK, double maxValueOK )
 
 void CBgFits::MeanLines( CBgArray& mean_lines, CBgArray& rms_lines )
 {
-   vector<int> counter;
-   
    mean_lines.assign( GetYSize() , 0 );
    rms_lines.assign( GetYSize() , 0 );
-   counter.assign( GetYSize(), 0 );
+   vector<float> line( GetXSize() );
    
    for(int y=0;y<GetYSize();y++){
-      double sum2 = 0.00;
-      for(int x=0;x<GetXSize();x++){
-         double value = getXY(x,y);
-         
-         if( !isnan(value) && !isinf(value) ){
-            mean_lines[y] += value;
-            sum2          += value*value;
-            counter[y]    += 1;
-         }
-      }
-      
-      mean_lines[y] = mean_lines[y] / counter[y];
-      rms_lines[y]  = sqrt( (sum2/counter[y]) - (mean_lines[y]*mean_lines[y]) );
+      bg_line_mean_rms( get_line( y, &(line[0]) ), GetXSize(), mean_lines[y], rms_lines[y] );
    }   
 }
 
 
-void CBgFits::Transpose( CBgFits& out_fits_t )
+// rows [y_start,y_end) of input image transposed tile by tile :
+struct cTransposeJob
+{
+   const float* in;
+   float* out;
+   int sizeX;
+   int sizeY;
+   int y_start;
+   int y_end;
+};
+
+static void bg_transpose_rows( cTransposeJob* job )
+{
+   int tile = CBgFits::m_TransposeTile;
+   for(int y=job->y_start;y<job->y_end;y+=tile){
+      int rows = ( (job->y_end - y) < tile ? (job->y_end - y) : tile );
+      for(int x=0;x<job->sizeX;x+=tile){
+         int cols = ( (job->sizeX - x) < tile ? (job->sizeX - x) : tile );
+         bg_simd_transpose( job->in + ((long)y)*job->sizeX + x, job->sizeX, job->out + ((long)x)*job->sizeY + y, job->sizeY, rows, cols );
+      }
+   }
+}
+
+static void* bg_transpose_thread( void* ptr )
+{
+   bg_transpose_rows( (cTransposeJob*)ptr );
+   return NULL;
+}
+
+void CBgFits::Transpose( CBgFits& out_fits_t, int n_threads )
+{
+   PrepareData();
+   if( !data || m_SizeX <= 0 || m_SizeY <= 0 ){
+      return;
+   }
+   if( out_fits_t.GetXSize() != m_SizeY || out_fits_t.GetYSize() != m_SizeX ){
+      out_fits_t.Realloc( m_SizeY, m_SizeX, FALSE );
+   }
+   float* out_data = out_fits_t.get_data();
+   if( m_TransposeTile < 8 ){
+      m_TransposeTile = 8;
+   }
+
+   n_threads = bg_threads_count( n_threads, ((long)m_SizeX)*m_SizeY );
+   int n_tiles_y = (m_SizeY + m_TransposeTile - 1)/m_TransposeTile;
+   if( n_threads > n_tiles_y ){
+      n_threads = n_tiles_y;
+   }
+   if( n_threads < 1 ){
+      n_threads = 1;
+   }
+
+   // every thread gets a range of whole tile rows :
+   vector<cTransposeJob> jobs( n_threads );
+   int tiles_per_thread = (n_tiles_y + n_threads - 1)/n_threads;
+   for(int t=0;t<n_threads;t++){
+      jobs[t].in = data;
+      jobs[t].out = out_data;
+      jobs[t].sizeX = m_SizeX;
+      jobs[t].sizeY = m_SizeY;
+      jobs[t].y_start = t*tiles_per_thread*m_TransposeTile;
+      jobs[t].y_end = (t+1)*tiles_per_thread*m_TransposeTile;
+      if( jobs[t].y_start > m_SizeY ){
+         jobs[t].y_start = m_SizeY;
+      }
+      if( jobs[t].y_end > m_SizeY ){
+         jobs[t].y_end = m_SizeY;
+      }
+   }
+
+   vector<pthread_t> threads;
+   for(int t=1;t<n_threads;t++){
+      pthread_t thread;
+      if( pthread_create( &thread, NULL, bg_transpose_thread, &(jobs[t]) ) ){
+         printf("WARNING : could not start transpose thread %d -> rows transposed in the calling thread\n",t);
+         bg_transpose_rows( &(jobs[t]) );
+         continue;
+      }
+      threads.push_back( thread );
+   }
+   bg_transpose_rows( &(jobs[0]) );
+   for(int t=0;t<threads.size();t++){
+      pthread_join( threads[t], NULL );
+   }
+
+   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+      printf("DEBUG : transposed %d x %d image using %d threads, tile = %d pixels\n",m_SizeX,m_SizeY,n_threads,m_TransposeTile);
+   }
+}
+
+void CBgFits::SwapAxisKeywords()
 {
-   for(int ch=0;ch<m_SizeX;ch++){
-      for(int t=0;t<m_SizeY;t++){
-         double val = getXY( ch, t );
-         out_fits_t.setXY( t, ch, val );
+   const char* axis_keys[] = { "CTYPE", "CRVAL", "CDELT", "CRPIX", "CUNIT", NULL };
+
+   for(int k=0;k<_fitsHeaderRecords.size();k++){
+      string& key = _fitsHeaderRecords[k].Keyword;
+      for(int i=0;axis_keys[i];i++){
+         int len = strlen(axis_keys[i]);
+         if( key.length() == (len+1) && strncmp( key.c_str(), axis_keys[i], len ) == 0 ){
+            if( key[len] == '1' ){
+               key[len] = '2';
+            }else if( key[len] == '2' ){
+               key[len] = '1';
+            }
+            break;
+         }
       }
    }
+   InvalidateHeaderIndex();
 }
@@ -4,9 +4,13 @@
 #include <fitsio.h>
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include "bg_array.h"
 #include "bg_globals.h"
 #include "bg_total_power.h"
+#include "bg_image.h"
+#include "bg_quantile.h"
 
 #define BG_FITS_DATA_TYPE float
 
@@ -31,6 +35,9 @@ enum eRejectionReasonType { eRejectionReason_NOT_REJECTED=0, eRejectionReason_To
 
 #define BIGHORNS_RFI_VALUE -1000
 
+// scaled 16-bit integer images (BITPIX=16 with BSCALE/BZERO) , BLANK value is used for NaN :
+enum eInt16Scaling { eInt16None=0, eInt16PerImage=1, eInt16PerRow=2 };
+
 using namespace std;
 
 // integration range :
@@ -70,6 +77,25 @@ struct cIntRange
 
                         };
 
+// tile compression of output images (cfitsio compression API) :
+struct cFitsCompression
+{
+   int   type;           // RICE_1, GZIP_1, GZIP_2, HCOMPRESS_1, PLIO_1 or 0 - no compression
+   long  tile[2];        // tile size in pixels, tile[0]<=0 means full row, default one row per tile (spectrum)
+   float quantize_level; // quantization of float images (noise/q), 0 -> lossless (only GZIP)
+
+   cFitsCompression( int _type=0, long tile_x=0, long tile_y=1, float _quantize_level=4.00 )
+   : type(_type), quantize_level(_quantize_level)
+   {
+      tile[0] = tile_x;
+      tile[1] = tile_y;
+   }
+   
+   // rice, gzip, gzip2, hcompress, plio, none -> cfitsio constant (<0 for unknown name)
+   static int ParseType( const char* szType );
+   static const char* GetTypeName( int type );
+};
+
 struct cWCSInfo 
 {
    string ctype;
@@ -78,6 +104,10 @@ struct cWCSInfo
    float  cdelt;
 };
 
+class CBgFitsAsyncWriter;
+class CBgAperture;
+struct cHeaderParseState;
+
 class CBgFits
 {
 protected :
@@ -90,13 +120,72 @@ protected :
   int bitpix;
   int image_type;
   
-  // fits DATA :  
+  // fits DATA : points to the pixels of m_Image (unless memory mapped or external), 16-bit image kept by ReadFits 
+  // (see SetKeepInt16) is in m_Int16 and data is NULL until converted (PrepareData/PrepareRow) :
   BG_FITS_DATA_TYPE* data;
   bool m_bExternalData;
+  CBgImageF   m_Image;
+  CBgImageI16 m_Int16;
+  // float image of sizeX x sizeY in data (current buffer of the same size is re-used) :
+  void AllocData( int sizeX, int sizeY );
+  
+  // memory mapped data unit (see ReadFitsMMap) :
+  void*  m_pMMapBase;
+  size_t m_MMapSize;
+  void FreeData();
+
+  // background writing of lines by DumpFitsLine (see EnableAsyncWrite) :
+  CBgFitsAsyncWriter* m_pAsyncWriter;
+  int    m_AsyncRingLines;
+  int    m_AsyncBatchLines;
   
   //! Fits header   
   vector<HeaderRecord> _fitsHeaderRecords;
   vector<cIntRange> m_IntegrationRanges;
+
+  // hashed index of _fitsHeaderRecords (keyword -> index of the first record with this keyword) and set of 
+  // integrations flagged with FLAG keywords, re-built on first use after the records are changed :
+  unordered_map<string,int> _headerKeywordMap;
+  unordered_set<int> m_FlaggedIntegrations;
+  bool m_bHeaderIndexValid;
+  void InvalidateHeaderIndex(){ m_bHeaderIndexValid = false; }
+  void SwapAxisKeywords(); // CTYPE1 <-> CTYPE2 , CRVAL1 <-> CRVAL2 ... for transposed image
+  void AddHeaderRecord( const HeaderRecord& rec );
+  int  FindKeywordIndex( const char* keyword );
+
+  // when not empty ReadFits only reads these keywords (see SetHeaderFilter) :
+  vector<string> m_HeaderKeywordsFilter;
+
+  // compression of written images :
+  cFitsCompression m_Compression;
+  int ApplyCompression( fitsfile* fptr, int image_bitpix );
+
+  // scaled 16-bit output (see SetInt16Output) and int16 images kept in memory (image_type=TSHORT, values in m_Int16), 
+  // with per-row scaling there is one BSCALE/BZERO for every row :
+  int  m_Int16Mode;
+  bool m_bKeepInt16;
+  vector<double> m_Int16Scale;
+  vector<double> m_Int16Zero;
+  int  m_Int16Blank;
+  int WriteInt16Image( fitsfile* fptr, vector<double>& row_scale, vector<double>& row_zero );
+  int WriteRowScaling( fitsfile* fptr, vector<double>& row_scale, vector<double>& row_zero );
+  inline float Int16ToFloat( short raw, int y ){
+     if( raw == m_Int16Blank ){
+        return (0.00/0.00);
+     }
+     int s = ( m_Int16Scale.size() > 1 ? y : 0 );
+     return raw*m_Int16Scale[s] + m_Int16Zero[s];
+  }
+  void ParseHeaderRecord( HeaderRecord& rec, cHeaderParseState& state );
+  int ReadFitsHeader( fitsfile* fp, int bIgnoreHeaderErrors, bool transposed );
+
+  // window read by ReadFitsROI : original coordinates of pixel (0,0), decimation step and size of the image in the file :
+  bool m_bROI;
+  int  m_RoiStartX;
+  int  m_RoiStartY;
+  int  m_RoiStep;
+  int  m_FullSizeX;
+  int  m_FullSizeY;
     
 public :
   double inttime; // exposure time 
@@ -111,6 +200,8 @@ public :
 
   // just for some data problems :
   static int gFitsUnixTimeError;
+  static cFitsCompression m_DefaultCompression; // used by new objects
+  static int m_DefaultInt16Mode;                 // used by new objects
   static const int m_TypicalBighornsChannels;
   static const int m_TypicalBighornsYSize;
 
@@ -132,6 +223,12 @@ public :
   int WriteKeys();
   int WriteKeys( fitsfile* fptr );
   int Close();
+
+  // DumpFitsLine only queues lines which are written to the file by a background thread in batches of batch_lines,
+  // must be called before Create, ring_lines<=0 switches back to synchronous writing
+  void EnableAsyncWrite( int ring_lines=1024, int batch_lines=128 );
+  CBgFitsAsyncWriter* GetAsyncWriter(){ return m_pAsyncWriter; }
+  int FlushAsyncWrite(); // waits until all queued lines are written
   int get_lines_counter() { return m_lines_counter; }
   void reset_lines_counter(){ m_lines_counter = 0; }
   void inc_lines_counter(){ m_lines_counter++; }
@@ -139,7 +236,35 @@ public :
   
 
   int ReadFits( const char* fits_file=NULL, int bAutoDetect=0, int bReadImage=1, int bIgnoreHeaderErrors=0, bool transposed=false );  
+  // whole cube with planes stacked along Y axis (see CBgFitsCube for access to single planes and spaxels) :
   int ReadFitsCube( const char* fits_file=NULL, int bAutoDetect=0, int bReadImage=1, int bIgnoreHeaderErrors=0 );  
+  // image transposed while reading (tile by tile, no second copy) : NAXIS2 x NAXIS1 pixels, axis keywords (CTYPE1<->CTYPE2 ...) swapped :
+  int ReadFitsTransposed( const char* fits_file=NULL, int bIgnoreHeaderErrors=0 );
+
+  // reads only pixels in window [x_start,x_end) x [y_start,y_end) (end<0 -> image size) taking every step-th pixel in both axes
+  // (fits_read_subset), image has the size of the window and getXY/valXY/setXY use coordinates of the full image 
+  // (NaN for pixels outside the window or between decimated pixels, such writes are ignored) , other methods 
+  // (valXY_auto, setXY_auto, get_line, statistics ...) use pixel coordinates in the window :
+  int ReadFitsROI( const char* fits_file, int x_start, int y_start, int x_end=-1, int y_end=-1, int step=1, int bIgnoreHeaderErrors=0 );
+  inline bool IsROI() const { return m_bROI; }
+  inline int GetRoiStartX() const { return (m_bROI ? m_RoiStartX : 0); }
+  inline int GetRoiStartY() const { return (m_bROI ? m_RoiStartY : 0); }
+  inline int GetRoiStep() const { return (m_bROI ? m_RoiStep : 1); }
+  inline int GetFullXSize() const { return (m_bROI ? m_FullSizeX : m_SizeX); }
+  inline int GetFullYSize() const { return (m_bROI ? m_FullSizeY : m_SizeY); }
+  // coordinate of the full image -> first pixel of the window at or after it (also works for exclusive end of a range) :
+  inline int RoiX( int x ) const { return (m_bROI ? (x - m_RoiStartX + m_RoiStep - 1)/m_RoiStep : x); }
+  inline int RoiY( int y ) const { return (m_bROI ? (y - m_RoiStartY + m_RoiStep - 1)/m_RoiStep : y); }
+  
+  // read of uncompressed BITPIX=-32 images without cfitsio buffers : data unit is mmap-ed (private mapping) and byte-swapped
+  // in place before returning, falls back to ReadFits for files which cannot be mapped (compressed, scaled, other BITPIX etc.)
+  int ReadFitsMMap( const char* fits_file=NULL, int bIgnoreHeaderErrors=0 );
+  bool IsMMapped() const { return (m_pMMapBase!=NULL); }
+  // 16-bit image kept by ReadFits is converted to float on the first access. The conversion is not thread-safe : objects shared
+  // by threads have to be prepared (PrepareData, get_data) before the threads are started (as GetStat, Transpose etc. do) :
+  inline void PrepareRow( int y ){ if( image_type == TSHORT ){ ConvertInt16ToFloat(); } }
+  inline void PrepareData(){ if( image_type == TSHORT ){ ConvertInt16ToFloat(); } }
+
   int WriteFits( const char* fits_file, int bUpdateSizeY=0, int bWriteKeys=1 );
   void ResetFilePointer(){ m_fptr = NULL; } // this is a workaround - not sure why required see line 416 in bg_fits.cpp
                                             // //      m_fptr = NULL; // NEW 2016-09-28 - will it be a problem for other things
@@ -154,8 +279,15 @@ public :
   void SetKeywordFloat(const char *keyword, float new_value );
   HeaderRecord* GetKeyword(const char *keyword);
   static HeaderRecord* GetKeyword(vector<HeaderRecord>& keys_list, const char *keyword);
-  std::vector<HeaderRecord>& GetKeys(){ return  _fitsHeaderRecords; }
-  void SetKeys( std::vector<HeaderRecord>& keys ){ _fitsHeaderRecords = keys; }
+  // reference can be used to modify the records -> keyword index is re-built on next use :
+  std::vector<HeaderRecord>& GetKeys(){ InvalidateHeaderIndex(); return  _fitsHeaderRecords; }
+  void SetKeys( std::vector<HeaderRecord>& keys ){ _fitsHeaderRecords = keys; InvalidateHeaderIndex(); }
+  void RebuildHeaderIndex();
+
+  // ReadFits reads only the listed keywords (comma separated, e.g. "DTIME-FS,DTIME-FU,INTTIME,CRVAL1,CDELT1") 
+  // instead of all the header, NULL or empty string reads all keywords again :
+  void SetHeaderFilter( const char* szKeywords );
+  void SetHeaderFilter( const vector<string>& keywords ){ m_HeaderKeywordsFilter = keywords; }
   double GetIntTime(){ return inttime; }
   void SetIntTime( double _inttime ){ inttime = _inttime; }
   double GetUnixTime();
@@ -176,6 +308,9 @@ public :
   vector<cIntRange>& GetIntRanges(){ return m_IntegrationRanges; }
   int GetRangesCount(){ return m_IntegrationRanges.size(); }
   cIntRange* GetRange(int y, int& out_range_idx);
+  bool IsIntegrationInState(int y, const char* szState); // true if szState is empty or integration y is in range of this name
+  // mask[y]=1 for integrations in [start_int,end_int) and in state szState (all if empty), returns number of such integrations :
+  int GetStateMask( vector<unsigned char>& mask, int start_int, int end_int, const char* szState );
   int IsAntenna(int y,int bDefaultYes=1);
   int IsReference(int y);
   eIntType GetIntType(int y);
@@ -188,7 +323,7 @@ public :
   inline int GetYSize() const{ return m_SizeY; }
   void SetYSize( int ySize ){ m_SizeY = ySize; }
   
-  inline float* get_data(){ return data; }
+  inline float* get_data(){ PrepareData(); return data; }
   const char* GetFileName(){ return m_FileName.c_str(); }  
   void SetFileName( const char* filename ){ m_FileName = filename; }
 
@@ -199,7 +334,8 @@ public :
   void Normalize(double norm_factor);
   void NormalizeY();
   void NormalizeX();
-  float setXY( int x, int y, float value );
+  float setXY( int x, int y, float value ); // coordinates of the full image for ROI images (as getXY/valXY)
+  float setXY_auto( int x, int y, float value ); // pixel coordinates in the image read (as valXY_auto)
   float addXY( int x, int y, float value );
   int setY( int y, float value );
   float* set_line( int y, vector<double>& line );
@@ -233,7 +369,11 @@ public :
   void DivideLines( int y1, int y0, const char* outfile="ratio.txt");
   int Compare( CBgFits& right, float min_diff=0.00001, int verb=0 );
   bool Offset( double dx, double dy, CBgFits& out_fits, double multiplier=1.00 );
-  void Transpose( CBgFits& out_fits_t );
+  // out_fits_t re-allocated to m_SizeY x m_SizeX if needed, cache-sized tiles transposed by n_threads threads (0 -> number of CPUs) :
+  void Transpose( CBgFits& out_fits_t, int n_threads=0 );
+  static int m_TransposeTile; // tile size in pixels
+  static int m_StatThreads; // threads used by GetStat (0 -> number of CPUs)
+  static int m_MaxThreads;  // limit of the number of CPUs used when 0 threads are requested (0 -> no limit)
   double Sum(); // calculates sum of pixel values in the image
   
   double GetStatBorder( double& mean, double& rms, double& minval, double& maxval, int border );
@@ -242,7 +382,12 @@ public :
   double GetStatRadiusAll( double& mean, double& rms, double& minval, double& maxval, 
                            double& median, double& iqr, double& rms_iqr, int& cnt, int radius,
                            bool do_iqr=true, 
-                           int xc=-1, int yc=-1, int gDebugLevel=0  );
+                           int xc=-1, int yc=-1, int gDebugLevel=0, double approx=BG_APPROX_DEFAULT );
+  // the same with spans of the aperture calculated once (see bg_aperture.h) and reused for many images ,
+  // approx : exact median/IQR (0) or t-digest of given compression (see bg_approx_compression) :
+  double GetStatRadiusAll( CBgAperture& aperture, double& mean, double& rms, double& minval, double& maxval,
+                           double& median, double& iqr, double& rms_iqr, int& cnt,
+                           bool do_iqr=true, int xc=-1, int yc=-1, int gDebugLevel=0, double approx=BG_APPROX_DEFAULT );
 
   double GetStat( CBgArray& avg_spectrum, CBgArray& rms_spectrum, int start_int=0, int end_int=-1, const char* szState=NULL,
                   CBgArray* min_spectrum=NULL, CBgArray* max_spectrum=NULL,
@@ -250,8 +395,8 @@ public :
                   CBgFits* rfi_flag_fits_file=NULL );
   void Divide( double value );
   int Recalc( eCalcFitsAction_T action, double value=0.00 );
-  int GetMedianInt( CBgArray& median_int, CBgArray& rms_iqr_int );
-  int GetMedianInt( vector<cIntRange>& int_ranges, CBgArray& median_int, CBgArray& rms_iqr_int );
+  int GetMedianInt( CBgArray& median_int, CBgArray& rms_iqr_int, double approx=BG_APPROX_DEFAULT );
+  int GetMedianInt( vector<cIntRange>& int_ranges, CBgArray& median_int, CBgArray& rms_iqr_int, double approx=BG_APPROX_DEFAULT );
   void Normalize( CBgArray& median_int );
   int FindValue(double value, double delta=1000, eFindValueType_T type=eFindValueExact);
   void SetValue(double value);
@@ -267,7 +412,10 @@ public :
   void MeanLines( CBgArray& mean_lines, CBgArray& rms_lines ); // calculates mean value in every line and returns in array 
   
   // operations on list of files 
-  int CalcMedian( vector<string>& fits_list, CBgFits& out_rms, int bDoAverage=0 );
+  // median (mean when bDoAverage>0) and rms_iqr (rms) of every pixel over all files. The same band of rows is read
+  // from all files (ROI reads), so that at most mem_budget_mb MB of input data is kept in memory, pixels of the band
+  // are calculated by n_threads threads (0 -> number of CPUs) :
+  int CalcMedian( vector<string>& fits_list, CBgFits& out_rms, int bDoAverage=0, int n_io_threads=2, double mem_budget_mb=1024, int n_threads=0 );
 
   // range operations :
   void dump_max_hold( int start_int, int end_int, const char* szOutFile, int bShowFreq=0 );
@@ -292,9 +440,168 @@ public :
   int IsFlagged( int integration );
   int IsRFI_OK(  int integration, double& out_total_power, double& max_ch_power_dbm, double& max_freq, double& local_threshold, double& orbcomm_total_power, int& out_rejection_reason );
   int SaveAsByte( const char* outfile );
+
+  // tile-compressed output in WriteFits, Create and SaveAsByte (ReadFits reads compressed files without any settings) :
+  void SetCompression( const cFitsCompression& compression ){ m_Compression = compression; }
+  void SetCompression( int type, long tile_x=0, long tile_y=1, float quantize_level=4.00 ){ m_Compression = cFitsCompression( type, tile_x, tile_y, quantize_level ); }
+  cFitsCompression& GetCompression(){ return m_Compression; }
+  static void SetDefaultCompression( const cFitsCompression& compression ){ m_DefaultCompression = compression; }
+
+  // 16-bit scaled integer output in WriteFits (half size of float files), BSCALE/BZERO are calculated from the data range
+  // of the whole image or of every row (eInt16PerRow - values are stored in ROWSCALE binary table extension) :
+  void SetInt16Output( int mode ){ m_Int16Mode = mode; }
+  int GetInt16Output() const { return m_Int16Mode; }
+  static void SetDefaultInt16Output( int mode ){ m_DefaultInt16Mode = mode; }
+  static int ParseInt16Mode( const char* szMode ); // none, image, row -> eInt16Scaling (<0 for unknown name)
+
+  // ReadFits keeps 16-bit images as int16 values (half memory) until the pixels are accessed, the first access to
+  // the values (getXY, get_line, get_data, arithmetics etc.) converts the image to float :
+  void SetKeepInt16( bool bKeep ){ m_bKeepInt16 = bKeep; }
+  inline bool IsInt16() const { return (image_type == TSHORT); }
+  void ConvertInt16ToFloat();
+  // BSCALE/BZERO of every row from ROWSCALE extension (file written with eInt16PerRow), fp is left at the image HDU ,
+  // n_image_rows - number of rows in the file (<0 -> m_SizeY) :
+  int ReadRowScaling( fitsfile* fp, vector<double>& row_scale, vector<double>& row_zero, int n_image_rows=-1 );
+  // BSCALE/BZERO and (when ROWSCALE=T) per-row scaling of 16-bit image in the current HDU (scale=1, zero=0 and empty
+  // row vectors for other BITPIX) , returns status of reading the ROWSCALE extension :
+  int ReadInt16Scaling( fitsfile* fp, int file_bitpix, int n_image_rows, double& scale, double& zero, vector<double>& row_scale, vector<double>& row_zero );
+
+  // keywords describing structure of the HDU (sizes, compression) which are not copied between files :
+  static bool IsStructuralKeyword( const char* keyword );
   
   // managing output files :
   CBgFits* AllocOutFits( const char* fname, int _y_size, int bAddStates=TRUE );
 };
 
+// methods of CBgImage (bg_image.h) using CBgFits :
+template<class T>
+void CBgImage<T>::ToFits( CBgFits& out ) const
+{
+   if( out.GetXSize() != m_SizeX || out.GetYSize() != m_SizeY ){
+      out.Realloc( m_SizeX, m_SizeY, FALSE );
+   }
+   float* out_data = out.get_data();
+   long n = m_Data.size();
+   for(long i=0;i<n;i++){
+      out_data[i] = ToPhysical( m_Data[i] );
+   }
+}
+
+template<class T>
+void CBgImage<T>::FromFits( CBgFits& in )
+{
+   Alloc( in.GetXSize(), in.GetYSize() );
+   float* in_data = in.get_data();
+   long n = m_Data.size();
+   for(long i=0;i<n;i++){
+      m_Data[i] = FromPhysical( in_data[i] );
+   }
+}
+
+template<class T>
+int CBgImage<T>::ReadFits( const char* fits_file, CBgFits* header )
+{
+   if( header ){
+      int ret = header->ReadFits( fits_file, 0, 0, 1 );
+      if( ret ){
+         return ret;
+      }
+   }
+
+   fitsfile* fp = NULL;
+   int status = 0;
+   fits_open_image( &fp, fits_file, READONLY, &status );
+   if( status ){
+      printf("ERROR : could not open FITS file %s , due to error %d\n",fits_file,status);
+      return status;
+   }
+
+   int bitpix = 0, naxis = 0;
+   long axsizes[2] = { 0, 1 };
+   fits_get_img_param( fp, 2, &bitpix, &naxis, axsizes, &status );
+   if( status || naxis < 1 ){
+      printf("ERROR : could not read parameters from FITS file %s, due to error %d\n",fits_file,status);
+      fits_close_file( fp, &status );
+      return ( status ? status : -1 );
+   }
+   Alloc( axsizes[0], ( naxis > 1 ? axsizes[1] : 1 ) );
+
+   m_Scale = 1.00;
+   m_Zero = 0.00;
+   T nulval = traits::null_value();
+   if( traits::is_integer && traits::bitpix == bitpix ){
+      int key_status = 0;
+      fits_read_key( fp, TDOUBLE, "BSCALE", &m_Scale, NULL, &key_status );
+      key_status = 0;
+      fits_read_key( fp, TDOUBLE, "BZERO", &m_Zero, NULL, &key_status );
+      fits_set_bscale( fp, 1.00, 0.00, &status );
+   }
+
+   vector<long> firstpixel( naxis, 1 );
+   LONGLONG nelements = m_Data.size();
+   if( nelements > 0 ){
+      fits_read_pix( fp, traits::datatype, &(firstpixel[0]), nelements, &nulval, get_data(), NULL, &status );
+   }
+   if( status ){
+      printf("ERROR : could not read data from FITS file %s, due to error %d\n",fits_file,status);
+      int close_status = 0;
+      fits_close_file( fp, &close_status );
+      return status;
+   }
+   fits_close_file( fp, &status );
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("INFO : read %d x %d image of %d-bit pixels (BITPIX=%d in file) from %s\n",m_SizeX,m_SizeY,(int)(8*sizeof(T)),bitpix,fits_file);
+   }
+
+   return status;
+}
+
+template<class T>
+int CBgImage<T>::WriteFits( const char* fits_file, CBgFits* header )
+{
+   string szFitsFileToOverwrite = "!";
+   szFitsFileToOverwrite += fits_file;
+   fitsfile* fp = NULL;
+   int status = 0;
+   long naxes[2] = { m_SizeX, m_SizeY };
+
+   if( fits_create_file( &fp, szFitsFileToOverwrite.c_str(), &status ) ){
+      printf("ERROR : could not create FITS file %s , due to error %d\n",fits_file,status);
+      return status;
+   }
+   fits_create_img( fp, traits::bitpix, 2, naxes, &status );
+
+   if( !status && traits::is_integer ){
+      if( m_Scale != 1.00 || m_Zero != 0.00 ){
+         fits_write_key( fp, TDOUBLE, "BSCALE", &m_Scale, "physical = raw*BSCALE + BZERO", &status );
+         fits_write_key( fp, TDOUBLE, "BZERO", &m_Zero, NULL, &status );
+      }
+      if( traits::null_value() != 0 ){
+         int blank = traits::null_value();
+         fits_write_key( fp, TINT, "BLANK", &blank, "NaN pixels", &status );
+      }
+      // raw values are written :
+      fits_set_hdustruc( fp, &status );
+      fits_set_bscale( fp, 1.00, 0.00, &status );
+   }
+
+   LONGLONG nelements = m_Data.size();
+   if( !status && nelements > 0 ){
+      fits_write_img( fp, traits::datatype, 1, nelements, get_data(), &status );
+   }
+   if( !status && header ){
+      header->WriteKeys( fp );
+   }
+
+   int close_status = 0;
+   fits_close_file( fp, &close_status );
+   if( status || close_status ){
+      printf("ERROR : could not write image to FITS file %s , due to error %d\n",fits_file,(status ? status : close_status));
+      return ( status ? status : close_status );
+   }
+
+   return 0;
+}
+
 #endif
@@ -0,0 +1,223 @@
+#include "bg_fits_async_writer.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "bg_globals.h"
+#include "bg_defines.h"
+
+static double bg_get_time_sec()
+{
+   struct timeval tv;
+   gettimeofday( &tv, NULL );
+   return tv.tv_sec + tv.tv_usec/1000000.00;
+}
+
+CBgFitsAsyncWriter::CBgFitsAsyncWriter( int line_size, int ring_lines, int batch_lines )
+: m_LinesQueued(0), m_LinesWritten(0), m_Batches(0), m_Stalls(0), m_StallTime(0), m_MaxQueueDepth(0),
+  m_fptr(NULL), m_WritePixel(1), m_LineSize(line_size), m_RingLines(ring_lines), m_BatchLines(batch_lines),
+  m_Head(0), m_Tail(0), m_Count(0), m_bStop(false), m_bFlush(false), m_bRunning(false), m_Status(0)
+{
+   if( m_RingLines <= 0 ){
+      m_RingLines = 1024;
+   }
+   if( m_BatchLines <= 0 || m_BatchLines > m_RingLines ){
+      m_BatchLines = m_RingLines;
+   }
+
+   m_Ring.assign( ((size_t)m_RingLines)*((size_t)m_LineSize), 0 );
+   m_Sizes.assign( m_RingLines, 0 );
+
+   pthread_mutex_init( &m_Mutex, NULL );
+   pthread_cond_init( &m_NotEmpty, NULL );
+   pthread_cond_init( &m_NotFull, NULL );
+}
+
+CBgFitsAsyncWriter::~CBgFitsAsyncWriter()
+{
+   Stop();
+
+   pthread_cond_destroy( &m_NotFull );
+   pthread_cond_destroy( &m_NotEmpty );
+   pthread_mutex_destroy( &m_Mutex );
+}
+
+int CBgFitsAsyncWriter::Start( fitsfile* fptr, long long first_pixel )
+{
+   if( m_bRunning ){
+      printf("ERROR : asynchronous FITS writer already running\n");
+      return -1;
+   }
+
+   m_fptr = fptr;
+   m_WritePixel = first_pixel;
+   m_Head = m_Tail = m_Count = 0;
+   m_bStop = false;
+   m_bFlush = false;
+   m_Status = 0;
+
+   int ret = pthread_create( &m_Thread, NULL, WriterThread, this );
+   if( ret ){
+      printf("ERROR : could not start asynchronous FITS writer thread, error = %d\n",ret);
+      return ret;
+   }
+   m_bRunning = true;
+
+   return 0;
+}
+
+void CBgFitsAsyncWriter::SetWritePixel( long long first_pixel )
+{
+   pthread_mutex_lock( &m_Mutex );
+   m_WritePixel = first_pixel;
+   pthread_mutex_unlock( &m_Mutex );
+}
+
+void* CBgFitsAsyncWriter::WriterThread( void* ptr )
+{
+   ((CBgFitsAsyncWriter*)ptr)->Run();
+   return NULL;
+}
+
+void CBgFitsAsyncWriter::Run()
+{
+   pthread_mutex_lock( &m_Mutex );
+   while( true ){
+      while( m_Count < m_BatchLines && !m_bStop && !m_bFlush ){
+         pthread_cond_wait( &m_NotEmpty, &m_Mutex );
+      }
+      if( m_Count == 0 ){
+         if( m_bStop ){
+            break;
+         }
+         // flush completed :
+         m_bFlush = false;
+         pthread_cond_broadcast( &m_NotFull );
+         continue;
+      }
+
+      // contiguous run of slots (up to the end of the ring), only full lines can be merged into one write :
+      int n_lines = m_Count;
+      if( n_lines > m_BatchLines ){
+         n_lines = m_BatchLines;
+      }
+      if( m_Tail + n_lines > m_RingLines ){
+         n_lines = m_RingLines - m_Tail;
+      }
+      int n_full = 0;
+      while( n_full < n_lines && m_Sizes[m_Tail+n_full] == m_LineSize ){
+         n_full++;
+      }
+      LONGLONG n_values = 0;
+      if( n_full > 0 ){
+         n_lines = n_full;
+         n_values = ((LONGLONG)n_lines)*m_LineSize;
+      }else{
+         n_lines = 1;
+         n_values = m_Sizes[m_Tail];
+      }
+      float* ptr = &(m_Ring[((size_t)m_Tail)*m_LineSize]);
+      pthread_mutex_unlock( &m_Mutex );
+
+      // filled slots are not modified by the producer, so the file is written without holding the lock :
+      int status = 0;
+      if( fits_write_img( m_fptr, TFLOAT, m_WritePixel, n_values, ptr, &status ) ){
+         if (status) fits_report_error(stderr, status);
+      }
+      m_WritePixel += n_values;
+
+      pthread_mutex_lock( &m_Mutex );
+      if( status && !m_Status ){
+         m_Status = status;
+      }
+      m_Tail = (m_Tail + n_lines) % m_RingLines;
+      m_Count -= n_lines;
+      m_LinesWritten += n_lines;
+      m_Batches++;
+      pthread_cond_broadcast( &m_NotFull );
+   }
+   pthread_mutex_unlock( &m_Mutex );
+}
+
+int CBgFitsAsyncWriter::Push( const float* buffer, int size )
+{
+   if( size > m_LineSize ){
+      printf("ERROR : line of size %d cannot be written by asynchronous writer with line size = %d\n",size,m_LineSize);
+      return -1;
+   }
+
+   pthread_mutex_lock( &m_Mutex );
+   if( m_Count >= m_RingLines ){
+      m_Stalls++;
+      double t_start = bg_get_time_sec();
+      while( m_Count >= m_RingLines ){
+         pthread_cond_signal( &m_NotEmpty );
+         pthread_cond_wait( &m_NotFull, &m_Mutex );
+      }
+      m_StallTime += (bg_get_time_sec() - t_start);
+   }
+   pthread_mutex_unlock( &m_Mutex );
+
+   // slot at m_Head is free and only used by the producer until m_Count is increased :
+   memcpy( &(m_Ring[((size_t)m_Head)*m_LineSize]), buffer, size*sizeof(float) );
+   m_Sizes[m_Head] = size;
+
+   pthread_mutex_lock( &m_Mutex );
+   m_Head = (m_Head + 1) % m_RingLines;
+   m_Count++;
+   m_LinesQueued++;
+   if( m_Count > m_MaxQueueDepth ){
+      m_MaxQueueDepth = m_Count;
+   }
+   if( m_Count >= m_BatchLines ){
+      pthread_cond_signal( &m_NotEmpty );
+   }
+   int status = m_Status;
+   pthread_mutex_unlock( &m_Mutex );
+
+   return status;
+}
+
+int CBgFitsAsyncWriter::Flush()
+{
+   if( !m_bRunning ){
+      return m_Status;
+   }
+
+   pthread_mutex_lock( &m_Mutex );
+   m_bFlush = true;
+   pthread_cond_signal( &m_NotEmpty );
+   while( m_Count > 0 || m_bFlush ){
+      pthread_cond_wait( &m_NotFull, &m_Mutex );
+   }
+   int status = m_Status;
+   pthread_mutex_unlock( &m_Mutex );
+
+   return status;
+}
+
+int CBgFitsAsyncWriter::Stop()
+{
+   if( !m_bRunning ){
+      return m_Status;
+   }
+
+   pthread_mutex_lock( &m_Mutex );
+   m_bStop = true;
+   pthread_cond_signal( &m_NotEmpty );
+   pthread_mutex_unlock( &m_Mutex );
+
+   pthread_join( m_Thread, NULL );
+   m_bRunning = false;
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      PrintStat();
+   }
+
+   return m_Status;
+}
+
+void CBgFitsAsyncWriter::PrintStat()
+{
+   printf("Asynchronous FITS writer : queued %ld lines, written %ld lines in %ld batches, max queue depth = %d / %d, stalls = %ld (%.6f sec)\n",
+          m_LinesQueued,m_LinesWritten,m_Batches,m_MaxQueueDepth,m_RingLines,m_Stalls,m_StallTime);
+}
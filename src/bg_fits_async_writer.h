@@ -0,0 +1,72 @@
+#ifndef _BG_FITS_ASYNC_WRITER_H__
+#define _BG_FITS_ASYNC_WRITER_H__
+
+#include <pthread.h>
+#include <fitsio.h>
+#include <vector>
+using namespace std;
+
+// Background writer of FITS image lines (spectra) : lines are copied to a pre-allocated ring of line buffers
+// and written to the file by a separate thread in contiguous batches of up to batch_lines.
+// Producer (acquisition loop) only blocks when the ring is full, which is counted as a stall (backpressure).
+// Used by CBgFits::DumpFitsLine after CBgFits::EnableAsyncWrite
+class CBgFitsAsyncWriter
+{
+public :
+   CBgFitsAsyncWriter( int line_size, int ring_lines=1024, int batch_lines=128 );
+   ~CBgFitsAsyncWriter();
+
+   // starts background thread writing to already created FITS file, first_pixel is 1-based cfitsio pixel index
+   int Start( fitsfile* fptr, long long first_pixel=1 );
+
+   // copies line to the ring (size must be <= line_size), returns status of previous writes (!=0 -> cfitsio error)
+   int Push( const float* buffer, int size );
+
+   // waits until all queued lines are written (file can be used by the caller after it returns)
+   int Flush();
+
+   // next pixel written by the thread (1-based), only after Flush when the caller wrote to the file directly
+   void SetWritePixel( long long first_pixel );
+
+   // drains the queue and stops the thread, returns cfitsio status of writes
+   int Stop();
+
+   bool IsRunning() const { return m_bRunning; }
+   int GetLineSize() const { return m_LineSize; }
+   void PrintStat();
+
+   // backpressure / performance statistics :
+   long int m_LinesQueued;
+   long int m_LinesWritten;
+   long int m_Batches;
+   long int m_Stalls;         // number of Push calls which had to wait for a free buffer
+   double   m_StallTime;      // total time [sec] producer waited for free buffers
+   int      m_MaxQueueDepth;
+
+protected :
+   static void* WriterThread( void* ptr );
+   void Run();
+
+   fitsfile* m_fptr;
+   long long m_WritePixel;  // next pixel to write (1-based)
+   int       m_LineSize;
+   int       m_RingLines;
+   int       m_BatchLines;
+   vector<float> m_Ring;
+   vector<int>   m_Sizes;   // number of values in every slot
+
+   int  m_Head;    // next slot to fill
+   int  m_Tail;    // next slot to write
+   int  m_Count;   // number of filled slots
+   bool m_bStop;
+   bool m_bFlush;
+   bool m_bRunning;
+   int  m_Status;  // first cfitsio error
+
+   pthread_t       m_Thread;
+   pthread_mutex_t m_Mutex;
+   pthread_cond_t  m_NotEmpty;
+   pthread_cond_t  m_NotFull;
+};
+
+#endif
@@ -0,0 +1,363 @@
+#include "bg_fits_catalog.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "bg_fits.h"
+#include "bg_globals.h"
+#include "bg_defines.h"
+
+// CTYPE first, it decides which of CRVAL/CDELT keywords describe the frequency axis :
+const char* CBgFitsCatalog::m_HeaderKeywords = "CTYPE1,CTYPE2,DTIME-FS,DTIME-FU,INTTIME,NACCUM,STARTFRQ,STOPFRQ,CRVAL1,CRVAL2,CDELT1,CDELT2,DATE-OBS,DATE";
+
+// catalog file : magic, number of entries, entries (path length, path, fixed size values) in native byte order
+static const char bg_catalog_magic[8] = { 'B','G','F','C','A','T','0','1' };
+
+template<class T>
+static bool bg_catalog_write( FILE* f, T value )
+{
+   return ( fwrite( &value, sizeof(T), 1, f ) == 1 );
+}
+
+template<class T>
+static bool bg_catalog_read( FILE* f, T& value )
+{
+   return ( fread( &value, sizeof(T), 1, f ) == 1 );
+}
+
+CBgFitsCatalog::CBgFitsCatalog( const char* catalog_file )
+: m_bModified(false), m_bScanned(false), m_NextToScan(0)
+{
+   if( catalog_file ){
+      m_FileName = catalog_file;
+   }
+   pthread_mutex_init( &m_Mutex, NULL );
+}
+
+CBgFitsCatalog::~CBgFitsCatalog()
+{
+   pthread_mutex_destroy( &m_Mutex );
+}
+
+int CBgFitsCatalog::Read( const char* catalog_file )
+{
+   if( catalog_file && strlen(catalog_file) ){
+      m_FileName = catalog_file;
+   }
+
+   m_Entries.clear();
+   m_Index.clear();
+   m_bModified = false;
+   m_bScanned = false;
+
+   FILE* f = fopen( m_FileName.c_str(), "rb" );
+   if( !f ){
+      if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+         printf("INFO : catalog file %s does not exist yet\n",m_FileName.c_str());
+      }
+      return 0;
+   }
+
+   char magic[8];
+   int32_t n_entries = 0;
+   if( fread( magic, 1, 8, f ) != 8 || memcmp( magic, bg_catalog_magic, 8 ) != 0 || !bg_catalog_read( f, n_entries ) || n_entries < 0 ){
+      printf("ERROR : file %s is not a FITS catalog file (or it was written by a different version)\n",m_FileName.c_str());
+      fclose( f );
+      return -1;
+   }
+
+   m_Entries.resize( n_entries );
+   bool bOK = true;
+   for(int i=0;i<n_entries && bOK;i++){
+      cFitsCatalogEntry& entry = m_Entries[i];
+      int32_t path_len = 0;
+      int64_t mtime = 0, file_size = 0;
+      int32_t values[5];
+
+      bOK = ( bg_catalog_read( f, path_len ) && path_len >= 0 && path_len < 65536 );
+      if( bOK ){
+         entry.path.resize( path_len );
+         bOK = ( path_len == 0 || fread( &(entry.path[0]), 1, path_len, f ) == path_len );
+      }
+      bOK = bOK && bg_catalog_read( f, mtime ) && bg_catalog_read( f, file_size ) && ( fread( values, sizeof(int32_t), 5, f ) == 5 );
+      bOK = bOK && bg_catalog_read( f, entry.inttime ) && bg_catalog_read( f, entry.start_freq ) && bg_catalog_read( f, entry.stop_freq ) && bg_catalog_read( f, entry.delta_freq );
+      if( bOK ){
+         entry.mtime     = mtime;
+         entry.file_size = file_size;
+         entry.status    = values[0];
+         entry.size_x    = values[1];
+         entry.size_y    = values[2];
+         entry.dtime_fs  = values[3];
+         entry.dtime_fu  = values[4];
+         m_Index[entry.path] = i;
+      }
+   }
+   fclose( f );
+
+   if( !bOK ){
+      printf("ERROR : catalog file %s is truncated or corrupted -> ignored\n",m_FileName.c_str());
+      m_Entries.clear();
+      m_Index.clear();
+      return -1;
+   }
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("INFO : read %d entries from catalog file %s\n",(int)m_Entries.size(),m_FileName.c_str());
+   }
+
+   return m_Entries.size();
+}
+
+int CBgFitsCatalog::Write( const char* catalog_file )
+{
+   if( catalog_file && strlen(catalog_file) ){
+      m_FileName = catalog_file;
+   }
+   if( m_FileName.length() == 0 ){
+      printf("ERROR : name of the catalog file not specified\n");
+      return -1;
+   }
+
+   // written to a temporary file and renamed, so that an interrupted run does not leave a broken catalog :
+   string szTmpFile = m_FileName + ".tmp";
+   FILE* f = fopen( szTmpFile.c_str(), "wb" );
+   if( !f ){
+      printf("ERROR : could not create catalog file %s\n",szTmpFile.c_str());
+      return -1;
+   }
+
+   bool bOK = ( fwrite( bg_catalog_magic, 1, 8, f ) == 8 ) && bg_catalog_write( f, (int32_t)m_Entries.size() );
+   for(int i=0;i<m_Entries.size() && bOK;i++){
+      cFitsCatalogEntry& entry = m_Entries[i];
+      int32_t values[5] = { entry.status, entry.size_x, entry.size_y, entry.dtime_fs, entry.dtime_fu };
+
+      bOK = bg_catalog_write( f, (int32_t)entry.path.length() ) && ( entry.path.length() == 0 || fwrite( entry.path.c_str(), 1, entry.path.length(), f ) == entry.path.length() );
+      bOK = bOK && bg_catalog_write( f, (int64_t)entry.mtime ) && bg_catalog_write( f, (int64_t)entry.file_size ) && ( fwrite( values, sizeof(int32_t), 5, f ) == 5 );
+      bOK = bOK && bg_catalog_write( f, entry.inttime ) && bg_catalog_write( f, entry.start_freq ) && bg_catalog_write( f, entry.stop_freq ) && bg_catalog_write( f, entry.delta_freq );
+   }
+   if( fclose( f ) ){
+      bOK = false;
+   }
+
+   if( !bOK || rename( szTmpFile.c_str(), m_FileName.c_str() ) ){
+      printf("ERROR : could not write catalog file %s\n",m_FileName.c_str());
+      unlink( szTmpFile.c_str() );
+      return -1;
+   }
+   m_bModified = false;
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("INFO : written %d entries to catalog file %s\n",(int)m_Entries.size(),m_FileName.c_str());
+   }
+
+   return 0;
+}
+
+cFitsCatalogEntry* CBgFitsCatalog::GetEntry( const char* path )
+{
+   unordered_map<string,int>::iterator it = m_Index.find( path );
+   if( it != m_Index.end() ){
+      return &(m_Entries[it->second]);
+   }
+
+   return NULL;
+}
+
+void CBgFitsCatalog::RemoveEntries( const vector<string>& paths )
+{
+   if( paths.size() == 0 ){
+      return;
+   }
+   for(int i=0;i<paths.size();i++){
+      m_Index.erase( paths[i] );
+   }
+
+   vector<cFitsCatalogEntry> entries;
+   entries.reserve( m_Index.size() );
+   for(int i=0;i<m_Entries.size();i++){
+      if( m_Index.find( m_Entries[i].path ) != m_Index.end() ){
+         entries.push_back( m_Entries[i] );
+      }
+   }
+   m_Entries.swap( entries );
+
+   m_Index.clear();
+   for(int i=0;i<m_Entries.size();i++){
+      m_Index[m_Entries[i].path] = i;
+   }
+   m_bModified = true;
+}
+
+int CBgFitsCatalog::Scan( vector<string>& fits_list, int n_threads )
+{
+   // entries of files which do not exist anymore are removed first (indexes of entries change) :
+   vector<struct stat> stats( fits_list.size() );
+   vector<bool> exists( fits_list.size(), false );
+   vector<string> missing;
+   for(int i=0;i<fits_list.size();i++){
+      if( stat( fits_list[i].c_str(), &(stats[i]) ) ){
+         printf("WARNING : file %s does not exist -> not added to the catalog\n",fits_list[i].c_str());
+         missing.push_back( fits_list[i] );
+         continue;
+      }
+      exists[i] = true;
+   }
+   RemoveEntries( missing );
+
+   for(int i=0;i<m_Entries.size();i++){
+      m_Entries[i].in_scan = false;
+   }
+   m_bScanned = true;
+
+   m_ToScan.clear();
+   int n_missing = missing.size();
+   for(int i=0;i<fits_list.size();i++){
+      if( !exists[i] ){
+         continue;
+      }
+      struct stat& st = stats[i];
+
+      cFitsCatalogEntry* pEntry = GetEntry( fits_list[i].c_str() );
+      int idx = -1;
+      if( pEntry ){
+         pEntry->in_scan = true;
+         if( pEntry->mtime == st.st_mtime && pEntry->file_size == st.st_size ){
+            // not modified since it was cataloged :
+            continue;
+         }
+         idx = m_Index[fits_list[i]];
+      }else{
+         idx = m_Entries.size();
+         m_Entries.push_back( cFitsCatalogEntry() );
+         m_Entries[idx].path = fits_list[i];
+         m_Entries[idx].in_scan = true;
+         m_Index[fits_list[i]] = idx;
+      }
+      m_Entries[idx].mtime = st.st_mtime;
+      m_Entries[idx].file_size = st.st_size;
+      m_ToScan.push_back( idx );
+   }
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("INFO : %d files on the list, %d found in the catalog, %d headers to read, %d missing files\n",(int)fits_list.size(),(int)(fits_list.size()-m_ToScan.size()-n_missing),(int)m_ToScan.size(),n_missing);
+   }
+   if( m_ToScan.size() == 0 ){
+      return 0;
+   }
+
+   if( n_threads > m_ToScan.size() ){
+      n_threads = m_ToScan.size();
+   }
+   if( n_threads <= 0 ){
+      n_threads = 1;
+   }
+
+   // entries are not added or removed while the threads are running, every thread fills different entries :
+   m_NextToScan = 0;
+   vector<pthread_t> threads;
+   for(int t=0;t<n_threads;t++){
+      pthread_t thread;
+      int ret = pthread_create( &thread, NULL, ScanThread, this );
+      if( ret ){
+         printf("ERROR : could not start header scanning thread %d, error = %d\n",t,ret);
+         break;
+      }
+      threads.push_back( thread );
+   }
+   if( threads.size() == 0 ){
+      // scan in the calling thread :
+      RunScan();
+   }
+   for(int t=0;t<threads.size();t++){
+      pthread_join( threads[t], NULL );
+   }
+   m_bModified = true;
+
+   return m_ToScan.size();
+}
+
+void* CBgFitsCatalog::ScanThread( void* ptr )
+{
+   ((CBgFitsCatalog*)ptr)->RunScan();
+   return NULL;
+}
+
+void CBgFitsCatalog::RunScan()
+{
+   while( true ){
+      pthread_mutex_lock( &m_Mutex );
+      int i = m_NextToScan;
+      m_NextToScan++;
+      pthread_mutex_unlock( &m_Mutex );
+      if( i >= m_ToScan.size() ){
+         break;
+      }
+
+      cFitsCatalogEntry& entry = m_Entries[ m_ToScan[i] ];
+
+      // new object for every file, so that values of keywords missing in this header are not taken from the previous one :
+      CBgFits fits;
+      fits.dtime_fs = -1000;
+      fits.SetHeaderFilter( m_HeaderKeywords );
+      entry.status = fits.ReadFits( entry.path.c_str(), 0, 0, 1 );
+      if( entry.status ){
+         printf("WARNING : could not read header of FITS file %s (error %d)\n",entry.path.c_str(),entry.status);
+         continue;
+      }
+
+      entry.size_x     = fits.GetXSize();
+      entry.size_y     = fits.GetYSize();
+      entry.dtime_fs   = fits.dtime_fs;
+      entry.dtime_fu   = fits.dtime_fu;
+      entry.inttime    = fits.inttime;
+      entry.start_freq = fits.start_freq;
+      entry.stop_freq  = fits.stop_freq;
+      entry.delta_freq = fits.delta_freq;
+   }
+}
+
+struct cCatalogTimeCompare
+{
+   vector<cFitsCatalogEntry>& entries;
+   cCatalogTimeCompare( vector<cFitsCatalogEntry>& _entries ) : entries(_entries) {}
+   bool operator()( int left, int right ) const { return entries[left].GetUnixTime() < entries[right].GetUnixTime(); }
+};
+
+int CBgFitsCatalog::Select( double ux_start, double ux_end, vector<string>& out_list, vector<double>* out_times )
+{
+   vector<int> selected;
+   for(int i=0;i<m_Entries.size();i++){
+      cFitsCatalogEntry& entry = m_Entries[i];
+      double uxtime = entry.GetUnixTime();
+      if( entry.status == 0 && uxtime >= ux_start && ( ux_end <= 0 || uxtime <= ux_end ) ){
+         if( m_bScanned ){
+            if( !entry.in_scan ){
+               continue;
+            }
+         }else{
+            struct stat st;
+            if( stat( entry.path.c_str(), &st ) ){
+               printf("WARNING : file %s in the catalog does not exist anymore -> not selected\n",entry.path.c_str());
+               continue;
+            }
+         }
+         selected.push_back( i );
+      }
+   }
+   std::stable_sort( selected.begin(), selected.end(), cCatalogTimeCompare( m_Entries ) );
+
+   out_list.clear();
+   if( out_times ){
+      out_times->clear();
+   }
+   for(int i=0;i<selected.size();i++){
+      out_list.push_back( m_Entries[selected[i]].path );
+      if( out_times ){
+         out_times->push_back( m_Entries[selected[i]].GetUnixTime() );
+      }
+   }
+
+   return out_list.size();
+}
@@ -0,0 +1,80 @@
+#ifndef _BG_FITS_CATALOG_H__
+#define _BG_FITS_CATALOG_H__
+
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+using namespace std;
+
+// header keys of a single FITS file stored in the catalog :
+struct cFitsCatalogEntry
+{
+   string path;
+   time_t mtime;      // modification time and size of the file when the header was read (entry is re-used only when both agree)
+   long   file_size;
+   int    status;     // ReadFits status (!=0 -> header could not be read)
+   int    size_x;
+   int    size_y;
+   int    dtime_fs;
+   int    dtime_fu;
+   double inttime;
+   double start_freq;
+   double stop_freq;
+   double delta_freq;
+   bool   in_scan;    // file is on the list of the last Scan (not saved in the catalog file)
+
+   cFitsCatalogEntry() : mtime(0), file_size(0), status(0), size_x(0), size_y(0), dtime_fs(0), dtime_fu(0),
+                         inttime(0), start_freq(0), stop_freq(0), delta_freq(0), in_scan(false) {}
+   inline double GetUnixTime() const { return dtime_fs + dtime_fu/1000000.00; }
+};
+
+// Catalog of header keys (DTIME-FS/FU, INTTIME, NAXIS, frequencies) of a list of FITS files stored in a binary sidecar file.
+// Scan reads only headers of the files which are not in the catalog or were modified since (by n_threads threads),
+// so that later runs (e.g. selection of files in a time range) do not have to open every FITS file again.
+class CBgFitsCatalog
+{
+public :
+   CBgFitsCatalog( const char* catalog_file=NULL );
+   ~CBgFitsCatalog();
+
+   // binary catalog file , Read returns number of entries (<0 on error, 0 for not existing file) :
+   int Read( const char* catalog_file=NULL );
+   int Write( const char* catalog_file=NULL );
+
+   // updates entries of all files on the list and removes entries of the files which do not exist anymore,
+   // returns number of headers read from FITS files :
+   int Scan( vector<string>& fits_list, int n_threads=4 );
+
+   // files with start time in range [ux_start,ux_end] sorted by time (ux_end<=0 -> no upper limit), only files on the list
+   // of the last Scan are selected (all existing files of the catalog when Scan was not called) :
+   int Select( double ux_start, double ux_end, vector<string>& out_list, vector<double>* out_times=NULL );
+
+   cFitsCatalogEntry* GetEntry( const char* path );
+   inline int GetEntriesCount() const { return m_Entries.size(); }
+   inline cFitsCatalogEntry& GetEntry( int idx ){ return m_Entries[idx]; }
+   inline bool IsModified() const { return m_bModified; }
+   const char* GetFileName(){ return m_FileName.c_str(); }
+
+   // keywords read from FITS headers :
+   static const char* m_HeaderKeywords;
+
+protected :
+   static void* ScanThread( void* ptr );
+   void RunScan();
+   void RemoveEntries( const vector<string>& paths ); // rebuilds m_Index
+
+   string m_FileName;
+   vector<cFitsCatalogEntry> m_Entries;
+   unordered_map<string,int> m_Index; // path -> index in m_Entries
+   bool m_bModified;
+   bool m_bScanned;
+
+   // scan of headers :
+   vector<int>     m_ToScan;     // indexes of entries to be read
+   int             m_NextToScan;
+   pthread_mutex_t m_Mutex;
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "bg_fits_cube.h"
+#include <stdio.h>
+#include <string.h>
+#include "bg_globals.h"
+#include "bg_defines.h"
+
+CBgFitsCube::CBgFitsCube( const char* fits_file, int max_planes )
+: m_PlaneReads(0), m_PlaneHits(0), m_SpaxelReads(0),
+  m_fptr(NULL), m_SizeX(0), m_SizeY(0), m_SizeZ(0), m_Naxis(0), m_MaxPlanes(max_planes), m_UseCounter(0)
+{
+   if( fits_file ){
+      m_FileName = fits_file;
+   }
+   if( m_MaxPlanes < 1 ){
+      m_MaxPlanes = 1;
+   }
+}
+
+CBgFitsCube::~CBgFitsCube()
+{
+   Close();
+}
+
+int CBgFitsCube::Open( const char* fits_file, int bIgnoreHeaderErrors )
+{
+   Close();
+
+   if( fits_file && strlen(fits_file) ){
+      m_FileName = fits_file;
+   }
+
+   // keywords only :
+   int ret = m_Header.ReadFits( m_FileName.c_str(), 0, 0, bIgnoreHeaderErrors );
+   if( ret ){
+      printf("ERROR : could not read header of FITS file %s\n",m_FileName.c_str());
+      return ret;
+   }
+
+   int status = 0;
+   fits_open_image(&m_fptr, m_FileName.c_str(), READONLY, &status);
+   if( status ){
+      printf("ERROR : could not open FITS file %s , due to error %d\n",m_FileName.c_str(),status);
+      m_fptr = NULL;
+      return status;
+   }
+
+   int bitpix = 0;
+   long axsizes[3] = { 0, 1, 1 };
+   fits_get_img_param(m_fptr, 3, &bitpix, &m_Naxis, axsizes, &status);
+   if( status || m_Naxis < 1 ){
+      printf("ERROR : could not read parameters from FITS file %s, due to error %d\n",m_FileName.c_str(),status);
+      Close();
+      return ( status ? status : -1 );
+   }
+   if( m_Naxis > 3 ){
+      printf("WARNING : FITS file %s has %d axes, only the first 3 are used\n",m_FileName.c_str(),m_Naxis);
+   }
+   m_SizeX = axsizes[0];
+   m_SizeY = ( m_Naxis > 1 ? axsizes[1] : 1 );
+   m_SizeZ = ( m_Naxis > 2 ? axsizes[2] : 1 );
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("INFO : opened FITS cube %s (%d x %d x %d), at most %d planes kept in memory\n",m_FileName.c_str(),m_SizeX,m_SizeY,m_SizeZ,m_MaxPlanes);
+   }
+
+   return 0;
+}
+
+void CBgFitsCube::Close()
+{
+   for(int i=0;i<m_Planes.size();i++){
+      delete m_Planes[i].plane;
+   }
+   m_Planes.clear();
+
+   if( m_fptr ){
+      int status = 0;
+      fits_close_file(m_fptr, &status);
+      if( status ){
+         printf("ERROR : could not close FITS file %s , due to error %d\n",m_FileName.c_str(),status);
+      }
+      m_fptr = NULL;
+   }
+}
+
+int CBgFitsCube::ReadPlane( int z, float* buffer )
+{
+   if( !m_fptr ){
+      printf("ERROR : FITS cube %s not opened\n",m_FileName.c_str());
+      return -1;
+   }
+   if( z < 0 || z >= m_SizeZ ){
+      printf("ERROR : requested plane %d outside cube %s with %d planes\n",z,m_FileName.c_str(),m_SizeZ);
+      return -1;
+   }
+
+   // further axes (if any) are at the first pixel :
+   int n_axes = ( m_Naxis > 3 ? m_Naxis : 3 );
+   vector<long> firstpixel( n_axes, 1 );
+   firstpixel[2] = z + 1;
+   LONGLONG nelements = ((LONGLONG)m_SizeX)*((LONGLONG)m_SizeY);
+   float nulval = (0.00/0.00);
+   int status = 0, anynul = 0;
+
+   fits_read_pix(m_fptr, TFLOAT, &(firstpixel[0]), nelements, &nulval, buffer, &anynul, &status);
+   if( status ){
+      printf("ERROR : could not read plane %d from FITS file %s , due to error %d\n",z,m_FileName.c_str(),status);
+      return status;
+   }
+   m_PlaneReads++;
+
+   return 0;
+}
+
+CBgFitsCube::cCubePlane* CBgFitsCube::FindPlane( int z )
+{
+   for(int i=0;i<m_Planes.size();i++){
+      if( m_Planes[i].z == z ){
+         return &(m_Planes[i]);
+      }
+   }
+
+   return NULL;
+}
+
+CBgFits* CBgFitsCube::GetPlane( int z )
+{
+   cCubePlane* pPlane = FindPlane( z );
+   if( pPlane ){
+      m_PlaneHits++;
+      pPlane->last_use = (++m_UseCounter);
+      return pPlane->plane;
+   }
+
+   if( m_Planes.size() >= m_MaxPlanes ){
+      // least recently used plane is replaced (its buffer is re-used) :
+      int lru = 0;
+      for(int i=1;i<m_Planes.size();i++){
+         if( m_Planes[i].last_use < m_Planes[lru].last_use ){
+            lru = i;
+         }
+      }
+      pPlane = &(m_Planes[lru]);
+   }else{
+      cCubePlane new_plane;
+      new_plane.z = -1;
+      new_plane.plane = new CBgFits( m_SizeX, m_SizeY );
+      new_plane.last_use = 0;
+      m_Planes.push_back( new_plane );
+      pPlane = &(m_Planes.back());
+   }
+
+   pPlane->z = -1;
+   if( ReadPlane( z, pPlane->plane->get_data() ) ){
+      return NULL;
+   }
+   pPlane->z = z;
+   pPlane->last_use = (++m_UseCounter);
+
+   return pPlane->plane;
+}
+
+float CBgFitsCube::getXYZ( int x, int y, int z )
+{
+   CBgFits* pPlane = GetPlane( z );
+   if( !pPlane ){
+      return (0.00/0.00);
+   }
+
+   return pPlane->getXY( x, y );
+}
+
+int CBgFitsCube::GetSpaxel( int x, int y, vector<float>& out_values, int z_start, int z_end )
+{
+   if( !m_fptr ){
+      printf("ERROR : FITS cube %s not opened\n",m_FileName.c_str());
+      return -1;
+   }
+   if( x < 0 || y < 0 || x >= m_SizeX || y >= m_SizeY ){
+      printf("ERROR : pixel (%d,%d) outside cube %s of size %d x %d\n",x,y,m_FileName.c_str(),m_SizeX,m_SizeY);
+      return -1;
+   }
+   if( z_start < 0 ){
+      z_start = 0;
+   }
+   if( z_end < 0 || z_end > m_SizeZ ){
+      z_end = m_SizeZ;
+   }
+   out_values.clear();
+   if( z_start >= z_end ){
+      return 0;
+   }
+   out_values.resize( z_end - z_start );
+
+   // planes already in memory :
+   bool bAllResident = true;
+   for(int z=z_start;z<z_end && bAllResident;z++){
+      cCubePlane* pPlane = FindPlane( z );
+      if( pPlane ){
+         out_values[z-z_start] = pPlane->plane->getXY( x, y );
+      }else{
+         bAllResident = false;
+      }
+   }
+   if( bAllResident ){
+      m_PlaneHits += (z_end - z_start);
+      return out_values.size();
+   }
+
+   // single pixel from every plane :
+   int n_axes = ( m_Naxis > 3 ? m_Naxis : 3 );
+   vector<long> fpixel( n_axes, 1 ), lpixel( n_axes, 1 ), inc( n_axes, 1 );
+   fpixel[0] = lpixel[0] = x + 1;
+   fpixel[1] = lpixel[1] = y + 1;
+   fpixel[2] = z_start + 1;
+   lpixel[2] = z_end;
+   float nulval = (0.00/0.00);
+   int status = 0, anynul = 0;
+
+   fits_read_subset(m_fptr, TFLOAT, &(fpixel[0]), &(lpixel[0]), &(inc[0]), &nulval, &(out_values[0]), &anynul, &status);
+   if( status ){
+      printf("ERROR : could not read pixel (%d,%d) in planes %d - %d from FITS file %s , due to error %d\n",x,y,z_start,z_end-1,m_FileName.c_str(),status);
+      out_values.clear();
+      return -status;
+   }
+   m_SpaxelReads++;
+
+   return out_values.size();
+}
+
+void CBgFitsCube::SetMaxPlanes( int max_planes )
+{
+   m_MaxPlanes = ( max_planes >= 1 ? max_planes : 1 );
+
+   while( m_Planes.size() > m_MaxPlanes ){
+      int lru = 0;
+      for(int i=1;i<m_Planes.size();i++){
+         if( m_Planes[i].last_use < m_Planes[lru].last_use ){
+            lru = i;
+         }
+      }
+      delete m_Planes[lru].plane;
+      m_Planes.erase( m_Planes.begin() + lru );
+   }
+}
+
+void CBgFitsCube::PrintStat()
+{
+   printf("FITS cube %s : %ld planes read, %ld plane cache hits, %ld spaxels read from file, %d / %d planes in memory\n",
+          m_FileName.c_str(),m_PlaneReads,m_PlaneHits,m_SpaxelReads,(int)m_Planes.size(),m_MaxPlanes);
+}
@@ -0,0 +1,70 @@
+#ifndef _BG_FITS_CUBE_H__
+#define _BG_FITS_CUBE_H__
+
+#include <fitsio.h>
+#include <string>
+#include <vector>
+#include "bg_fits.h"
+using namespace std;
+
+// FITS cube (NAXIS3 planes of NAXIS1 x NAXIS2 pixels, e.g. image per channel or per time step) kept open on disk.
+// Planes are read on demand and at most max_planes of them are kept in memory (least recently used is dropped),
+// pixel values through all the planes (spaxel) are read directly from the file without loading the planes.
+// Not thread safe (single fitsfile pointer).
+class CBgFitsCube
+{
+public :
+   CBgFitsCube( const char* fits_file=NULL, int max_planes=16 );
+   ~CBgFitsCube();
+
+   int Open( const char* fits_file=NULL, int bIgnoreHeaderErrors=1 );
+   void Close();
+   bool IsOpen() const { return (m_fptr!=NULL); }
+
+   inline int GetXSize() const { return m_SizeX; }
+   inline int GetYSize() const { return m_SizeY; }
+   inline int GetZSize() const { return m_SizeZ; } // 1 for 2D images
+   CBgFits& GetHeader(){ return m_Header; }        // keywords (image is not read)
+   const char* GetFileName(){ return m_FileName.c_str(); }
+
+   // plane z loaded on first use, pointer is valid until max_planes other planes are requested :
+   CBgFits* GetPlane( int z );
+   float getXYZ( int x, int y, int z );
+
+   // reads plane z into buffer of GetXSize()*GetYSize() values (no caching) :
+   int ReadPlane( int z, float* buffer );
+
+   // values of pixel (x,y) in planes [z_start,z_end) (z_end<0 -> all planes) , resident planes are not read again :
+   int GetSpaxel( int x, int y, vector<float>& out_values, int z_start=0, int z_end=-1 );
+
+   void SetMaxPlanes( int max_planes );
+   inline int GetMaxPlanes() const { return m_MaxPlanes; }
+   void PrintStat();
+
+   // cache statistics :
+   long int m_PlaneReads;
+   long int m_PlaneHits;
+   long int m_SpaxelReads;
+
+protected :
+   struct cCubePlane
+   {
+      int      z;
+      CBgFits* plane;
+      long int last_use;
+   };
+   cCubePlane* FindPlane( int z );
+
+   fitsfile* m_fptr;
+   string    m_FileName;
+   CBgFits   m_Header;
+   int       m_SizeX;
+   int       m_SizeY;
+   int       m_SizeZ;
+   int       m_Naxis;
+   int       m_MaxPlanes;
+   long int  m_UseCounter;
+   vector<cCubePlane> m_Planes; // resident planes
+};
+
+#endif
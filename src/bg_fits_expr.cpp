@@ -0,0 +1,488 @@
+#include "bg_fits_expr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "bg_fits.h"
+#include "bg_globals.h"
+#include "bg_defines.h"
+
+int CBgFitsExpr::m_BlockSize = 512;
+
+struct cExprFunction
+{
+   const char* name;
+   eExprOp_T   op;
+   int         n_args;
+};
+
+static cExprFunction gExprFunctions[] = {
+   { "sqrt",  eExprSqrt,  1 },
+   { "log10", eExprLog10, 1 },
+   { "log",   eExprLog10, 1 }, // as log action of calcfits_bg
+   { "ln",    eExprLn,    1 },
+   { "exp",   eExprExp,   1 },
+   { "abs",   eExprAbs,   1 },
+   { "db",    eExprDB,    1 },
+   { "dB",    eExprDB,    1 },
+   { "lin",   eExprLin,   1 },
+   { "min",   eExprMin,   2 },
+   { "max",   eExprMax,   2 },
+   { "pow",   eExprPow,   2 },
+   { NULL,    eExprConst, 0 }
+};
+
+static const char* bg_expr_op_name( eExprOp_T op )
+{
+   switch( op ){
+      case eExprConst : return "const";
+      case eExprImage : return "image";
+      case eExprNeg   : return "neg";
+      case eExprAdd   : return "add";
+      case eExprSub   : return "sub";
+      case eExprMul   : return "mul";
+      case eExprDiv   : return "div";
+      case eExprPow   : return "pow";
+      case eExprMin   : return "min";
+      case eExprMax   : return "max";
+      case eExprSqrt  : return "sqrt";
+      case eExprLog10 : return "log10";
+      case eExprLn    : return "ln";
+      case eExprExp   : return "exp";
+      case eExprAbs   : return "abs";
+      case eExprDB    : return "db";
+      case eExprLin   : return "lin";
+   }
+   return "unknown";
+}
+
+static inline bool bg_expr_is_binary( eExprOp_T op )
+{
+   return ( op == eExprAdd || op == eExprSub || op == eExprMul || op == eExprDiv || op == eExprPow || op == eExprMin || op == eExprMax );
+}
+
+// NaN in any of the arguments gives NaN :
+static inline double bg_expr_min( double l, double r )
+{
+   return ( (l < r || l != l) ? l : r );
+}
+
+static inline double bg_expr_max( double l, double r )
+{
+   return ( (l > r || l != l) ? l : r );
+}
+
+// same formulas as CBgFits::Recalc (used for constant folding and in the evaluation loops) :
+static double bg_expr_calc( eExprOp_T op, double l, double r )
+{
+   switch( op ){
+      case eExprNeg   : return -l;
+      case eExprAdd   : return l + r;
+      case eExprSub   : return l - r;
+      case eExprMul   : return l * r;
+      case eExprDiv   : return l / r;
+      case eExprPow   : return pow( l, r );
+      case eExprMin   : return bg_expr_min( l, r );
+      case eExprMax   : return bg_expr_max( l, r );
+      case eExprSqrt  : return sqrt( l );
+      case eExprLog10 : return log10( l );
+      case eExprLn    : return log( l );
+      case eExprExp   : return exp( l );
+      case eExprAbs   : return fabs( l );
+      case eExprDB    : return 10.00*log10( l );
+      case eExprLin   : return exp( (l / 10) * log(10.0) );
+      default :
+         break;
+   }
+   return l;
+}
+
+CBgFitsExpr::CBgFitsExpr( const char* expression )
+: m_Pos(0), m_nImages(0), m_MaxDepth(0)
+{
+   if( expression && strlen(expression) ){
+      Compile( expression );
+   }
+}
+
+bool CBgFitsExpr::Error( const char* szMessage )
+{
+   printf("ERROR : in expression %s : %s at position %d\n",m_Expression.c_str(),szMessage,m_Pos);
+   return false;
+}
+
+void CBgFitsExpr::SkipSpaces()
+{
+   while( m_Pos < m_Expression.length() && isspace( m_Expression[m_Pos] ) ){
+      m_Pos++;
+   }
+}
+
+void CBgFitsExpr::Emit( eExprOp_T op, double value, int image )
+{
+   int n = m_Program.size();
+
+   if( op != eExprConst && op != eExprImage && n >= 1 && m_Program[n-1].op == eExprConst ){
+      if( !bg_expr_is_binary( op ) ){
+         // f(const) :
+         m_Program[n-1].value = bg_expr_calc( op, m_Program[n-1].value, 0.00 );
+         return;
+      }
+
+      if( n >= 2 && m_Program[n-2].op == eExprConst ){
+         // const OP const :
+         m_Program[n-2].value = bg_expr_calc( op, m_Program[n-2].value, m_Program[n-1].value );
+         m_Program.pop_back();
+         return;
+      }
+
+      // X OP const -> constant is not pushed on the stack :
+      value = m_Program[n-1].value;
+      m_Program.pop_back();
+      cExprInstr instr = { op, value, -1, true };
+      m_Program.push_back( instr );
+      return;
+   }
+
+   cExprInstr instr = { op, value, image, false };
+   m_Program.push_back( instr );
+}
+
+int CBgFitsExpr::Compile( const char* expression )
+{
+   m_Expression = ( expression ? expression : "" );
+   m_Program.clear();
+   m_Pos = 0;
+   m_nImages = 0;
+   m_MaxDepth = 0;
+
+   bool bOK = ParseSum();
+   SkipSpaces();
+   if( bOK && m_Pos < m_Expression.length() ){
+      bOK = Error( "unexpected character" );
+   }
+   if( bOK && m_Program.size() == 0 ){
+      bOK = Error( "empty expression" );
+   }
+   if( !bOK ){
+      m_Program.clear();
+      return -1;
+   }
+
+   int depth = 0;
+   for(int i=0;i<m_Program.size();i++){
+      cExprInstr& instr = m_Program[i];
+      if( instr.op == eExprConst || instr.op == eExprImage ){
+         depth++;
+      }else if( bg_expr_is_binary( instr.op ) && !instr.bConstRight ){
+         depth--;
+      }
+      if( depth > m_MaxDepth ){
+         m_MaxDepth = depth;
+      }
+   }
+   m_Stack.assign( ((long)m_MaxDepth)*m_BlockSize, 0.00 );
+
+   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+      PrintProgram();
+   }
+
+   return 0;
+}
+
+void CBgFitsExpr::PrintProgram()
+{
+   printf("Expression %s : %d instructions, %d images, stack depth %d\n",m_Expression.c_str(),(int)m_Program.size(),m_nImages,m_MaxDepth);
+   for(int i=0;i<m_Program.size();i++){
+      cExprInstr& instr = m_Program[i];
+      if( instr.op == eExprImage ){
+         printf("\t%s %c\n",bg_expr_op_name(instr.op),'a'+instr.image);
+      }else if( instr.op == eExprConst || instr.bConstRight ){
+         printf("\t%s %.8f\n",bg_expr_op_name(instr.op),instr.value);
+      }else{
+         printf("\t%s\n",bg_expr_op_name(instr.op));
+      }
+   }
+}
+
+// sum := product { (+|-) product }
+bool CBgFitsExpr::ParseSum()
+{
+   if( !ParseProduct() ){
+      return false;
+   }
+
+   while( true ){
+      SkipSpaces();
+      if( m_Pos >= m_Expression.length() || (m_Expression[m_Pos] != '+' && m_Expression[m_Pos] != '-') ){
+         break;
+      }
+      eExprOp_T op = ( m_Expression[m_Pos] == '+' ? eExprAdd : eExprSub );
+      m_Pos++;
+      if( !ParseProduct() ){
+         return false;
+      }
+      Emit( op );
+   }
+
+   return true;
+}
+
+// product := unary { (*|/) unary }
+bool CBgFitsExpr::ParseProduct()
+{
+   if( !ParseUnary() ){
+      return false;
+   }
+
+   while( true ){
+      SkipSpaces();
+      if( m_Pos >= m_Expression.length() || (m_Expression[m_Pos] != '*' && m_Expression[m_Pos] != '/') ){
+         break;
+      }
+      eExprOp_T op = ( m_Expression[m_Pos] == '*' ? eExprMul : eExprDiv );
+      m_Pos++;
+      if( !ParseUnary() ){
+         return false;
+      }
+      Emit( op );
+   }
+
+   return true;
+}
+
+// unary := (-|+) unary | power
+bool CBgFitsExpr::ParseUnary()
+{
+   SkipSpaces();
+   if( m_Pos < m_Expression.length() && (m_Expression[m_Pos] == '-' || m_Expression[m_Pos] == '+') ){
+      bool bNeg = ( m_Expression[m_Pos] == '-' );
+      m_Pos++;
+      if( !ParseUnary() ){
+         return false;
+      }
+      if( bNeg ){
+         Emit( eExprNeg );
+      }
+      return true;
+   }
+
+   return ParsePower();
+}
+
+// power := primary [ ^ unary ] (right associative)
+bool CBgFitsExpr::ParsePower()
+{
+   if( !ParsePrimary() ){
+      return false;
+   }
+
+   SkipSpaces();
+   if( m_Pos < m_Expression.length() && m_Expression[m_Pos] == '^' ){
+      m_Pos++;
+      if( !ParseUnary() ){
+         return false;
+      }
+      Emit( eExprPow );
+   }
+
+   return true;
+}
+
+// primary := number | image | function( sum [, sum] ) | ( sum )
+bool CBgFitsExpr::ParsePrimary()
+{
+   SkipSpaces();
+   if( m_Pos >= m_Expression.length() ){
+      return Error( "unexpected end of expression" );
+   }
+
+   char c = m_Expression[m_Pos];
+   if( c == '(' ){
+      m_Pos++;
+      if( !ParseSum() ){
+         return false;
+      }
+      SkipSpaces();
+      if( m_Pos >= m_Expression.length() || m_Expression[m_Pos] != ')' ){
+         return Error( "missing )" );
+      }
+      m_Pos++;
+      return true;
+   }
+
+   if( isdigit(c) || c == '.' ){
+      const char* start = m_Expression.c_str() + m_Pos;
+      char* end = NULL;
+      double value = strtod( start, &end );
+      if( end == start ){
+         return Error( "wrong number" );
+      }
+      m_Pos += (end - start);
+      Emit( eExprConst, value );
+      return true;
+   }
+
+   if( !isalpha(c) ){
+      return Error( "unexpected character" );
+   }
+
+   int start = m_Pos;
+   while( m_Pos < m_Expression.length() && (isalnum( m_Expression[m_Pos] ) || m_Expression[m_Pos] == '_') ){
+      m_Pos++;
+   }
+   string name = m_Expression.substr( start, m_Pos - start );
+   SkipSpaces();
+
+   if( m_Pos < m_Expression.length() && m_Expression[m_Pos] == '(' ){
+      cExprFunction* pFunc = NULL;
+      for(int i=0;gExprFunctions[i].name;i++){
+         if( strcmp( gExprFunctions[i].name, name.c_str() ) == 0 ){
+            pFunc = &(gExprFunctions[i]);
+            break;
+         }
+      }
+      if( !pFunc ){
+         m_Pos = start;
+         return Error( "unknown function" );
+      }
+
+      m_Pos++;
+      for(int arg=0;arg<pFunc->n_args;arg++){
+         if( arg > 0 ){
+            SkipSpaces();
+            if( m_Pos >= m_Expression.length() || m_Expression[m_Pos] != ',' ){
+               return Error( "missing function argument" );
+            }
+            m_Pos++;
+         }
+         if( !ParseSum() ){
+            return false;
+         }
+      }
+      SkipSpaces();
+      if( m_Pos >= m_Expression.length() || m_Expression[m_Pos] != ')' ){
+         return Error( "missing ) after function arguments" );
+      }
+      m_Pos++;
+      Emit( pFunc->op );
+      return true;
+   }
+
+   if( name.length() == 1 ){
+      // image a,b,c ... (or A,B,C ...) :
+      int image = tolower( name[0] ) - 'a';
+      Emit( eExprImage, 0.00, image );
+      if( image >= m_nImages ){
+         m_nImages = image + 1;
+      }
+      return true;
+   }
+
+   m_Pos = start;
+   return Error( "unknown name (images are single letters a,b,c...)" );
+}
+
+int CBgFitsExpr::Evaluate( vector<CBgFits*>& images, CBgFits& out )
+{
+   if( !IsCompiled() ){
+      printf("ERROR : expression not compiled\n");
+      return -1;
+   }
+   if( images.size() < m_nImages ){
+      printf("ERROR : expression %s requires %d images, only %d provided\n",m_Expression.c_str(),m_nImages,(int)images.size());
+      return -1;
+   }
+
+   int sizeX = ( images.size() > 0 ? images[0]->GetXSize() : out.GetXSize() );
+   int sizeY = ( images.size() > 0 ? images[0]->GetYSize() : out.GetYSize() );
+   vector<float*> image_data( m_nImages, (float*)NULL );
+   for(int i=0;i<m_nImages;i++){
+      if( images[i]->GetXSize() != sizeX || images[i]->GetYSize() != sizeY ){
+         printf("ERROR : image %c has size %d x %d != %d x %d\n",'a'+i,images[i]->GetXSize(),images[i]->GetYSize(),sizeX,sizeY);
+         return -1;
+      }
+      image_data[i] = images[i]->get_data();
+   }
+   if( out.GetXSize() != sizeX || out.GetYSize() != sizeY ){
+      out.Realloc( sizeX, sizeY, FALSE );
+   }
+   float* out_data = out.get_data();
+   long size = ((long)sizeX)*sizeY;
+   if( size > 0 && !out_data ){
+      printf("ERROR : output image not allocated\n");
+      return -1;
+   }
+
+   // every block is calculated by the whole program before the next one, out block is written after inputs are read :
+   for(long start=0;start<size;start+=m_BlockSize){
+      int n = ( (size - start) < m_BlockSize ? (size - start) : m_BlockSize );
+      int sp = 0;
+
+      for(int i=0;i<m_Program.size();i++){
+         cExprInstr& instr = m_Program[i];
+
+         if( instr.op == eExprConst ){
+            double* top = &(m_Stack[((long)sp)*m_BlockSize]);
+            for(int k=0;k<n;k++){
+               top[k] = instr.value;
+            }
+            sp++;
+            continue;
+         }
+         if( instr.op == eExprImage ){
+            double* top = &(m_Stack[((long)sp)*m_BlockSize]);
+            const float* in = image_data[instr.image] + start;
+            for(int k=0;k<n;k++){
+               top[k] = in[k];
+            }
+            sp++;
+            continue;
+         }
+
+         if( bg_expr_is_binary( instr.op ) ){
+            double* left = NULL;
+            if( instr.bConstRight ){
+               left = &(m_Stack[((long)(sp-1))*m_BlockSize]);
+               double r = instr.value;
+               switch( instr.op ){
+                  case eExprAdd : for(int k=0;k<n;k++){ left[k] = left[k] + r; } break;
+                  case eExprSub : for(int k=0;k<n;k++){ left[k] = left[k] - r; } break;
+                  case eExprMul : for(int k=0;k<n;k++){ left[k] = left[k] * r; } break;
+                  case eExprDiv : for(int k=0;k<n;k++){ left[k] = left[k] / r; } break;
+                  default : for(int k=0;k<n;k++){ left[k] = bg_expr_calc( instr.op, left[k], r ); } break;
+               }
+            }else{
+               left = &(m_Stack[((long)(sp-2))*m_BlockSize]);
+               const double* right = left + m_BlockSize;
+               switch( instr.op ){
+                  case eExprAdd : for(int k=0;k<n;k++){ left[k] = left[k] + right[k]; } break;
+                  case eExprSub : for(int k=0;k<n;k++){ left[k] = left[k] - right[k]; } break;
+                  case eExprMul : for(int k=0;k<n;k++){ left[k] = left[k] * right[k]; } break;
+                  case eExprDiv : for(int k=0;k<n;k++){ left[k] = left[k] / right[k]; } break;
+                  default : for(int k=0;k<n;k++){ left[k] = bg_expr_calc( instr.op, left[k], right[k] ); } break;
+               }
+               sp--;
+            }
+            continue;
+         }
+
+         double* top = &(m_Stack[((long)(sp-1))*m_BlockSize]);
+         switch( instr.op ){
+            case eExprNeg  : for(int k=0;k<n;k++){ top[k] = -top[k]; } break;
+            case eExprSqrt : for(int k=0;k<n;k++){ top[k] = sqrt( top[k] ); } break;
+            case eExprAbs  : for(int k=0;k<n;k++){ top[k] = fabs( top[k] ); } break;
+            default : for(int k=0;k<n;k++){ top[k] = bg_expr_calc( instr.op, top[k], 0.00 ); } break;
+         }
+      }
+
+      const double* result = &(m_Stack[0]);
+      float* out_block = out_data + start;
+      for(int k=0;k<n;k++){
+         out_block[k] = result[k];
+      }
+   }
+
+   return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef _BG_FITS_EXPR_H__
+#define _BG_FITS_EXPR_H__
+
+#include <string>
+#include <vector>
+using namespace std;
+
+class CBgFits;
+
+enum eExprOp_T { eExprConst=0, eExprImage, eExprNeg, eExprAdd, eExprSub, eExprMul, eExprDiv, eExprPow, eExprMin, eExprMax,
+                 eExprSqrt, eExprLog10, eExprLn, eExprExp, eExprAbs, eExprDB, eExprLin };
+
+struct cExprInstr
+{
+   eExprOp_T op;
+   double    value;      // eExprConst, or right operand of binary operation when bConstRight
+   int       image;      // eExprImage : index of input image (a=0, b=1, ...)
+   bool      bConstRight;
+};
+
+// Per-pixel expression on N images of the same size, e.g. "db(sqrt(a*b)/c)+3" (a - first image, b - second ...).
+// Expression is compiled to a stack program which is executed in one pass over blocks of pixels (no intermediate images),
+// values are calculated in double precision as in CBgFits::Recalc.
+// Operators : + - * / ^ , functions : sqrt, log10 (log), ln, exp, abs, db (10*log10), lin (dB -> linear), min, max, pow
+class CBgFitsExpr
+{
+public :
+   CBgFitsExpr( const char* expression=NULL );
+
+   // returns 0 if OK, <0 on syntax error (message printed) :
+   int Compile( const char* expression );
+   inline bool IsCompiled() const { return (m_Program.size()>0); }
+   inline int GetImagesCount() const { return m_nImages; } // number of input images required (highest letter used)
+   const char* GetExpression(){ return m_Expression.c_str(); }
+   void PrintProgram();
+
+   // out = expression( images[0], images[1], ... ) , out can be one of the inputs (calculated in place).
+   // Returns 0 if OK, <0 on error
+   int Evaluate( vector<CBgFits*>& images, CBgFits& out );
+
+   // number of pixels calculated together :
+   static int m_BlockSize;
+
+protected :
+   // recursive descent parser, returns false on error :
+   bool ParseSum();
+   bool ParseProduct();
+   bool ParseUnary();
+   bool ParsePower();
+   bool ParsePrimary();
+   void SkipSpaces();
+   bool Error( const char* szMessage );
+
+   // adds instruction, operations on constants are folded :
+   void Emit( eExprOp_T op, double value=0.00, int image=-1 );
+
+   string m_Expression;
+   int    m_Pos;
+   vector<cExprInstr> m_Program;
+   int    m_nImages;
+   int    m_MaxDepth;
+   vector<double> m_Stack; // m_MaxDepth blocks of m_BlockSize values
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "bg_fits_prefetch.h"
+#include <stdio.h>
+#include "bg_globals.h"
+#include "bg_defines.h"
+
+CBgFitsPrefetcher::CBgFitsPrefetcher( vector<string>& fits_list, int n_threads, int queue_size, int start_index, int end_index )
+: m_FitsList(fits_list), m_nThreads(n_threads), m_QueueSize(queue_size), m_StartIndex(start_index), m_EndIndex(end_index),
+  m_bAutoDetect(0), m_bReadImage(1), m_bIgnoreHeaderErrors(1),
+  m_RoiStartX(0), m_RoiStartY(0), m_RoiEndX(-1), m_RoiEndY(-1), m_RoiStep(0), m_NextToRead(start_index), m_NextToConsume(start_index), m_bStop(false)
+{
+   if( m_nThreads <= 0 ){
+      m_nThreads = 1;
+   }
+   if( m_QueueSize < m_nThreads ){
+      m_QueueSize = m_nThreads;
+   }
+   if( m_StartIndex < 0 ){
+      m_StartIndex = 0;
+   }
+   if( m_EndIndex < 0 || m_EndIndex > fits_list.size() ){
+      m_EndIndex = fits_list.size();
+   }
+   m_NextToRead = m_NextToConsume = m_StartIndex;
+
+   cPrefetchSlot empty_slot;
+   empty_slot.fits = NULL;
+   empty_slot.status = 0;
+   empty_slot.ready = false;
+   m_Slots.assign( m_QueueSize, empty_slot );
+
+   pthread_mutex_init( &m_Mutex, NULL );
+   pthread_cond_init( &m_SlotReady, NULL );
+   pthread_cond_init( &m_SlotFree, NULL );
+}
+
+CBgFitsPrefetcher::~CBgFitsPrefetcher()
+{
+   Stop();
+
+   for(int i=0;i<m_Slots.size();i++){
+      if( m_Slots[i].fits ){
+         delete m_Slots[i].fits;
+      }
+   }
+   for(int i=0;i<m_FreeList.size();i++){
+      delete m_FreeList[i];
+   }
+
+   pthread_cond_destroy( &m_SlotFree );
+   pthread_cond_destroy( &m_SlotReady );
+   pthread_mutex_destroy( &m_Mutex );
+}
+
+void CBgFitsPrefetcher::SetReadOptions( int bAutoDetect, int bReadImage, int bIgnoreHeaderErrors )
+{
+   m_bAutoDetect = bAutoDetect;
+   m_bReadImage = bReadImage;
+   m_bIgnoreHeaderErrors = bIgnoreHeaderErrors;
+}
+
+void CBgFitsPrefetcher::SetROI( int x_start, int y_start, int x_end, int y_end, int step )
+{
+   m_RoiStartX = x_start;
+   m_RoiStartY = y_start;
+   m_RoiEndX = x_end;
+   m_RoiEndY = y_end;
+   m_RoiStep = step;
+}
+
+int CBgFitsPrefetcher::Start()
+{
+   m_bStop = false;
+   for(int t=0;t<m_nThreads;t++){
+      pthread_t thread;
+      int ret = pthread_create( &thread, NULL, ReaderThread, this );
+      if( ret ){
+         printf("ERROR : could not start FITS reading thread %d, error = %d\n",t,ret);
+         return ret;
+      }
+      m_Threads.push_back( thread );
+   }
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("INFO : started %d threads reading FITS files %d - %d ahead (queue of %d files)\n",m_nThreads,m_StartIndex,m_EndIndex-1,m_QueueSize);
+   }
+
+   return 0;
+}
+
+void CBgFitsPrefetcher::Stop()
+{
+   pthread_mutex_lock( &m_Mutex );
+   m_bStop = true;
+   pthread_cond_broadcast( &m_SlotFree );
+   pthread_mutex_unlock( &m_Mutex );
+
+   for(int t=0;t<m_Threads.size();t++){
+      pthread_join( m_Threads[t], NULL );
+   }
+   m_Threads.clear();
+}
+
+void* CBgFitsPrefetcher::ReaderThread( void* ptr )
+{
+   ((CBgFitsPrefetcher*)ptr)->Run();
+   return NULL;
+}
+
+void CBgFitsPrefetcher::Run()
+{
+   pthread_mutex_lock( &m_Mutex );
+   while( !m_bStop && m_NextToRead < m_EndIndex ){
+      // bounded queue : do not read more than m_QueueSize files ahead of the consumer
+      if( m_NextToRead >= m_NextToConsume + m_QueueSize ){
+         pthread_cond_wait( &m_SlotFree, &m_Mutex );
+         continue;
+      }
+
+      int index = m_NextToRead;
+      m_NextToRead++;
+
+      CBgFits* fits = NULL;
+      if( m_FitsList[index].length() > 0 ){
+         if( m_FreeList.size() > 0 ){
+            fits = m_FreeList.back();
+            m_FreeList.pop_back();
+         }
+      }
+      pthread_mutex_unlock( &m_Mutex );
+
+      int status = 0;
+      if( m_FitsList[index].length() > 0 ){
+         if( !fits ){
+            fits = new CBgFits( m_FitsList[index].c_str() );
+         }
+         // otherwise value from the previously read file is kept when the keyword is missing :
+         fits->dtime_fs = -1000;
+         if( m_RoiStep > 0 ){
+            status = fits->ReadFitsROI( m_FitsList[index].c_str(), m_RoiStartX, m_RoiStartY, m_RoiEndX, m_RoiEndY, m_RoiStep, m_bIgnoreHeaderErrors );
+         }else{
+            status = fits->ReadFits( m_FitsList[index].c_str(), m_bAutoDetect, m_bReadImage, m_bIgnoreHeaderErrors );
+         }
+      }
+
+      pthread_mutex_lock( &m_Mutex );
+      cPrefetchSlot& slot = m_Slots[ (index-m_StartIndex) % m_QueueSize ];
+      slot.fits = fits;
+      slot.status = status;
+      slot.ready = true;
+      pthread_cond_broadcast( &m_SlotReady );
+   }
+   pthread_mutex_unlock( &m_Mutex );
+}
+
+CBgFits* CBgFitsPrefetcher::Next( int& out_index, int& out_status )
+{
+   out_index = -1;
+   out_status = 0;
+   if( m_NextToConsume >= m_EndIndex ){
+      return NULL;
+   }
+   if( m_Threads.size() <= 0 ){
+      Start();
+   }
+
+   pthread_mutex_lock( &m_Mutex );
+   cPrefetchSlot& slot = m_Slots[ (m_NextToConsume-m_StartIndex) % m_QueueSize ];
+   while( !slot.ready ){
+      pthread_cond_wait( &m_SlotReady, &m_Mutex );
+   }
+
+   CBgFits* fits = slot.fits;
+   out_status = slot.status;
+   out_index = m_NextToConsume;
+   slot.fits = NULL;
+   slot.ready = false;
+   m_NextToConsume++;
+   pthread_cond_broadcast( &m_SlotFree );
+   pthread_mutex_unlock( &m_Mutex );
+
+   return fits;
+}
+
+void CBgFitsPrefetcher::Release( CBgFits* fits )
+{
+   if( fits ){
+      pthread_mutex_lock( &m_Mutex );
+      m_FreeList.push_back( fits );
+      pthread_mutex_unlock( &m_Mutex );
+   }
+}
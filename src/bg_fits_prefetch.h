@@ -0,0 +1,71 @@
+#ifndef _BG_FITS_PREFETCH_H__
+#define _BG_FITS_PREFETCH_H__
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "bg_fits.h"
+using namespace std;
+
+// Reads FITS files from a list by n_threads I/O threads ahead of the consumer, at most queue_size files are kept
+// decoded in memory waiting to be consumed. Files are returned by Next in the order of the list, so that
+// the processing loop only waits when the disk is slower than the computation.
+// Empty entries in the list are not read and are returned as NULL with status 0 (e.g. optional companion files).
+// Files are read in parallel, so cfitsio has to be compiled as thread safe (reentrant, default in current versions).
+class CBgFitsPrefetcher
+{
+public :
+   CBgFitsPrefetcher( vector<string>& fits_list, int n_threads=2, int queue_size=4, int start_index=0, int end_index=-1 );
+   ~CBgFitsPrefetcher();
+
+   // parameters passed to CBgFits::ReadFits :
+   void SetReadOptions( int bAutoDetect=0, int bReadImage=1, int bIgnoreHeaderErrors=1 );
+
+   // files are read with CBgFits::ReadFitsROI (only pixels in the window), step<=0 switches back to ReadFits :
+   void SetROI( int x_start, int y_start, int x_end, int y_end, int step=1 );
+
+   int Start();
+   void Stop();
+
+   // returns next file (in list order) and its index on the list, NULL for empty entry and at the end of the list (out_index<0).
+   // out_status is the status returned by ReadFits - the object is also returned when reading failed so the caller can decide
+   // what to do (e.g. skip the file with -i option). The object belongs to the caller, it can be given back by Release
+   CBgFits* Next( int& out_index, int& out_status );
+   void Release( CBgFits* fits );
+
+   inline int GetThreadsCount() const { return m_nThreads; }
+
+protected :
+   struct cPrefetchSlot
+   {
+      CBgFits* fits;
+      int      status;
+      bool     ready;
+   };
+
+   static void* ReaderThread( void* ptr );
+   void Run();
+
+   vector<string>& m_FitsList;
+   int m_nThreads;
+   int m_QueueSize;
+   int m_StartIndex;
+   int m_EndIndex;
+   int m_bAutoDetect;
+   int m_bReadImage;
+   int m_bIgnoreHeaderErrors;
+   int m_RoiStartX, m_RoiStartY, m_RoiEndX, m_RoiEndY, m_RoiStep; // m_RoiStep=0 -> whole images
+
+   vector<cPrefetchSlot> m_Slots; // slot of list index i is (i-m_StartIndex) % m_QueueSize
+   vector<CBgFits*> m_FreeList;   // objects released by the consumer, re-used to avoid re-allocations
+   int  m_NextToRead;
+   int  m_NextToConsume;
+   bool m_bStop;
+
+   vector<pthread_t> m_Threads;
+   pthread_mutex_t   m_Mutex;
+   pthread_cond_t    m_SlotReady;
+   pthread_cond_t    m_SlotFree;
+};
+
+#endif
@@ -0,0 +1,472 @@
+#include "bg_fits_reader.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bg_globals.h"
+#include "bg_bedlam.h"
+#include "bg_units.h"
+
+CBgSpectrumStat::CBgSpectrumStat( int n_channels )
+{
+   Init( n_channels );
+}
+
+void CBgSpectrumStat::Init( int n_channels )
+{
+   m_nChannels = n_channels;
+   m_MinVal = 10000000.00;
+   m_MaxVal = -100000000.00;
+   m_MinPos = -1;
+   m_MaxPos = -1;
+   m_nInt = 0;
+
+   m_ChMean.alloc( n_channels, 0 );
+   m_ChM2.alloc( n_channels, 0 );
+   m_ChCount.alloc( n_channels, 0 );
+   m_ChMin.alloc( n_channels, 1000e9 );
+   m_ChMax.alloc( n_channels, -1000e9 );
+
+   m_TotalSum = 0.00;
+   m_NonZeroCount = 0;
+}
+
+void CBgSpectrumStat::AddRow( const float* row, int y, const float* flags, double min_acceptable_value )
+{
+   for(int x=0;x<m_nChannels;x++){
+      double val = row[x];
+
+      // min/max spectra do not take RFI flags into account :
+      if( val < m_ChMin[x] && val>=min_acceptable_value ){
+         m_ChMin[x] = val;
+      }
+      if( val > m_ChMax[x] ){
+         m_ChMax[x] = val;
+      }
+
+      if( flags && flags[x] > 0 ){
+         continue;
+      }
+
+      long int i = ((long int)y)*m_nChannels + x;
+      if( val > m_MaxVal ){
+         m_MaxVal = val;
+         m_MaxPos = i;
+      }
+      if( val < m_MinVal ){
+         m_MinVal = val;
+         m_MinPos = i;
+      }
+
+      // Welford update (no cancellation of large sum of squares) :
+      double n = m_ChCount[x] + 1;
+      double delta = val - m_ChMean[x];
+      m_ChMean[x] += delta / n;
+      m_ChM2[x] += delta*(val - m_ChMean[x]);
+      m_ChCount[x] = n;
+   }
+
+   m_nInt++;
+}
+
+void CBgSpectrumStat::AddToTotal( const float* row )
+{
+   for(int x=0;x<m_nChannels;x++){
+      double val = row[x];
+      m_TotalSum += val;
+
+      if( fabs(val) > 0.0000000001 ){
+         m_NonZeroCount++;
+      }
+   }
+}
+
+// mean and M2 of a + b (Chan et al.) :
+static void bg_merge_mean_m2( long double& n_a, long double& mean_a, long double& m2_a, long double n_b, long double mean_b, long double m2_b )
+{
+   if( n_b <= 0 ){
+      return;
+   }
+   if( n_a <= 0 ){
+      n_a = n_b;
+      mean_a = mean_b;
+      m2_a = m2_b;
+      return;
+   }
+
+   long double n = n_a + n_b;
+   long double delta = mean_b - mean_a;
+   mean_a += delta*(n_b/n);
+   m2_a += m2_b + delta*delta*(n_a*n_b/n);
+   n_a = n;
+}
+
+void CBgSpectrumStat::Merge( const CBgSpectrumStat& right )
+{
+   if( right.m_nChannels != m_nChannels ){
+      printf("ERROR : cannot merge statistics of %d channels with %d channels\n",right.m_nChannels,m_nChannels);
+      return;
+   }
+
+   for(int x=0;x<m_nChannels;x++){
+      long double n = m_ChCount[x], mean = m_ChMean[x], m2 = m_ChM2[x];
+      bg_merge_mean_m2( n, mean, m2, right.m_ChCount[x], right.m_ChMean[x], right.m_ChM2[x] );
+      m_ChCount[x] = n;
+      m_ChMean[x] = mean;
+      m_ChM2[x] = m2;
+
+      if( right.m_ChMin[x] < m_ChMin[x] ){
+         m_ChMin[x] = right.m_ChMin[x];
+      }
+      if( right.m_ChMax[x] > m_ChMax[x] ){
+         m_ChMax[x] = right.m_ChMax[x];
+      }
+   }
+
+   // right has later rows -> first occurence is kept for equal values :
+   if( right.m_MaxVal > m_MaxVal ){
+      m_MaxVal = right.m_MaxVal;
+      m_MaxPos = right.m_MaxPos;
+   }
+   if( right.m_MinVal < m_MinVal ){
+      m_MinVal = right.m_MinVal;
+      m_MinPos = right.m_MinPos;
+   }
+   m_nInt += right.m_nInt;
+   m_TotalSum += right.m_TotalSum;
+   m_NonZeroCount += right.m_NonZeroCount;
+}
+
+double CBgSpectrumStat::Finish( CBgFits& header, int start_int, int end_int, CBgArray& avg_spectrum, CBgArray& rms_spectrum,
+                                CBgArray* min_spectrum, CBgArray* max_spectrum, int* out_number_of_used_integrations )
+{
+   // all values from per channel mean/M2 :
+   long double count = 0, mean = 0, m2 = 0;
+   for(int x=0;x<m_nChannels;x++){
+      bg_merge_mean_m2( count, mean, m2, m_ChCount[x], m_ChMean[x], m_ChM2[x] );
+   }
+   long double rms = 0.00;
+   if( count > 0 ){
+      rms = sqrt( m2 / count );
+   }else{
+      mean = (0.00/0.00);
+   }
+
+   avg_spectrum.alloc( m_nChannels , 0 );
+   rms_spectrum.alloc( m_nChannels , 0 );
+   if( min_spectrum ){
+      min_spectrum->alloc( m_nChannels , 1000e9 );
+   }
+   if( max_spectrum ){
+      max_spectrum->alloc( m_nChannels , -1000e9 );
+   }
+
+   for(int x=0;x<m_nChannels;x++){
+      int y_lines_count = m_ChCount[x];
+      double ch_mean = m_ChMean[x];
+      double ch_rms = 0.00;
+      if( y_lines_count > 0 ){
+         ch_rms = sqrt( m_ChM2[x] / y_lines_count );
+      }else{
+         ch_mean = 0;
+      }
+
+      rms_spectrum[x] = ch_rms;
+      avg_spectrum[x] = ch_mean;
+
+      if( min_spectrum && max_spectrum ){
+         (*min_spectrum)[x] = m_ChMin[x];
+         (*max_spectrum)[x] = m_ChMax[x];
+      }
+   }
+
+   double inttime = header.GetIntTime();
+   double total_inttime = inttime * m_nInt;
+
+   // calculate total power of average integration in bedlam units and dBm
+   double total_power = 0.00, total_power_mW = 0;
+   for(int i=0;i<avg_spectrum.size();i++){
+      double freq = header.ch2freq(i);
+      total_power += avg_spectrum[i];
+      total_power_mW += CBedlamSpectrometer::power2mW( freq,avg_spectrum[i]);
+   }
+   double total_power_dbm = mW2dbm( total_power_mW );
+
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("##################################### STATISTICS %d - %d #####################################\n",start_int,end_int);
+      printf("Mean    = %e\n",(double)mean);
+      printf("RMS     = %e\n",(double)rms);
+      printf("SUM     = %.8f\n",m_TotalSum);
+      printf("Int count = %d\n",m_nInt);
+      printf("MAX val = %.8f at (%ld,%ld)\n",(double)m_MaxVal,(m_MaxPos%m_nChannels),(m_MaxPos/m_nChannels));
+      printf("MIN val = %.8f at (%ld,%ld)\n",(double)m_MinVal,(m_MinPos%m_nChannels),(m_MinPos/m_nChannels));
+      printf("INTTIME = %d x %.8f [sec] = %.8f [sec]\n",m_nInt,inttime,total_inttime);
+      printf("TOTAL POWER ( uxtime = %.8f ) = %.20f [?] = %.2f [dBm]\n",header.GetUnixTime(),total_power,total_power_dbm);
+      printf("Non-zero values = %ld\n",m_NonZeroCount);
+      printf("######################################################################################\n");
+   }
+
+   if( out_number_of_used_integrations ){
+     (*out_number_of_used_integrations) = m_nInt;
+   }
+
+   return total_inttime;
+}
+
+void bg_line_mean_rms( const float* row, int n, double& mean, double& rms )
+{
+   double sum = 0.00, sum2 = 0.00;
+   int counter = 0;
+
+   for(int x=0;x<n;x++){
+      double value = row[x];
+
+      if( !isnan(value) && !isinf(value) ){
+         sum     += value;
+         sum2    += value*value;
+         counter += 1;
+      }
+   }
+
+   mean = sum / counter;
+   rms  = sqrt( (sum2/counter) - (mean*mean) );
+}
+
+void bg_max_hold( const float* row, float* out_line, int n )
+{
+   for(int x=0;x<n;x++){
+      if( row[x] > out_line[x] ){
+         out_line[x] = row[x];
+      }
+   }
+}
+
+void bg_min_hold( const float* row, float* out_line, int n )
+{
+   for(int x=0;x<n;x++){
+      if( row[x] < out_line[x] ){
+         out_line[x] = row[x];
+      }
+   }
+}
+
+int bg_save_hold( const char* szOutFile, float* out_line, CBgFits& header, int bShowFreq )
+{
+   FILE* outfile = fopen(szOutFile,"w");
+   if( !outfile ){
+      printf("ERROR : could not open output file %s\n",szOutFile);
+      return -1;
+   }
+
+   for(int x=0;x<header.GetXSize();x++){
+       double x_val = x;
+       if( bShowFreq ){
+          x_val = header.ch2freq(x);
+       }
+
+      fprintf(outfile,"%.2f %e\n",x_val,out_line[x]);
+   }
+   fclose(outfile);
+
+   return header.GetXSize();
+}
+
+
+CBgFitsReader::CBgFitsReader( const char* fits_file, int block_rows )
+: m_fptr(NULL), m_BlockRows(1024), m_NextRow(0), m_BlockStart(0)
+{
+   if( fits_file ){
+      m_FileName = fits_file;
+   }
+   SetBlockRows( block_rows );
+}
+
+CBgFitsReader::~CBgFitsReader()
+{
+   Close();
+}
+
+void CBgFitsReader::SetBlockRows( int block_rows )
+{
+   if( block_rows > 0 ){
+      m_BlockRows = block_rows;
+   }
+}
+
+int CBgFitsReader::Open( const char* fits_file, int bIgnoreHeaderErrors )
+{
+   Close();
+
+   if( fits_file && strlen(fits_file) ){
+      m_FileName = fits_file;
+   }
+
+   // header only :
+   int ret = m_Header.ReadFits( m_FileName.c_str(), 0, 0, bIgnoreHeaderErrors );
+   if( ret ){
+      printf("ERROR : could not read header of FITS file %s\n",m_FileName.c_str());
+      return ret;
+   }
+
+   int status = 0;
+   fits_open_image(&m_fptr, m_FileName.c_str(), READONLY, &status);
+   if( status ){
+      printf("ERROR : could not open FITS file %s , due to error %d\n",m_FileName.c_str(),status);
+      m_fptr = NULL;
+      return status;
+   }
+
+   // 16-bit image written with per-row scaling (see CBgFits::SetInt16Output), BSCALE/BZERO of the whole image are applied by cfitsio :
+   int file_bitpix = 0;
+   double scale, zero;
+   fits_get_img_type( m_fptr, &file_bitpix, &status );
+   if( status || ( status = m_Header.ReadInt16Scaling( m_fptr, file_bitpix, GetYSize(), scale, zero, m_RowScale, m_RowZero ) ) ){
+      Close();
+      return status;
+   }
+
+   m_NextRow = 0;
+   m_BlockStart = 0;
+   if( gBGPrintfLevel >= BG_INFO_LEVEL ){
+      printf("INFO : opened FITS file %s (%d x %d) for reading in blocks of %d rows\n",m_FileName.c_str(),GetXSize(),GetYSize(),m_BlockRows);
+   }
+
+   return 0;
+}
+
+void CBgFitsReader::Close()
+{
+   if( m_fptr ){
+      int status = 0;
+      fits_close_file(m_fptr, &status);
+      if( status ){
+         printf("ERROR : could not close FITS file %s , due to error %d\n",m_FileName.c_str(),status);
+      }
+      m_fptr = NULL;
+   }
+}
+
+void CBgFitsReader::SetRow( int y )
+{
+   if( y < 0 ){
+      y = 0;
+   }
+   m_NextRow = y;
+}
+
+int CBgFitsReader::ReadBlock( CBgFits& block )
+{
+   if( !m_fptr ){
+      printf("ERROR : FITS file %s not opened\n",m_FileName.c_str());
+      return -1;
+   }
+
+   int n_rows = GetYSize() - m_NextRow;
+   if( n_rows <= 0 ){
+      return 0;
+   }
+   if( n_rows > m_BlockRows ){
+      n_rows = m_BlockRows;
+   }
+
+   if( block.GetXSize() != GetXSize() || block.GetYSize() != n_rows || !block.get_data() ){
+      block.Realloc( GetXSize(), n_rows, FALSE );
+   }
+
+   int status = 0, anynul = 0;
+   long firstpixel[2];
+   firstpixel[0] = 1;
+   firstpixel[1] = m_NextRow + 1;
+   LONGLONG nelements = ((LONGLONG)GetXSize())*((LONGLONG)n_rows);
+   float nulval = 0;
+   if( m_Header.GetKeyword("BLANK") ){
+      // BLANK pixels of integer images are NaN as in CBgFits::ReadFits :
+      nulval = (0.00/0.00);
+   }
+
+   fits_read_pix(m_fptr, TFLOAT, firstpixel, nelements, &nulval, block.get_data(), &anynul, &status);
+   if( status ){
+      printf("ERROR : could not read rows %d - %d from FITS file %s , due to error %d\n",m_NextRow,m_NextRow+n_rows-1,m_FileName.c_str(),status);
+      return -status;
+   }
+
+   if( m_RowScale.size() > 0 ){
+      for(int y=0;y<n_rows;y++){
+         float* line = block.get_line( y );
+         for(int x=0;x<GetXSize();x++){
+            line[x] = line[x]*m_RowScale[m_NextRow+y] + m_RowZero[m_NextRow+y];
+         }
+      }
+   }
+
+   m_BlockStart = m_NextRow;
+   m_NextRow += n_rows;
+
+   if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+      printf("DEBUG : read rows %d - %d from %s\n",m_BlockStart,m_NextRow-1,m_FileName.c_str());
+   }
+
+   return n_rows;
+}
+
+double CBgFitsReader::GetStat( CBgArray& avg_spectrum, CBgArray& rms_spectrum,
+                               int start_int, int end_int, const char* szState,
+                               CBgArray* min_spectrum, CBgArray* max_spectrum,
+                               double min_acceptable_value, int* out_number_of_used_integrations,
+                               CBgFits* rfi_flag_fits_file )
+{
+   if( rfi_flag_fits_file ){
+      if( GetXSize() != rfi_flag_fits_file->GetXSize() || GetYSize() != rfi_flag_fits_file->GetYSize() ){
+         printf("ERROR : provided RFI flags file differs in size (%d,%d) from the analysed FITS file (%d,%d)\n",rfi_flag_fits_file->GetXSize(),rfi_flag_fits_file->GetYSize(),GetXSize(),GetYSize());
+         return -100000;
+      }
+   }
+
+   if( end_int < 0 ){
+      end_int = GetYSize();
+   }
+
+   CBgSpectrumStat stat( GetXSize() );
+   vector<float> flags_line( GetXSize() );
+   CBgFits block;
+
+   // all rows are read, because informational total sum is calculated over the whole image :
+   Rewind();
+   int n_rows;
+   while( (n_rows = ReadBlock( block )) > 0 ){
+      for(int r=0;r<n_rows;r++){
+         int y = m_BlockStart + r;
+         float* row = block.get_line(r);
+
+         stat.AddToTotal( row );
+
+         if( y < start_int || y >= end_int || !m_Header.IsIntegrationInState( y, szState ) ){
+            continue;
+         }
+
+         const float* flags = NULL;
+         if( rfi_flag_fits_file ){
+            flags = rfi_flag_fits_file->get_line( y, &(flags_line[0]) );
+         }
+         stat.AddRow( row, y, flags, min_acceptable_value );
+      }
+   }
+
+   return stat.Finish( m_Header, start_int, end_int, avg_spectrum, rms_spectrum, min_spectrum, max_spectrum, out_number_of_used_integrations );
+}
+
+void CBgFitsReader::MeanLines( CBgArray& mean_lines, CBgArray& rms_lines )
+{
+   mean_lines.assign( GetYSize() , 0 );
+   rms_lines.assign( GetYSize() , 0 );
+
+   CBgFits block;
+   Rewind();
+   int n_rows;
+   while( (n_rows = ReadBlock( block )) > 0 ){
+      for(int r=0;r<n_rows;r++){
+         int y = m_BlockStart + r;
+         bg_line_mean_rms( block.get_line(r), GetXSize(), mean_lines[y], rms_lines[y] );
+      }
+   }
+}
+
@@ -0,0 +1,97 @@
+#ifndef _BG_FITS_READER_H__
+#define _BG_FITS_READER_H__
+
+#include <fitsio.h>
+#include "bg_fits.h"
+#include "bg_array.h"
+
+// per-channel statistics of selected integrations (rows), accumulated row by row (Welford mean/M2 per channel).
+// Used by CBgFits::GetStat (image in memory, rows split between threads and merged) and CBgFitsReader::GetStat (image streamed in blocks of rows)
+class CBgSpectrumStat
+{
+public :
+   CBgSpectrumStat( int n_channels=0 );
+   void Init( int n_channels );
+
+   // row   : values of integration y
+   // flags : optional RFI flags for this integration (values >0 are skipped in mean/rms)
+   void AddRow( const float* row, int y, const float* flags=NULL, double min_acceptable_value=-1e20 );
+
+   // informational sum and count of non-zero values over all integrations (also not selected ones)
+   void AddToTotal( const float* row );
+
+   // adds statistics of rows following the rows added to this object (e.g. accumulated by another thread) :
+   void Merge( const CBgSpectrumStat& right );
+
+   // calculates avg/rms (and min/max) spectra, prints summary and returns total integration time
+   double Finish( CBgFits& header, int start_int, int end_int, CBgArray& avg_spectrum, CBgArray& rms_spectrum,
+                  CBgArray* min_spectrum=NULL, CBgArray* max_spectrum=NULL, int* out_number_of_used_integrations=NULL );
+
+   int m_nChannels;
+
+   // all selected (not flagged) values , mean and rms are calculated from per channel values :
+   long double m_MinVal, m_MaxVal;
+   long int m_MinPos, m_MaxPos;
+   int m_nInt;
+
+   // per channel (m_ChM2 - sum of squared differences from the mean) :
+   CBgArray m_ChMean, m_ChM2, m_ChCount, m_ChMin, m_ChMax;
+
+   // all integrations :
+   double m_TotalSum;
+   long int m_NonZeroCount;
+};
+
+// basic per-row and per-channel accumulations of CBgFits (bg_line_mean_rms also used by CBgFitsReader::MeanLines) :
+void bg_line_mean_rms( const float* row, int n, double& mean, double& rms );
+void bg_max_hold( const float* row, float* out_line, int n );
+void bg_min_hold( const float* row, float* out_line, int n );
+int  bg_save_hold( const char* szOutFile, float* out_line, CBgFits& header, int bShowFreq );
+
+
+// Reads a FITS image (typically dynamic spectrum with integrations as rows) in blocks of N rows using fits_read_pix,
+// so that memory usage is O(block) rather than O(file). Header is read once to GetHeader().
+class CBgFitsReader
+{
+public :
+   CBgFitsReader( const char* fits_file=NULL, int block_rows=1024 );
+   ~CBgFitsReader();
+
+   int Open( const char* fits_file=NULL, int bIgnoreHeaderErrors=1 );
+   void Close();
+
+   // reads next block of rows into block image (re-allocated when needed), block.GetYSize() is the number of rows read.
+   // Returns number of rows read, 0 at the end of image, <0 on error
+   int ReadBlock( CBgFits& block );
+
+   // next block starts at row y :
+   void SetRow( int y );
+   void Rewind(){ SetRow(0); }
+
+   inline int GetBlockStart() const { return m_BlockStart; } // first row of the last block read
+   inline int GetBlockRows() const { return m_BlockRows; }
+   void SetBlockRows( int block_rows );
+   inline int GetXSize() const { return m_Header.GetXSize(); }
+   inline int GetYSize() const { return m_Header.GetYSize(); }
+   CBgFits& GetHeader(){ return m_Header; }
+   const char* GetFileName(){ return m_FileName.c_str(); }
+
+   // streaming versions of CBgFits functions (same parameters and outputs) :
+   double GetStat( CBgArray& avg_spectrum, CBgArray& rms_spectrum, int start_int=0, int end_int=-1, const char* szState=NULL,
+                   CBgArray* min_spectrum=NULL, CBgArray* max_spectrum=NULL,
+                   double min_acceptable_value=-1e20, int* out_number_of_used_integrations=NULL,
+                   CBgFits* rfi_flag_fits_file=NULL );
+   void MeanLines( CBgArray& mean_lines, CBgArray& rms_lines );
+
+protected :
+   fitsfile* m_fptr;
+   string    m_FileName;
+   CBgFits   m_Header;   // header only (image is not read)
+   int       m_BlockRows;
+   int       m_NextRow;
+   int       m_BlockStart;
+   vector<double> m_RowScale; // per-row scaling of 16-bit images (empty if not used)
+   vector<double> m_RowZero;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "bg_globals.h"
 #include <vector>
+#include <algorithm>
 #include <stdio.h>
 #include <iostream>
 #include <fstream>
@@ -232,25 +233,11 @@ double calc_avg_rms( double* ftab, long cnt, double& rms, int bOnlyPositive /*=0
 
 void my_sort_float( vector<double>& ftab, long cnt /*=-1*/ )
 {
-   // WARNING / TODO :
-   // it's a temporary solutions and unnecessarily slow -> should be changed to proper Quick sort on vector<double> 
-
-   if( cnt < 0 ){
+   // sorted in place (no temporary copy), use bg_quantile.h when only median / quartiles are needed :
+   if( cnt < 0 || cnt > (long)ftab.size() ){
       cnt = ftab.size();
    }
-   double* ftab_tmp = new double[ cnt ];
-   
-   for(int i=0;i<cnt;i++){
-      ftab_tmp[i] = ftab[i];
-   }
-   
-   my_sort_float( ftab_tmp, cnt );
-
-   for(int i=0;i<cnt;i++){
-      ftab[i] = ftab_tmp[i];
-   }
-   
-   delete [] ftab_tmp;
+   std::sort( ftab.begin(), ftab.begin() + cnt );
 }
 
 
@@ -0,0 +1,190 @@
+#ifndef _BG_IMAGE_H__
+#define _BG_IMAGE_H__
+
+#include <fitsio.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "bg_globals.h"
+#include "bg_defines.h"
+
+using namespace std;
+
+class CBgFits;
+
+// BLANK value of 16-bit images (NaN) :
+#define BG_INT16_BLANK -32768
+
+// cfitsio types and NULL values of supported pixel types :
+template<class T> struct CBgPixelTraits {};
+
+template<> struct CBgPixelTraits<unsigned char>
+{
+   static const int datatype = TBYTE;
+   static const int bitpix = BYTE_IMG;
+   static const bool is_integer = true;
+   static unsigned char null_value(){ return 0; }
+   static double min_value(){ return 0; }
+   static double max_value(){ return 255; }
+};
+
+template<> struct CBgPixelTraits<short>
+{
+   static const int datatype = TSHORT;
+   static const int bitpix = SHORT_IMG;
+   static const bool is_integer = true;
+   static short null_value(){ return BG_INT16_BLANK; }
+   static double min_value(){ return BG_INT16_BLANK+1; }
+   static double max_value(){ return 32767; }
+};
+
+template<> struct CBgPixelTraits<float>
+{
+   static const int datatype = TFLOAT;
+   static const int bitpix = FLOAT_IMG;
+   static const bool is_integer = false;
+   static float null_value(){ return (0.00/0.00); }
+   static double min_value(){ return -3.4e38; }
+   static double max_value(){ return 3.4e38; }
+};
+
+template<> struct CBgPixelTraits<double>
+{
+   static const int datatype = TDOUBLE;
+   static const int bitpix = DOUBLE_IMG;
+   static const bool is_integer = false;
+   static double null_value(){ return (0.00/0.00); }
+   static double min_value(){ return -1.7e308; }
+   static double max_value(){ return 1.7e308; }
+};
+
+// 2D image with pixels stored natively as T (8-bit masks, raw 16-bit spectra, double accumulators ...) without per-pixel
+// type checks. Integer images keep BSCALE/BZERO (physical value = raw*scale + zero) and NULL (BLANK) pixels, which are NaN
+// in the float CBgFits facade (ToFits / FromFits). Header keywords are handled by CBgFits (optional header parameter).
+// Per-row scaling (ROWSCALE, see CBgFits::SetInt16Output) is not supported, such files are read by CBgFits.
+// CBgFits keeps its pixels in CBgImageF (and 16-bit images in CBgImageI16), the CBgFits methods are defined in bg_fits.h.
+template<class T>
+class CBgImage
+{
+public :
+   typedef CBgPixelTraits<T> traits;
+
+   CBgImage( int sizeX=0, int sizeY=0 )
+   : m_SizeX(0), m_SizeY(0), m_Scale(1.00), m_Zero(0.00)
+   {
+      Alloc( sizeX, sizeY );
+   }
+
+   void Alloc( int sizeX, int sizeY )
+   {
+      m_SizeX = ( sizeX > 0 ? sizeX : 0 );
+      m_SizeY = ( sizeY > 0 ? sizeY : 0 );
+      m_Data.assign( ((long)m_SizeX)*m_SizeY, (T)0 );
+   }
+
+   // releases the memory :
+   void Free()
+   {
+      vector<T>().swap( m_Data );
+      m_SizeX = 0;
+      m_SizeY = 0;
+   }
+
+   void Swap( CBgImage<T>& right )
+   {
+      m_Data.swap( right.m_Data );
+      std::swap( m_SizeX, right.m_SizeX );
+      std::swap( m_SizeY, right.m_SizeY );
+      std::swap( m_Scale, right.m_Scale );
+      std::swap( m_Zero, right.m_Zero );
+   }
+
+   inline int GetXSize() const { return m_SizeX; }
+   inline int GetYSize() const { return m_SizeY; }
+   inline long size() const { return m_Data.size(); }
+   inline T* get_data(){ return ( m_Data.size() ? &(m_Data[0]) : NULL ); }
+   inline T* get_line( int y ){ return get_data() + ((long)y)*m_SizeX; }
+
+   // no bounds checks :
+   inline T& operator()( int x, int y ){ return m_Data[((long)y)*m_SizeX + x]; }
+
+   // null value outside the image :
+   inline T getXY( int x, int y ) const
+   {
+      if( x>=0 && y>=0 && x<m_SizeX && y<m_SizeY ){
+         return m_Data[((long)y)*m_SizeX + x];
+      }
+      return traits::null_value();
+   }
+   inline void setXY( int x, int y, T value )
+   {
+      if( x>=0 && y>=0 && x<m_SizeX && y<m_SizeY ){
+         m_Data[((long)y)*m_SizeX + x] = value;
+      }
+   }
+   void SetValue( T value ){ m_Data.assign( m_Data.size(), value ); }
+
+   // physical value (scaling applied, NULL -> NaN) :
+   inline double ToPhysical( T raw ) const
+   {
+      if( traits::is_integer && raw == traits::null_value() && traits::null_value() != 0 ){
+         return (0.00/0.00);
+      }
+      return raw*m_Scale + m_Zero;
+   }
+   inline T FromPhysical( double value ) const
+   {
+      if( isnan(value) ){
+         return traits::null_value();
+      }
+      double raw = ( value - m_Zero ) / m_Scale;
+      if( traits::is_integer ){
+         raw = floor( raw + 0.5 );
+         if( raw < traits::min_value() ){
+            raw = traits::min_value();
+         }
+         if( raw > traits::max_value() ){
+            raw = traits::max_value();
+         }
+      }
+      return (T)raw;
+   }
+   inline double valXY( int x, int y ) const { return ToPhysical( getXY( x, y ) ); }
+
+   inline double GetScale() const { return m_Scale; }
+   inline double GetZero() const { return m_Zero; }
+   void SetScaling( double scale, double zero ){ m_Scale = ( scale != 0.00 ? scale : 1.00 ); m_Zero = zero; }
+
+   // float facade : out = physical values
+   void ToFits( CBgFits& out ) const;
+
+   // from float image, values converted with current scaling (see SetScaling) :
+   void FromFits( CBgFits& in );
+
+   // returns 0 if OK, cfitsio error otherwise. Values of other types are converted by cfitsio,
+   // integer images are read raw (BSCALE/BZERO kept in GetScale/GetZero) :
+   int ReadFits( const char* fits_file, CBgFits* header=NULL );
+
+   // header keywords (optional) are written after the image, scaling keys of integer images are written when not trivial :
+   int WriteFits( const char* fits_file, CBgFits* header=NULL );
+
+protected :
+   int       m_SizeX;
+   int       m_SizeY;
+   double    m_Scale;
+   double    m_Zero;
+   vector<T> m_Data;
+};
+
+typedef CBgImage<unsigned char> CBgImageU8;  // masks / flags
+typedef CBgImage<short>         CBgImageI16; // raw 16-bit spectra
+typedef CBgImage<float>         CBgImageF;
+typedef CBgImage<double>        CBgImageD;   // accumulators
+
+// CBgFits and the methods of CBgImage using it :
+#include "bg_fits.h"
+
+#endif
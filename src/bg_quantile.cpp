@@ -0,0 +1,573 @@
+#include "bg_quantile.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bg_globals.h"
+#include "bg_defines.h"
+
+int gBGApproxQuantiles=0;
+
+double bg_select( double* tab, long cnt, long k )
+{
+   if( cnt <= 0 ){
+      return (0.00/0.00);
+   }
+   if( k < 0 ){
+      k = 0;
+   }
+   if( k >= cnt ){
+      k = cnt-1;
+   }
+
+   std::nth_element( tab, tab + k, tab + cnt );
+   return tab[k];
+}
+
+double bg_median( double* tab, long cnt )
+{
+   return bg_select( tab, cnt, cnt/2 );
+}
+
+bool bg_median_iqr( double* tab, long cnt, double& median, double& q25, double& q75 )
+{
+   if( cnt <= 0 ){
+      median = q25 = q75 = (0.00/0.00);
+      return false;
+   }
+
+   long half = cnt/2;
+   long i25 = (long)(cnt*0.25);
+   long i75 = (long)(cnt*0.75);
+
+   // after selecting the median lower quartile is in [0,half) and upper in (half,cnt) :
+   median = bg_select( tab, cnt, half );
+   q25 = ( i25 < half ? bg_select( tab, half, i25 ) : median );
+   q75 = ( i75 > half ? bg_select( tab + half + 1, cnt - half - 1, i75 - half - 1 ) : median );
+
+   return true;
+}
+
+double bg_median_rms_iqr( double* tab, long cnt, double& rms_iqr )
+{
+   double median, q25, q75;
+   bg_median_iqr( tab, cnt, median, q25, q75 );
+   rms_iqr = (q75 - q25)/1.35;
+
+   return median;
+}
+
+CBgQuantile::CBgQuantile( int reserve )
+: m_Count(0)
+{
+   if( reserve > 0 ){
+      m_Buffer.resize( reserve );
+   }
+}
+
+void CBgQuantile::assign( const double* values, long cnt )
+{
+   if( (long)m_Buffer.size() < cnt ){
+      m_Buffer.resize( cnt );
+   }
+   std::copy( values, values + cnt, m_Buffer.begin() );
+   m_Count = cnt;
+}
+
+void CBgQuantile::assign( const float* values, long cnt )
+{
+   if( (long)m_Buffer.size() < cnt ){
+      m_Buffer.resize( cnt );
+   }
+   std::copy( values, values + cnt, m_Buffer.begin() );
+   m_Count = cnt;
+}
+
+double CBgQuantile::Select( long k )
+{
+   return bg_select( m_Buffer.data(), m_Count, k );
+}
+
+double CBgQuantile::Median()
+{
+   return bg_median( m_Buffer.data(), m_Count );
+}
+
+bool CBgQuantile::MedianIQR( double& median, double& q25, double& q75 )
+{
+   return bg_median_iqr( m_Buffer.data(), m_Count, median, q25, q75 );
+}
+
+double CBgQuantile::MedianRmsIQR( double& rms_iqr )
+{
+   return bg_median_rms_iqr( m_Buffer.data(), m_Count, rms_iqr );
+}
+
+// order used by the skip list (NaN after all other values) :
+static inline bool bg_sq_less( double a, double b )
+{
+   if( isnan(a) ){
+      return false;
+   }
+   return ( a < b || isnan(b) );
+}
+
+static inline bool bg_sq_equal( double a, double b )
+{
+   return ( a == b || (isnan(a) && isnan(b)) );
+}
+
+CBgSlidingQuantile::CBgSlidingQuantile( int expected_size )
+: m_MaxLevels(2), m_Head(NULL), m_Count(0), m_Random(2463534242u)
+{
+   while( m_MaxLevels < 32 && (1l << (m_MaxLevels-1)) < expected_size ){
+      m_MaxLevels++;
+   }
+   m_Chain.assign( m_MaxLevels, NULL );
+   m_Steps.assign( m_MaxLevels, 0 );
+   m_FreeNodes.resize( m_MaxLevels + 1 );
+
+   m_Head = NewNode( 0.00, m_MaxLevels );
+   for(int level=0;level<m_MaxLevels;level++){
+      m_Head->next[level] = NULL;
+      m_Head->width[level] = 1;
+   }
+}
+
+CBgSlidingQuantile::~CBgSlidingQuantile()
+{
+   clear();
+   for(int l=0;l<m_FreeNodes.size();l++){
+      for(int i=0;i<m_FreeNodes[l].size();i++){
+         free( m_FreeNodes[l][i] );
+      }
+   }
+   free( m_Head );
+}
+
+CBgSlidingQuantile::cNode* CBgSlidingQuantile::NewNode( double value, int levels )
+{
+   cNode* node = NULL;
+   if( m_FreeNodes[levels].size() > 0 ){
+      node = m_FreeNodes[levels].back();
+      m_FreeNodes[levels].pop_back();
+   }else{
+      // node, pointers and widths in one block :
+      node = (cNode*)malloc( sizeof(cNode) + levels*(sizeof(cNode*) + sizeof(long)) );
+      node->levels = levels;
+      node->next = (cNode**)(node + 1);
+      node->width = (long*)(node->next + levels);
+   }
+   node->value = value;
+
+   return node;
+}
+
+int CBgSlidingQuantile::RandomLevels()
+{
+   // xorshift32 , level l+1 with probability 1/2^l :
+   m_Random ^= (m_Random << 13);
+   m_Random ^= (m_Random >> 17);
+   m_Random ^= (m_Random << 5);
+
+   int levels = 1;
+   unsigned int bits = m_Random;
+   while( levels < m_MaxLevels && (bits & 1) ){
+      levels++;
+      bits >>= 1;
+   }
+   return levels;
+}
+
+void CBgSlidingQuantile::clear()
+{
+   cNode* node = m_Head->next[0];
+   while( node ){
+      cNode* next = node->next[0];
+      m_FreeNodes[node->levels].push_back( node );
+      node = next;
+   }
+   for(int level=0;level<m_MaxLevels;level++){
+      m_Head->next[level] = NULL;
+      m_Head->width[level] = 1;
+   }
+   m_Count = 0;
+}
+
+void CBgSlidingQuantile::Insert( double value )
+{
+   cNode* node = m_Head;
+   for(int level=m_MaxLevels-1;level>=0;level--){
+      m_Steps[level] = 0;
+      while( node->next[level] && !bg_sq_less( value, node->next[level]->value ) ){
+         m_Steps[level] += node->width[level];
+         node = node->next[level];
+      }
+      m_Chain[level] = node;
+   }
+
+   int levels = RandomLevels();
+   cNode* new_node = NewNode( value, levels );
+   long steps = 0;
+   for(int level=0;level<levels;level++){
+      cNode* prev = m_Chain[level];
+      new_node->next[level] = prev->next[level];
+      prev->next[level] = new_node;
+      new_node->width[level] = prev->width[level] - steps;
+      prev->width[level] = steps + 1;
+      steps += m_Steps[level];
+   }
+   for(int level=levels;level<m_MaxLevels;level++){
+      m_Chain[level]->width[level]++;
+   }
+   m_Count++;
+}
+
+bool CBgSlidingQuantile::Erase( double value )
+{
+   cNode* node = m_Head;
+   for(int level=m_MaxLevels-1;level>=0;level--){
+      while( node->next[level] && bg_sq_less( node->next[level]->value, value ) ){
+         node = node->next[level];
+      }
+      m_Chain[level] = node;
+   }
+
+   cNode* found = m_Chain[0]->next[0];
+   if( !found || !bg_sq_equal( found->value, value ) ){
+      if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+         printf("DEBUG : CBgSlidingQuantile::Erase value %.8f not found\n",value);
+      }
+      return false;
+   }
+
+   for(int level=0;level<found->levels;level++){
+      cNode* prev = m_Chain[level];
+      prev->width[level] += found->width[level] - 1;
+      prev->next[level] = found->next[level];
+   }
+   for(int level=found->levels;level<m_MaxLevels;level++){
+      m_Chain[level]->width[level]--;
+   }
+   m_FreeNodes[found->levels].push_back( found );
+   m_Count--;
+
+   return true;
+}
+
+double CBgSlidingQuantile::Select( long k )
+{
+   if( m_Count <= 0 ){
+      return (0.00/0.00);
+   }
+   if( k < 0 ){
+      k = 0;
+   }
+   if( k >= m_Count ){
+      k = m_Count-1;
+   }
+
+   cNode* node = m_Head;
+   long i = k + 1;
+   for(int level=m_MaxLevels-1;level>=0;level--){
+      while( node->next[level] && node->width[level] <= i ){
+         i -= node->width[level];
+         node = node->next[level];
+      }
+   }
+
+   return node->value;
+}
+
+double CBgSlidingQuantile::Median()
+{
+   return Select( m_Count/2 );
+}
+
+bool CBgSlidingQuantile::MedianIQR( double& median, double& q25, double& q75 )
+{
+   if( m_Count <= 0 ){
+      median = q25 = q75 = (0.00/0.00);
+      return false;
+   }
+
+   median = Select( m_Count/2 );
+   q25 = Select( (long)(m_Count*0.25) );
+   q75 = Select( (long)(m_Count*0.75) );
+   return true;
+}
+
+double CBgSlidingQuantile::MedianRmsIQR( double& rms_iqr )
+{
+   double median, q25, q75;
+   MedianIQR( median, q25, q75 );
+   rms_iqr = (q75 - q25)/1.35;
+
+   return median;
+}
+
+double CBgTDigest::m_DefaultCompression=100.00;
+
+CBgTDigest::CBgTDigest( double compression )
+: m_Compression(compression), m_TotalWeight(0), m_BufferWeight(0), m_Min(0), m_Max(0)
+{
+   if( m_Compression <= 0 ){
+      m_Compression = m_DefaultCompression;
+   }
+   if( m_Compression < 10 ){
+      m_Compression = 10;
+   }
+}
+
+long CBgTDigest::GetMaxMemory( double compression )
+{
+   CBgTDigest tmp( compression );
+
+   // at most ~compression centroids (and compression values of small samples) + full buffer :
+   return (long)( 3*ceil( tmp.m_Compression ) )*sizeof(cCentroid);
+}
+
+void CBgTDigest::clear()
+{
+   m_Centroids.clear();
+   m_Buffer.clear();
+   m_TotalWeight = 0;
+   m_BufferWeight = 0;
+}
+
+void CBgTDigest::Add( double value, double weight )
+{
+   if( isnan(value) || weight <= 0 ){
+      return;
+   }
+   if( Count() <= 0 ){
+      m_Min = value;
+      m_Max = value;
+   }
+   if( value < m_Min ){
+      m_Min = value;
+   }
+   if( value > m_Max ){
+      m_Max = value;
+   }
+
+   cCentroid c;
+   c.mean = value;
+   c.weight = weight;
+   if( m_Buffer.capacity() == 0 ){
+      // exactly the buffer size (no growth beyond it) :
+      m_Buffer.reserve( (long)ceil( 2*m_Compression ) );
+   }
+   m_Buffer.push_back( c );
+   m_BufferWeight += weight;
+
+   // buffer of the same size as the digest (bounded memory) :
+   if( m_Buffer.size() >= 2*m_Compression ){
+      Compress();
+   }
+}
+
+void CBgTDigest::Merge( const CBgTDigest& right )
+{
+   if( right.Count() <= 0 ){
+      return;
+   }
+   if( Count() <= 0 ){
+      m_Min = right.m_Min;
+      m_Max = right.m_Max;
+   }
+   if( right.m_Min < m_Min ){
+      m_Min = right.m_Min;
+   }
+   if( right.m_Max > m_Max ){
+      m_Max = right.m_Max;
+   }
+
+   m_Buffer.insert( m_Buffer.end(), right.m_Centroids.begin(), right.m_Centroids.end() );
+   m_Buffer.insert( m_Buffer.end(), right.m_Buffer.begin(), right.m_Buffer.end() );
+   m_BufferWeight += right.m_TotalWeight + right.m_BufferWeight;
+   Compress();
+}
+
+// scale function k(q) = compression/(2*pi) * asin(2q-1) and its inverse :
+static inline double bg_tdigest_k( double q, double compression )
+{
+   return compression/(2.00*M_PI) * asin( 2.00*q - 1.00 );
+}
+
+static inline double bg_tdigest_q( double k, double compression )
+{
+   double arg = k*(2.00*M_PI)/compression;
+   if( arg >= M_PI/2.00 ){
+      return 1.00;
+   }
+   return ( sin( arg ) + 1.00 )/2.00;
+}
+
+void CBgTDigest::Compress()
+{
+   if( m_Buffer.size() <= 0 ){
+      return;
+   }
+
+   // all centroids sorted by mean :
+   std::sort( m_Buffer.begin(), m_Buffer.end() );
+   vector<cCentroid> all( m_Centroids.size() + m_Buffer.size() );
+   std::merge( m_Centroids.begin(), m_Centroids.end(), m_Buffer.begin(), m_Buffer.end(), all.begin() );
+   m_Buffer.clear();
+   m_TotalWeight += m_BufferWeight;
+   m_BufferWeight = 0;
+
+   // small samples are kept as they are (exact quantiles) :
+   if( m_TotalWeight <= m_Compression ){
+      m_Centroids.swap( all );
+      return;
+   }
+
+   // neighbouring centroids are merged as long as the result does not exceed size limit given by the scale function
+   // (merged in double precision) :
+   m_Centroids.clear();
+   double total = m_TotalWeight;
+   double weight_before = 0.00;
+   double q_limit = bg_tdigest_q( bg_tdigest_k( 0.00, m_Compression ) + 1.00, m_Compression );
+   double current_mean = all[0].mean;
+   double current_weight = all[0].weight;
+   for(int i=1;i<all.size();i++){
+      double q = (weight_before + current_weight + all[i].weight)/total;
+      if( q <= q_limit ){
+         current_weight += all[i].weight;
+         current_mean += (all[i].mean - current_mean)*(all[i].weight/current_weight);
+      }else{
+         cCentroid c;
+         c.mean = current_mean;
+         c.weight = current_weight;
+         m_Centroids.push_back( c );
+         weight_before += current_weight;
+         q_limit = bg_tdigest_q( bg_tdigest_k( weight_before/total, m_Compression ) + 1.00, m_Compression );
+         current_mean = all[i].mean;
+         current_weight = all[i].weight;
+      }
+   }
+   cCentroid c;
+   c.mean = current_mean;
+   c.weight = current_weight;
+   m_Centroids.push_back( c );
+   m_Centroids.shrink_to_fit();
+}
+
+double CBgTDigest::Quantile( double q )
+{
+   Compress();
+   int n = m_Centroids.size();
+   if( n <= 0 ){
+      return (0.00/0.00);
+   }
+   if( n == 1 ){
+      return m_Centroids[0].mean;
+   }
+
+   // position of the value in sorted table (index k -> centre of k-th unit weight, as tab[(int)(cnt*q)]) :
+   double total = m_TotalWeight;
+   double index = floor( q*total ) + 0.5;
+   if( index > total - 0.5 ){
+      index = total - 0.5;
+   }
+   if( index < 0.5 ){
+      index = 0.5;
+   }
+
+   // left tail between minimum and centre of the first centroid :
+   const cCentroid& first = m_Centroids[0];
+   if( index < first.weight/2.00 ){
+      if( first.weight <= 1.00 ){
+         return first.mean;
+      }
+      return m_Min + (first.mean - m_Min)*(index - 0.5)/(first.weight/2.00 - 0.5);
+   }
+
+   double cum = first.weight/2.00; // weight up to the centre of centroid i
+   for(int i=0;i<n-1;i++){
+      const cCentroid& left = m_Centroids[i];
+      const cCentroid& right = m_Centroids[i+1];
+      double dw = (left.weight + right.weight)/2.00;
+      if( cum + dw > index ){
+         // single values are returned exactly :
+         if( left.weight <= 1.00 && (index - cum) < 0.5 ){
+            return left.mean;
+         }
+         if( right.weight <= 1.00 && (cum + dw - index) <= 0.5 ){
+            return right.mean;
+         }
+         double z1 = index - cum;
+         double z2 = cum + dw - index;
+         return (left.mean*z2 + right.mean*z1)/dw;
+      }
+      cum += dw;
+   }
+
+   // right tail between centre of the last centroid and maximum :
+   const cCentroid& last = m_Centroids[n-1];
+   if( last.weight <= 1.00 ){
+      return last.mean;
+   }
+   double z1 = index - cum;
+   double half = last.weight/2.00 - 0.5;
+   if( half <= 0 || z1 >= half ){
+      return m_Max;
+   }
+   return last.mean + (m_Max - last.mean)*(z1/half);
+}
+
+double CBgTDigest::Median()
+{
+   return Quantile( 0.5 );
+}
+
+bool CBgTDigest::MedianIQR( double& median, double& q25, double& q75 )
+{
+   if( Count() <= 0 ){
+      median = q25 = q75 = (0.00/0.00);
+      return false;
+   }
+
+   median = Quantile( 0.5 );
+   q25 = Quantile( 0.25 );
+   q75 = Quantile( 0.75 );
+   return true;
+}
+
+double CBgTDigest::MedianRmsIQR( double& rms_iqr )
+{
+   double median, q25, q75;
+   MedianIQR( median, q25, q75 );
+   rms_iqr = (q75 - q25)/1.35;
+
+   return median;
+}
+
+double CBgTDigest::Trim( double min_value, double max_value )
+{
+   Compress();
+
+   vector<cCentroid> kept;
+   m_TotalWeight = 0;
+   for(int i=0;i<m_Centroids.size();i++){
+      if( m_Centroids[i].mean >= min_value && m_Centroids[i].mean <= max_value ){
+         kept.push_back( m_Centroids[i] );
+         m_TotalWeight += m_Centroids[i].weight;
+      }
+   }
+   m_Centroids.swap( kept );
+   if( m_Centroids.size() > 0 ){
+      m_Min = std::max( m_Min, min_value );
+      m_Max = std::min( m_Max, max_value );
+      if( m_Min > m_Centroids[0].mean ){
+         m_Min = m_Centroids[0].mean;
+      }
+      if( m_Max < m_Centroids.back().mean ){
+         m_Max = m_Centroids.back().mean;
+      }
+   }
+
+   return m_TotalWeight;
+}
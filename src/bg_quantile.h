@@ -0,0 +1,156 @@
+#ifndef _BG_QUANTILE_H__
+#define _BG_QUANTILE_H__
+
+#include <vector>
+using namespace std;
+
+// Order statistics by quickselect (std::nth_element, expected O(n)) instead of sorting the whole table.
+// Indexes are the same as used with sorted tables in this package :
+// median = tab[cnt/2] , q25 = tab[(int)(cnt*0.25)] , q75 = tab[(int)(cnt*0.75)]
+// Tables are partially reordered.
+
+// k-th smallest value (k=0,...,cnt-1) :
+double bg_select( double* tab, long cnt, long k );
+
+double bg_median( double* tab, long cnt );
+
+// returns false for empty table :
+bool bg_median_iqr( double* tab, long cnt, double& median, double& q25, double& q75 );
+
+// median and rms_iqr = (q75-q25)/1.35 , returns median :
+double bg_median_rms_iqr( double* tab, long cnt, double& rms_iqr );
+
+// default of the approx parameter (BG_APPROX_DEFAULT, see bg_approx_compression) of GetMedianInt, GetStatRadiusAll, 
+// GetAvgEstimator, CLightcurve::GetStat : >0 -> robust statistics (median, rms_iqr) are calculated from t-digest sketches 
+// (CBgTDigest, single pass, approximate) instead of exact selection :
+extern int gBGApproxQuantiles;
+
+// values collected into reusable scratch buffer (no allocation when the same object is used for many
+// channels / pixels), input data is not modified :
+class CBgQuantile
+{
+public :
+   CBgQuantile( int reserve=0 );
+
+   inline void clear(){ m_Count = 0; }
+   inline long size() const { return m_Count; }
+   inline void push_back( double value ){ if( m_Count >= (long)m_Buffer.size() ){ m_Buffer.resize( 2*m_Count + 16 ); } m_Buffer[m_Count++] = value; }
+   void assign( const double* values, long cnt );
+   void assign( const float* values, long cnt );
+
+   double Select( long k );
+   double Median();
+   bool MedianIQR( double& median, double& q25, double& q75 );
+   double MedianRmsIQR( double& rms_iqr );
+
+protected :
+   vector<double> m_Buffer;
+   long m_Count;
+};
+
+// Sorted multiset of values for sliding windows (indexable skip list) : insert / erase / k-th value in O(log n).
+// NaN values are kept as larger than any other value. Nodes of erased values are reused.
+class CBgSlidingQuantile
+{
+public :
+   // expected_size - typical number of values in the window (sets number of skip list levels) :
+   CBgSlidingQuantile( int expected_size=1024 );
+   ~CBgSlidingQuantile();
+
+   void Insert( double value );
+   bool Erase( double value ); // one occurence is removed, returns false if value not found (message only at debug level)
+   void clear();
+   inline long size() const { return m_Count; }
+
+   double Select( long k ); // k-th smallest value (k=0,...,size()-1)
+   double Median();
+   bool MedianIQR( double& median, double& q25, double& q75 );
+   double MedianRmsIQR( double& rms_iqr );
+
+protected :
+   struct cNode
+   {
+      double  value;
+      int     levels;
+      cNode** next;
+      long*   width; // number of values skipped by next[level] (1 on level 0)
+   };
+
+   cNode* NewNode( double value, int levels );
+   int RandomLevels();
+
+   // nodes are owned by the object (no copies) :
+   CBgSlidingQuantile( const CBgSlidingQuantile& );
+   CBgSlidingQuantile& operator=( const CBgSlidingQuantile& );
+
+   int           m_MaxLevels;
+   cNode*        m_Head;
+   long          m_Count;
+   unsigned int  m_Random;
+   vector<cNode*> m_Chain;
+   vector<long>   m_Steps;
+   vector< vector<cNode*> > m_FreeNodes; // per number of levels
+};
+
+// Mergeable t-digest (merging variant, arcsine scale function) : approximate quantiles of any number of values in constant
+// memory (at most ~compression centroids + buffer of 2*compression values, see GetMaxMemory). Error is smallest in the tails and ~1/compression of the rank in the middle,
+// for small samples (count <= compression) quantiles are exact and use the index convention above.
+// Digests of parts of the data (e.g. accumulated by different threads) can be combined by Merge. NaN values are ignored.
+class CBgTDigest
+{
+public :
+   CBgTDigest( double compression=0 ); // <=0 -> m_DefaultCompression
+
+   void Add( double value, double weight=1.00 );
+   void Merge( const CBgTDigest& right );
+   void clear();
+
+   inline double Count() const { return m_TotalWeight + m_BufferWeight; }
+   double Quantile( double q ); // q in [0,1]
+   double Median();
+   bool MedianIQR( double& median, double& q25, double& q75 );
+   double MedianRmsIQR( double& rms_iqr );
+
+   // removes centroids with mean outside [min_value,max_value] (sigma clipping), returns remaining weight :
+   double Trim( double min_value, double max_value );
+
+   inline int GetCentroidsCount(){ Compress(); return m_Centroids.size(); }
+
+   // upper limit of memory allocated by a digest of given compression (centroids and full buffer) in bytes :
+   static long GetMaxMemory( double compression=0 );
+
+   static double m_DefaultCompression;
+
+protected :
+   // float centroids (values are float pixels) to keep many per-pixel digests small :
+   struct cCentroid
+   {
+      float mean;
+      float weight;
+      bool operator<( const cCentroid& right ) const { return mean < right.mean; }
+   };
+
+   void Compress();
+
+   double m_Compression;
+   double m_TotalWeight;  // weight in m_Centroids
+   double m_BufferWeight; // weight in m_Buffer
+   double m_Min;
+   double m_Max;
+   vector<cCentroid> m_Centroids;
+   vector<cCentroid> m_Buffer;
+};
+
+// approx parameter of robust statistics : 0 - exact , >0 - t-digest of this compression , 
+// BG_APPROX_DEFAULT - t-digest of CBgTDigest::m_DefaultCompression when gBGApproxQuantiles>0 (exact otherwise) ,
+// returns compression of t-digest to be used (0 -> exact) :
+#define BG_APPROX_DEFAULT -1
+inline double bg_approx_compression( double approx )
+{
+   if( approx < 0 ){
+      return ( gBGApproxQuantiles > 0 ? CBgTDigest::m_DefaultCompression : 0 );
+   }
+   return approx;
+}
+
+#endif
@@ -0,0 +1,763 @@
+#include "bg_simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bg_globals.h"
+#include "bg_defines.h"
+
+// results have to be the same as from the scalar loops -> a*b+c must not be contracted to FMA :
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BG_SIMD_X86
+#include <immintrin.h>
+#endif
+
+static int gBgSimdLevel = -1;
+
+static void bg_simd_binary_scalar( eBgSimdBinaryOp op, float* left, const float* right, long n, double value )
+{
+   switch( op ){
+      case eSimdAdd :
+         for(long i=0;i<n;i++){
+            left[i] = left[i] + right[i];
+         }
+         break;
+
+      case eSimdSubtract :
+         for(long i=0;i<n;i++){
+            left[i] = left[i] - right[i];
+         }
+         break;
+
+      case eSimdMultiply :
+         for(long i=0;i<n;i++){
+            left[i] = left[i] * right[i];
+         }
+         break;
+
+      case eSimdDivide :
+         for(long i=0;i<n;i++){
+            if( right[i] != 0.00 ){
+               left[i] = left[i] / right[i];
+            }
+         }
+         break;
+
+      case eSimdAddSquared :
+         for(long i=0;i<n;i++){
+            left[i] = left[i] + right[i]*right[i];
+         }
+         break;
+
+      case eSimdComplexMag :
+         for(long i=0;i<n;i++){
+            left[i] = left[i]*left[i] + right[i]*right[i];
+         }
+         break;
+
+      case eSimdAddMult :
+         for(long i=0;i<n;i++){
+            left[i] = (left[i] + right[i]) * value;
+         }
+         break;
+
+      case eSimdSEFD :
+         for(long i=0;i<n;i++){
+            double xx_val = left[i];
+            double yy_val = right[i];
+            left[i] = 0.5*sqrt( xx_val*xx_val + yy_val*yy_val );
+         }
+         break;
+   }
+}
+
+static void bg_simd_unary_scalar( eBgSimdUnaryOp op, float* data, long n, double value )
+{
+   switch( op ){
+      case eSimdAddConst :
+         for(long i=0;i<n;i++){
+            data[i] = data[i] + value;
+         }
+         break;
+
+      case eSimdTimesConst :
+         for(long i=0;i<n;i++){
+            data[i] = data[i] * value;
+         }
+         break;
+
+      case eSimdDivideConst :
+         for(long i=0;i<n;i++){
+            data[i] = data[i] / value;
+         }
+         break;
+
+      case eSimdInvert :
+         for(long i=0;i<n;i++){
+            data[i] = 1.00 / data[i];
+         }
+         break;
+
+      case eSimdAbs :
+         for(long i=0;i<n;i++){
+            data[i] = fabs( data[i] );
+         }
+         break;
+
+      case eSimdSqrt :
+         for(long i=0;i<n;i++){
+            data[i] = sqrt( data[i] );
+         }
+         break;
+
+      case eSimdClipMax :
+         for(long i=0;i<n;i++){
+            if( data[i] > value ){
+               data[i] = value;
+            }
+         }
+         break;
+
+      case eSimdConstOver :
+         for(long i=0;i<n;i++){
+            data[i] = value / data[i];
+         }
+         break;
+   }
+}
+
+static void bg_simd_stat_scalar( const float* data, long n, cBgSimdStat& stat, long i_start )
+{
+   for(long i=i_start;i<n;i++){
+      double val = data[i];
+      if( isnan(val) || isinf(val) ){
+         stat.nan_count++;
+         continue;
+      }
+      stat.sum[i & 7] += val;
+      stat.sum2[i & 7] += val*val;
+      stat.count++;
+      if( val < stat.minval ){
+         stat.minval = val;
+      }
+      if( val > stat.maxval ){
+         stat.maxval = val;
+      }
+   }
+}
+
+#ifdef BG_SIMD_X86
+
+// operations with float operands only are done on 8 floats, with double constants on 4 floats converted to doubles :
+__attribute__((target("avx2")))
+static void bg_simd_binary_avx2( eBgSimdBinaryOp op, float* left, const float* right, long n, double value )
+{
+   long i = 0;
+
+   switch( op ){
+      case eSimdAdd :
+         for(;i+8<=n;i+=8){
+            _mm256_storeu_ps( left+i, _mm256_add_ps( _mm256_loadu_ps(left+i), _mm256_loadu_ps(right+i) ) );
+         }
+         break;
+
+      case eSimdSubtract :
+         for(;i+8<=n;i+=8){
+            _mm256_storeu_ps( left+i, _mm256_sub_ps( _mm256_loadu_ps(left+i), _mm256_loadu_ps(right+i) ) );
+         }
+         break;
+
+      case eSimdMultiply :
+         for(;i+8<=n;i+=8){
+            _mm256_storeu_ps( left+i, _mm256_mul_ps( _mm256_loadu_ps(left+i), _mm256_loadu_ps(right+i) ) );
+         }
+         break;
+
+      case eSimdDivide :
+         {
+            // NaN != 0 -> divided as in the scalar code :
+            __m256 zero = _mm256_setzero_ps();
+            for(;i+8<=n;i+=8){
+               __m256 l = _mm256_loadu_ps(left+i);
+               __m256 r = _mm256_loadu_ps(right+i);
+               __m256 mask = _mm256_cmp_ps( r, zero, _CMP_NEQ_UQ );
+               _mm256_storeu_ps( left+i, _mm256_blendv_ps( l, _mm256_div_ps( l, r ), mask ) );
+            }
+         }
+         break;
+
+      case eSimdAddSquared :
+         for(;i+8<=n;i+=8){
+            __m256 r = _mm256_loadu_ps(right+i);
+            _mm256_storeu_ps( left+i, _mm256_add_ps( _mm256_loadu_ps(left+i), _mm256_mul_ps( r, r ) ) );
+         }
+         break;
+
+      case eSimdComplexMag :
+         for(;i+8<=n;i+=8){
+            __m256 l = _mm256_loadu_ps(left+i);
+            __m256 r = _mm256_loadu_ps(right+i);
+            _mm256_storeu_ps( left+i, _mm256_add_ps( _mm256_mul_ps( l, l ), _mm256_mul_ps( r, r ) ) );
+         }
+         break;
+
+      case eSimdAddMult :
+         {
+            __m256d mult = _mm256_set1_pd( value );
+            for(;i+4<=n;i+=4){
+               __m128 sum = _mm_add_ps( _mm_loadu_ps(left+i), _mm_loadu_ps(right+i) );
+               _mm_storeu_ps( left+i, _mm256_cvtpd_ps( _mm256_mul_pd( _mm256_cvtps_pd( sum ), mult ) ) );
+            }
+         }
+         break;
+
+      case eSimdSEFD :
+         {
+            __m256d half = _mm256_set1_pd( 0.5 );
+            for(;i+4<=n;i+=4){
+               __m256d l = _mm256_cvtps_pd( _mm_loadu_ps(left+i) );
+               __m256d r = _mm256_cvtps_pd( _mm_loadu_ps(right+i) );
+               __m256d mag = _mm256_sqrt_pd( _mm256_add_pd( _mm256_mul_pd( l, l ), _mm256_mul_pd( r, r ) ) );
+               _mm_storeu_ps( left+i, _mm256_cvtpd_ps( _mm256_mul_pd( half, mag ) ) );
+            }
+         }
+         break;
+   }
+
+   bg_simd_binary_scalar( op, left+i, right+i, n-i, value );
+}
+
+__attribute__((target("avx2")))
+static void bg_simd_unary_avx2( eBgSimdUnaryOp op, float* data, long n, double value )
+{
+   long i = 0;
+   __m256d val = _mm256_set1_pd( value );
+
+   switch( op ){
+      case eSimdAddConst :
+         for(;i+4<=n;i+=4){
+            _mm_storeu_ps( data+i, _mm256_cvtpd_ps( _mm256_add_pd( _mm256_cvtps_pd( _mm_loadu_ps(data+i) ), val ) ) );
+         }
+         break;
+
+      case eSimdTimesConst :
+         for(;i+4<=n;i+=4){
+            _mm_storeu_ps( data+i, _mm256_cvtpd_ps( _mm256_mul_pd( _mm256_cvtps_pd( _mm_loadu_ps(data+i) ), val ) ) );
+         }
+         break;
+
+      case eSimdDivideConst :
+         for(;i+4<=n;i+=4){
+            _mm_storeu_ps( data+i, _mm256_cvtpd_ps( _mm256_div_pd( _mm256_cvtps_pd( _mm_loadu_ps(data+i) ), val ) ) );
+         }
+         break;
+
+      case eSimdInvert :
+         {
+            // 1/x correctly rounded in float is the same as rounded double result :
+            __m256 one = _mm256_set1_ps( 1.00 );
+            for(;i+8<=n;i+=8){
+               _mm256_storeu_ps( data+i, _mm256_div_ps( one, _mm256_loadu_ps(data+i) ) );
+            }
+         }
+         break;
+
+      case eSimdAbs :
+         {
+            __m256 sign = _mm256_set1_ps( -0.00 );
+            for(;i+8<=n;i+=8){
+               _mm256_storeu_ps( data+i, _mm256_andnot_ps( sign, _mm256_loadu_ps(data+i) ) );
+            }
+         }
+         break;
+
+      case eSimdSqrt :
+         for(;i+8<=n;i+=8){
+            _mm256_storeu_ps( data+i, _mm256_sqrt_ps( _mm256_loadu_ps(data+i) ) );
+         }
+         break;
+
+      case eSimdClipMax :
+         for(;i+4<=n;i+=4){
+            __m256d d = _mm256_cvtps_pd( _mm_loadu_ps(data+i) );
+            __m256d mask = _mm256_cmp_pd( d, val, _CMP_GT_OQ );
+            _mm_storeu_ps( data+i, _mm256_cvtpd_ps( _mm256_blendv_pd( d, val, mask ) ) );
+         }
+         break;
+
+      case eSimdConstOver :
+         for(;i+4<=n;i+=4){
+            _mm_storeu_ps( data+i, _mm256_cvtpd_ps( _mm256_div_pd( val, _mm256_cvtps_pd( _mm_loadu_ps(data+i) ) ) ) );
+         }
+         break;
+   }
+
+   bg_simd_unary_scalar( op, data+i, n-i, value );
+}
+
+// 16 floats or 8 floats converted to doubles :
+__attribute__((target("avx512f")))
+static void bg_simd_binary_avx512( eBgSimdBinaryOp op, float* left, const float* right, long n, double value )
+{
+   long i = 0;
+
+   switch( op ){
+      case eSimdAdd :
+         for(;i+16<=n;i+=16){
+            _mm512_storeu_ps( left+i, _mm512_add_ps( _mm512_loadu_ps(left+i), _mm512_loadu_ps(right+i) ) );
+         }
+         break;
+
+      case eSimdSubtract :
+         for(;i+16<=n;i+=16){
+            _mm512_storeu_ps( left+i, _mm512_sub_ps( _mm512_loadu_ps(left+i), _mm512_loadu_ps(right+i) ) );
+         }
+         break;
+
+      case eSimdMultiply :
+         for(;i+16<=n;i+=16){
+            _mm512_storeu_ps( left+i, _mm512_mul_ps( _mm512_loadu_ps(left+i), _mm512_loadu_ps(right+i) ) );
+         }
+         break;
+
+      case eSimdDivide :
+         {
+            __m512 zero = _mm512_setzero_ps();
+            for(;i+16<=n;i+=16){
+               __m512 l = _mm512_loadu_ps(left+i);
+               __m512 r = _mm512_loadu_ps(right+i);
+               __mmask16 mask = _mm512_cmp_ps_mask( r, zero, _CMP_NEQ_UQ );
+               _mm512_storeu_ps( left+i, _mm512_mask_div_ps( l, mask, l, r ) );
+            }
+         }
+         break;
+
+      case eSimdAddSquared :
+         for(;i+16<=n;i+=16){
+            __m512 r = _mm512_loadu_ps(right+i);
+            _mm512_storeu_ps( left+i, _mm512_add_ps( _mm512_loadu_ps(left+i), _mm512_mul_ps( r, r ) ) );
+         }
+         break;
+
+      case eSimdComplexMag :
+         for(;i+16<=n;i+=16){
+            __m512 l = _mm512_loadu_ps(left+i);
+            __m512 r = _mm512_loadu_ps(right+i);
+            _mm512_storeu_ps( left+i, _mm512_add_ps( _mm512_mul_ps( l, l ), _mm512_mul_ps( r, r ) ) );
+         }
+         break;
+
+      case eSimdAddMult :
+         {
+            __m512d mult = _mm512_set1_pd( value );
+            for(;i+8<=n;i+=8){
+               __m256 sum = _mm256_add_ps( _mm256_loadu_ps(left+i), _mm256_loadu_ps(right+i) );
+               _mm256_storeu_ps( left+i, _mm512_cvtpd_ps( _mm512_mul_pd( _mm512_cvtps_pd( sum ), mult ) ) );
+            }
+         }
+         break;
+
+      case eSimdSEFD :
+         {
+            __m512d half = _mm512_set1_pd( 0.5 );
+            for(;i+8<=n;i+=8){
+               __m512d l = _mm512_cvtps_pd( _mm256_loadu_ps(left+i) );
+               __m512d r = _mm512_cvtps_pd( _mm256_loadu_ps(right+i) );
+               __m512d mag = _mm512_sqrt_pd( _mm512_add_pd( _mm512_mul_pd( l, l ), _mm512_mul_pd( r, r ) ) );
+               _mm256_storeu_ps( left+i, _mm512_cvtpd_ps( _mm512_mul_pd( half, mag ) ) );
+            }
+         }
+         break;
+   }
+
+   bg_simd_binary_scalar( op, left+i, right+i, n-i, value );
+}
+
+__attribute__((target("avx512f")))
+static void bg_simd_unary_avx512( eBgSimdUnaryOp op, float* data, long n, double value )
+{
+   long i = 0;
+   __m512d val = _mm512_set1_pd( value );
+
+   switch( op ){
+      case eSimdAddConst :
+         for(;i+8<=n;i+=8){
+            _mm256_storeu_ps( data+i, _mm512_cvtpd_ps( _mm512_add_pd( _mm512_cvtps_pd( _mm256_loadu_ps(data+i) ), val ) ) );
+         }
+         break;
+
+      case eSimdTimesConst :
+         for(;i+8<=n;i+=8){
+            _mm256_storeu_ps( data+i, _mm512_cvtpd_ps( _mm512_mul_pd( _mm512_cvtps_pd( _mm256_loadu_ps(data+i) ), val ) ) );
+         }
+         break;
+
+      case eSimdDivideConst :
+         for(;i+8<=n;i+=8){
+            _mm256_storeu_ps( data+i, _mm512_cvtpd_ps( _mm512_div_pd( _mm512_cvtps_pd( _mm256_loadu_ps(data+i) ), val ) ) );
+         }
+         break;
+
+      case eSimdInvert :
+         {
+            __m512 one = _mm512_set1_ps( 1.00 );
+            for(;i+16<=n;i+=16){
+               _mm512_storeu_ps( data+i, _mm512_div_ps( one, _mm512_loadu_ps(data+i) ) );
+            }
+         }
+         break;
+
+      case eSimdAbs :
+         for(;i+16<=n;i+=16){
+            _mm512_storeu_ps( data+i, _mm512_abs_ps( _mm512_loadu_ps(data+i) ) );
+         }
+         break;
+
+      case eSimdSqrt :
+         for(;i+16<=n;i+=16){
+            _mm512_storeu_ps( data+i, _mm512_sqrt_ps( _mm512_loadu_ps(data+i) ) );
+         }
+         break;
+
+      case eSimdClipMax :
+         for(;i+8<=n;i+=8){
+            __m512d d = _mm512_cvtps_pd( _mm256_loadu_ps(data+i) );
+            __mmask8 mask = _mm512_cmp_pd_mask( d, val, _CMP_GT_OQ );
+            _mm256_storeu_ps( data+i, _mm512_cvtpd_ps( _mm512_mask_blend_pd( mask, d, val ) ) );
+         }
+         break;
+
+      case eSimdConstOver :
+         for(;i+8<=n;i+=8){
+            _mm256_storeu_ps( data+i, _mm512_cvtpd_ps( _mm512_div_pd( val, _mm512_cvtps_pd( _mm256_loadu_ps(data+i) ) ) ) );
+         }
+         break;
+   }
+
+   bg_simd_unary_scalar( op, data+i, n-i, value );
+}
+
+// 8 values per iteration (lanes of sum/sum2 as in the scalar version), non-finite values masked out :
+__attribute__((target("avx2")))
+static void bg_simd_stat_avx2( const float* data, long n, cBgSimdStat& stat )
+{
+   __m256d sum_lo = _mm256_loadu_pd( stat.sum ), sum_hi = _mm256_loadu_pd( stat.sum + 4 );
+   __m256d sum2_lo = _mm256_loadu_pd( stat.sum2 ), sum2_hi = _mm256_loadu_pd( stat.sum2 + 4 );
+   __m256 vmin = _mm256_set1_ps( INFINITY ), vmax = _mm256_set1_ps( -INFINITY );
+   __m256 zero = _mm256_setzero_ps();
+   long count = 0;
+
+   long i = 0;
+   for(;i+8<=n;i+=8){
+      __m256 v = _mm256_loadu_ps( data + i );
+      __m256 finite = _mm256_cmp_ps( _mm256_sub_ps( v, v ), zero, _CMP_EQ_OQ );
+      count += __builtin_popcount( _mm256_movemask_ps( finite ) );
+      vmin = _mm256_min_ps( vmin, _mm256_blendv_ps( _mm256_set1_ps( INFINITY ), v, finite ) );
+      vmax = _mm256_max_ps( vmax, _mm256_blendv_ps( _mm256_set1_ps( -INFINITY ), v, finite ) );
+
+      __m256 v0 = _mm256_and_ps( v, finite );
+      __m256d lo = _mm256_cvtps_pd( _mm256_castps256_ps128( v0 ) );
+      __m256d hi = _mm256_cvtps_pd( _mm256_extractf128_ps( v0, 1 ) );
+      sum_lo = _mm256_add_pd( sum_lo, lo );
+      sum_hi = _mm256_add_pd( sum_hi, hi );
+      sum2_lo = _mm256_add_pd( sum2_lo, _mm256_mul_pd( lo, lo ) );
+      sum2_hi = _mm256_add_pd( sum2_hi, _mm256_mul_pd( hi, hi ) );
+   }
+
+   _mm256_storeu_pd( stat.sum, sum_lo );
+   _mm256_storeu_pd( stat.sum + 4, sum_hi );
+   _mm256_storeu_pd( stat.sum2, sum2_lo );
+   _mm256_storeu_pd( stat.sum2 + 4, sum2_hi );
+   float mins[8], maxs[8];
+   _mm256_storeu_ps( mins, vmin );
+   _mm256_storeu_ps( maxs, vmax );
+   for(int l=0;l<8;l++){
+      if( mins[l] < stat.minval ){
+         stat.minval = mins[l];
+      }
+      if( maxs[l] > stat.maxval ){
+         stat.maxval = maxs[l];
+      }
+   }
+   stat.count += count;
+   stat.nan_count += i - count;
+
+   bg_simd_stat_scalar( data, n, stat, i );
+}
+
+__attribute__((target("avx512f")))
+static void bg_simd_stat_avx512( const float* data, long n, cBgSimdStat& stat )
+{
+   __m512d sum = _mm512_loadu_pd( stat.sum ), sum2 = _mm512_loadu_pd( stat.sum2 );
+   __m512d vmin = _mm512_set1_pd( INFINITY ), vmax = _mm512_set1_pd( -INFINITY );
+   __m512d zero = _mm512_setzero_pd();
+   long count = 0;
+
+   long i = 0;
+   for(;i+8<=n;i+=8){
+      __m512d v = _mm512_cvtps_pd( _mm256_loadu_ps( data + i ) );
+      __mmask8 finite = _mm512_cmp_pd_mask( _mm512_sub_pd( v, v ), zero, _CMP_EQ_OQ );
+      count += __builtin_popcount( (unsigned int)finite );
+      vmin = _mm512_mask_min_pd( vmin, finite, vmin, v );
+      vmax = _mm512_mask_max_pd( vmax, finite, vmax, v );
+      sum = _mm512_mask_add_pd( sum, finite, sum, v );
+      sum2 = _mm512_mask_add_pd( sum2, finite, sum2, _mm512_mul_pd( v, v ) );
+   }
+
+   _mm512_storeu_pd( stat.sum, sum );
+   _mm512_storeu_pd( stat.sum2, sum2 );
+   double mins[8], maxs[8];
+   _mm512_storeu_pd( mins, vmin );
+   _mm512_storeu_pd( maxs, vmax );
+   for(int l=0;l<8;l++){
+      if( mins[l] < stat.minval ){
+         stat.minval = mins[l];
+      }
+      if( maxs[l] > stat.maxval ){
+         stat.maxval = maxs[l];
+      }
+   }
+   stat.count += count;
+   stat.nan_count += i - count;
+
+   bg_simd_stat_scalar( data, n, stat, i );
+}
+
+// 8 rows of 8 values -> 8 columns :
+__attribute__((target("avx2")))
+static void bg_simd_transpose_avx2( const float* in, long in_stride, float* out, long out_stride, int rows, int cols )
+{
+   int r = 0;
+   for(;r+8<=rows;r+=8){
+      int c = 0;
+      for(;c+8<=cols;c+=8){
+         const float* src = in + r*in_stride + c;
+         __m256 r0 = _mm256_loadu_ps( src );
+         __m256 r1 = _mm256_loadu_ps( src + in_stride );
+         __m256 r2 = _mm256_loadu_ps( src + 2*in_stride );
+         __m256 r3 = _mm256_loadu_ps( src + 3*in_stride );
+         __m256 r4 = _mm256_loadu_ps( src + 4*in_stride );
+         __m256 r5 = _mm256_loadu_ps( src + 5*in_stride );
+         __m256 r6 = _mm256_loadu_ps( src + 6*in_stride );
+         __m256 r7 = _mm256_loadu_ps( src + 7*in_stride );
+
+         __m256 t0 = _mm256_unpacklo_ps( r0, r1 );
+         __m256 t1 = _mm256_unpackhi_ps( r0, r1 );
+         __m256 t2 = _mm256_unpacklo_ps( r2, r3 );
+         __m256 t3 = _mm256_unpackhi_ps( r2, r3 );
+         __m256 t4 = _mm256_unpacklo_ps( r4, r5 );
+         __m256 t5 = _mm256_unpackhi_ps( r4, r5 );
+         __m256 t6 = _mm256_unpacklo_ps( r6, r7 );
+         __m256 t7 = _mm256_unpackhi_ps( r6, r7 );
+
+         __m256 s0 = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE(1,0,1,0) );
+         __m256 s1 = _mm256_shuffle_ps( t0, t2, _MM_SHUFFLE(3,2,3,2) );
+         __m256 s2 = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE(1,0,1,0) );
+         __m256 s3 = _mm256_shuffle_ps( t1, t3, _MM_SHUFFLE(3,2,3,2) );
+         __m256 s4 = _mm256_shuffle_ps( t4, t6, _MM_SHUFFLE(1,0,1,0) );
+         __m256 s5 = _mm256_shuffle_ps( t4, t6, _MM_SHUFFLE(3,2,3,2) );
+         __m256 s6 = _mm256_shuffle_ps( t5, t7, _MM_SHUFFLE(1,0,1,0) );
+         __m256 s7 = _mm256_shuffle_ps( t5, t7, _MM_SHUFFLE(3,2,3,2) );
+
+         float* dst = out + c*out_stride + r;
+         _mm256_storeu_ps( dst,                _mm256_permute2f128_ps( s0, s4, 0x20 ) );
+         _mm256_storeu_ps( dst + out_stride,   _mm256_permute2f128_ps( s1, s5, 0x20 ) );
+         _mm256_storeu_ps( dst + 2*out_stride, _mm256_permute2f128_ps( s2, s6, 0x20 ) );
+         _mm256_storeu_ps( dst + 3*out_stride, _mm256_permute2f128_ps( s3, s7, 0x20 ) );
+         _mm256_storeu_ps( dst + 4*out_stride, _mm256_permute2f128_ps( s0, s4, 0x31 ) );
+         _mm256_storeu_ps( dst + 5*out_stride, _mm256_permute2f128_ps( s1, s5, 0x31 ) );
+         _mm256_storeu_ps( dst + 6*out_stride, _mm256_permute2f128_ps( s2, s6, 0x31 ) );
+         _mm256_storeu_ps( dst + 7*out_stride, _mm256_permute2f128_ps( s3, s7, 0x31 ) );
+      }
+
+      // remaining columns of these rows :
+      for(;c<cols;c++){
+         for(int k=0;k<8;k++){
+            out[c*out_stride + r + k] = in[(r+k)*in_stride + c];
+         }
+      }
+   }
+
+   // remaining rows :
+   for(;r<rows;r++){
+      for(int c=0;c<cols;c++){
+         out[c*out_stride + r] = in[r*in_stride + c];
+      }
+   }
+}
+
+#endif
+
+int bg_simd_max_level()
+{
+#ifdef BG_SIMD_X86
+   __builtin_cpu_init();
+   if( __builtin_cpu_supports("avx512f") ){
+      return eSimdAVX512;
+   }
+   if( __builtin_cpu_supports("avx2") ){
+      return eSimdAVX2;
+   }
+#endif
+
+   return eSimdScalar;
+}
+
+int bg_simd_set_level( int level )
+{
+   int max_level = bg_simd_max_level();
+   if( level > max_level ){
+      printf("WARNING : SIMD level %s not supported by the CPU -> %s used\n",bg_simd_level_name(level),bg_simd_level_name(max_level));
+      level = max_level;
+   }
+   if( level < eSimdScalar ){
+      level = eSimdScalar;
+   }
+   gBgSimdLevel = level;
+
+   return gBgSimdLevel;
+}
+
+int bg_simd_level()
+{
+   if( gBgSimdLevel < 0 ){
+      int level = bg_simd_max_level();
+      const char* szEnv = getenv("BG_SIMD");
+      if( szEnv && szEnv[0] ){
+         if( strcmp(szEnv,"scalar") == 0 ){
+            level = eSimdScalar;
+         }else if( strcmp(szEnv,"avx2") == 0 && level > eSimdAVX2 ){
+            level = eSimdAVX2;
+         }
+      }
+      gBgSimdLevel = level;
+
+      if( gBGPrintfLevel >= BG_DEBUG_LEVEL ){
+         printf("DEBUG : element-wise image kernels use %s\n",bg_simd_level_name(gBgSimdLevel));
+      }
+   }
+
+   return gBgSimdLevel;
+}
+
+const char* bg_simd_level_name( int level )
+{
+   switch( level ){
+      case eSimdAVX2 :
+         return "avx2";
+      case eSimdAVX512 :
+         return "avx512";
+      default :
+         return "scalar";
+   }
+}
+
+void bg_simd_binary( eBgSimdBinaryOp op, float* left, const float* right, long n, double value )
+{
+   if( !left || !right || n <= 0 ){
+      return;
+   }
+
+#ifdef BG_SIMD_X86
+   switch( bg_simd_level() ){
+      case eSimdAVX512 :
+         bg_simd_binary_avx512( op, left, right, n, value );
+         return;
+      case eSimdAVX2 :
+         bg_simd_binary_avx2( op, left, right, n, value );
+         return;
+   }
+#endif
+
+   bg_simd_binary_scalar( op, left, right, n, value );
+}
+
+void bg_simd_unary( eBgSimdUnaryOp op, float* data, long n, double value )
+{
+   if( !data || n <= 0 ){
+      return;
+   }
+
+#ifdef BG_SIMD_X86
+   switch( bg_simd_level() ){
+      case eSimdAVX512 :
+         bg_simd_unary_avx512( op, data, n, value );
+         return;
+      case eSimdAVX2 :
+         bg_simd_unary_avx2( op, data, n, value );
+         return;
+   }
+#endif
+
+   bg_simd_unary_scalar( op, data, n, value );
+}
+
+void bg_simd_transpose( const float* in, long in_stride, float* out, long out_stride, int rows, int cols )
+{
+   if( !in || !out || rows <= 0 || cols <= 0 ){
+      return;
+   }
+
+#ifdef BG_SIMD_X86
+   // AVX-512 uses the same 8x8 kernel (16x16 does not fit tiles of a few tens of values better) :
+   if( bg_simd_level() >= eSimdAVX2 ){
+      bg_simd_transpose_avx2( in, in_stride, out, out_stride, rows, cols );
+      return;
+   }
+#endif
+
+   for(int r=0;r<rows;r++){
+      const float* src = in + r*in_stride;
+      for(int c=0;c<cols;c++){
+         out[c*out_stride + r] = src[c];
+      }
+   }
+}
+
+void bg_simd_stat_init( cBgSimdStat& stat )
+{
+   for(int l=0;l<8;l++){
+      stat.sum[l] = 0.00;
+      stat.sum2[l] = 0.00;
+   }
+   stat.minval = INFINITY;
+   stat.maxval = -INFINITY;
+   stat.count = 0;
+   stat.nan_count = 0;
+}
+
+void bg_simd_stat( const float* data, long n, cBgSimdStat& stat )
+{
+   if( !data || n <= 0 ){
+      return;
+   }
+
+#ifdef BG_SIMD_X86
+   switch( bg_simd_level() ){
+      case eSimdAVX512 :
+         bg_simd_stat_avx512( data, n, stat );
+         return;
+      case eSimdAVX2 :
+         bg_simd_stat_avx2( data, n, stat );
+         return;
+   }
+#endif
+
+   bg_simd_stat_scalar( data, n, stat, 0 );
+}
+
+double bg_simd_stat_sum( const cBgSimdStat& stat, double& sum2 )
+{
+   double sum = 0.00;
+   sum2 = 0.00;
+   for(int l=0;l<8;l++){
+      sum += stat.sum[l];
+      sum2 += stat.sum2[l];
+   }
+
+   return sum;
+}
@@ -0,0 +1,65 @@
+#ifndef _BG_SIMD_H__
+#define _BG_SIMD_H__
+
+// element-wise kernels on contiguous float buffers (image data or rows of images).
+// AVX-512 / AVX2 versions are selected at runtime (CPU check on the first call), scalar loops otherwise.
+// All versions give the same results as the scalar code : operations with double constants are done in double
+// precision, NaN values propagate as in the scalar expressions and no FMA contraction is used.
+
+enum eBgSimdLevel { eSimdScalar=0, eSimdAVX2=1, eSimdAVX512=2 };
+
+// left[i] = left[i] OP right[i] :
+enum eBgSimdBinaryOp
+{
+   eSimdAdd=0,        // left + right
+   eSimdSubtract,     // left - right
+   eSimdMultiply,     // left * right
+   eSimdDivide,       // left / right , left unchanged where right == 0
+   eSimdAddSquared,   // left + right*right
+   eSimdComplexMag,   // left*left + right*right
+   eSimdAddMult,      // (left + right) * value
+   eSimdSEFD          // 0.5*sqrt( left*left + right*right ) (double precision)
+};
+
+// data[i] = OP( data[i] ) :
+enum eBgSimdUnaryOp
+{
+   eSimdAddConst=0,   // data + value
+   eSimdTimesConst,   // data * value
+   eSimdDivideConst,  // data / value
+   eSimdInvert,       // 1 / data
+   eSimdAbs,          // fabs( data )
+   eSimdSqrt,         // sqrt( data )
+   eSimdClipMax,      // data > value -> value
+   eSimdConstOver     // value / data
+};
+
+// level used by the kernels, BG_SIMD environment variable (scalar/avx2/avx512) can lower it :
+int bg_simd_level();
+int bg_simd_max_level(); // best level supported by the CPU
+int bg_simd_set_level( int level ); // returns the level really set (not higher than supported)
+const char* bg_simd_level_name( int level );
+
+void bg_simd_binary( eBgSimdBinaryOp op, float* left, const float* right, long n, double value=1.00 );
+void bg_simd_unary( eBgSimdUnaryOp op, float* data, long n, double value=0.00 );
+
+// out[c*out_stride + r] = in[r*in_stride + c] for block of rows x cols values (8x8 blocks transposed in AVX registers),
+// large images should be transposed in tiles of a few tens of rows/columns which fit in cache :
+void bg_simd_transpose( const float* in, long in_stride, float* out, long out_stride, int rows, int cols );
+
+// statistics of finite values (NaN and inf are counted in nan_count), sums are accumulated in 8 interleaved partial sums
+// (value i of every call goes to sum[i%8]) by all versions, so results do not depend on the instruction set :
+struct cBgSimdStat
+{
+   double sum[8];
+   double sum2[8];
+   double minval;
+   double maxval;
+   long   count;
+   long   nan_count;
+};
+void bg_simd_stat_init( cBgSimdStat& stat );
+void bg_simd_stat( const float* data, long n, cBgSimdStat& stat ); // values added to stat
+double bg_simd_stat_sum( const cBgSimdStat& stat, double& sum2 ); // returns sum (partial sums added in order 0..7)
+
+#endif
@@ -3,82 +3,106 @@
 #include <stdlib.h>
 #include <math.h>
 #include "bg_globals.h"
+#include "bg_quantile.h"
 
 double get_trim_median( double n_sigma_iqr, double* tab, int& cnt, double& sigma_iqr )
 {   
-   double* newtab = new double[cnt];
-
-   int q75= (int)(cnt*0.75);
-   int q25= (int)(cnt*0.25);
-   double iqr = tab[q75]-tab[q25];
+   double median, q25, q75;
+   bg_median_iqr( tab, cnt, median, q25, q75 );
+   double iqr = q75 - q25;
    sigma_iqr = iqr/1.35;
    double range = sigma_iqr*n_sigma_iqr;
-   double median = tab[(int)cnt/2];
    
+   // values within range are kept (in place) :
    int newcnt=0;
    for(int i=0;i<cnt;i++){
       if( fabs(tab[i]-median) <= range ){
-         newtab[newcnt] = tab[i];
+         tab[newcnt] = tab[i];
          newcnt++;
       }
    }
                                           
-   double ret=newtab[newcnt/2];
+   double ret = bg_median( tab, newcnt );
    if( gBGPrintfLevel>=2 ){
       printf("\tmedian = %.4f, iqr = %.4f -> sigma_iqr = %.4f -> range = %.4f -> new_median = %.4f [diff = %.4f]\n",median,iqr,sigma_iqr,range,ret,fabs(median-ret));
    }
 
    // returning smaller array :
    cnt = newcnt;
-   for(int i=0;i<newcnt;i++){
-      tab[i] = newtab[i];
-   }   
 
-   delete [] newtab;
    return ret;
 }
                                                 
 double get_trim_median_up( double n_sigma_iqr, double* tab, int& cnt, double& sigma_iqr )
 {   
-   double* newtab = new double[cnt];
-
-   int q75= (int)(cnt*0.75);
-   int q25= (int)(cnt*0.25);
-   double iqr = tab[q75]-tab[q25];
+   double median, q25, q75;
+   bg_median_iqr( tab, cnt, median, q25, q75 );
+   double iqr = q75 - q25;
    sigma_iqr = iqr/1.35;
    double range = sigma_iqr*n_sigma_iqr;
-   double median = tab[(int)cnt/2];
    
+   // values within range are kept (in place) :
    int newcnt=0;
    for(int i=0;i<cnt;i++){
       if( (tab[i]-median) < range ){
-         newtab[newcnt] = tab[i];
+         tab[newcnt] = tab[i];
          newcnt++;
       }
    }
                                           
-   double ret=newtab[newcnt/2];
+   double ret = bg_median( tab, newcnt );
    if( gBGPrintfLevel>=2 ){
       printf("\tmedian = %.4f, iqr = %.4f -> sigma_iqr = %.4f -> range = %.4f -> new_median = %.4f [diff = %.4f]\n",median,iqr,sigma_iqr,range,ret,fabs(median-ret));
    }
 
    // returning smaller array :
    cnt = newcnt;
-   for(int i=0;i<newcnt;i++){
-      tab[i] = newtab[i];
-   }   
 
-   delete [] newtab;
    return ret;
 }
                                                 
                                                 
+// sigma clipping on t-digest sketch of given compression , centroids outside the range are removed :
+static double GetAvgEstimatorApprox( double* intab, int cnt, int n_iter, double& sigma_iqr, int trim_up, double compression )
+{
+   CBgTDigest digest( compression );
+   for(int i=0;i<cnt;i++){
+      digest.Add( intab[i] );
+   }
+
+   double out_median = digest.Median();
+   for(int i=0;i<n_iter;i++){
+      double median, q25, q75;
+      digest.MedianIQR( median, q25, q75 );
+      sigma_iqr = (q75 - q25)/1.35;
+      double range = sigma_iqr*5.00;
+
+      if( trim_up > 0 ){
+         digest.Trim( -1e300, median + range );
+      }else{
+         digest.Trim( median - range, median + range );
+      }
+      out_median = digest.Median();
+      if( gBGPrintfLevel>=2 ){
+         printf("\tmedian = %.4f, sigma_iqr = %.4f -> range = %.4f -> new_median = %.4f (approx.)\n",median,sigma_iqr,range,out_median);
+      }
+   }
+
+   return out_median;
+}
+
 // INPUT  : 
-// intab  : sorted table                                                 
+// intab  : table of values (does not have to be sorted, it is not modified)
 // cnt    : number of elements in a table
 // n_iter : number of iterations 
-double GetAvgEstimator( double* intab, int cnt, int n_iter, double& sigma_iqr, int x, int trim_up )
+// approx : 0 - exact median/IQR , >0 - t-digest of this compression , BG_APPROX_DEFAULT - see gBGApproxQuantiles
+double GetAvgEstimator( double* intab, int cnt, int n_iter, double& sigma_iqr, int x, int trim_up, double approx )
 {
+   double compression = bg_approx_compression( approx );
+   if( compression > 0 ){
+      return GetAvgEstimatorApprox( intab, cnt, n_iter, sigma_iqr, trim_up, compression );
+   }
+
    double* tab = new double[cnt]; // working copy 
    for(int i=0;i<cnt;i++){
       tab[i] = intab[i];
@@ -95,7 +119,7 @@ double GetAvgEstimator( double* intab, int cnt, int n_iter, double& sigma_iqr, i
       printf("\n\nChannel %d / %.4f [MHz]\n",x,ch2freq(x));
    }                  
    int newcnt=cnt;
-   double out_median = tab[cnt/2];
+   double out_median = bg_median( tab, cnt );
    for(int i=0;i<n_iter;i++){
       if( gBGPrintfLevel>=2 ){
          printf("\t------ Iteration = %d -----\n",i);
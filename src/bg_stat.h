@@ -1,8 +1,11 @@
 #ifndef _BG_STAT_H__
 #define _BG_STAT_H__
 
+#include "bg_quantile.h"
+
 double get_trim_median( double n_sigma_iqr, double* tab, int& cnt, double& sigma_iqr );
 double get_trim_median_up( double n_sigma_iqr, double* tab, int& cnt, double& sigma_iqr );
-double GetAvgEstimator( double* intab, int cnt, int n_iter, double& sigma_iqr, int x=0, int trim_up=0 );
+// approx : exact median/IQR (0) or t-digest of given compression (see bg_approx_compression) :
+double GetAvgEstimator( double* intab, int cnt, int n_iter, double& sigma_iqr, int x=0, int trim_up=0, double approx=BG_APPROX_DEFAULT );
 
 #endif
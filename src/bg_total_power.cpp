@@ -36,18 +36,12 @@ double CTotalPowerList::GetLocalMedian( double curr_uxtime, double time_interval
       i--;
    }
    
-   double* tmp_list2 = new double[tmp_list.size()];
-   for(i=0;i<tmp_list.size();i++){
-      tmp_list2[i] = tmp_list[i];
-   }   
-   my_sort_float(  tmp_list2, tmp_list.size() );
-   
+   // GetAvgEstimator uses quickselect on its own copy, so the list does not have to be sorted :
    int trim_upper=1;
-//   double median = GetAvgEstimator( tmp_list2, tmp_list.size(), 3, sigma_iqr, 0, trim_upper );
-//   double median = GetAvgEstimator( tmp_list2, tmp_list.size(), 0, sigma_iqr, 0, trim_upper );
-   double median = GetAvgEstimator( tmp_list2, tmp_list.size(), 10, sigma_iqr, 0, trim_upper );
+//   double median = GetAvgEstimator( tmp_list.data(), tmp_list.size(), 3, sigma_iqr, 0, trim_upper );
+//   double median = GetAvgEstimator( tmp_list.data(), tmp_list.size(), 0, sigma_iqr, 0, trim_upper );
+   double median = GetAvgEstimator( tmp_list.data(), tmp_list.size(), 10, sigma_iqr, 0, trim_upper );
    
-   delete [] tmp_list2;
    return median;
 }
 
@@ -68,18 +62,12 @@ double CTotalPowerList::GetLocalMedianBothSides( double curr_uxtime, double time
       }
    }
    
-   double* tmp_list2 = new double[tmp_list.size()];
-   for(int i=0;i<tmp_list.size();i++){
-      tmp_list2[i] = tmp_list[i];
-   }   
-   my_sort_float(  tmp_list2, tmp_list.size() );
-   
+   // GetAvgEstimator uses quickselect on its own copy, so the list does not have to be sorted :
    int trim_upper=1;
-//   double median = GetAvgEstimator( tmp_list2, tmp_list.size(), 3, sigma_iqr, 0, trim_upper );
-//   double median = GetAvgEstimator( tmp_list2, tmp_list.size(), 0, sigma_iqr, 0, trim_upper );
-   double median = GetAvgEstimator( tmp_list2, tmp_list.size(), 10, sigma_iqr, 0, trim_upper );
+//   double median = GetAvgEstimator( tmp_list.data(), tmp_list.size(), 3, sigma_iqr, 0, trim_upper );
+//   double median = GetAvgEstimator( tmp_list.data(), tmp_list.size(), 0, sigma_iqr, 0, trim_upper );
+   double median = GetAvgEstimator( tmp_list.data(), tmp_list.size(), 10, sigma_iqr, 0, trim_upper );
    
-   delete [] tmp_list2;
    return median;
 }
 